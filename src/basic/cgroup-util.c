@@ -2055,9 +2055,6 @@ int cg_get_keyed_attribute(
                 char **ret_values) {
 
         _cleanup_free_ char *filename = NULL, *contents = NULL;
-        const char *p;
-        size_t n, i, n_done = 0;
-        char **v;
         int r;
 
         /* Reads one or more fields of a cgroupsv2 keyed attribute file. The 'keys' parameter should be an strv with
@@ -2074,6 +2071,23 @@ int cg_get_keyed_attribute(
         if (r < 0)
                 return r;
 
+        return cg_parse_keyed_attribute(contents, keys, ret_values);
+}
+
+int cg_parse_keyed_attribute(
+                const char *contents,
+                char **keys,
+                char **ret_values) {
+
+        const char *p;
+        size_t n, i, n_done = 0;
+        char **v;
+        int r;
+
+        assert(contents);
+
+        /* Like cg_get_keyed_attribute(), but parses the contents of the attribute file read by the caller */
+
         n = strv_length(keys);
         if (n == 0) /* No keys to retrieve? That's easy, we are done then */
                 return 0;
@@ -25,6 +25,9 @@
 
 #define CGROUP_CPU_QUOTA_PERIOD_USEC ((usec_t) 100 * USEC_PER_MSEC)
 
+/* Size of the buffer we read cgroup inotify events into. The events carry no names, hence this fits 4096 of them. */
+#define CGROUP_INOTIFY_BUFFER_SIZE (4096 * sizeof(struct inotify_event))
+
 bool manager_owns_root_cgroup(Manager *m) {
         assert(m);
 
@@ -68,6 +71,191 @@ static void cgroup_compat_warn(void) {
                 log_unit_debug(unit, "cgroup-compat: " fmt, ##__VA_ARGS__);     \
         } while (false)
 
+int unit_remember_cgroup_attribute(Unit *u, const char *key, const char *value) {
+        _cleanup_free_ char *k = NULL, *v = NULL;
+        int r;
+
+        assert(u);
+        assert(key);
+        assert(value);
+
+        /* Records the value last written to a cgroup attribute, so that we can skip writing it again when it didn't
+         * change. The key is "<controller>/<attribute>", optionally followed by ":<entry>" for attributes that
+         * carry more than one setting, such as per-device ones. */
+
+        r = hashmap_ensure_allocated(&u->cgroup_attributes, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        k = strdup(key);
+        v = strdup(value);
+        if (!k || !v)
+                return -ENOMEM;
+
+        unit_forget_cgroup_attribute(u, key);
+
+        r = hashmap_put(u->cgroup_attributes, k, v);
+        if (r < 0)
+                return r;
+
+        k = v = NULL;
+        return 0;
+}
+
+void unit_forget_cgroup_attribute(Unit *u, const char *key) {
+        char *k = NULL;
+
+        assert(u);
+        assert(key);
+
+        free(hashmap_remove2(u->cgroup_attributes, key, (void**) &k));
+        free(k);
+}
+
+void unit_forget_cgroup_attributes(Unit *u, CGroupMask mask) {
+        CGroupController c;
+
+        assert(u);
+
+        if (hashmap_isempty(u->cgroup_attributes))
+                return;
+
+        if ((mask & _CGROUP_MASK_ALL) == _CGROUP_MASK_ALL) {
+                u->cgroup_attributes = hashmap_free_free_free(u->cgroup_attributes);
+                return;
+        }
+
+        for (c = 0; c < _CGROUP_CONTROLLER_MAX; c++) {
+                const char *prefix;
+                Iterator i;
+                char *k;
+                void *v;
+
+                if (!(mask & CGROUP_CONTROLLER_TO_MASK(c)))
+                        continue;
+
+                prefix = strjoina(cgroup_controller_to_string(c), "/");
+
+                HASHMAP_FOREACH_KEY(v, k, u->cgroup_attributes, i)
+                        if (startswith(k, prefix)) {
+                                hashmap_remove(u->cgroup_attributes, k);
+                                free(k);
+                                free(v);
+                        }
+        }
+}
+
+/* While applying the attributes of a unit's cgroup we keep the cgroup directories of the controllers open, and write
+ * the attributes relative to them, instead of resolving the full path for each of them. */
+typedef struct CGroupAttributeWriter {
+        Unit *unit;
+        const char *path;
+        int dir_fd[_CGROUP_CONTROLLER_MAX];
+} CGroupAttributeWriter;
+
+static void cgroup_attribute_writer_done(CGroupAttributeWriter *w) {
+        CGroupController c;
+
+        assert(w);
+
+        for (c = 0; c < _CGROUP_CONTROLLER_MAX; c++)
+                w->dir_fd[c] = safe_close(w->dir_fd[c]);
+}
+
+static int cgroup_attribute_writer_dir(CGroupAttributeWriter *w, const char *controller) {
+        _cleanup_free_ char *p = NULL;
+        CGroupController c;
+        int r;
+
+        assert(w);
+        assert(controller);
+
+        assert_se((c = cgroup_controller_from_string(controller)) >= 0);
+
+        if (w->dir_fd[c] >= 0)
+                return w->dir_fd[c];
+
+        r = cg_get_path(controller, w->path, NULL, &p);
+        if (r < 0)
+                return r;
+
+        w->dir_fd[c] = open(p, O_PATH|O_DIRECTORY|O_CLOEXEC);
+        if (w->dir_fd[c] < 0)
+                return -errno;
+
+        return w->dir_fd[c];
+}
+
+static int cgroup_attribute_write(CGroupAttributeWriter *w, const char *controller, const char *attribute, const char *value) {
+        _cleanup_close_ int fd = -1;
+        int dir_fd;
+        size_t l;
+        ssize_t n;
+
+        assert(w);
+        assert(attribute);
+        assert(value);
+
+        dir_fd = cgroup_attribute_writer_dir(w, controller);
+        if (dir_fd < 0)
+                return dir_fd;
+
+        fd = openat(dir_fd, attribute, O_WRONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        /* cgroup attributes need to be written in a single write() */
+        l = strlen(value);
+        n = write(fd, value, l);
+        if (n < 0)
+                return -errno;
+        if ((size_t) n != l)
+                return -EIO;
+
+        w->unit->manager->n_cgroup_attribute_writes++;
+        return 0;
+}
+
+static int cgroup_attribute_apply(
+                CGroupAttributeWriter *w,
+                const char *controller,
+                const char *attribute,
+                const char *entry,
+                const char *value) {
+
+        const char *key;
+        Unit *u;
+        int r;
+
+        assert(w);
+        assert(controller);
+        assert(attribute);
+        assert(value);
+
+        /* Writes an attribute, unless we wrote the very same value to it before */
+
+        u = w->unit;
+        key = strjoina(controller, "/", attribute, entry ? ":" : "", strempty(entry));
+
+        if (streq_ptr(hashmap_get(u->cgroup_attributes, key), value)) {
+                u->manager->n_cgroup_attribute_writes_skipped++;
+                return 0;
+        }
+
+        r = cgroup_attribute_write(w, controller, attribute, value);
+        if (r < 0) {
+                /* We don't know what the attribute is set to now, make sure to write it again next time */
+                unit_forget_cgroup_attribute(u, key);
+                return r;
+        }
+
+        r = unit_remember_cgroup_attribute(u, key, value);
+        if (r < 0)
+                log_unit_debug_errno(u, r, "Failed to remember value of cgroup attribute %s, ignoring: %m", attribute);
+
+        return 0;
+}
+
 void cgroup_context_init(CGroupContext *c) {
         assert(c);
 
@@ -335,13 +523,12 @@ static int lookup_block_device(const char *p, dev_t *ret) {
         return 0;
 }
 
-static int whitelist_device(const char *path, const char *node, const char *acc) {
+static int whitelist_device(char ***entries, const char *node, const char *acc) {
         char buf[2+DECIMAL_STR_MAX(dev_t)*2+2+4];
         struct stat st;
         bool ignore_notfound;
-        int r;
 
-        assert(path);
+        assert(entries);
         assert(acc);
 
         if (node[0] == '-') {
@@ -369,21 +556,16 @@ static int whitelist_device(const char *path, const char *node, const char *acc)
                 major(st.st_rdev), minor(st.st_rdev),
                 acc);
 
-        r = cg_set_attribute("devices", path, "devices.allow", buf);
-        if (r < 0)
-                log_full_errno(IN_SET(r, -ENOENT, -EROFS, -EINVAL, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
-                               "Failed to set devices.allow on %s: %m", path);
-
-        return r;
+        return strv_extend(entries, buf);
 }
 
-static int whitelist_major(const char *path, const char *name, char type, const char *acc) {
+static int whitelist_major(char ***entries, const char *name, char type, const char *acc) {
         _cleanup_fclose_ FILE *f = NULL;
         char line[LINE_MAX];
         bool good = false;
         int r;
 
-        assert(path);
+        assert(entries);
         assert(acc);
         assert(IN_SET(type, 'b', 'c'));
 
@@ -440,10 +622,9 @@ static int whitelist_major(const char *path, const char *name, char type, const
                         maj,
                         acc);
 
-                r = cg_set_attribute("devices", path, "devices.allow", buf);
+                r = strv_extend(entries, buf);
                 if (r < 0)
-                        log_full_errno(IN_SET(r, -ENOENT, -EROFS, -EINVAL, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
-                                       "Failed to set devices.allow on %s: %m", path);
+                        return r;
         }
 
         return 0;
@@ -482,14 +663,14 @@ static uint64_t cgroup_context_cpu_shares(CGroupContext *c, ManagerState state)
                 return CGROUP_CPU_SHARES_DEFAULT;
 }
 
-static void cgroup_apply_unified_cpu_config(Unit *u, uint64_t weight, uint64_t quota) {
+static void cgroup_apply_unified_cpu_config(CGroupAttributeWriter *w, uint64_t weight, uint64_t quota) {
         char buf[MAX(DECIMAL_STR_MAX(uint64_t) + 1, (DECIMAL_STR_MAX(usec_t) + 1) * 2)];
         int r;
 
         xsprintf(buf, "%" PRIu64 "\n", weight);
-        r = cg_set_attribute("cpu", u->cgroup_path, "cpu.weight", buf);
+        r = cgroup_attribute_apply(w, "cpu", "cpu.weight", NULL, buf);
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set cpu.weight: %m");
 
         if (quota != USEC_INFINITY)
@@ -498,36 +679,36 @@ static void cgroup_apply_unified_cpu_config(Unit *u, uint64_t weight, uint64_t q
         else
                 xsprintf(buf, "max " USEC_FMT "\n", CGROUP_CPU_QUOTA_PERIOD_USEC);
 
-        r = cg_set_attribute("cpu", u->cgroup_path, "cpu.max", buf);
+        r = cgroup_attribute_apply(w, "cpu", "cpu.max", NULL, buf);
 
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set cpu.max: %m");
 }
 
-static void cgroup_apply_legacy_cpu_config(Unit *u, uint64_t shares, uint64_t quota) {
+static void cgroup_apply_legacy_cpu_config(CGroupAttributeWriter *w, uint64_t shares, uint64_t quota) {
         char buf[MAX(DECIMAL_STR_MAX(uint64_t), DECIMAL_STR_MAX(usec_t)) + 1];
         int r;
 
         xsprintf(buf, "%" PRIu64 "\n", shares);
-        r = cg_set_attribute("cpu", u->cgroup_path, "cpu.shares", buf);
+        r = cgroup_attribute_apply(w, "cpu", "cpu.shares", NULL, buf);
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set cpu.shares: %m");
 
         xsprintf(buf, USEC_FMT "\n", CGROUP_CPU_QUOTA_PERIOD_USEC);
-        r = cg_set_attribute("cpu", u->cgroup_path, "cpu.cfs_period_us", buf);
+        r = cgroup_attribute_apply(w, "cpu", "cpu.cfs_period_us", NULL, buf);
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set cpu.cfs_period_us: %m");
 
         if (quota != USEC_INFINITY) {
                 xsprintf(buf, USEC_FMT "\n", quota * CGROUP_CPU_QUOTA_PERIOD_USEC / USEC_PER_SEC);
-                r = cg_set_attribute("cpu", u->cgroup_path, "cpu.cfs_quota_us", buf);
+                r = cgroup_attribute_apply(w, "cpu", "cpu.cfs_quota_us", NULL, buf);
         } else
-                r = cg_set_attribute("cpu", u->cgroup_path, "cpu.cfs_quota_us", "-1");
+                r = cgroup_attribute_apply(w, "cpu", "cpu.cfs_quota_us", NULL, "-1");
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set cpu.cfs_quota_us: %m");
 }
 
@@ -587,8 +768,8 @@ static uint64_t cgroup_weight_io_to_blkio(uint64_t io_weight) {
                      CGROUP_BLKIO_WEIGHT_MIN, CGROUP_BLKIO_WEIGHT_MAX);
 }
 
-static void cgroup_apply_io_device_weight(Unit *u, const char *dev_path, uint64_t io_weight) {
-        char buf[DECIMAL_STR_MAX(dev_t)*2+2+DECIMAL_STR_MAX(uint64_t)+1];
+static void cgroup_apply_io_device_weight(CGroupAttributeWriter *w, const char *dev_path, uint64_t io_weight) {
+        char buf[DECIMAL_STR_MAX(dev_t)*2+2+DECIMAL_STR_MAX(uint64_t)+1], entry[DECIMAL_STR_MAX(dev_t)*2+2];
         dev_t dev;
         int r;
 
@@ -596,15 +777,16 @@ static void cgroup_apply_io_device_weight(Unit *u, const char *dev_path, uint64_
         if (r < 0)
                 return;
 
-        xsprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), io_weight);
-        r = cg_set_attribute("io", u->cgroup_path, "io.weight", buf);
+        xsprintf(entry, "%u:%u", major(dev), minor(dev));
+        xsprintf(buf, "%s %" PRIu64 "\n", entry, io_weight);
+        r = cgroup_attribute_apply(w, "io", "io.weight", entry, buf);
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set io.weight: %m");
 }
 
-static void cgroup_apply_blkio_device_weight(Unit *u, const char *dev_path, uint64_t blkio_weight) {
-        char buf[DECIMAL_STR_MAX(dev_t)*2+2+DECIMAL_STR_MAX(uint64_t)+1];
+static void cgroup_apply_blkio_device_weight(CGroupAttributeWriter *w, const char *dev_path, uint64_t blkio_weight) {
+        char buf[DECIMAL_STR_MAX(dev_t)*2+2+DECIMAL_STR_MAX(uint64_t)+1], entry[DECIMAL_STR_MAX(dev_t)*2+2];
         dev_t dev;
         int r;
 
@@ -612,16 +794,17 @@ static void cgroup_apply_blkio_device_weight(Unit *u, const char *dev_path, uint
         if (r < 0)
                 return;
 
-        xsprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), blkio_weight);
-        r = cg_set_attribute("blkio", u->cgroup_path, "blkio.weight_device", buf);
+        xsprintf(entry, "%u:%u", major(dev), minor(dev));
+        xsprintf(buf, "%s %" PRIu64 "\n", entry, blkio_weight);
+        r = cgroup_attribute_apply(w, "blkio", "blkio.weight_device", entry, buf);
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set blkio.weight_device: %m");
 }
 
-static void cgroup_apply_io_device_limit(Unit *u, const char *dev_path, uint64_t *limits) {
+static void cgroup_apply_io_device_limit(CGroupAttributeWriter *w, const char *dev_path, uint64_t *limits) {
         char limit_bufs[_CGROUP_IO_LIMIT_TYPE_MAX][DECIMAL_STR_MAX(uint64_t)];
-        char buf[DECIMAL_STR_MAX(dev_t)*2+2+(6+DECIMAL_STR_MAX(uint64_t)+1)*4];
+        char buf[DECIMAL_STR_MAX(dev_t)*2+2+(6+DECIMAL_STR_MAX(uint64_t)+1)*4], entry[DECIMAL_STR_MAX(dev_t)*2+2];
         CGroupIOLimitType type;
         dev_t dev;
         int r;
@@ -636,17 +819,18 @@ static void cgroup_apply_io_device_limit(Unit *u, const char *dev_path, uint64_t
                 else
                         xsprintf(limit_bufs[type], "%s", limits[type] == CGROUP_LIMIT_MAX ? "max" : "0");
 
-        xsprintf(buf, "%u:%u rbps=%s wbps=%s riops=%s wiops=%s\n", major(dev), minor(dev),
+        xsprintf(entry, "%u:%u", major(dev), minor(dev));
+        xsprintf(buf, "%s rbps=%s wbps=%s riops=%s wiops=%s\n", entry,
                  limit_bufs[CGROUP_IO_RBPS_MAX], limit_bufs[CGROUP_IO_WBPS_MAX],
                  limit_bufs[CGROUP_IO_RIOPS_MAX], limit_bufs[CGROUP_IO_WIOPS_MAX]);
-        r = cg_set_attribute("io", u->cgroup_path, "io.max", buf);
+        r = cgroup_attribute_apply(w, "io", "io.max", entry, buf);
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set io.max: %m");
 }
 
-static void cgroup_apply_blkio_device_limit(Unit *u, const char *dev_path, uint64_t rbps, uint64_t wbps) {
-        char buf[DECIMAL_STR_MAX(dev_t)*2+2+DECIMAL_STR_MAX(uint64_t)+1];
+static void cgroup_apply_blkio_device_limit(CGroupAttributeWriter *w, const char *dev_path, uint64_t rbps, uint64_t wbps) {
+        char buf[DECIMAL_STR_MAX(dev_t)*2+2+DECIMAL_STR_MAX(uint64_t)+1], entry[DECIMAL_STR_MAX(dev_t)*2+2];
         dev_t dev;
         int r;
 
@@ -654,16 +838,18 @@ static void cgroup_apply_blkio_device_limit(Unit *u, const char *dev_path, uint6
         if (r < 0)
                 return;
 
-        sprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), rbps);
-        r = cg_set_attribute("blkio", u->cgroup_path, "blkio.throttle.read_bps_device", buf);
+        xsprintf(entry, "%u:%u", major(dev), minor(dev));
+
+        sprintf(buf, "%s %" PRIu64 "\n", entry, rbps);
+        r = cgroup_attribute_apply(w, "blkio", "blkio.throttle.read_bps_device", entry, buf);
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set blkio.throttle.read_bps_device: %m");
 
-        sprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), wbps);
-        r = cg_set_attribute("blkio", u->cgroup_path, "blkio.throttle.write_bps_device", buf);
+        sprintf(buf, "%s %" PRIu64 "\n", entry, wbps);
+        r = cgroup_attribute_apply(w, "blkio", "blkio.throttle.write_bps_device", entry, buf);
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set blkio.throttle.write_bps_device: %m");
 }
 
@@ -671,19 +857,134 @@ static bool cgroup_context_has_unified_memory_config(CGroupContext *c) {
         return c->memory_low > 0 || c->memory_high != CGROUP_LIMIT_MAX || c->memory_max != CGROUP_LIMIT_MAX || c->memory_swap_max != CGROUP_LIMIT_MAX;
 }
 
-static void cgroup_apply_unified_memory_limit(Unit *u, const char *file, uint64_t v) {
+static void cgroup_apply_unified_memory_limit(CGroupAttributeWriter *w, const char *file, uint64_t v) {
         char buf[DECIMAL_STR_MAX(uint64_t) + 1] = "max";
         int r;
 
         if (v != CGROUP_LIMIT_MAX)
                 xsprintf(buf, "%" PRIu64 "\n", v);
 
-        r = cg_set_attribute("memory", u->cgroup_path, file, buf);
+        r = cgroup_attribute_apply(w, "memory", file, NULL, buf);
         if (r < 0)
-                log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set %s: %m", file);
 }
 
+static void cgroup_apply_devices(CGroupAttributeWriter *w, CGroupContext *c) {
+        _cleanup_strv_free_ char **entries = NULL;
+        _cleanup_free_ char *joined = NULL;
+        const char *reset, *key = "devices/devices.list";
+        CGroupDeviceAllow *a;
+        bool failed = false;
+        char **e;
+        int r;
+
+        /* The device list is rebuilt from scratch every time it is applied: it is reset first, and then the
+         * individual entries are allowed again. That's not something we want to do needlessly on a running cgroup,
+         * hence we remember the whole list as one value, and skip all the writes if it didn't change. */
+
+        if (c->device_allow || c->device_policy != CGROUP_AUTO)
+                reset = "devices.deny";
+        else
+                reset = "devices.allow";
+
+        if (c->device_policy == CGROUP_CLOSED ||
+            (c->device_policy == CGROUP_AUTO && c->device_allow)) {
+                static const char auto_devices[] =
+                        "/dev/null\0" "rwm\0"
+                        "/dev/zero\0" "rwm\0"
+                        "/dev/full\0" "rwm\0"
+                        "/dev/random\0" "rwm\0"
+                        "/dev/urandom\0" "rwm\0"
+                        "/dev/tty\0" "rwm\0"
+                        "/dev/ptmx\0" "rwm\0"
+                        /* Allow /run/systemd/inaccessible/{chr,blk} devices for mapping InaccessiblePaths */
+                        "-/run/systemd/inaccessible/chr\0" "rwm\0"
+                        "-/run/systemd/inaccessible/blk\0" "rwm\0";
+
+                const char *x, *y;
+
+                NULSTR_FOREACH_PAIR(x, y, auto_devices)
+                        if (whitelist_device(&entries, x, y) == -ENOMEM)
+                                goto oom;
+
+                /* PTS (/dev/pts) devices may not be duplicated, but accessed */
+                if (whitelist_major(&entries, "pts", 'c', "rw") == -ENOMEM)
+                        goto oom;
+        }
+
+        LIST_FOREACH(device_allow, a, c->device_allow) {
+                char acc[4], *val;
+                unsigned k = 0;
+
+                if (a->r)
+                        acc[k++] = 'r';
+                if (a->w)
+                        acc[k++] = 'w';
+                if (a->m)
+                        acc[k++] = 'm';
+
+                if (k == 0)
+                        continue;
+
+                acc[k++] = 0;
+
+                if (path_startswith(a->path, "/dev/"))
+                        r = whitelist_device(&entries, a->path, acc);
+                else if ((val = startswith(a->path, "block-")))
+                        r = whitelist_major(&entries, val, 'b', acc);
+                else if ((val = startswith(a->path, "char-")))
+                        r = whitelist_major(&entries, val, 'c', acc);
+                else {
+                        log_unit_debug(w->unit, "Ignoring device %s while writing cgroup attribute.", a->path);
+                        continue;
+                }
+                if (r == -ENOMEM)
+                        goto oom;
+        }
+
+        joined = strv_join(entries, "\n");
+        if (!joined)
+                goto oom;
+
+        if (!strextend(&joined, "\n", reset, NULL))
+                goto oom;
+
+        if (streq_ptr(hashmap_get(w->unit->cgroup_attributes, key), joined)) {
+                w->unit->manager->n_cgroup_attribute_writes_skipped += 1 + strv_length(entries);
+                return;
+        }
+
+        /* Changing the devices list of a populated cgroup might result in EINVAL, hence ignore EINVAL here. */
+
+        r = cgroup_attribute_write(w, "devices", reset, "a");
+        if (r < 0) {
+                log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EINVAL, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                              "Failed to reset devices.list: %m");
+                failed = true;
+        }
+
+        STRV_FOREACH(e, entries) {
+                r = cgroup_attribute_write(w, "devices", "devices.allow", *e);
+                if (r < 0) {
+                        log_unit_full(w->unit, IN_SET(r, -ENOENT, -EROFS, -EINVAL, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
+                                      "Failed to set devices.allow on %s: %m", w->path);
+                        failed = true;
+                }
+        }
+
+        if (failed)
+                unit_forget_cgroup_attribute(w->unit, key);
+        else
+                (void) unit_remember_cgroup_attribute(w->unit, key, joined);
+
+        return;
+
+oom:
+        log_oom();
+        unit_forget_cgroup_attribute(w->unit, key);
+}
+
 static void cgroup_apply_firewall(Unit *u) {
         assert(u);
 
@@ -701,6 +1002,9 @@ static void cgroup_context_apply(
                 bool apply_bpf,
                 ManagerState state) {
 
+        _cleanup_(cgroup_attribute_writer_done) CGroupAttributeWriter writer = {
+                .dir_fd = { [0 ... _CGROUP_CONTROLLER_MAX - 1] = -1 },
+        };
         const char *path;
         CGroupContext *c;
         bool is_root;
@@ -721,6 +1025,9 @@ static void cgroup_context_apply(
         if (is_root) /* Make sure we don't try to display messages with an empty path. */
                 path = "/";
 
+        writer.unit = u;
+        writer.path = path;
+
         /* We generally ignore errors caused by read-only mounted
          * cgroup trees (assuming we are running in a container then),
          * and missing cgroups, i.e. EROFS and ENOENT. */
@@ -746,7 +1053,7 @@ static void cgroup_context_apply(
                         } else
                                 weight = CGROUP_WEIGHT_DEFAULT;
 
-                        cgroup_apply_unified_cpu_config(u, weight, c->cpu_quota_per_sec_usec);
+                        cgroup_apply_unified_cpu_config(&writer, weight, c->cpu_quota_per_sec_usec);
                 } else {
                         uint64_t shares;
 
@@ -762,7 +1069,7 @@ static void cgroup_context_apply(
                         else
                                 shares = CGROUP_CPU_SHARES_DEFAULT;
 
-                        cgroup_apply_legacy_cpu_config(u, shares, c->cpu_quota_per_sec_usec);
+                        cgroup_apply_legacy_cpu_config(&writer, shares, c->cpu_quota_per_sec_usec);
                 }
         }
 
@@ -787,7 +1094,7 @@ static void cgroup_context_apply(
                                 weight = CGROUP_WEIGHT_DEFAULT;
 
                         xsprintf(buf, "default %" PRIu64 "\n", weight);
-                        r = cg_set_attribute("io", path, "io.weight", buf);
+                        r = cgroup_attribute_apply(&writer, "io", "io.weight", NULL, buf);
                         if (r < 0)
                                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                                               "Failed to set io.weight: %m");
@@ -797,7 +1104,7 @@ static void cgroup_context_apply(
 
                                 /* FIXME: no way to reset this list */
                                 LIST_FOREACH(device_weights, w, c->io_device_weights)
-                                        cgroup_apply_io_device_weight(u, w->path, w->weight);
+                                        cgroup_apply_io_device_weight(&writer, w->path, w->weight);
                         } else if (has_blockio) {
                                 CGroupBlockIODeviceWeight *w;
 
@@ -808,7 +1115,7 @@ static void cgroup_context_apply(
                                         log_cgroup_compat(u, "Applying BlockIODeviceWeight %" PRIu64 " as IODeviceWeight %" PRIu64 " for %s",
                                                           w->weight, weight, w->path);
 
-                                        cgroup_apply_io_device_weight(u, w->path, weight);
+                                        cgroup_apply_io_device_weight(&writer, w->path, weight);
                                 }
                         }
                 }
@@ -818,7 +1125,7 @@ static void cgroup_context_apply(
                         CGroupIODeviceLimit *l;
 
                         LIST_FOREACH(device_limits, l, c->io_device_limits)
-                                cgroup_apply_io_device_limit(u, l->path, l->limits);
+                                cgroup_apply_io_device_limit(&writer, l->path, l->limits);
 
                 } else if (has_blockio) {
                         CGroupBlockIODeviceBandwidth *b;
@@ -836,7 +1143,7 @@ static void cgroup_context_apply(
                                 log_cgroup_compat(u, "Applying BlockIO{Read|Write}Bandwidth %" PRIu64 " %" PRIu64 " as IO{Read|Write}BandwidthMax for %s",
                                                   b->rbps, b->wbps, b->path);
 
-                                cgroup_apply_io_device_limit(u, b->path, limits);
+                                cgroup_apply_io_device_limit(&writer, b->path, limits);
                         }
                 }
         }
@@ -862,7 +1169,7 @@ static void cgroup_context_apply(
                                 weight = CGROUP_BLKIO_WEIGHT_DEFAULT;
 
                         xsprintf(buf, "%" PRIu64 "\n", weight);
-                        r = cg_set_attribute("blkio", path, "blkio.weight", buf);
+                        r = cgroup_attribute_apply(&writer, "blkio", "blkio.weight", NULL, buf);
                         if (r < 0)
                                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                                               "Failed to set blkio.weight: %m");
@@ -877,14 +1184,14 @@ static void cgroup_context_apply(
                                         log_cgroup_compat(u, "Applying IODeviceWeight %" PRIu64 " as BlockIODeviceWeight %" PRIu64 " for %s",
                                                           w->weight, weight, w->path);
 
-                                        cgroup_apply_blkio_device_weight(u, w->path, weight);
+                                        cgroup_apply_blkio_device_weight(&writer, w->path, weight);
                                 }
                         } else if (has_blockio) {
                                 CGroupBlockIODeviceWeight *w;
 
                                 /* FIXME: no way to reset this list */
                                 LIST_FOREACH(device_weights, w, c->blockio_device_weights)
-                                        cgroup_apply_blkio_device_weight(u, w->path, w->weight);
+                                        cgroup_apply_blkio_device_weight(&writer, w->path, w->weight);
                         }
                 }
 
@@ -896,13 +1203,13 @@ static void cgroup_context_apply(
                                 log_cgroup_compat(u, "Applying IO{Read|Write}Bandwidth %" PRIu64 " %" PRIu64 " as BlockIO{Read|Write}BandwidthMax for %s",
                                                   l->limits[CGROUP_IO_RBPS_MAX], l->limits[CGROUP_IO_WBPS_MAX], l->path);
 
-                                cgroup_apply_blkio_device_limit(u, l->path, l->limits[CGROUP_IO_RBPS_MAX], l->limits[CGROUP_IO_WBPS_MAX]);
+                                cgroup_apply_blkio_device_limit(&writer, l->path, l->limits[CGROUP_IO_RBPS_MAX], l->limits[CGROUP_IO_WBPS_MAX]);
                         }
                 } else if (has_blockio) {
                         CGroupBlockIODeviceBandwidth *b;
 
                         LIST_FOREACH(device_bandwidths, b, c->blockio_device_bandwidths)
-                                cgroup_apply_blkio_device_limit(u, b->path, b->rbps, b->wbps);
+                                cgroup_apply_blkio_device_limit(&writer, b->path, b->rbps, b->wbps);
                 }
         }
 
@@ -920,10 +1227,10 @@ static void cgroup_context_apply(
                                         log_cgroup_compat(u, "Applying MemoryLimit %" PRIu64 " as MemoryMax", max);
                         }
 
-                        cgroup_apply_unified_memory_limit(u, "memory.low", c->memory_low);
-                        cgroup_apply_unified_memory_limit(u, "memory.high", c->memory_high);
-                        cgroup_apply_unified_memory_limit(u, "memory.max", max);
-                        cgroup_apply_unified_memory_limit(u, "memory.swap.max", swap_max);
+                        cgroup_apply_unified_memory_limit(&writer, "memory.low", c->memory_low);
+                        cgroup_apply_unified_memory_limit(&writer, "memory.high", c->memory_high);
+                        cgroup_apply_unified_memory_limit(&writer, "memory.max", max);
+                        cgroup_apply_unified_memory_limit(&writer, "memory.swap.max", swap_max);
                 } else {
                         char buf[DECIMAL_STR_MAX(uint64_t) + 1];
                         uint64_t val;
@@ -939,77 +1246,15 @@ static void cgroup_context_apply(
                         else
                                 xsprintf(buf, "%" PRIu64 "\n", val);
 
-                        r = cg_set_attribute("memory", path, "memory.limit_in_bytes", buf);
+                        r = cgroup_attribute_apply(&writer, "memory", "memory.limit_in_bytes", NULL, buf);
                         if (r < 0)
                                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                                               "Failed to set memory.limit_in_bytes: %m");
                 }
         }
 
-        if ((apply_mask & CGROUP_MASK_DEVICES) && !is_root) {
-                CGroupDeviceAllow *a;
-
-                /* Changing the devices list of a populated cgroup
-                 * might result in EINVAL, hence ignore EINVAL
-                 * here. */
-
-                if (c->device_allow || c->device_policy != CGROUP_AUTO)
-                        r = cg_set_attribute("devices", path, "devices.deny", "a");
-                else
-                        r = cg_set_attribute("devices", path, "devices.allow", "a");
-                if (r < 0)
-                        log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EINVAL, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
-                                      "Failed to reset devices.list: %m");
-
-                if (c->device_policy == CGROUP_CLOSED ||
-                    (c->device_policy == CGROUP_AUTO && c->device_allow)) {
-                        static const char auto_devices[] =
-                                "/dev/null\0" "rwm\0"
-                                "/dev/zero\0" "rwm\0"
-                                "/dev/full\0" "rwm\0"
-                                "/dev/random\0" "rwm\0"
-                                "/dev/urandom\0" "rwm\0"
-                                "/dev/tty\0" "rwm\0"
-                                "/dev/ptmx\0" "rwm\0"
-                                /* Allow /run/systemd/inaccessible/{chr,blk} devices for mapping InaccessiblePaths */
-                                "-/run/systemd/inaccessible/chr\0" "rwm\0"
-                                "-/run/systemd/inaccessible/blk\0" "rwm\0";
-
-                        const char *x, *y;
-
-                        NULSTR_FOREACH_PAIR(x, y, auto_devices)
-                                whitelist_device(path, x, y);
-
-                        /* PTS (/dev/pts) devices may not be duplicated, but accessed */
-                        whitelist_major(path, "pts", 'c', "rw");
-                }
-
-                LIST_FOREACH(device_allow, a, c->device_allow) {
-                        char acc[4], *val;
-                        unsigned k = 0;
-
-                        if (a->r)
-                                acc[k++] = 'r';
-                        if (a->w)
-                                acc[k++] = 'w';
-                        if (a->m)
-                                acc[k++] = 'm';
-
-                        if (k == 0)
-                                continue;
-
-                        acc[k++] = 0;
-
-                        if (path_startswith(a->path, "/dev/"))
-                                whitelist_device(path, a->path, acc);
-                        else if ((val = startswith(a->path, "block-")))
-                                whitelist_major(path, val, 'b', acc);
-                        else if ((val = startswith(a->path, "char-")))
-                                whitelist_major(path, val, 'c', acc);
-                        else
-                                log_unit_debug(u, "Ignoring device %s while writing cgroup attribute.", a->path);
-                }
-        }
+        if ((apply_mask & CGROUP_MASK_DEVICES) && !is_root)
+                cgroup_apply_devices(&writer, c);
 
         if (apply_mask & CGROUP_MASK_PIDS) {
 
@@ -1044,9 +1289,9 @@ static void cgroup_context_apply(
                                 char buf[DECIMAL_STR_MAX(uint64_t) + 2];
 
                                 sprintf(buf, "%" PRIu64 "\n", c->tasks_max);
-                                r = cg_set_attribute("pids", path, "pids.max", buf);
+                                r = cgroup_attribute_apply(&writer, "pids", "pids.max", NULL, buf);
                         } else
-                                r = cg_set_attribute("pids", path, "pids.max", "max");
+                                r = cgroup_attribute_apply(&writer, "pids", "pids.max", NULL, "max");
                         if (r < 0)
                                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                                               "Failed to set pids.max: %m");
@@ -1133,11 +1378,9 @@ CGroupMask unit_get_members_mask(Unit *u) {
         u->cgroup_members_mask = 0;
 
         if (u->type == UNIT_SLICE) {
-                void *v;
                 Unit *member;
-                Iterator i;
 
-                HASHMAP_FOREACH_KEY(v, member, u->dependencies[UNIT_BEFORE], i) {
+                UNIT_FOREACH_DEPENDENCY(member, u, UNIT_BEFORE) {
 
                         if (member == u)
                                 continue;
@@ -1357,6 +1600,94 @@ int unit_set_cgroup_path(Unit *u, const char *path) {
         return 1;
 }
 
+/* Watch descriptors are handed out by the kernel in increasing order, and are only reused once they wrap around. Hence
+ * we keep the units indexed by watch descriptor in a two-level table: an array of chunks, each covering a range of
+ * watch descriptors, of which only the ones that have any watch descriptors in use are allocated. */
+#define CGROUP_INOTIFY_WD_CHUNK_SHIFT 10
+#define CGROUP_INOTIFY_WD_CHUNK_SIZE (1U << CGROUP_INOTIFY_WD_CHUNK_SHIFT)
+
+struct CGroupInotifyChunk {
+        unsigned n_used;
+        Unit *units[CGROUP_INOTIFY_WD_CHUNK_SIZE];
+};
+
+static Unit *manager_get_unit_by_cgroup_inotify_wd(Manager *m, int wd) {
+        struct CGroupInotifyChunk *chunk;
+        size_t c;
+
+        assert(m);
+
+        if (wd < 0)
+                return NULL;
+
+        c = (unsigned) wd >> CGROUP_INOTIFY_WD_CHUNK_SHIFT;
+        if (c >= m->n_cgroup_inotify_wd_chunks)
+                return NULL;
+
+        chunk = m->cgroup_inotify_wd_chunks[c];
+        if (!chunk)
+                return NULL;
+
+        return chunk->units[wd & (CGROUP_INOTIFY_WD_CHUNK_SIZE - 1)];
+}
+
+static int manager_put_unit_by_cgroup_inotify_wd(Manager *m, int wd, Unit *u) {
+        struct CGroupInotifyChunk *chunk;
+        size_t c, i;
+
+        assert(m);
+        assert(wd >= 0);
+        assert(u);
+
+        c = (unsigned) wd >> CGROUP_INOTIFY_WD_CHUNK_SHIFT;
+        i = wd & (CGROUP_INOTIFY_WD_CHUNK_SIZE - 1);
+
+        if (!GREEDY_REALLOC0(m->cgroup_inotify_wd_chunks, m->n_cgroup_inotify_wd_chunks, c + 1))
+                return -ENOMEM;
+
+        chunk = m->cgroup_inotify_wd_chunks[c];
+        if (!chunk) {
+                chunk = new0(struct CGroupInotifyChunk, 1);
+                if (!chunk)
+                        return -ENOMEM;
+
+                m->cgroup_inotify_wd_chunks[c] = chunk;
+        }
+
+        if (chunk->units[i])
+                return chunk->units[i] == u ? 0 : -EEXIST;
+
+        chunk->units[i] = u;
+        chunk->n_used++;
+
+        return 0;
+}
+
+static void manager_remove_unit_by_cgroup_inotify_wd(Manager *m, int wd) {
+        struct CGroupInotifyChunk *chunk;
+        size_t c, i;
+
+        assert(m);
+
+        if (wd < 0)
+                return;
+
+        c = (unsigned) wd >> CGROUP_INOTIFY_WD_CHUNK_SHIFT;
+        i = wd & (CGROUP_INOTIFY_WD_CHUNK_SIZE - 1);
+
+        if (c >= m->n_cgroup_inotify_wd_chunks)
+                return;
+
+        chunk = m->cgroup_inotify_wd_chunks[c];
+        if (!chunk || !chunk->units[i])
+                return;
+
+        chunk->units[i] = NULL;
+
+        if (--chunk->n_used == 0)
+                m->cgroup_inotify_wd_chunks[c] = mfree(chunk);
+}
+
 int unit_watch_cgroup(Unit *u) {
         _cleanup_free_ char *events = NULL;
         int r;
@@ -1380,10 +1711,6 @@ int unit_watch_cgroup(Unit *u) {
         if (unit_has_name(u, SPECIAL_ROOT_SLICE))
                 return 0;
 
-        r = hashmap_ensure_allocated(&u->manager->cgroup_inotify_wd_unit, &trivial_hash_ops);
-        if (r < 0)
-                return log_oom();
-
         r = cg_get_path(SYSTEMD_CGROUP_CONTROLLER, u->cgroup_path, "cgroup.events", &events);
         if (r < 0)
                 return log_oom();
@@ -1399,9 +1726,9 @@ int unit_watch_cgroup(Unit *u) {
                 return log_unit_error_errno(u, errno, "Failed to add inotify watch descriptor for control group %s: %m", u->cgroup_path);
         }
 
-        r = hashmap_put(u->manager->cgroup_inotify_wd_unit, INT_TO_PTR(u->cgroup_inotify_wd), u);
+        r = manager_put_unit_by_cgroup_inotify_wd(u->manager, u->cgroup_inotify_wd, u);
         if (r < 0)
-                return log_unit_error_errno(u, r, "Failed to add inotify watch descriptor to hash map: %m");
+                return log_unit_error_errno(u, r, "Failed to add inotify watch descriptor to table: %m");
 
         return 0;
 }
@@ -1458,6 +1785,10 @@ static int unit_create_cgroup(
                 return log_unit_error_errno(u, r, "Failed to create cgroup %s: %m", u->cgroup_path);
         created = !!r;
 
+        /* A freshly created cgroup carries the default values, and so do the attributes of controllers that get
+         * enabled again later on, hence forget what we wrote before. */
+        unit_forget_cgroup_attributes(u, created ? _CGROUP_MASK_ALL : ~target_mask);
+
         /* Start watching it */
         (void) unit_watch_cgroup(u);
 
@@ -1730,14 +2061,16 @@ static int unit_realize_cgroup_now(Unit *u, ManagerState state) {
 }
 
 unsigned manager_dispatch_cgroup_realize_queue(Manager *m) {
+        unsigned n = 0, n_writes, n_skipped;
         ManagerState state;
-        unsigned n = 0;
         Unit *i;
         int r;
 
         assert(m);
 
         state = manager_state(m);
+        n_writes = m->n_cgroup_attribute_writes;
+        n_skipped = m->n_cgroup_attribute_writes_skipped;
 
         while ((i = m->cgroup_realize_queue)) {
                 assert(i->in_cgroup_realize_queue);
@@ -1755,6 +2088,10 @@ unsigned manager_dispatch_cgroup_realize_queue(Manager *m) {
                 n++;
         }
 
+        if (n > 0)
+                log_debug("Realized cgroups of %u queued units: %u attribute writes, %u unchanged ones skipped.",
+                          n, m->n_cgroup_attribute_writes - n_writes, m->n_cgroup_attribute_writes_skipped - n_skipped);
+
         return n;
 }
 
@@ -1766,11 +2103,9 @@ static void unit_add_siblings_to_cgroup_realize_queue(Unit *u) {
          * neither the specified unit itself nor the parents.) */
 
         while ((slice = UNIT_DEREF(u->slice))) {
-                Iterator i;
                 Unit *m;
-                void *v;
 
-                HASHMAP_FOREACH_KEY(v, m, u->dependencies[UNIT_BEFORE], i) {
+                UNIT_FOREACH_DEPENDENCY(m, u, UNIT_BEFORE) {
                         if (m == u)
                                 continue;
 
@@ -1838,9 +2173,11 @@ void unit_release_cgroup(Unit *u) {
                 if (inotify_rm_watch(u->manager->cgroup_inotify_fd, u->cgroup_inotify_wd) < 0)
                         log_unit_debug_errno(u, errno, "Failed to remove cgroup inotify watch %i for %s, ignoring", u->cgroup_inotify_wd, u->id);
 
-                (void) hashmap_remove(u->manager->cgroup_inotify_wd_unit, INT_TO_PTR(u->cgroup_inotify_wd));
+                manager_remove_unit_by_cgroup_inotify_wd(u->manager, u->cgroup_inotify_wd);
                 u->cgroup_inotify_wd = -1;
         }
+
+        unit_forget_cgroup_attributes(u, _CGROUP_MASK_ALL);
 }
 
 void unit_prune_cgroup(Unit *u) {
@@ -1854,7 +2191,9 @@ void unit_prune_cgroup(Unit *u) {
         if (!u->cgroup_path)
                 return;
 
-        (void) unit_get_cpu_usage(u, NULL); /* Cache the last CPU usage value before we destroy the cgroup */
+        /* Cache the last CPU usage value before we destroy the cgroup, and make sure it is current */
+        unit_flush_accounting_cache(u);
+        (void) unit_get_cpu_usage(u, NULL);
 
         is_root_slice = unit_has_name(u, SPECIAL_ROOT_SLICE);
 
@@ -2090,23 +2429,33 @@ void unit_add_to_cgroup_empty_queue(Unit *u) {
 }
 
 static int on_cgroup_inotify_event(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        _cleanup_free_ Unit **pending = NULL;
+        size_t n_pending = 0, n_pending_allocated = 0, i;
         Manager *m = userdata;
+        int r = 0;
 
         assert(s);
         assert(fd >= 0);
         assert(m);
 
+        /* A busy cgroup generates lots of events for the same unit, and with many units lots of events queue up
+         * between two iterations of the event loop. Hence, first drain all queued events, with large reads, and only
+         * then check each unit that got any event once. */
+
         for (;;) {
-                union inotify_event_buffer buffer;
+                union {
+                        struct inotify_event ev;
+                        uint8_t raw[CGROUP_INOTIFY_BUFFER_SIZE];
+                } buffer;
                 struct inotify_event *e;
                 ssize_t l;
 
                 l = read(fd, &buffer, sizeof(buffer));
                 if (l < 0) {
-                        if (IN_SET(errno, EINTR, EAGAIN))
-                                return 0;
+                        if (!IN_SET(errno, EINTR, EAGAIN))
+                                r = log_error_errno(errno, "Failed to read control group inotify events: %m");
 
-                        return log_error_errno(errno, "Failed to read control group inotify events: %m");
+                        break;
                 }
 
                 FOREACH_INOTIFY_EVENT(e, buffer, l) {
@@ -2120,7 +2469,7 @@ static int on_cgroup_inotify_event(sd_event_source *s, int fd, uint32_t revents,
                                 /* The watch was just removed */
                                 continue;
 
-                        u = hashmap_get(m->cgroup_inotify_wd_unit, INT_TO_PTR(e->wd));
+                        u = manager_get_unit_by_cgroup_inotify_wd(m, e->wd);
                         if (!u) /* Not that inotify might deliver
                                  * events for a watch even after it
                                  * was removed, because it was queued
@@ -2128,9 +2477,26 @@ static int on_cgroup_inotify_event(sd_event_source *s, int fd, uint32_t revents,
                                  * this here safely. */
                                 continue;
 
-                        unit_add_to_cgroup_empty_queue(u);
+                        if (u->cgroup_inotify_pending)
+                                continue;
+
+                        if (!GREEDY_REALLOC(pending, n_pending_allocated, n_pending + 1)) {
+                                /* Can't batch it, process it right-away then */
+                                unit_add_to_cgroup_empty_queue(u);
+                                continue;
+                        }
+
+                        pending[n_pending++] = u;
+                        u->cgroup_inotify_pending = true;
                 }
         }
+
+        for (i = 0; i < n_pending; i++) {
+                pending[i]->cgroup_inotify_pending = false;
+                unit_add_to_cgroup_empty_queue(pending[i]);
+        }
+
+        return r;
 }
 
 int manager_setup_cgroup(Manager *m) {
@@ -2278,6 +2644,8 @@ int manager_setup_cgroup(Manager *m) {
 }
 
 void manager_shutdown_cgroup(Manager *m, bool delete) {
+        size_t i;
+
         assert(m);
 
         /* We can't really delete the group, since we are in it. But
@@ -2286,8 +2654,12 @@ void manager_shutdown_cgroup(Manager *m, bool delete) {
                 (void) cg_trim(SYSTEMD_CGROUP_CONTROLLER, m->cgroup_root, false);
 
         m->cgroup_empty_event_source = sd_event_source_unref(m->cgroup_empty_event_source);
+        m->accounting_cache_event_source = sd_event_source_unref(m->accounting_cache_event_source);
 
-        m->cgroup_inotify_wd_unit = hashmap_free(m->cgroup_inotify_wd_unit);
+        for (i = 0; i < m->n_cgroup_inotify_wd_chunks; i++)
+                free(m->cgroup_inotify_wd_chunks[i]);
+        m->cgroup_inotify_wd_chunks = mfree(m->cgroup_inotify_wd_chunks);
+        m->n_cgroup_inotify_wd_chunks = 0;
 
         m->cgroup_inotify_event_source = sd_event_source_unref(m->cgroup_inotify_event_source);
         m->cgroup_inotify_fd = safe_close(m->cgroup_inotify_fd);
@@ -2387,16 +2759,58 @@ int manager_notify_cgroup_empty(Manager *m, const char *cgroup) {
         return 1;
 }
 
-int unit_get_memory_current(Unit *u, uint64_t *ret) {
+static int cgroup_read_attribute_full(int dir_fd, const char *attribute, char **ret) {
+        _cleanup_fclose_ FILE *f = NULL;
+        int fd;
+
+        assert(dir_fd >= 0);
+        assert(attribute);
+        assert(ret);
+
+        /* Reads the complete contents of a cgroup attribute, relative to the already opened cgroup directory */
+
+        fd = openat(dir_fd, attribute, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        f = fdopen(fd, "re");
+        if (!f) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        return read_full_stream(f, ret, NULL);
+}
+
+static int cgroup_read_attribute(int dir_fd, const char *controller, const char *path, const char *attribute, char **ret) {
+        _cleanup_free_ char *contents = NULL;
+        int r;
+
+        assert(attribute);
+        assert(ret);
+
+        /* Reads a single line cgroup attribute, relative to the already opened cgroup directory if we have one */
+
+        if (dir_fd < 0)
+                return cg_get_attribute(controller, path, attribute, ret);
+
+        r = cgroup_read_attribute_full(dir_fd, attribute, &contents);
+        if (r < 0)
+                return r;
+
+        truncate_nl(contents);
+
+        *ret = TAKE_PTR(contents);
+        return 0;
+}
+
+static int unit_read_memory_current(Unit *u, int dir_fd, uint64_t *ret) {
         _cleanup_free_ char *v = NULL;
         int r;
 
         assert(u);
         assert(ret);
 
-        if (!UNIT_CGROUP_BOOL(u, memory_accounting))
-                return -ENODATA;
-
         if (!u->cgroup_path)
                 return -ENODATA;
 
@@ -2411,7 +2825,7 @@ int unit_get_memory_current(Unit *u, uint64_t *ret) {
         if (r < 0)
                 return r;
         if (r > 0)
-                r = cg_get_attribute("memory", u->cgroup_path, "memory.current", &v);
+                r = cgroup_read_attribute(dir_fd, "memory", u->cgroup_path, "memory.current", &v);
         else
                 r = cg_get_attribute("memory", u->cgroup_path, "memory.usage_in_bytes", &v);
         if (r == -ENOENT)
@@ -2422,16 +2836,13 @@ int unit_get_memory_current(Unit *u, uint64_t *ret) {
         return safe_atou64(v, ret);
 }
 
-int unit_get_tasks_current(Unit *u, uint64_t *ret) {
+static int unit_read_tasks_current(Unit *u, int dir_fd, uint64_t *ret) {
         _cleanup_free_ char *v = NULL;
         int r;
 
         assert(u);
         assert(ret);
 
-        if (!UNIT_CGROUP_BOOL(u, tasks_accounting))
-                return -ENODATA;
-
         if (!u->cgroup_path)
                 return -ENODATA;
 
@@ -2442,7 +2853,7 @@ int unit_get_tasks_current(Unit *u, uint64_t *ret) {
         if ((u->cgroup_realized_mask & CGROUP_MASK_PIDS) == 0)
                 return -ENODATA;
 
-        r = cg_get_attribute("pids", u->cgroup_path, "pids.current", &v);
+        r = cgroup_read_attribute(dir_fd, "pids", u->cgroup_path, "pids.current", &v);
         if (r == -ENOENT)
                 return -ENODATA;
         if (r < 0)
@@ -2451,7 +2862,7 @@ int unit_get_tasks_current(Unit *u, uint64_t *ret) {
         return safe_atou64(v, ret);
 }
 
-static int unit_get_cpu_usage_raw(Unit *u, nsec_t *ret) {
+static int unit_get_cpu_usage_raw(Unit *u, int dir_fd, nsec_t *ret) {
         _cleanup_free_ char *v = NULL;
         uint64_t ns;
         int r;
@@ -2476,11 +2887,17 @@ static int unit_get_cpu_usage_raw(Unit *u, nsec_t *ret) {
                 if ((u->cgroup_realized_mask & CGROUP_MASK_CPU) == 0)
                         return -ENODATA;
 
-                r = cg_get_keyed_attribute("cpu", u->cgroup_path, "cpu.stat", STRV_MAKE("usage_usec"), &val);
-                if (r < 0)
-                        return r;
+                /* cpu.stat is a keyed file with one key per line, hence read it completely */
+                if (dir_fd >= 0) {
+                        r = cgroup_read_attribute_full(dir_fd, "cpu.stat", &v);
+                        if (r >= 0)
+                                r = cg_parse_keyed_attribute(v, STRV_MAKE("usage_usec"), &val);
+                } else
+                        r = cg_get_keyed_attribute("cpu", u->cgroup_path, "cpu.stat", STRV_MAKE("usage_usec"), &val);
                 if (IN_SET(r, -ENOENT, -ENXIO))
                         return -ENODATA;
+                if (r < 0)
+                        return r;
 
                 r = safe_atou64(val, &us);
                 if (r < 0)
@@ -2506,6 +2923,241 @@ static int unit_get_cpu_usage_raw(Unit *u, nsec_t *ret) {
         return 0;
 }
 
+static int unit_read_ip_accounting(Unit *u, CGroupIPAccountingMetric metric, uint64_t *ret) {
+        uint64_t value;
+        int fd, r;
+
+        assert(u);
+        assert(ret);
+
+        fd = IN_SET(metric, CGROUP_IP_INGRESS_BYTES, CGROUP_IP_INGRESS_PACKETS) ?
+                u->ip_accounting_ingress_map_fd :
+                u->ip_accounting_egress_map_fd;
+        if (fd < 0)
+                return -ENODATA;
+
+        if (IN_SET(metric, CGROUP_IP_INGRESS_BYTES, CGROUP_IP_EGRESS_BYTES))
+                r = bpf_firewall_read_accounting(fd, &value, NULL);
+        else
+                r = bpf_firewall_read_accounting(fd, NULL, &value);
+        if (r < 0)
+                return r;
+
+        *ret = value;
+        return 0;
+}
+
+static int unit_read_accounting(Unit *u, CGroupAccountingMetric metric, int dir_fd, uint64_t *ret) {
+        assert(u);
+        assert(ret);
+
+        switch (metric) {
+
+        case CGROUP_ACCOUNTING_CPU_USAGE:
+                return unit_get_cpu_usage_raw(u, dir_fd, ret);
+
+        case CGROUP_ACCOUNTING_MEMORY_CURRENT:
+                return unit_read_memory_current(u, dir_fd, ret);
+
+        case CGROUP_ACCOUNTING_TASKS_CURRENT:
+                return unit_read_tasks_current(u, dir_fd, ret);
+
+        case CGROUP_ACCOUNTING_IP_INGRESS_BYTES:
+        case CGROUP_ACCOUNTING_IP_INGRESS_PACKETS:
+        case CGROUP_ACCOUNTING_IP_EGRESS_BYTES:
+        case CGROUP_ACCOUNTING_IP_EGRESS_PACKETS:
+                return unit_read_ip_accounting(u, metric - CGROUP_ACCOUNTING_IP_INGRESS_BYTES, ret);
+
+        default:
+                assert_not_reached("Unknown accounting metric");
+        }
+}
+
+void unit_flush_accounting_cache(Unit *u) {
+        assert(u);
+
+        /* Drops all sampled accounting values of the unit, so that the next query reads them afresh */
+
+        u->accounting_cache_valid = 0;
+        u->accounting_cache_used = false;
+
+        if (!u->in_accounting_cache_queue)
+                return;
+
+        LIST_REMOVE(accounting_cache_queue, u->manager->accounting_cache_queue, u);
+        u->in_accounting_cache_queue = false;
+}
+
+static void unit_refresh_accounting_cache(Unit *u) {
+        _cleanup_close_ int dir_fd = -1;
+        CGroupAccountingMetric metric;
+
+        assert(u);
+
+        /* On the unified hierarchy all attributes live in the same directory, hence open it once and read all of
+         * them relative to it. */
+        if (u->cgroup_path && cg_all_unified() > 0 && !unit_has_root_cgroup(u)) {
+                _cleanup_free_ char *p = NULL;
+
+                if (cg_get_path(SYSTEMD_CGROUP_CONTROLLER, u->cgroup_path, NULL, &p) >= 0)
+                        dir_fd = open(p, O_PATH|O_DIRECTORY|O_CLOEXEC);
+        }
+
+        for (metric = 0; metric < _CGROUP_ACCOUNTING_METRIC_MAX; metric++) {
+                if (!(u->accounting_cache_valid & (1U << metric)))
+                        continue;
+
+                if (unit_read_accounting(u, metric, dir_fd, &u->accounting_cache[metric]) < 0)
+                        u->accounting_cache_valid &= ~(1U << metric);
+        }
+}
+
+static int on_accounting_cache_refresh(sd_event_source *s, uint64_t usec, void *userdata) {
+        Manager *m = userdata;
+        Unit *u, *next;
+        int r;
+
+        assert(s);
+        assert(m);
+
+        /* Refreshes the sampled accounting values of all units that have been queried since the last refresh, in one
+         * go. The values of the others are dropped, so that we don't keep sampling units nobody is interested in. */
+
+        LIST_FOREACH_SAFE(accounting_cache_queue, u, next, m->accounting_cache_queue) {
+                if (!u->accounting_cache_used || m->accounting_cache_usec == 0) {
+                        unit_flush_accounting_cache(u);
+                        continue;
+                }
+
+                u->accounting_cache_used = false;
+                unit_refresh_accounting_cache(u);
+
+                if (u->accounting_cache_valid == 0)
+                        unit_flush_accounting_cache(u);
+        }
+
+        if (!m->accounting_cache_queue)
+                return 0;
+
+        r = sd_event_source_set_time(s, usec + m->accounting_cache_usec);
+        if (r < 0) {
+                log_error_errno(r, "Failed to reschedule accounting cache refresh: %m");
+                goto fail;
+        }
+
+        r = sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+        if (r < 0) {
+                log_error_errno(r, "Failed to enable accounting cache refresh: %m");
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        /* Without the timer the cached values would never be refreshed again. Drop them all, so that the next query
+         * reads the current values, and arms the timer again. */
+        while (m->accounting_cache_queue)
+                unit_flush_accounting_cache(m->accounting_cache_queue);
+
+        return r;
+}
+
+static int unit_add_to_accounting_cache_queue(Unit *u) {
+        Manager *m;
+        usec_t next;
+        int r;
+
+        assert(u);
+
+        m = u->manager;
+
+        if (u->in_accounting_cache_queue)
+                return 0;
+
+        if (!m->accounting_cache_queue) {
+                next = usec_add(now(CLOCK_MONOTONIC), m->accounting_cache_usec);
+
+                if (m->accounting_cache_event_source) {
+                        r = sd_event_source_set_time(m->accounting_cache_event_source, next);
+                        if (r < 0)
+                                return r;
+
+                        r = sd_event_source_set_enabled(m->accounting_cache_event_source, SD_EVENT_ONESHOT);
+                        if (r < 0)
+                                return r;
+                } else {
+                        r = sd_event_add_time(m->event, &m->accounting_cache_event_source, CLOCK_MONOTONIC, next, 0, on_accounting_cache_refresh, m);
+                        if (r < 0)
+                                return r;
+
+                        (void) sd_event_source_set_description(m->accounting_cache_event_source, "accounting-cache-refresh");
+                }
+        }
+
+        LIST_PREPEND(accounting_cache_queue, m->accounting_cache_queue, u);
+        u->in_accounting_cache_queue = true;
+
+        return 0;
+}
+
+static int unit_get_accounting(Unit *u, CGroupAccountingMetric metric, uint64_t *ret) {
+        uint64_t v;
+        int r;
+
+        assert(u);
+        assert(metric >= 0);
+        assert(metric < _CGROUP_ACCOUNTING_METRIC_MAX);
+        assert(ret);
+
+        /* If the accounting cache is enabled, serve the value from memory if we have sampled it before. The value is
+         * at most one refresh period (AccountingCacheSec=) old. Otherwise read it right-away, and keep sampling it
+         * from now on. */
+
+        if (u->manager->accounting_cache_usec > 0 && (u->accounting_cache_valid & (1U << metric))) {
+                u->accounting_cache_used = true;
+                *ret = u->accounting_cache[metric];
+                return 0;
+        }
+
+        r = unit_read_accounting(u, metric, -1, &v);
+        if (r < 0)
+                return r;
+
+        if (u->manager->accounting_cache_usec > 0) {
+                r = unit_add_to_accounting_cache_queue(u);
+                if (r < 0)
+                        log_unit_debug_errno(u, r, "Failed to enqueue unit for accounting cache refresh, ignoring: %m");
+                else {
+                        u->accounting_cache[metric] = v;
+                        u->accounting_cache_valid |= 1U << metric;
+                        u->accounting_cache_used = true;
+                }
+        }
+
+        *ret = v;
+        return 0;
+}
+
+int unit_get_memory_current(Unit *u, uint64_t *ret) {
+        assert(u);
+        assert(ret);
+
+        if (!UNIT_CGROUP_BOOL(u, memory_accounting))
+                return -ENODATA;
+
+        return unit_get_accounting(u, CGROUP_ACCOUNTING_MEMORY_CURRENT, ret);
+}
+
+int unit_get_tasks_current(Unit *u, uint64_t *ret) {
+        assert(u);
+        assert(ret);
+
+        if (!UNIT_CGROUP_BOOL(u, tasks_accounting))
+                return -ENODATA;
+
+        return unit_get_accounting(u, CGROUP_ACCOUNTING_TASKS_CURRENT, ret);
+}
+
 int unit_get_cpu_usage(Unit *u, nsec_t *ret) {
         nsec_t ns;
         int r;
@@ -2519,7 +3171,7 @@ int unit_get_cpu_usage(Unit *u, nsec_t *ret) {
         if (!UNIT_CGROUP_BOOL(u, cpu_accounting))
                 return -ENODATA;
 
-        r = unit_get_cpu_usage_raw(u, &ns);
+        r = unit_get_accounting(u, CGROUP_ACCOUNTING_CPU_USAGE, &ns);
         if (r == -ENODATA && u->cpu_usage_last != NSEC_INFINITY) {
                 /* If we can't get the CPU usage anymore (because the cgroup was already removed, for example), use our
                  * cached value. */
@@ -2549,7 +3201,7 @@ int unit_get_ip_accounting(
                 uint64_t *ret) {
 
         uint64_t value;
-        int fd, r;
+        int r;
 
         assert(u);
         assert(metric >= 0);
@@ -2559,16 +3211,7 @@ int unit_get_ip_accounting(
         if (!UNIT_CGROUP_BOOL(u, ip_accounting))
                 return -ENODATA;
 
-        fd = IN_SET(metric, CGROUP_IP_INGRESS_BYTES, CGROUP_IP_INGRESS_PACKETS) ?
-                u->ip_accounting_ingress_map_fd :
-                u->ip_accounting_egress_map_fd;
-        if (fd < 0)
-                return -ENODATA;
-
-        if (IN_SET(metric, CGROUP_IP_INGRESS_BYTES, CGROUP_IP_EGRESS_BYTES))
-                r = bpf_firewall_read_accounting(fd, &value, NULL);
-        else
-                r = bpf_firewall_read_accounting(fd, NULL, &value);
+        r = unit_get_accounting(u, CGROUP_ACCOUNTING_IP_INGRESS_BYTES + metric, &value);
         if (r < 0)
                 return r;
 
@@ -2588,8 +3231,9 @@ int unit_reset_cpu_accounting(Unit *u) {
         assert(u);
 
         u->cpu_usage_last = NSEC_INFINITY;
+        unit_flush_accounting_cache(u);
 
-        r = unit_get_cpu_usage_raw(u, &ns);
+        r = unit_get_cpu_usage_raw(u, -1, &ns);
         if (r < 0) {
                 u->cpu_usage_base = 0;
                 return r;
@@ -2604,6 +3248,8 @@ int unit_reset_ip_accounting(Unit *u) {
 
         assert(u);
 
+        unit_flush_accounting_cache(u);
+
         if (u->ip_accounting_ingress_map_fd >= 0)
                 r = bpf_firewall_reset_accounting(u->ip_accounting_ingress_map_fd);
 
@@ -2654,10 +3300,8 @@ void unit_invalidate_cgroup_bpf(Unit *u) {
          * list of our children includes our own. */
         if (u->type == UNIT_SLICE) {
                 Unit *member;
-                Iterator i;
-                void *v;
 
-                HASHMAP_FOREACH_KEY(v, member, u->dependencies[UNIT_BEFORE], i) {
+                UNIT_FOREACH_DEPENDENCY(member, u, UNIT_BEFORE) {
                         if (member == u)
                                 continue;
 
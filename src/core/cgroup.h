@@ -121,6 +121,19 @@ typedef enum CGroupIPAccountingMetric {
         _CGROUP_IP_ACCOUNTING_METRIC_INVALID = -1,
 } CGroupIPAccountingMetric;
 
+/* The accounting values that may be served from the manager's accounting cache */
+typedef enum CGroupAccountingMetric {
+        CGROUP_ACCOUNTING_CPU_USAGE,           /* raw, i.e. cpu_usage_base not subtracted yet */
+        CGROUP_ACCOUNTING_MEMORY_CURRENT,
+        CGROUP_ACCOUNTING_TASKS_CURRENT,
+        CGROUP_ACCOUNTING_IP_INGRESS_BYTES,    /* in the order of CGroupIPAccountingMetric */
+        CGROUP_ACCOUNTING_IP_INGRESS_PACKETS,
+        CGROUP_ACCOUNTING_IP_EGRESS_BYTES,
+        CGROUP_ACCOUNTING_IP_EGRESS_PACKETS,
+        _CGROUP_ACCOUNTING_METRIC_MAX,
+        _CGROUP_ACCOUNTING_METRIC_INVALID = -1,
+} CGroupAccountingMetric;
+
 typedef struct Unit Unit;
 typedef struct Manager Manager;
 
@@ -159,6 +172,10 @@ void unit_release_cgroup(Unit *u);
 void unit_prune_cgroup(Unit *u);
 int unit_watch_cgroup(Unit *u);
 
+int unit_remember_cgroup_attribute(Unit *u, const char *key, const char *value);
+void unit_forget_cgroup_attribute(Unit *u, const char *key);
+void unit_forget_cgroup_attributes(Unit *u, CGroupMask mask);
+
 void unit_add_to_cgroup_empty_queue(Unit *u);
 
 int unit_attach_pids_to_cgroup(Unit *u, Set *pids, const char *suffix_path);
@@ -185,6 +202,8 @@ int unit_get_ip_accounting(Unit *u, CGroupIPAccountingMetric metric, uint64_t *r
 int unit_reset_cpu_accounting(Unit *u);
 int unit_reset_ip_accounting(Unit *u);
 
+void unit_flush_accounting_cache(Unit *u);
+
 #define UNIT_CGROUP_BOOL(u, name)                       \
         ({                                              \
         CGroupContext *cc = unit_get_cgroup_context(u); \
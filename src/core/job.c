@@ -438,9 +438,7 @@ int job_type_merge_and_collapse(JobType *a, JobType b, Unit *u) {
 }
 
 static bool job_is_runnable(Job *j) {
-        Iterator i;
         Unit *other;
-        void *v;
 
         assert(j);
         assert(j->installed);
@@ -468,7 +466,7 @@ static bool job_is_runnable(Job *j) {
                  * dependencies, regardless whether they are
                  * starting or stopping something. */
 
-                HASHMAP_FOREACH_KEY(v, other, j->unit->dependencies[UNIT_AFTER], i)
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER)
                         if (other->job)
                                 return false;
         }
@@ -476,7 +474,7 @@ static bool job_is_runnable(Job *j) {
         /* Also, if something else is being stopped and we should
          * change state after it, then let's wait. */
 
-        HASHMAP_FOREACH_KEY(v, other, j->unit->dependencies[UNIT_BEFORE], i)
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE)
                 if (other->job &&
                     IN_SET(other->job->type, JOB_STOP, JOB_RESTART))
                         return false;
@@ -839,12 +837,10 @@ static void job_emit_status_message(Unit *u, JobType t, JobResult result) {
 
 static void job_fail_dependencies(Unit *u, UnitDependency d) {
         Unit *other;
-        Iterator i;
-        void *v;
 
         assert(u);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[d], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, d) {
                 Job *j = other->job;
 
                 if (!j)
@@ -873,8 +869,6 @@ int job_finish_and_invalidate(Job *j, JobResult result, bool recursive, bool alr
         Unit *u;
         Unit *other;
         JobType t;
-        Iterator i;
-        void *v;
 
         assert(j);
         assert(j->installed);
@@ -945,12 +939,12 @@ int job_finish_and_invalidate(Job *j, JobResult result, bool recursive, bool alr
 
 finish:
         /* Try to start the next jobs that can be started */
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_AFTER], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_AFTER)
                 if (other->job) {
                         job_add_to_run_queue(other->job);
                         job_add_to_gc_queue(other->job);
                 }
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BEFORE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BEFORE)
                 if (other->job) {
                         job_add_to_run_queue(other->job);
                         job_add_to_gc_queue(other->job);
@@ -1298,8 +1292,6 @@ int job_get_timeout(Job *j, usec_t *timeout) {
 
 bool job_may_gc(Job *j) {
         Unit *other;
-        Iterator i;
-        void *v;
 
         assert(j);
 
@@ -1329,7 +1321,7 @@ bool job_may_gc(Job *j) {
 
         /* If a job is ordered after ours, and is to be started, then it needs to wait for us, regardless if we stop or
          * start, hence let's not GC in that case. */
-        HASHMAP_FOREACH_KEY(v, other, j->unit->dependencies[UNIT_BEFORE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE) {
                 if (!other->job)
                         continue;
 
@@ -1342,7 +1334,7 @@ bool job_may_gc(Job *j) {
 
         /* If we are going down, but something else is ordered After= us, then it needs to wait for us */
         if (IN_SET(j->type, JOB_STOP, JOB_RESTART))
-                HASHMAP_FOREACH_KEY(v, other, j->unit->dependencies[UNIT_AFTER], i) {
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER) {
                         if (!other->job)
                                 continue;
 
@@ -1419,8 +1411,6 @@ int job_get_before(Job *j, Job*** ret) {
         _cleanup_free_ Job** list = NULL;
         size_t n = 0, n_allocated = 0;
         Unit *other = NULL;
-        Iterator i;
-        void *v;
 
         /* Returns a list of all pending jobs that need to finish before this job may be started. */
 
@@ -1434,7 +1424,7 @@ int job_get_before(Job *j, Job*** ret) {
 
         if (IN_SET(j->type, JOB_START, JOB_VERIFY_ACTIVE, JOB_RELOAD)) {
 
-                HASHMAP_FOREACH_KEY(v, other, j->unit->dependencies[UNIT_AFTER], i) {
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER) {
                         if (!other->job)
                                 continue;
 
@@ -1444,7 +1434,7 @@ int job_get_before(Job *j, Job*** ret) {
                 }
         }
 
-        HASHMAP_FOREACH_KEY(v, other, j->unit->dependencies[UNIT_BEFORE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE) {
                 if (!other->job)
                         continue;
 
@@ -1467,15 +1457,13 @@ int job_get_after(Job *j, Job*** ret) {
         _cleanup_free_ Job** list = NULL;
         size_t n = 0, n_allocated = 0;
         Unit *other = NULL;
-        void *v;
-        Iterator i;
 
         assert(j);
         assert(ret);
 
         /* Returns a list of all pending jobs that are waiting for this job to finish. */
 
-        HASHMAP_FOREACH_KEY(v, other, j->unit->dependencies[UNIT_BEFORE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE) {
                 if (!other->job)
                         continue;
 
@@ -1492,7 +1480,7 @@ int job_get_after(Job *j, Job*** ret) {
 
         if (IN_SET(j->type, JOB_STOP, JOB_RESTART)) {
 
-                HASHMAP_FOREACH_KEY(v, other, j->unit->dependencies[UNIT_AFTER], i) {
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER) {
                         if (!other->job)
                                 continue;
 
@@ -126,6 +126,11 @@ struct Job {
         Job* marker;
         unsigned generation;
 
+        /* Used by the ordering cycle check, which looks for strongly connected components of the ordering graph
+         * using Tarjan's algorithm. Only valid if 'generation' matches the current pass. */
+        unsigned scc_index;
+        unsigned scc_lowlink;
+
         uint32_t id;
 
         JobType type;
@@ -157,6 +162,7 @@ struct Job {
         bool in_gc_queue:1;
         bool ref_by_private_bus:1;
         bool reloaded:1;
+        bool on_scc_stack:1;
 };
 
 Job* job_new(Unit *unit, JobType type);
@@ -1074,13 +1074,11 @@ enum {
 
 static void unit_gc_mark_good(Unit *u, unsigned gc_marker) {
         Unit *other;
-        Iterator i;
-        void *v;
 
         u->gc_marker = gc_marker + GC_OFFSET_GOOD;
 
         /* Recursively mark referenced units as GOOD as well */
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_REFERENCES], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REFERENCES)
                 if (other->gc_marker == gc_marker + GC_OFFSET_UNSURE)
                         unit_gc_mark_good(other, gc_marker);
 }
@@ -1088,8 +1086,6 @@ static void unit_gc_mark_good(Unit *u, unsigned gc_marker) {
 static void unit_gc_sweep(Unit *u, unsigned gc_marker) {
         Unit *other;
         bool is_bad;
-        Iterator i;
-        void *v;
 
         assert(u);
 
@@ -1107,7 +1103,7 @@ static void unit_gc_sweep(Unit *u, unsigned gc_marker) {
 
         is_bad = true;
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_REFERENCED_BY], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REFERENCED_BY) {
                 unit_gc_sweep(other, gc_marker);
 
                 if (other->gc_marker == gc_marker + GC_OFFSET_GOOD)
@@ -1802,10 +1798,8 @@ static int manager_dispatch_target_deps_queue(Manager *m) {
 
                 for (k = 0; k < ELEMENTSOF(deps); k++) {
                         Unit *target;
-                        Iterator i;
-                        void *v;
 
-                        HASHMAP_FOREACH_KEY(v, target, u->dependencies[deps[k]], i) {
+                        UNIT_FOREACH_DEPENDENCY(target, u, deps[k]) {
                                 r = unit_add_default_target_dependency(u, target);
                                 if (r < 0)
                                         return r;
@@ -127,6 +127,9 @@ struct Manager {
         /* Units whose cgroup ran empty */
         LIST_HEAD(Unit, cgroup_empty_queue);
 
+        /* Units whose accounting values are sampled periodically */
+        LIST_HEAD(Unit, accounting_cache_queue);
+
         /* Target units whose default target dependencies haven't been set yet */
         LIST_HEAD(Unit, target_deps_queue);
 
@@ -232,10 +235,20 @@ struct Manager {
         CGroupMask cgroup_supported;
         char *cgroup_root;
 
+        /* If non-zero, accounting values are sampled in this interval, and queries are served from memory */
+        usec_t accounting_cache_usec;
+        sd_event_source *accounting_cache_event_source;
+
+        /* Counters of cgroup attribute writes done, and of those skipped because the value didn't change */
+        unsigned n_cgroup_attribute_writes;
+        unsigned n_cgroup_attribute_writes_skipped;
+
         /* Notifications from cgroups, when the unified hierarchy is used is done via inotify. */
         int cgroup_inotify_fd;
         sd_event_source *cgroup_inotify_event_source;
-        Hashmap *cgroup_inotify_wd_unit;
+        /* Units by inotify watch descriptor, see manager_get_unit_by_cgroup_inotify_wd() */
+        struct CGroupInotifyChunk **cgroup_inotify_wd_chunks;
+        size_t n_cgroup_inotify_wd_chunks;
 
         /* A defer event for handling cgroup empty events and processing them after SIGCHLD in all cases. */
         sd_event_source *cgroup_empty_event_source;
@@ -317,7 +317,7 @@ static int path_add_trigger_dependencies(Path *p) {
 
         assert(p);
 
-        if (!hashmap_isempty(UNIT(p)->dependencies[UNIT_TRIGGERS]))
+        if (unit_dependency_count(UNIT(p), UNIT_TRIGGERS) > 0)
                 return 0;
 
         r = unit_load_related_unit(UNIT(p), ".service", &x);
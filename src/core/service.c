@@ -1209,13 +1209,11 @@ static int service_collect_fds(Service *s,
 
                 rn_socket_fds = 1;
         } else {
-                Iterator i;
-                void *v;
                 Unit *u;
 
                 /* Pass all our configured sockets for singleton services */
 
-                HASHMAP_FOREACH_KEY(v, u, UNIT(s)->dependencies[UNIT_TRIGGERED_BY], i) {
+                UNIT_FOREACH_DEPENDENCY(u, UNIT(s), UNIT_TRIGGERED_BY) {
                         _cleanup_free_ int *cfds = NULL;
                         Socket *sock;
                         int cn_fds;
@@ -2254,12 +2254,10 @@ static void socket_enter_running(Socket *s, int cfd) {
         if (cfd < 0) {
                 bool pending = false;
                 Unit *other;
-                Iterator i;
-                void *v;
 
                 /* If there's already a start pending don't bother to
                  * do anything */
-                HASHMAP_FOREACH_KEY(v, other, UNIT(s)->dependencies[UNIT_TRIGGERS], i)
+                UNIT_FOREACH_DEPENDENCY(other, UNIT(s), UNIT_TRIGGERS)
                         if (unit_active_or_pending(other)) {
                                 pending = true;
                                 break;
@@ -45,27 +45,37 @@ void transaction_abort(Transaction *tr) {
 }
 
 static void transaction_find_jobs_that_matter_to_anchor(Job *j, unsigned generation) {
-        JobDependency *l;
+        Job *stack;
 
-        /* A recursive sweep through the graph that marks all units
-         * that matter to the anchor job, i.e. are directly or
-         * indirectly a dependency of the anchor job via paths that
-         * are fully marked as mattering. */
+        /* A sweep through the graph that marks all units that matter to the anchor job, i.e. are directly or
+         * indirectly a dependency of the anchor job via paths that are fully marked as mattering. This is done
+         * iteratively, with the marker fields forming the stack of jobs still to look at, so that long dependency
+         * chains do not result in deep recursion. */
 
         j->matters_to_anchor = true;
         j->generation = generation;
+        j->marker = NULL;
 
-        LIST_FOREACH(subject, l, j->subject_list) {
+        for (stack = j; (j = stack); ) {
+                JobDependency *l;
 
-                /* This link does not matter */
-                if (!l->matters)
-                        continue;
+                stack = j->marker;
 
-                /* This unit has already been marked */
-                if (l->object->generation == generation)
-                        continue;
+                LIST_FOREACH(subject, l, j->subject_list) {
 
-                transaction_find_jobs_that_matter_to_anchor(l->object, generation);
+                        /* This link does not matter */
+                        if (!l->matters)
+                                continue;
+
+                        /* This unit has already been marked */
+                        if (l->object->generation == generation)
+                                continue;
+
+                        l->object->matters_to_anchor = true;
+                        l->object->generation = generation;
+                        l->object->marker = stack;
+                        stack = l->object;
+                }
         }
 }
 
@@ -284,12 +294,15 @@ static void transaction_drop_redundant(Transaction *tr) {
 
         /* Goes through the transaction and removes all jobs of the units
          * whose jobs are all noops. If not all of a unit's jobs are
-         * redundant, they are kept. */
+         * redundant, they are kept. Whether a job is redundant only
+         * depends on its own unit, and deleting the jobs without their
+         * dependencies only removes the current entry from tr->jobs,
+         * hence a single pass suffices. */
 
         assert(tr);
 
-rescan:
         HASHMAP_FOREACH(j, tr->jobs, i) {
+                Unit *u = j->unit;
                 Job *k;
 
                 LIST_FOREACH(transaction, k, j) {
@@ -301,8 +314,8 @@ rescan:
                 }
 
                 /* log_debug("Found redundant job %s/%s, dropping.", j->unit->id, job_type_to_string(j->type)); */
-                transaction_delete_job(tr, j, false);
-                goto rescan;
+                while ((k = hashmap_get(tr->jobs, u)))
+                        transaction_delete_job(tr, k, false);
         next_unit:;
         }
 }
@@ -340,161 +353,329 @@ static char* merge_unit_ids(const char* unit_log_field, char **pairs) {
         return ans;
 }
 
-static int transaction_verify_order_one(Transaction *tr, Job *j, Job *from, unsigned generation, sd_bus_error *e) {
-        Iterator i;
+static Job* transaction_next_ordered_job(Transaction *tr, Job *j, unsigned *idx) {
         Unit *u;
-        void *v;
-        int r;
 
         assert(tr);
         assert(j);
-        assert(!j->transaction_prev);
+        assert(idx);
 
-        /* Does a recursive sweep through the ordering graph, looking
-         * for a cycle. If we find a cycle we try to break it. */
+        /* Returns the next job j is ordered before, continuing the search at the dependency index *idx. We assume
+         * that the dependencies are bidirectional, and hence can ignore UNIT_AFTER. */
 
-        /* Have we seen this before? */
-        if (j->generation == generation) {
-                Job *k, *delete = NULL;
-                _cleanup_free_ char **array = NULL, *unit_ids = NULL;
-                char **unit_id, **job_type;
+        while ((u = unit_dependency_table_nth_unit(j->unit->dependencies, UNIT_BEFORE, (*idx)++))) {
+                Job *o;
 
-                /* If the marker is NULL we have been here already and
-                 * decided the job was loop-free from here. Hence
-                 * shortcut things and return right-away. */
-                if (!j->marker)
-                        return 0;
+                /* Is there a job for this unit? */
+                o = hashmap_get(tr->jobs, u);
+                if (o)
+                        return o;
 
-                /* So, the marker is not NULL and we already have been here. We have
-                 * a cycle. Let's try to break it. We go backwards in our path and
-                 * try to find a suitable job to remove. We use the marker to find
-                 * our way back, since smart how we are we stored our way back in
-                 * there. */
+                /* Ok, there is no job for this in the transaction, but maybe there is already one running? */
+                if (u->job)
+                        return u->job;
+        }
+
+        return NULL;
+}
+
+typedef struct CycleBreak {
+        Job *job;       /* the job the cycle starts with */
+        Job *delete;    /* the job to drop to break it */
+        Unit *unit;     /* the unit of that job, whose jobs are all dropped */
+        char *unit_ids; /* structured logging fields for the units on the cycle */
+} CycleBreak;
+
+static void cycle_break_free_many(CycleBreak *b, size_t n) {
+        size_t k;
 
-                for (k = from; k; k = ((k->generation == generation && k->marker != k) ? k->marker : NULL)) {
+        for (k = 0; k < n; k++)
+                free(b[k].unit_ids);
 
-                        /* For logging below */
-                        if (strv_push_pair(&array, k->unit->id, (char*) job_type_to_string(k->type)) < 0)
-                                log_oom();
+        free(b);
+}
+
+static int transaction_find_cycle(
+                Transaction *tr,
+                Job **scc,
+                size_t n_scc,
+                CycleBreak *ret,
+                sd_bus_error *e) {
+
+        _cleanup_free_ char **array = NULL, *unit_ids = NULL;
+        _cleanup_free_ Job **queue = NULL;
+        size_t n_queue = 0, head = 0, n;
+        char **unit_id, **job_type;
+        Job *j, *k, *from = NULL, *delete = NULL;
+
+        assert(tr);
+        assert(scc);
+        assert(n_scc > 1);
+        assert(ret);
+
+        /* We found a strongly connected component of the ordering graph with more than one job, i.e. there is at
+         * least one cycle in it. Find one, with a breadth-first search from the root of the component back to
+         * itself, remembering the way back in the marker fields, and pick a job to drop to break it. */
+
+        j = scc[0];
+
+        for (n = 0; n < n_scc; n++)
+                scc[n]->marker = NULL;
+
+        queue = new(Job*, n_scc);
+        if (!queue)
+                return -ENOMEM;
 
-                        if (!delete && hashmap_get(tr->jobs, k->unit) && !unit_matters_to_anchor(k->unit, k))
-                                /* Ok, we can drop this one, so let's do so. */
-                                delete = k;
+        j->marker = j;
+        queue[n_queue++] = j;
 
-                        /* Check if this in fact was the beginning of the cycle */
-                        if (k == j)
+        while (!from && head < n_queue) {
+                Job *x = queue[head++], *o;
+                unsigned idx = 0;
+
+                while ((o = transaction_next_ordered_job(tr, x, &idx))) {
+
+                        /* Only look at edges within this component */
+                        if (!o->on_scc_stack || o->scc_index < j->scc_index)
+                                continue;
+
+                        if (o == j) {
+                                from = x;
                                 break;
-                }
+                        }
 
-                unit_ids = merge_unit_ids(j->manager->unit_log_field, array); /* ignore error */
-
-                STRV_FOREACH_PAIR(unit_id, job_type, array)
-                        /* logging for j not k here to provide a consistent narrative */
-                        log_struct(LOG_WARNING,
-                                   "MESSAGE=%s: Found %s on %s/%s",
-                                   j->unit->id,
-                                   unit_id == array ? "ordering cycle" : "dependency",
-                                   *unit_id, *job_type,
-                                   unit_ids);
-
-                if (delete) {
-                        const char *status;
-                        /* logging for j not k here to provide a consistent narrative */
-                        log_struct(LOG_ERR,
-                                   "MESSAGE=%s: Job %s/%s deleted to break ordering cycle starting with %s/%s",
-                                   j->unit->id, delete->unit->id, job_type_to_string(delete->type),
-                                   j->unit->id, job_type_to_string(j->type),
-                                   unit_ids);
-
-                        if (log_get_show_color())
-                                status = ANSI_HIGHLIGHT_RED " SKIP " ANSI_NORMAL;
-                        else
-                                status = " SKIP ";
+                        if (o->marker)
+                                continue;
 
-                        unit_status_printf(delete->unit, status,
-                                           "Ordering cycle found, skipping %s");
-                        transaction_delete_unit(tr, delete->unit);
-                        return -EAGAIN;
+                        o->marker = x;
+                        queue[n_queue++] = o;
                 }
+        }
+
+        /* Every job in a strongly connected component is reachable from every other */
+        assert(from);
+
+        /* Go backwards on our path and try to find a suitable job to remove */
+        for (k = from; ; k = k->marker) {
+
+                /* For logging below */
+                if (strv_push_pair(&array, k->unit->id, (char*) job_type_to_string(k->type)) < 0)
+                        log_oom();
+
+                if (!delete && hashmap_get(tr->jobs, k->unit) && !unit_matters_to_anchor(k->unit, k))
+                        /* Ok, we can drop this one, so let's do so. */
+                        delete = k;
+
+                /* Check if this in fact was the beginning of the cycle */
+                if (k == j)
+                        break;
+        }
+
+        unit_ids = merge_unit_ids(j->manager->unit_log_field, array); /* ignore error */
 
-                log_struct(LOG_ERR,
-                           "MESSAGE=%s: Unable to break cycle starting with %s/%s",
-                           j->unit->id, j->unit->id, job_type_to_string(j->type),
+        STRV_FOREACH_PAIR(unit_id, job_type, array)
+                /* logging for j not k here to provide a consistent narrative */
+                log_struct(LOG_WARNING,
+                           "MESSAGE=%s: Found %s on %s/%s",
+                           j->unit->id,
+                           unit_id == array ? "ordering cycle" : "dependency",
+                           *unit_id, *job_type,
                            unit_ids);
 
-                return sd_bus_error_setf(e, BUS_ERROR_TRANSACTION_ORDER_IS_CYCLIC,
-                                         "Transaction order is cyclic. See system logs for details.");
+        if (delete) {
+                *ret = (CycleBreak) {
+                        .job = j,
+                        .delete = delete,
+                        .unit = delete->unit,
+                        .unit_ids = TAKE_PTR(unit_ids),
+                };
+                return 0;
         }
 
-        /* Make the marker point to where we come from, so that we can
-         * find our way backwards if we want to break a cycle. We use
-         * a special marker for the beginning: we point to
-         * ourselves. */
-        j->marker = from ? from : j;
-        j->generation = generation;
+        log_struct(LOG_ERR,
+                   "MESSAGE=%s: Unable to break cycle starting with %s/%s",
+                   j->unit->id, j->unit->id, job_type_to_string(j->type),
+                   unit_ids);
 
-        /* We assume that the dependencies are bidirectional, and
-         * hence can ignore UNIT_AFTER */
-        HASHMAP_FOREACH_KEY(v, u, j->unit->dependencies[UNIT_BEFORE], i) {
-                Job *o;
+        return sd_bus_error_setf(e, BUS_ERROR_TRANSACTION_ORDER_IS_CYCLIC,
+                                 "Transaction order is cyclic. See system logs for details.");
+}
 
-                /* Is there a job for this unit? */
-                o = hashmap_get(tr->jobs, u);
-                if (!o) {
-                        /* Ok, there is no job for this in the
-                         * transaction, but maybe there is already one
-                         * running? */
-                        o = u->job;
-                        if (!o)
-                                continue;
-                }
+static void transaction_log_cycle_break(const CycleBreak *b) {
+        const char *status;
 
-                r = transaction_verify_order_one(tr, o, j, generation, e);
-                if (r < 0)
-                        return r;
-        }
+        assert(b);
 
-        /* Ok, let's backtrack, and remember that this entry is not on
-         * our path anymore. */
-        j->marker = NULL;
+        /* logging for the first job of the cycle here, to provide a consistent narrative */
+        log_struct(LOG_ERR,
+                   "MESSAGE=%s: Job %s/%s deleted to break ordering cycle starting with %s/%s",
+                   b->job->unit->id, b->delete->unit->id, job_type_to_string(b->delete->type),
+                   b->job->unit->id, job_type_to_string(b->job->type),
+                   b->unit_ids);
 
-        return 0;
+        if (log_get_show_color())
+                status = ANSI_HIGHLIGHT_RED " SKIP " ANSI_NORMAL;
+        else
+                status = " SKIP ";
+
+        unit_status_printf(b->delete->unit, status,
+                           "Ordering cycle found, skipping %s");
 }
 
+typedef struct OrderFrame {
+        Job *job;
+        unsigned next; /* index of the next UNIT_BEFORE dependency to look at */
+} OrderFrame;
+
 static int transaction_verify_order(Transaction *tr, unsigned *generation, sd_bus_error *e) {
-        Job *j;
-        int r;
+        _cleanup_free_ OrderFrame *frames = NULL;
+        _cleanup_free_ Job **stack = NULL;
+        CycleBreak *breaks = NULL;
+        size_t n_frames = 0, n_frames_allocated = 0, n_stack = 0, n_stack_allocated = 0, n_breaks = 0, n_breaks_allocated = 0, k;
+        unsigned g, index = 0;
+        int r = 0, unfixable = 0;
         Iterator i;
-        unsigned g;
+        Job *j;
 
         assert(tr);
         assert(generation);
 
-        /* Check if the ordering graph is cyclic. If it is, try to fix
-         * that up by dropping one of the jobs. */
+        /* Check if the ordering graph is cyclic. If it is, try to fix that up by dropping one of the jobs of each
+         * cycle. This finds the strongly connected components of the graph with an iterative version of Tarjan's
+         * algorithm, hence acyclic transactions are verified in a single linear pass, regardless of the length of
+         * the ordering chains in them. Every component with more than one job contains a cycle. All components are
+         * checked before anything is dropped, so that a cycle we can't break fails the transaction without skipping
+         * any jobs first. */
 
         g = (*generation)++;
 
         HASHMAP_FOREACH(j, tr->jobs, i) {
-                r = transaction_verify_order_one(tr, j, NULL, g, e);
-                if (r < 0)
-                        return r;
+                Job *x = j;
+
+                if (j->generation == g)
+                        continue;
+
+                for (;;) {
+                        Job *o;
+
+                        if (x) {
+                                /* Visit x for the first time */
+                                x->generation = g;
+                                x->scc_index = x->scc_lowlink = index++;
+                                x->on_scc_stack = true;
+
+                                if (!GREEDY_REALLOC(stack, n_stack_allocated, n_stack + 1) ||
+                                    !GREEDY_REALLOC(frames, n_frames_allocated, n_frames + 1)) {
+                                        r = -ENOMEM;
+                                        goto finish;
+                                }
+
+                                stack[n_stack++] = x;
+                                frames[n_frames++] = (OrderFrame) { .job = x };
+                        }
+
+                        if (n_frames == 0)
+                                break;
+
+                        x = NULL;
+
+                        o = transaction_next_ordered_job(tr, frames[n_frames - 1].job, &frames[n_frames - 1].next);
+                        if (o) {
+                                if (o->generation != g)
+                                        x = o; /* Not visited yet, descend */
+                                else if (o->on_scc_stack)
+                                        frames[n_frames - 1].job->scc_lowlink = MIN(frames[n_frames - 1].job->scc_lowlink, o->scc_index);
+
+                                continue;
+                        }
+
+                        /* All jobs ordered after this one have been looked at, let's backtrack */
+                        o = frames[--n_frames].job;
+                        if (n_frames > 0)
+                                frames[n_frames - 1].job->scc_lowlink = MIN(frames[n_frames - 1].job->scc_lowlink, o->scc_lowlink);
+
+                        if (o->scc_lowlink == o->scc_index) {
+                                k = n_stack;
+
+                                /* o is the root of a strongly connected component, which consists of it and
+                                 * everything above it on the stack */
+                                do
+                                        k--;
+                                while (stack[k] != o);
+
+                                if (n_stack - k > 1) {
+                                        if (!GREEDY_REALLOC(breaks, n_breaks_allocated, n_breaks + 1)) {
+                                                r = -ENOMEM;
+                                                goto finish;
+                                        }
+
+                                        /* Only report the first cycle we can't break */
+                                        r = transaction_find_cycle(tr, stack + k, n_stack - k, breaks + n_breaks, unfixable < 0 ? NULL : e);
+                                        if (r == -ENOMEM)
+                                                goto finish;
+                                        if (r < 0)
+                                                unfixable = r;
+                                        else
+                                                n_breaks++;
+                                }
+
+                                for (; n_stack > k; n_stack--)
+                                        stack[n_stack - 1]->on_scc_stack = false;
+                        }
+                }
         }
 
-        return 0;
+        r = unfixable;
+        if (r < 0 || n_breaks == 0)
+                goto finish;
+
+        /* All cycles can be broken. Let's drop the jobs we picked, and ask our caller to garbage collect and check
+         * again. Log everything first, as dropping the jobs of one unit might free jobs referenced by another
+         * entry. */
+        for (k = 0; k < n_breaks; k++)
+                transaction_log_cycle_break(breaks + k);
+
+        for (k = 0; k < n_breaks; k++)
+                transaction_delete_unit(tr, breaks[k].unit);
+
+        r = -EAGAIN;
+
+finish:
+        cycle_break_free_many(breaks, n_breaks);
+        return r;
 }
 
-static void transaction_collect_garbage(Transaction *tr) {
+static int transaction_collect_garbage(Transaction *tr) {
+        _cleanup_set_free_ Set *pending = NULL;
         Iterator i;
+        Unit *u;
         Job *j;
+        int r;
 
         assert(tr);
 
-        /* Drop jobs that are not required by any other job */
+        /* Drop jobs that are not required by any other job. Deleting a job might leave the jobs it required and the
+         * next job of the same unit unreferenced, hence instead of rescanning the whole transaction after each
+         * deletion, we keep a set of the units that might have become garbage collectable. */
 
-rescan:
         HASHMAP_FOREACH(j, tr->jobs, i) {
-                if (tr->anchor_job == j || j->object_list) {
+                if (tr->anchor_job == j || j->object_list)
+                        continue;
+
+                r = set_ensure_allocated(&pending, NULL);
+                if (r < 0)
+                        return r;
+
+                r = set_put(pending, j->unit);
+                if (r < 0)
+                        return r;
+        }
+
+        while ((u = set_steal_first(pending))) {
+                JobDependency *l;
+
+                j = hashmap_get(tr->jobs, u);
+                if (!j || tr->anchor_job == j || j->object_list) {
                         /* log_debug("Keeping job %s/%s because of %s/%s", */
                         /*           j->unit->id, job_type_to_string(j->type), */
                         /*           j->object_list->subject ? j->object_list->subject->unit->id : "root", */
@@ -502,10 +683,23 @@ rescan:
                         continue;
                 }
 
+                LIST_FOREACH(subject, l, j->subject_list) {
+                        r = set_put(pending, l->object->unit);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (j->transaction_next) {
+                        r = set_put(pending, u);
+                        if (r < 0)
+                                return r;
+                }
+
                 /* log_debug("Garbage collecting job %s/%s", j->unit->id, job_type_to_string(j->type)); */
                 transaction_delete_job(tr, j, true);
-                goto rescan;
         }
+
+        return 0;
 }
 
 static int transaction_is_destructive(Transaction *tr, JobMode mode, sd_bus_error *e) {
@@ -532,18 +726,31 @@ static int transaction_is_destructive(Transaction *tr, JobMode mode, sd_bus_erro
         return 0;
 }
 
-static void transaction_minimize_impact(Transaction *tr) {
-        Job *j;
+static int transaction_minimize_impact(Transaction *tr) {
+        _cleanup_free_ Unit **units = NULL;
+        size_t n_units = 0, n_units_allocated = 0, k;
         Iterator i;
+        Job *j;
 
         assert(tr);
 
         /* Drops all unnecessary jobs that reverse already active jobs
-         * or that stop a running service. */
+         * or that stop a running service. Whether a job qualifies only
+         * depends on the job itself, but deleting it also deletes the
+         * jobs depending on it. Hence, first collect the units with such
+         * jobs, and then drop their jobs one by one, looking them up
+         * again each time. */
 
-rescan:
         HASHMAP_FOREACH(j, tr->jobs, i) {
-                LIST_FOREACH(transaction, j, j) {
+                if (!GREEDY_REALLOC(units, n_units_allocated, n_units + 1))
+                        return -ENOMEM;
+
+                units[n_units++] = j->unit;
+        }
+
+        for (k = 0; k < n_units; k++) {
+        rescan:
+                LIST_FOREACH(transaction, j, (Job*) hashmap_get(tr->jobs, units[k])) {
                         bool stops_running_service, changes_existing_job;
 
                         /* If it matters, we shouldn't drop it */
@@ -583,6 +790,8 @@ rescan:
                         goto rescan;
                 }
         }
+
+        return 0;
 }
 
 static int transaction_apply(Transaction *tr, Manager *m, JobMode mode) {
@@ -677,8 +886,11 @@ int transaction_activate(Transaction *tr, Manager *m, JobMode mode, sd_bus_error
         /* Second step: Try not to stop any running services if
          * we don't have to. Don't try to reverse running
          * jobs if we don't have to. */
-        if (mode == JOB_FAIL)
-                transaction_minimize_impact(tr);
+        if (mode == JOB_FAIL) {
+                r = transaction_minimize_impact(tr);
+                if (r < 0)
+                        return log_warning_errno(r, "Failed to minimize transaction impact: %m");
+        }
 
         /* Third step: Drop redundant jobs */
         transaction_drop_redundant(tr);
@@ -686,8 +898,11 @@ int transaction_activate(Transaction *tr, Manager *m, JobMode mode, sd_bus_error
         for (;;) {
                 /* Fourth step: Let's remove unneeded jobs that might
                  * be lurking. */
-                if (mode != JOB_ISOLATE)
-                        transaction_collect_garbage(tr);
+                if (mode != JOB_ISOLATE) {
+                        r = transaction_collect_garbage(tr);
+                        if (r < 0)
+                                return log_warning_errno(r, "Failed to garbage collect transaction: %m");
+                }
 
                 /* Fifth step: verify order makes sense and correct
                  * cycles if necessary and possible */
@@ -719,8 +934,11 @@ int transaction_activate(Transaction *tr, Manager *m, JobMode mode, sd_bus_error
 
                 /* Seventh step: an entry got dropped, let's garbage
                  * collect its dependencies. */
-                if (mode != JOB_ISOLATE)
-                        transaction_collect_garbage(tr);
+                if (mode != JOB_ISOLATE) {
+                        r = transaction_collect_garbage(tr);
+                        if (r < 0)
+                                return log_warning_errno(r, "Failed to garbage collect transaction: %m");
+                }
 
                 /* Let's see if the resulting transaction still has
                  * unmergeable entries ... */
@@ -842,16 +1060,14 @@ static void transaction_unlink_job(Transaction *tr, Job *j, bool delete_dependen
 }
 
 void transaction_add_propagate_reload_jobs(Transaction *tr, Unit *unit, Job *by, bool ignore_order, sd_bus_error *e) {
-        Iterator i;
         JobType nt;
         Unit *dep;
-        void *v;
         int r;
 
         assert(tr);
         assert(unit);
 
-        HASHMAP_FOREACH_KEY(v, dep, unit->dependencies[UNIT_PROPAGATES_RELOAD_TO], i) {
+        UNIT_FOREACH_DEPENDENCY(dep, unit, UNIT_PROPAGATES_RELOAD_TO) {
                 nt = job_type_collapse(JOB_TRY_RELOAD, dep);
                 if (nt == JOB_NOP)
                         continue;
@@ -881,7 +1097,6 @@ int transaction_add_job_and_dependencies(
         Iterator i;
         Unit *dep;
         Job *ret;
-        void *v;
         int r;
 
         assert(tr);
@@ -956,7 +1171,7 @@ int transaction_add_job_and_dependencies(
 
                 /* Finally, recursively add in all dependencies. */
                 if (IN_SET(type, JOB_START, JOB_RESTART)) {
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_REQUIRES], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_REQUIRES) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, true, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR) /* job type not applicable */
@@ -966,7 +1181,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_BINDS_TO], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_BINDS_TO) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, true, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR) /* job type not applicable */
@@ -976,7 +1191,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_WANTS], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_WANTS) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, false, false, false, ignore_order, e);
                                 if (r < 0) {
                                         /* unit masked, job type not applicable and unit not found are not considered as errors. */
@@ -988,7 +1203,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_REQUISITE], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_REQUISITE) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_VERIFY_ACTIVE, dep, ret, true, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR) /* job type not applicable */
@@ -998,7 +1213,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_CONFLICTS], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_CONFLICTS) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_STOP, dep, ret, true, true, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR) /* job type not applicable */
@@ -1008,7 +1223,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[UNIT_CONFLICTED_BY], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_CONFLICTED_BY) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_STOP, dep, ret, false, false, false, ignore_order, e);
                                 if (r < 0) {
                                         log_unit_warning(dep,
@@ -1037,7 +1252,7 @@ int transaction_add_job_and_dependencies(
                         ptype = type == JOB_RESTART ? JOB_TRY_RESTART : type;
 
                         for (j = 0; j < ELEMENTSOF(propagate_deps); j++)
-                                HASHMAP_FOREACH_KEY(v, dep, ret->unit->dependencies[propagate_deps[j]], i) {
+                                UNIT_FOREACH_DEPENDENCY(dep, ret->unit, propagate_deps[j]) {
                                         JobType nt;
 
                                         nt = job_type_collapse(ptype, dep);
@@ -0,0 +1,246 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc-util.h"
+#include "unit-dependency.h"
+#include "util.h"
+
+static unsigned table_capacity(const UnitDependencyTable *t, UnitDependency d) {
+        assert(t);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        if (d + 1 < _UNIT_DEPENDENCY_MAX)
+                return t->offset[d + 1] - t->offset[d];
+
+        return t->n_allocated - t->offset[d];
+}
+
+static unsigned table_n_sorted(const UnitDependencyTable *t, UnitDependency d) {
+        assert(t);
+
+        return t->n[d] - t->n_unsorted[d];
+}
+
+/* Returns the index (relative to the start of the group) of the first entry of the sorted prefix whose unit pointer is
+ * not lower than 'other', i.e. the position 'other' is stored at or would have to be inserted at. */
+static unsigned table_lower_bound(const UnitDependencyTable *t, UnitDependency d, const struct Unit *other) {
+        const UnitDependencyEntry *group;
+        unsigned lo = 0, hi;
+
+        assert(t);
+
+        group = t->entries + t->offset[d];
+        hi = table_n_sorted(t, d);
+
+        while (lo < hi) {
+                unsigned mid = lo + (hi - lo) / 2;
+
+                if ((uintptr_t) group[mid].other < (uintptr_t) other)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return lo;
+}
+
+static int entry_compare(const UnitDependencyEntry *a, const UnitDependencyEntry *b) {
+        if ((uintptr_t) a->other < (uintptr_t) b->other)
+                return -1;
+        if ((uintptr_t) a->other > (uintptr_t) b->other)
+                return 1;
+        return 0;
+}
+
+/* Sorts the unsorted tail of a group and merges it into the sorted prefix */
+static void table_merge_tail(UnitDependencyTable *t, UnitDependency d) {
+        UnitDependencyEntry tail[UNIT_DEPENDENCY_TAIL_MAX], *group;
+        unsigned i, j, k, n_tail;
+
+        assert(t);
+
+        n_tail = t->n_unsorted[d];
+        if (n_tail == 0)
+                return;
+
+        assert(n_tail <= UNIT_DEPENDENCY_TAIL_MAX);
+
+        group = t->entries + t->offset[d];
+        i = table_n_sorted(t, d);
+
+        memcpy(tail, group + i, n_tail * sizeof(UnitDependencyEntry));
+        typesafe_qsort(tail, n_tail, entry_compare);
+
+        /* Merge from the end, so that the prefix is only moved once, and never overwritten before it is read. The
+         * entries of the tail are not in the prefix, there are no duplicates. */
+        j = n_tail;
+        k = t->n[d];
+        while (j > 0) {
+                if (i > 0 && (uintptr_t) group[i - 1].other > (uintptr_t) tail[j - 1].other)
+                        group[--k] = group[--i];
+                else
+                        group[--k] = tail[--j];
+        }
+
+        t->n_unsorted[d] = 0;
+}
+
+UnitDependencyTable* unit_dependency_table_free(UnitDependencyTable *t) {
+        return mfree(t);
+}
+
+int unit_dependency_table_reserve(UnitDependencyTable **t, UnitDependency d, unsigned n_add) {
+        UnitDependencyTable *n;
+        unsigned cap, new_cap, delta;
+        size_t total;
+
+        assert(t);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        if (!*t) {
+                if (n_add == 0)
+                        return 0;
+
+                *t = new0(UnitDependencyTable, 1);
+                if (!*t)
+                        return -ENOMEM;
+        }
+
+        cap = table_capacity(*t, d);
+        if ((uint64_t) (*t)->n[d] + n_add <= cap)
+                return 0;
+
+        /* Grow the group geometrically, so that adding n dependencies of the same type one by one only results in
+         * O(log n) reallocations. The other groups keep their current size. */
+        new_cap = MAX((*t)->n[d] + n_add, cap * 2);
+        delta = new_cap - cap;
+
+        total = (size_t) (*t)->n_allocated + delta;
+        if (total > UINT32_MAX)
+                return -ENOMEM;
+
+        n = realloc(*t, offsetof(UnitDependencyTable, entries) + total * sizeof(UnitDependencyEntry));
+        if (!n)
+                return -ENOMEM;
+
+        /* Shift all groups following ours (including their unused slots) to the end, to make room */
+        if (d + 1 < _UNIT_DEPENDENCY_MAX) {
+                UnitDependency k;
+
+                memmove(n->entries + n->offset[d + 1] + delta,
+                        n->entries + n->offset[d + 1],
+                        (n->n_allocated - n->offset[d + 1]) * sizeof(UnitDependencyEntry));
+
+                for (k = d + 1; k < _UNIT_DEPENDENCY_MAX; k++)
+                        n->offset[k] += delta;
+        }
+
+        n->n_allocated = total;
+        *t = n;
+
+        return 0;
+}
+
+int unit_dependency_table_put(UnitDependencyTable **t, UnitDependency d, struct Unit *other, UnitDependencyInfo info) {
+        UnitDependencyEntry *e;
+        unsigned n;
+        bool sorted;
+        int r;
+
+        assert(t);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+        assert(other);
+
+        e = unit_dependency_table_find(*t, d, other);
+        if (e) {
+                e->info = info;
+                return 0;
+        }
+
+        r = unit_dependency_table_reserve(t, d, 1);
+        if (r < 0)
+                return r;
+
+        /* Entries added in ascending order, which is common, extend the sorted prefix. Anything else goes into the
+         * tail. */
+        n = (*t)->n[d];
+        sorted = (*t)->n_unsorted[d] == 0 &&
+                 (n == 0 || (uintptr_t) (*t)->entries[(*t)->offset[d] + n - 1].other < (uintptr_t) other);
+
+        (*t)->entries[(*t)->offset[d] + n] = (UnitDependencyEntry) {
+                .other = other,
+                .info = info,
+        };
+        (*t)->n[d]++;
+
+        if (!sorted) {
+                (*t)->n_unsorted[d]++;
+
+                /* Keep the tail shorter than the square root of the group, or 16 entries, whichever is larger */
+                if ((*t)->n_unsorted[d] >= UNIT_DEPENDENCY_TAIL_MAX ||
+                    ((*t)->n_unsorted[d] > 16 && (unsigned) (*t)->n_unsorted[d] * (*t)->n_unsorted[d] > (*t)->n[d]))
+                        table_merge_tail(*t, d);
+        }
+
+        return 1;
+}
+
+UnitDependencyEntry* unit_dependency_table_find(const UnitDependencyTable *t, UnitDependency d, const struct Unit *other) {
+        const UnitDependencyEntry *group;
+        unsigned idx;
+
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        if (!t || !other)
+                return NULL;
+
+        group = t->entries + t->offset[d];
+
+        idx = table_lower_bound(t, d, other);
+        if (idx < table_n_sorted(t, d) && group[idx].other == other)
+                return (UnitDependencyEntry*) group + idx;
+
+        for (idx = table_n_sorted(t, d); idx < t->n[d]; idx++)
+                if (group[idx].other == other)
+                        return (UnitDependencyEntry*) group + idx;
+
+        return NULL;
+}
+
+bool unit_dependency_table_remove(UnitDependencyTable *t, UnitDependency d, const struct Unit *other) {
+        UnitDependencyEntry *e, *end;
+
+        e = unit_dependency_table_find(t, d, other);
+        if (!e)
+                return false;
+
+        /* Both parts of the group move up by one, if the entry is in the tail, the tail gets shorter */
+        if (e >= t->entries + t->offset[d] + table_n_sorted(t, d))
+                t->n_unsorted[d]--;
+
+        end = t->entries + t->offset[d] + t->n[d];
+        memmove(e, e + 1, (end - e - 1) * sizeof(UnitDependencyEntry));
+        t->n[d]--;
+
+        return true;
+}
+
+void unit_dependency_table_clear(UnitDependencyTable *t, UnitDependency d) {
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        if (!t)
+                return;
+
+        t->n[d] = 0;
+        t->n_unsorted[d] = 0;
+}
+
+size_t unit_dependency_table_allocated(const UnitDependencyTable *t) {
+        if (!t)
+                return 0;
+
+        return offsetof(UnitDependencyTable, entries) + (size_t) t->n_allocated * sizeof(UnitDependencyEntry);
+}
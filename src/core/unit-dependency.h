@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "macro.h"
+#include "unit-def.h"
+
+struct Unit;
+
+/* Stores the 'reason' a dependency was created as a bit mask, i.e. due to which configuration source it came to be. We
+ * use this so that we can selectively flush out parts of dependencies again. Note that the same dependency might be
+ * created as a result of multiple "reasons", hence the bitmask. */
+typedef enum UnitDependencyMask {
+        /* Configured directly by the unit file, .wants/.requries symlink or drop-in, or as an immediate result of a
+         * non-dependency option configured that way.  */
+        UNIT_DEPENDENCY_FILE               = 1 << 0,
+
+        /* As unconditional implicit dependency (not affected by unit configuration — except by the unit name and
+         * type) */
+        UNIT_DEPENDENCY_IMPLICIT           = 1 << 1,
+
+        /* A dependency effected by DefaultDependencies=yes. Note that dependencies marked this way are conceptually
+         * just a subset of UNIT_DEPENDENCY_FILE, as DefaultDependencies= is itself a unit file setting that can only
+         * be set in unit files. We make this two separate bits only to help debugging how dependencies came to be. */
+        UNIT_DEPENDENCY_DEFAULT            = 1 << 2,
+
+        /* A dependency created from udev rules */
+        UNIT_DEPENDENCY_UDEV               = 1 << 3,
+
+        /* A dependency created because of some unit's RequiresMountsFor= setting */
+        UNIT_DEPENDENCY_PATH               = 1 << 4,
+
+        /* A dependency created because of data read from /proc/self/mountinfo and no other configuration source */
+        UNIT_DEPENDENCY_MOUNTINFO_IMPLICIT = 1 << 5,
+
+        /* A dependency created because of data read from /proc/self/mountinfo, but conditionalized by
+         * DefaultDependencies= and thus also involving configuration from UNIT_DEPENDENCY_FILE sources */
+        UNIT_DEPENDENCY_MOUNTINFO_DEFAULT  = 1 << 6,
+
+        /* A dependency created because of data read from /proc/swaps and no other configuration source */
+        UNIT_DEPENDENCY_PROC_SWAP          = 1 << 7,
+
+        _UNIT_DEPENDENCY_MASK_FULL         = (1 << 8) - 1,
+} UnitDependencyMask;
+
+/* Encodes why a dependency exists. It has the same size as a void pointer, and is also used as value in the
+ * requires_mounts_for hashmap, without any indirection. Note that this stores two masks, as both the origin and the
+ * destination of a dependency might have created it. */
+typedef union UnitDependencyInfo {
+        void *data;
+        struct {
+                UnitDependencyMask origin_mask:16;
+                UnitDependencyMask destination_mask:16;
+        } _packed_;
+} UnitDependencyInfo;
+
+typedef struct UnitDependencyEntry {
+        struct Unit *other;
+        UnitDependencyInfo info;
+} UnitDependencyEntry;
+
+/* All dependencies of a unit, in a single allocation. Entries are grouped by dependency type, in the order of the
+ * UnitDependency enum, so that iterating one dependency type walks a contiguous array. Each group consists of a prefix
+ * sorted by the pointer value of the other unit, which lookups binary search, followed by a short unsorted tail of
+ * recently added entries, which lookups scan. Once the tail gets longer than the square root of the group (but at most
+ * UNIT_DEPENDENCY_TAIL_MAX entries), it is sorted and merged into the prefix, hence adding dependencies in random order
+ * doesn't require moving the entries of the group around for every single one of them. Each group may have some unused slots at its end, so that adding a dependency never requires
+ * touching the entries of the other types, unless the group has to be enlarged. */
+#define UNIT_DEPENDENCY_TAIL_MAX 128U
+
+typedef struct UnitDependencyTable {
+        uint32_t offset[_UNIT_DEPENDENCY_MAX];    /* index of the first entry of each type */
+        uint32_t n[_UNIT_DEPENDENCY_MAX];         /* number of used entries of each type */
+        uint32_t n_allocated;                     /* number of entry slots, used or not */
+        uint8_t n_unsorted[_UNIT_DEPENDENCY_MAX]; /* number of entries in the unsorted tail of each type */
+        UnitDependencyEntry entries[];
+} UnitDependencyTable;
+
+UnitDependencyTable* unit_dependency_table_free(UnitDependencyTable *t);
+DEFINE_TRIVIAL_CLEANUP_FUNC(UnitDependencyTable*, unit_dependency_table_free);
+
+int unit_dependency_table_reserve(UnitDependencyTable **t, UnitDependency d, unsigned n_add);
+int unit_dependency_table_put(UnitDependencyTable **t, UnitDependency d, struct Unit *other, UnitDependencyInfo info);
+UnitDependencyEntry* unit_dependency_table_find(const UnitDependencyTable *t, UnitDependency d, const struct Unit *other);
+bool unit_dependency_table_remove(UnitDependencyTable *t, UnitDependency d, const struct Unit *other);
+void unit_dependency_table_clear(UnitDependencyTable *t, UnitDependency d);
+
+size_t unit_dependency_table_allocated(const UnitDependencyTable *t);
+
+static inline unsigned unit_dependency_table_size(const UnitDependencyTable *t, UnitDependency d) {
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        return t ? t->n[d] : 0;
+}
+
+static inline UnitDependencyEntry* unit_dependency_table_nth(const UnitDependencyTable *t, UnitDependency d, unsigned n) {
+        if (n >= unit_dependency_table_size(t, d))
+                return NULL;
+
+        return (UnitDependencyEntry*) t->entries + t->offset[d] + n;
+}
+
+static inline struct Unit* unit_dependency_table_nth_unit(const UnitDependencyTable *t, UnitDependency d, unsigned n) {
+        UnitDependencyEntry *e;
+
+        e = unit_dependency_table_nth(t, d, n);
+        return e ? e->other : NULL;
+}
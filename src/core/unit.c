@@ -438,25 +438,23 @@ void unit_add_to_dbus_queue(Unit *u) {
         u->in_dbus_queue = true;
 }
 
-static void bidi_set_free(Unit *u, Hashmap *h) {
+static void bidi_set_free(Unit *u, UnitDependency d) {
         Unit *other;
-        Iterator i;
-        void *v;
 
         assert(u);
 
-        /* Frees the hashmap and makes sure we are dropped from the inverse pointers */
+        /* Drops all dependencies of the specified type and makes sure we are dropped from the inverse pointers */
 
-        HASHMAP_FOREACH_KEY(v, other, h, i) {
-                UnitDependency d;
+        UNIT_FOREACH_DEPENDENCY(other, u, d) {
+                UnitDependency k;
 
-                for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                        hashmap_remove(other->dependencies[d], u);
+                for (k = 0; k < _UNIT_DEPENDENCY_MAX; k++)
+                        (void) unit_dependency_table_remove(other->dependencies, k, u);
 
                 unit_add_to_gc_queue(other);
         }
 
-        hashmap_free(h);
+        unit_dependency_table_clear(u->dependencies, d);
 }
 
 static void unit_remove_transient(Unit *u) {
@@ -589,7 +587,8 @@ void unit_free(Unit *u) {
         }
 
         for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                bidi_set_free(u, u->dependencies[d]);
+                bidi_set_free(u, d);
+        u->dependencies = unit_dependency_table_free(u->dependencies);
 
         if (u->on_console)
                 manager_unref_console(u->manager);
@@ -628,6 +627,9 @@ void unit_free(Unit *u) {
         if (u->in_cgroup_empty_queue)
                 LIST_REMOVE(cgroup_empty_queue, u->manager->cgroup_empty_queue, u);
 
+        if (u->in_accounting_cache_queue)
+                LIST_REMOVE(accounting_cache_queue, u->manager->accounting_cache_queue, u);
+
         if (u->in_cleanup_queue)
                 LIST_REMOVE(cleanup_queue, u->manager->cleanup_queue, u);
 
@@ -744,24 +746,15 @@ static int reserve_dependencies(Unit *u, Unit *other, UnitDependency d) {
         assert(other);
         assert(d < _UNIT_DEPENDENCY_MAX);
 
-        /*
-         * If u does not have this dependency set allocated, there is no need
-         * to reserve anything. In that case other's set will be transferred
-         * as a whole to u by complete_move().
-         */
-        if (!u->dependencies[d])
-                return 0;
-
         /* merge_dependencies() will skip a u-on-u dependency */
-        n_reserve = hashmap_size(other->dependencies[d]) - !!hashmap_get(other->dependencies[d], u);
+        n_reserve = unit_dependency_count(other, d) - unit_has_dependency(other, d, u);
 
-        return hashmap_reserve(u->dependencies[d], n_reserve);
+        return unit_dependency_table_reserve(&u->dependencies, d, n_reserve);
 }
 
 static void merge_dependencies(Unit *u, Unit *other, const char *other_id, UnitDependency d) {
-        Iterator i;
+        UnitDependencyEntry *e;
         Unit *back;
-        void *v;
         int r;
 
         /* Merges all dependencies of type 'd' of the unit 'other' into the deps of the unit 'u' */
@@ -771,7 +764,7 @@ static void merge_dependencies(Unit *u, Unit *other, const char *other_id, UnitD
         assert(d < _UNIT_DEPENDENCY_MAX);
 
         /* Fix backwards pointers. Let's iterate through all dependendent units of the other unit. */
-        HASHMAP_FOREACH_KEY(v, back, other->dependencies[d], i) {
+        UNIT_FOREACH_DEPENDENCY(back, other, d) {
                 UnitDependency k;
 
                 /* Let's now iterate through the dependencies of that dependencies of the other units, looking for
@@ -780,46 +773,60 @@ static void merge_dependencies(Unit *u, Unit *other, const char *other_id, UnitD
                 for (k = 0; k < _UNIT_DEPENDENCY_MAX; k++) {
                         if (back == u) {
                                 /* Do not add dependencies between u and itself. */
-                                if (hashmap_remove(back->dependencies[k], other))
+                                if (unit_dependency_table_remove(back->dependencies, k, other))
                                         maybe_warn_about_dependency(u, other_id, k);
                         } else {
-                                UnitDependencyInfo di_u, di_other, di_merged;
+                                UnitDependencyInfo di_u = {}, di_other, di_merged;
 
                                 /* Let's drop this dependency between "back" and "other", and let's create it between
                                  * "back" and "u" instead. Let's merge the bit masks of the dependency we are moving,
                                  * and any such dependency which might already exist */
 
-                                di_other.data = hashmap_get(back->dependencies[k], other);
-                                if (!di_other.data)
+                                e = unit_dependency_table_find(back->dependencies, k, other);
+                                if (!e)
                                         continue; /* dependency isn't set, let's try the next one */
+                                di_other = e->info;
 
-                                di_u.data = hashmap_get(back->dependencies[k], u);
+                                e = unit_dependency_table_find(back->dependencies, k, u);
+                                if (e)
+                                        di_u = e->info;
 
                                 di_merged = (UnitDependencyInfo) {
                                         .origin_mask = di_u.origin_mask | di_other.origin_mask,
                                         .destination_mask = di_u.destination_mask | di_other.destination_mask,
                                 };
 
-                                r = hashmap_remove_and_replace(back->dependencies[k], other, u, di_merged.data);
+                                /* Removing the old entry first frees up the slot the new one needs, hence this cannot
+                                 * fail. */
+                                assert_se(unit_dependency_table_remove(back->dependencies, k, other));
+                                r = unit_dependency_table_put(&back->dependencies, k, u, di_merged);
                                 if (r < 0)
                                         log_warning_errno(r, "Failed to remove/replace: back=%s other=%s u=%s: %m", back->id, other_id, u->id);
                                 assert(r >= 0);
-
-                                /* assert_se(hashmap_remove_and_replace(back->dependencies[k], other, u, di_merged.data) >= 0); */
                         }
                 }
 
         }
 
         /* Also do not move dependencies on u to itself */
-        back = hashmap_remove(other->dependencies[d], u);
-        if (back)
+        if (unit_dependency_table_remove(other->dependencies, d, u))
                 maybe_warn_about_dependency(u, other_id, d);
 
         /* The move cannot fail. The caller must have performed a reservation. */
-        assert_se(hashmap_complete_move(&u->dependencies[d], &other->dependencies[d]) == 0);
+        UNIT_FOREACH_DEPENDENCY_ENTRY(e, other, d) {
+                UnitDependencyInfo di = e->info;
+                UnitDependencyEntry *f;
+
+                f = unit_dependency_table_find(u->dependencies, d, e->other);
+                if (f) {
+                        di.origin_mask |= f->info.origin_mask;
+                        di.destination_mask |= f->info.destination_mask;
+                }
+
+                assert_se(unit_dependency_table_put(&u->dependencies, d, e->other, di) >= 0);
+        }
 
-        other->dependencies[d] = hashmap_free(other->dependencies[d]);
+        unit_dependency_table_clear(other->dependencies, d);
 }
 
 int unit_merge(Unit *u, Unit *other) {
@@ -1214,16 +1221,15 @@ void unit_dump(Unit *u, FILE *f, const char *prefix) {
                         prefix, yes_no(u->assert_result));
 
         for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
-                UnitDependencyInfo di;
-                Unit *other;
+                UnitDependencyEntry *e;
 
-                HASHMAP_FOREACH_KEY(di.data, other, u->dependencies[d], i) {
+                UNIT_FOREACH_DEPENDENCY_ENTRY(e, u, d) {
                         bool space = false;
 
-                        fprintf(f, "%s\t%s: %s (", prefix, unit_dependency_to_string(d), other->id);
+                        fprintf(f, "%s\t%s: %s (", prefix, unit_dependency_to_string(d), e->other->id);
 
-                        print_unit_dependency_mask(f, "origin", di.origin_mask, &space);
-                        print_unit_dependency_mask(f, "destination", di.destination_mask, &space);
+                        print_unit_dependency_mask(f, "origin", e->info.origin_mask, &space);
+                        print_unit_dependency_mask(f, "destination", e->info.destination_mask, &space);
 
                         fputs(")\n", f);
                 }
@@ -1355,7 +1361,7 @@ int unit_add_default_target_dependency(Unit *u, Unit *target) {
                 return 0;
 
         /* Don't create loops */
-        if (hashmap_get(target->dependencies[UNIT_BEFORE], u))
+        if (unit_has_dependency(target, UNIT_BEFORE, u))
                 return 0;
 
         return unit_add_dependency(target, UNIT_AFTER, u, true, UNIT_DEPENDENCY_DEFAULT);
@@ -1503,7 +1509,7 @@ int unit_load(Unit *u) {
                 if (r < 0)
                         goto fail;
 
-                if (u->on_failure_job_mode == JOB_ISOLATE && hashmap_size(u->dependencies[UNIT_ON_FAILURE]) > 1) {
+                if (u->on_failure_job_mode == JOB_ISOLATE && unit_dependency_count(u, UNIT_ON_FAILURE) > 1) {
                         log_unit_error(u, "More than one OnFailure= dependencies specified but OnFailureJobMode=isolate set. Refusing.");
                         r = -ENOEXEC;
                         goto fail;
@@ -1720,8 +1726,6 @@ bool unit_shall_confirm_spawn(Unit *u) {
 
 static bool unit_verify_deps(Unit *u) {
         Unit *other;
-        Iterator j;
-        void *v;
 
         assert(u);
 
@@ -1730,9 +1734,9 @@ static bool unit_verify_deps(Unit *u) {
          * processing, but do not have any effect afterwards. We don't check BindsTo= dependencies that are not used in
          * conjunction with After= as for them any such check would make things entirely racy. */
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BINDS_TO], j) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO) {
 
-                if (!hashmap_contains(u->dependencies[UNIT_AFTER], other))
+                if (!unit_has_dependency(u, UNIT_AFTER, other))
                         continue;
 
                 if (!UNIT_IS_ACTIVE_OR_RELOADING(unit_active_state(other))) {
@@ -1944,7 +1948,7 @@ bool unit_can_reload(Unit *u) {
         if (UNIT_VTABLE(u)->can_reload)
                 return UNIT_VTABLE(u)->can_reload(u);
 
-        if (!hashmap_isempty(u->dependencies[UNIT_PROPAGATES_RELOAD_TO]))
+        if (unit_dependency_count(u, UNIT_PROPAGATES_RELOAD_TO) > 0)
                 return true;
 
         return UNIT_VTABLE(u)->reload;
@@ -1977,10 +1981,8 @@ static void unit_check_unneeded(Unit *u) {
 
         for (j = 0; j < ELEMENTSOF(needed_dependencies); j++) {
                 Unit *other;
-                Iterator i;
-                void *v;
 
-                HASHMAP_FOREACH_KEY(v, other, u->dependencies[needed_dependencies[j]], i)
+                UNIT_FOREACH_DEPENDENCY(other, u, needed_dependencies[j])
                         if (unit_active_or_pending(other) || unit_will_restart(other))
                                 return;
         }
@@ -2005,8 +2007,6 @@ static void unit_check_binds_to(Unit *u) {
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
         bool stop = false;
         Unit *other;
-        Iterator i;
-        void *v;
         int r;
 
         assert(u);
@@ -2017,7 +2017,7 @@ static void unit_check_binds_to(Unit *u) {
         if (unit_active_state(u) != UNIT_ACTIVE)
                 return;
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BINDS_TO], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO) {
                 if (other->job)
                         continue;
 
@@ -2053,88 +2053,80 @@ static void unit_check_binds_to(Unit *u) {
 }
 
 static void retroactively_start_dependencies(Unit *u) {
-        Iterator i;
         Unit *other;
-        void *v;
 
         assert(u);
         assert(UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(u)));
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_REQUIRES], i)
-                if (!hashmap_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, NULL, NULL);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BINDS_TO], i)
-                if (!hashmap_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, NULL, NULL);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_WANTS], i)
-                if (!hashmap_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_FAIL, NULL, NULL);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_CONFLICTS], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTS)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, NULL, NULL);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_CONFLICTED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTED_BY)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, NULL, NULL);
 }
 
 static void retroactively_stop_dependencies(Unit *u) {
         Unit *other;
-        Iterator i;
-        void *v;
 
         assert(u);
         assert(UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(u)));
 
         /* Pull down units which are bound to us recursively if enabled */
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BOUND_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BOUND_BY)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, NULL, NULL);
 }
 
 static void check_unneeded_dependencies(Unit *u) {
         Unit *other;
-        Iterator i;
-        void *v;
 
         assert(u);
         assert(UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(u)));
 
         /* Garbage collect services that might not be needed anymore, if enabled */
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_REQUIRES], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_WANTS], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_REQUISITE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUISITE)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_BINDS_TO], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
 }
 
 void unit_start_on_failure(Unit *u) {
         Unit *other;
-        Iterator i;
-        void *v;
         int r;
 
         assert(u);
 
-        if (hashmap_size(u->dependencies[UNIT_ON_FAILURE]) <= 0)
+        if (unit_dependency_count(u, UNIT_ON_FAILURE) <= 0)
                 return;
 
         log_unit_info(u, "Triggering OnFailure= dependencies.");
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_ON_FAILURE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_ON_FAILURE) {
                 _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
 
                 r = manager_add_job(u->manager, JOB_START, other, u->on_failure_job_mode, &error, NULL);
@@ -2145,12 +2137,10 @@ void unit_start_on_failure(Unit *u) {
 
 void unit_trigger_notify(Unit *u) {
         Unit *other;
-        Iterator i;
-        void *v;
 
         assert(u);
 
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_TRIGGERED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_TRIGGERED_BY)
                 if (UNIT_VTABLE(other)->trigger_notify)
                         UNIT_VTABLE(other)->trigger_notify(other, u);
 }
@@ -2177,6 +2167,8 @@ static int unit_log_resources(Unit *u) {
          * accounting was enabled for a unit. It does this in two ways: a friendly human readable string with reduced
          * information and the complete data in structured fields. */
 
+        unit_flush_accounting_cache(u);
+
         (void) unit_get_cpu_usage(u, &nsec);
         if (nsec != NSEC_INFINITY) {
                 char buf[FORMAT_TIMESPAN_MAX] = "";
@@ -2745,47 +2737,43 @@ static void maybe_warn_about_dependency(Unit *u, const char *other, UnitDependen
                 log_unit_warning(u, "Dependency %s=%s dropped, merged into %s", unit_dependency_to_string(dependency), strna(other), u->id);
 }
 
-static int unit_add_dependency_hashmap(
-                Hashmap **h,
+static int unit_add_dependency_table(
+                UnitDependencyTable **t,
+                UnitDependency d,
                 Unit *other,
                 UnitDependencyMask origin_mask,
                 UnitDependencyMask destination_mask) {
 
+        UnitDependencyEntry *e;
         UnitDependencyInfo info;
         int r;
 
-        assert(h);
+        assert(t);
         assert(other);
         assert(origin_mask < _UNIT_DEPENDENCY_MASK_FULL);
         assert(destination_mask < _UNIT_DEPENDENCY_MASK_FULL);
         assert(origin_mask > 0 || destination_mask > 0);
 
-        r = hashmap_ensure_allocated(h, NULL);
-        if (r < 0)
-                return r;
-
-        assert_cc(sizeof(void*) == sizeof(info));
-
-        info.data = hashmap_get(*h, other);
-        if (info.data) {
+        e = unit_dependency_table_find(*t, d, other);
+        if (e) {
                 /* Entry already exists. Add in our mask. */
 
-                if (FLAGS_SET(origin_mask, info.origin_mask) &&
-                    FLAGS_SET(destination_mask, info.destination_mask))
+                if (FLAGS_SET(origin_mask, e->info.origin_mask) &&
+                    FLAGS_SET(destination_mask, e->info.destination_mask))
                         return 0; /* NOP */
 
-                info.origin_mask |= origin_mask;
-                info.destination_mask |= destination_mask;
-
-                r = hashmap_update(*h, other, info.data);
-        } else {
-                info = (UnitDependencyInfo) {
-                        .origin_mask = origin_mask,
-                        .destination_mask = destination_mask,
-                };
+                e->info.origin_mask |= origin_mask;
+                e->info.destination_mask |= destination_mask;
 
-                r = hashmap_put(*h, other, info.data);
+                return 1;
         }
+
+        info = (UnitDependencyInfo) {
+                .origin_mask = origin_mask,
+                .destination_mask = destination_mask,
+        };
+
+        r = unit_dependency_table_put(t, d, other, info);
         if (r < 0)
                 return r;
 
@@ -2846,22 +2834,22 @@ int unit_add_dependency(
                 return 0;
         }
 
-        r = unit_add_dependency_hashmap(u->dependencies + d, other, mask, 0);
+        r = unit_add_dependency_table(&u->dependencies, d, other, mask, 0);
         if (r < 0)
                 return r;
 
         if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID && inverse_table[d] != d) {
-                r = unit_add_dependency_hashmap(other->dependencies + inverse_table[d], u, 0, mask);
+                r = unit_add_dependency_table(&other->dependencies, inverse_table[d], u, 0, mask);
                 if (r < 0)
                         return r;
         }
 
         if (add_reference) {
-                r = unit_add_dependency_hashmap(u->dependencies + UNIT_REFERENCES, other, mask, 0);
+                r = unit_add_dependency_table(&u->dependencies, UNIT_REFERENCES, other, mask, 0);
                 if (r < 0)
                         return r;
 
-                r = unit_add_dependency_hashmap(other->dependencies + UNIT_REFERENCED_BY, u, 0, mask);
+                r = unit_add_dependency_table(&other->dependencies, UNIT_REFERENCED_BY, u, 0, mask);
                 if (r < 0)
                         return r;
         }
@@ -3206,6 +3194,8 @@ static const char *ip_accounting_metric_field[_CGROUP_IP_ACCOUNTING_METRIC_MAX]
 
 int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
         CGroupIPAccountingMetric m;
+        Iterator i;
+        char *k, *v;
         int r;
 
         assert(u);
@@ -3251,6 +3241,16 @@ int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
         (void) unit_serialize_cgroup_mask(f, "cgroup-enabled-mask", u->cgroup_enabled_mask);
         unit_serialize_item_format(u, f, "cgroup-bpf-realized", "%i", u->cgroup_bpf_state);
 
+        HASHMAP_FOREACH_KEY(v, k, u->cgroup_attributes, i) {
+                _cleanup_free_ char *c = NULL;
+
+                c = strjoin(k, " ", v);
+                if (!c)
+                        return log_oom();
+
+                (void) unit_serialize_item_escaped(u, f, "cgroup-attribute", c);
+        }
+
         if (uid_is_valid(u->ref_uid))
                 unit_serialize_item_format(u, f, "ref-uid", UID_FMT, u->ref_uid);
         if (gid_is_valid(u->ref_gid))
@@ -3261,6 +3261,9 @@ int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
 
         bus_track_serialize(u->bus_track, f, "ref");
 
+        /* Make sure we serialize the current counters, not sampled ones */
+        unit_flush_accounting_cache(u);
+
         for (m = 0; m < _CGROUP_IP_ACCOUNTING_METRIC_MAX; m++) {
                 uint64_t v;
 
@@ -3554,6 +3557,29 @@ int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
                                 log_unit_debug(u, "Failed to parse cgroup-enabled-mask %s, ignoring.", v);
                         continue;
 
+                } else if (streq(l, "cgroup-attribute")) {
+                        _cleanup_free_ char *c = NULL;
+                        char *value;
+
+                        r = cunescape(v, 0, &c);
+                        if (r < 0) {
+                                log_unit_debug_errno(u, r, "Failed to unescape cgroup attribute %s, ignoring: %m", v);
+                                continue;
+                        }
+
+                        value = strchr(c, ' ');
+                        if (!value) {
+                                log_unit_debug(u, "Failed to parse cgroup attribute %s, ignoring.", c);
+                                continue;
+                        }
+                        *(value++) = 0;
+
+                        r = unit_remember_cgroup_attribute(u, c, value);
+                        if (r < 0)
+                                log_unit_debug_errno(u, r, "Failed to remember cgroup attribute %s, ignoring: %m", c);
+
+                        continue;
+
                 } else if (streq(l, "cgroup-bpf-realized")) {
                         int i;
 
@@ -4689,8 +4715,6 @@ int unit_setup_exec_runtime(Unit *u) {
         ExecRuntime **rt;
         size_t offset;
         Unit *other;
-        Iterator i;
-        void *v;
         int r;
 
         offset = UNIT_VTABLE(u)->exec_runtime_offset;
@@ -4702,7 +4726,7 @@ int unit_setup_exec_runtime(Unit *u) {
                 return 0;
 
         /* Try to get it from somebody else */
-        HASHMAP_FOREACH_KEY(v, other, u->dependencies[UNIT_JOINS_NAMESPACE_OF], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_JOINS_NAMESPACE_OF) {
                 r = exec_runtime_acquire(u->manager, NULL, other->id, false, rt);
                 if (r == 1)
                         return 1;
@@ -5070,19 +5094,23 @@ int unit_fork_helper_process(Unit *u, const char *name, pid_t *ret) {
         return 0;
 }
 
-static void unit_update_dependency_mask(Unit *u, UnitDependency d, Unit *other, UnitDependencyInfo di) {
+static void unit_update_dependency_mask(Unit *u, UnitDependency d, UnitDependencyEntry *e, UnitDependencyInfo di) {
+        Unit *other;
+
         assert(u);
         assert(d >= 0);
         assert(d < _UNIT_DEPENDENCY_MAX);
-        assert(other);
+        assert(e);
+
+        other = e->other;
 
         if (di.origin_mask == 0 && di.destination_mask == 0) {
                 /* No bit set anymore, let's drop the whole entry */
-                assert_se(hashmap_remove(u->dependencies[d], other));
+                assert_se(unit_dependency_table_remove(u->dependencies, d, other));
                 log_unit_debug(u, "%s lost dependency %s=%s", u->id, unit_dependency_to_string(d), other->id);
         } else
                 /* Mask was reduced, let's update the entry */
-                assert_se(hashmap_update(u->dependencies[d], other, di.data) == 0);
+                e->info = di;
 }
 
 void unit_remove_dependencies(Unit *u, UnitDependencyMask mask) {
@@ -5099,19 +5127,19 @@ void unit_remove_dependencies(Unit *u, UnitDependencyMask mask) {
                 bool done;
 
                 do {
-                        UnitDependencyInfo di;
-                        Unit *other;
-                        Iterator i;
+                        UnitDependencyEntry *e;
 
                         done = true;
 
-                        HASHMAP_FOREACH_KEY(di.data, other, u->dependencies[d], i) {
+                        UNIT_FOREACH_DEPENDENCY_ENTRY(e, u, d) {
+                                UnitDependencyInfo di = e->info;
+                                Unit *other = e->other;
                                 UnitDependency q;
 
                                 if ((di.origin_mask & ~mask) == di.origin_mask)
                                         continue;
                                 di.origin_mask &= ~mask;
-                                unit_update_dependency_mask(u, d, other, di);
+                                unit_update_dependency_mask(u, d, e, di);
 
                                 /* We updated the dependency from our unit to the other unit now. But most dependencies
                                  * imply a reverse dependency. Hence, let's delete that one too. For that we go through
@@ -5119,14 +5147,19 @@ void unit_remove_dependencies(Unit *u, UnitDependencyMask mask) {
                                  * have the right mask set. */
 
                                 for (q = 0; q < _UNIT_DEPENDENCY_MAX; q++) {
+                                        UnitDependencyEntry *f;
                                         UnitDependencyInfo dj;
 
-                                        dj.data = hashmap_get(other->dependencies[q], u);
+                                        f = unit_dependency_table_find(other->dependencies, q, u);
+                                        if (!f)
+                                                continue;
+
+                                        dj = f->info;
                                         if ((dj.destination_mask & ~mask) == dj.destination_mask)
                                                 continue;
                                         dj.destination_mask &= ~mask;
 
-                                        unit_update_dependency_mask(other, q, u, dj);
+                                        unit_update_dependency_mask(other, q, f, dj);
                                 }
 
                                 unit_add_to_gc_queue(other);
@@ -10,6 +10,7 @@
 #include "emergency-action.h"
 #include "install.h"
 #include "list.h"
+#include "unit-dependency.h"
 #include "unit-name.h"
 #include "cgroup.h"
 
@@ -47,53 +48,6 @@ static inline bool UNIT_IS_INACTIVE_OR_FAILED(UnitActiveState t) {
         return IN_SET(t, UNIT_INACTIVE, UNIT_FAILED);
 }
 
-/* Stores the 'reason' a dependency was created as a bit mask, i.e. due to which configuration source it came to be. We
- * use this so that we can selectively flush out parts of dependencies again. Note that the same dependency might be
- * created as a result of multiple "reasons", hence the bitmask. */
-typedef enum UnitDependencyMask {
-        /* Configured directly by the unit file, .wants/.requries symlink or drop-in, or as an immediate result of a
-         * non-dependency option configured that way.  */
-        UNIT_DEPENDENCY_FILE               = 1 << 0,
-
-        /* As unconditional implicit dependency (not affected by unit configuration — except by the unit name and
-         * type) */
-        UNIT_DEPENDENCY_IMPLICIT           = 1 << 1,
-
-        /* A dependency effected by DefaultDependencies=yes. Note that dependencies marked this way are conceptually
-         * just a subset of UNIT_DEPENDENCY_FILE, as DefaultDependencies= is itself a unit file setting that can only
-         * be set in unit files. We make this two separate bits only to help debugging how dependencies came to be. */
-        UNIT_DEPENDENCY_DEFAULT            = 1 << 2,
-
-        /* A dependency created from udev rules */
-        UNIT_DEPENDENCY_UDEV               = 1 << 3,
-
-        /* A dependency created because of some unit's RequiresMountsFor= setting */
-        UNIT_DEPENDENCY_PATH               = 1 << 4,
-
-        /* A dependency created because of data read from /proc/self/mountinfo and no other configuration source */
-        UNIT_DEPENDENCY_MOUNTINFO_IMPLICIT = 1 << 5,
-
-        /* A dependency created because of data read from /proc/self/mountinfo, but conditionalized by
-         * DefaultDependencies= and thus also involving configuration from UNIT_DEPENDENCY_FILE sources */
-        UNIT_DEPENDENCY_MOUNTINFO_DEFAULT  = 1 << 6,
-
-        /* A dependency created because of data read from /proc/swaps and no other configuration source */
-        UNIT_DEPENDENCY_PROC_SWAP          = 1 << 7,
-
-        _UNIT_DEPENDENCY_MASK_FULL         = (1 << 8) - 1,
-} UnitDependencyMask;
-
-/* The Unit's dependencies[] hashmaps use this structure as value. It has the same size as a void pointer, and thus can
- * be stored directly as hashmap value, without any indirection. Note that this stores two masks, as both the origin
- * and the destination of a dependency might have created it. */
-typedef union UnitDependencyInfo {
-        void *data;
-        struct {
-                UnitDependencyMask origin_mask:16;
-                UnitDependencyMask destination_mask:16;
-        } _packed_;
-} UnitDependencyInfo;
-
 #include "job.h"
 
 struct UnitRef {
@@ -123,9 +77,9 @@ typedef struct Unit {
 
         Set *names;
 
-        /* For each dependency type we maintain a Hashmap whose key is the Unit* object, and the value encodes why the
-         * dependency exists, using the UnitDependencyInfo type */
-        Hashmap *dependencies[_UNIT_DEPENDENCY_MAX];
+        /* For each dependency type the other Unit* objects, together with a UnitDependencyInfo encoding why the
+         * dependency exists. Use the unit_*_dependency() helpers and UNIT_FOREACH_DEPENDENCY() to access this. */
+        UnitDependencyTable *dependencies;
 
         /* Similar, for RequiresMountsFor= path dependencies. The key is the path, the value the UnitDependencyInfo type */
         Hashmap *requires_mounts_for;
@@ -209,6 +163,9 @@ typedef struct Unit {
         /* cgroup empty queue */
         LIST_FIELDS(Unit, cgroup_empty_queue);
 
+        /* Units whose accounting values are sampled by the accounting cache */
+        LIST_FIELDS(Unit, accounting_cache_queue);
+
         /* Target dependencies queue */
         LIST_FIELDS(Unit, target_deps_queue);
 
@@ -259,6 +216,14 @@ typedef struct Unit {
         CGroupMask cgroup_members_mask;
         int cgroup_inotify_wd;
 
+        /* The values we last wrote to the cgroup attributes, so that we can skip rewriting unchanged ones */
+        Hashmap *cgroup_attributes;
+
+        /* Accounting values sampled by the accounting cache, indexed by CGroupAccountingMetric. Only the ones whose
+         * bit is set in accounting_cache_valid are. */
+        uint64_t accounting_cache[_CGROUP_ACCOUNTING_METRIC_MAX];
+        unsigned accounting_cache_valid;
+
         /* IP BPF Firewalling/accounting */
         int ip_accounting_ingress_map_fd;
         int ip_accounting_egress_map_fd;
@@ -322,6 +287,13 @@ typedef struct Unit {
         bool in_cgroup_realize_queue:1;
         bool in_cgroup_empty_queue:1;
         bool in_target_deps_queue:1;
+        bool in_accounting_cache_queue:1;
+
+        /* Whether the unit got a cgroup inotify event in the batch currently being processed */
+        bool cgroup_inotify_pending:1;
+
+        /* Whether the cached accounting values have been queried since they were last refreshed */
+        bool accounting_cache_used:1;
 
         bool sent_dbus_new_signal:1;
 
@@ -586,7 +558,28 @@ extern const UnitVTable * const unit_vtable[_UNIT_TYPE_MAX];
 #define UNIT_HAS_CGROUP_CONTEXT(u) (UNIT_VTABLE(u)->cgroup_context_offset > 0)
 #define UNIT_HAS_KILL_CONTEXT(u) (UNIT_VTABLE(u)->kill_context_offset > 0)
 
-#define UNIT_TRIGGER(u) ((Unit*) hashmap_first_key((u)->dependencies[UNIT_TRIGGERS]))
+#define UNIT_TRIGGER(u) ((Unit*) unit_dependency_table_nth_unit((u)->dependencies, UNIT_TRIGGERS, 0))
+
+/* Iterates through all units 'u' has a dependency of type 'd' on. Dependencies may be removed from 'u' while
+ * iterating, but only if the loop is left immediately afterwards. */
+#define _UNIT_FOREACH_DEPENDENCY(other, u, d, i)                        \
+        for (unsigned i = 0; ((other) = unit_dependency_table_nth_unit((u)->dependencies, (d), i)); i++)
+#define UNIT_FOREACH_DEPENDENCY(other, u, d)                            \
+        _UNIT_FOREACH_DEPENDENCY(other, u, d, UNIQ_T(i, UNIQ))
+
+/* Same, but also returns the UnitDependencyEntry, in order to access the UnitDependencyInfo */
+#define _UNIT_FOREACH_DEPENDENCY_ENTRY(e, u, d, i)                      \
+        for (unsigned i = 0; ((e) = unit_dependency_table_nth((u)->dependencies, (d), i)); i++)
+#define UNIT_FOREACH_DEPENDENCY_ENTRY(e, u, d)                          \
+        _UNIT_FOREACH_DEPENDENCY_ENTRY(e, u, d, UNIQ_T(i, UNIQ))
+
+static inline bool unit_has_dependency(const Unit *u, UnitDependency d, const Unit *other) {
+        return !!unit_dependency_table_find(u->dependencies, d, other);
+}
+
+static inline unsigned unit_dependency_count(const Unit *u, UnitDependency d) {
+        return unit_dependency_table_size(u->dependencies, d);
+}
 
 Unit *unit_new(Manager *m, size_t size);
 void unit_free(Unit *u);
@@ -291,8 +291,41 @@ struct trie_f {
         uint64_t nodes_count;
         uint64_t children_count;
         uint64_t values_count;
+
+        /* the match string leading to the node which is being written, and the literal keys found so far */
+        char *path;
+        size_t path_len, path_allocated;
+        HwdbIndexEntry *index;
+        size_t index_count, index_allocated;
 };
 
+static void trie_f_done(struct trie_f *trie) {
+        free(trie->path);
+        hwdb_index_entries_free(trie->index, trie->index_count);
+}
+
+static int trie_path_push(struct trie_f *trie, const char *s, size_t len) {
+        if (!GREEDY_REALLOC(trie->path, trie->path_allocated, trie->path_len + len + 1))
+                return -ENOMEM;
+
+        memcpy(trie->path + trie->path_len, s, len);
+        trie->path_len += len;
+        trie->path[trie->path_len] = '\0';
+
+        return 0;
+}
+
+static void trie_path_pop(struct trie_f *trie, size_t len) {
+        assert(trie->path_len >= len);
+
+        trie->path_len -= len;
+        trie->path[trie->path_len] = '\0';
+}
+
+static bool node_has_glob_child(const struct trie_node *node) {
+        return node_lookup(node, '*') || node_lookup(node, '?') || node_lookup(node, '[');
+}
+
 /* calculate the storage space for the nodes, children arrays, value arrays */
 static void trie_store_nodes_size(struct trie_f *trie, struct trie_node *node) {
         uint64_t i;
@@ -307,7 +340,27 @@ static void trie_store_nodes_size(struct trie_f *trie, struct trie_node *node) {
                 trie->strings_off += sizeof(struct trie_value_entry2_f);
 }
 
-static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node) {
+static int trie_index_add(struct trie_f *trie, uint64_t node_off) {
+        char *key;
+
+        if (!GREEDY_REALLOC(trie->index, trie->index_allocated, trie->index_count + 1))
+                return -ENOMEM;
+
+        key = strdup(trie->path);
+        if (!key)
+                return -ENOMEM;
+
+        trie->index[trie->index_count++] = (HwdbIndexEntry) {
+                .key = key,
+                .node_off = node_off,
+        };
+
+        return 0;
+}
+
+/* Writes the node and everything below it. 'literal' tells whether the trie search on the way to this node could not
+ * have taken any glob branch, in which case the node's values are added to the index of literal keys. */
+static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node, bool literal) {
         uint64_t i;
         struct trie_node_f n = {
                 .prefix_off = htole64(trie->strings_off + node->prefix_off),
@@ -315,7 +368,18 @@ static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node) {
                 .values_count = htole64(node->values_count),
         };
         _cleanup_free_ struct trie_child_entry_f *children = NULL;
+        const char *prefix;
+        size_t prefix_len;
         int64_t node_off;
+        int r;
+
+        prefix = trie->trie->strings->buf + node->prefix_off;
+        prefix_len = strlen(prefix);
+        r = trie_path_push(trie, prefix, prefix_len);
+        if (r < 0)
+                return r;
+
+        literal = literal && !strpbrk(prefix, "*?[") && !node_has_glob_child(node);
 
         if (node->children_count) {
                 children = new(struct trie_child_entry_f, node->children_count);
@@ -327,7 +391,12 @@ static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node) {
         for (i = 0; i < node->children_count; i++) {
                 int64_t child_off;
 
-                child_off = trie_store_nodes(trie, node->children[i].child);
+                r = trie_path_push(trie, (const char *) &node->children[i].c, 1);
+                if (r < 0)
+                        return r;
+
+                child_off = trie_store_nodes(trie, node->children[i].child, literal);
+                trie_path_pop(trie, 1);
                 if (child_off < 0)
                         return child_off;
 
@@ -362,17 +431,26 @@ static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node) {
         }
         trie->values_count += node->values_count;
 
+        if (literal && node->values_count > 0) {
+                r = trie_index_add(trie, node_off);
+                if (r < 0)
+                        return r;
+        }
+
+        trie_path_pop(trie, prefix_len);
+
         return node_off;
 }
 
 static int trie_store(struct trie *trie, const char *filename) {
-        struct trie_f t = {
+        _cleanup_(trie_f_done) struct trie_f t = {
                 .trie = trie,
         };
         _cleanup_free_ char *filename_tmp = NULL;
         int64_t pos;
         int64_t root_off;
         int64_t size;
+        uint64_t index_off = 0, index_len = 0;
         struct trie_header_f h = {
                 .signature = HWDB_SIG,
                 .tool_version = htole64(atoi(PACKAGE_VERSION)),
@@ -396,7 +474,7 @@ static int trie_store(struct trie *trie, const char *filename) {
         if (fseeko(t.f, sizeof(struct trie_header_f), SEEK_SET) < 0)
                 goto error_fclose;
 
-        root_off = trie_store_nodes(&t, trie->root);
+        root_off = trie_store_nodes(&t, trie->root, true);
         h.nodes_root_off = htole64(root_off);
         pos = ftello(t.f);
         h.nodes_len = htole64(pos - sizeof(struct trie_header_f));
@@ -405,6 +483,15 @@ static int trie_store(struct trie *trie, const char *filename) {
         fwrite(trie->strings->buf, trie->strings->len, 1, t.f);
         h.strings_len = htole64(trie->strings->len);
 
+        /* write index of literal keys, readers which don't know it simply ignore it */
+        r = hwdb_index_write(t.f, t.index, t.index_count, &index_off, &index_len);
+        if (r < 0) {
+                log_warning_errno(r, "Failed to write index of literal keys, ignoring: %m");
+                index_off = index_len = 0;
+        }
+        h.index_off = htole64(index_off);
+        h.index_len = htole64(index_len);
+
         /* write header */
         size = ftello(t.f);
         h.file_size = htole64(size);
@@ -435,6 +522,7 @@ static int trie_store(struct trie *trie, const char *filename) {
                   t.values_count * sizeof(struct trie_value_entry2_f), t.values_count);
         log_debug("string store:     %8zu bytes", trie->strings->len);
         log_debug("strings start:    %8"PRIu64, t.strings_off);
+        log_debug("literal keys:     %8"PRIu64" bytes (%8zu)", index_len, t.index_count);
         return 0;
 
  error_fclose:
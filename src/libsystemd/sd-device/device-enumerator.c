@@ -1,9 +1,17 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
 #include "sd-device.h"
 
 #include "alloc-util.h"
 #include "device-enumerator-private.h"
+#include "device-index.h"
+#include "device-internal.h"
+#include "device-private.h"
 #include "device-util.h"
 #include "dirent-util.h"
 #include "fd-util.h"
@@ -14,6 +22,7 @@
 #include "util.h"
 
 #define DEVICE_ENUMERATE_MAX_DEPTH 256
+#define DEVICE_ENUMERATE_MAX_THREADS 8U
 
 typedef enum DeviceEnumerationType {
         DEVICE_ENUMERATION_TYPE_DEVICES,
@@ -38,6 +47,8 @@ struct sd_device_enumerator {
         Set *match_tag;
         sd_device *match_parent;
         bool match_allow_uninitialized;
+
+        unsigned n_threads;
 };
 
 _public_ int sd_device_enumerator_new(sd_device_enumerator **ret) {
@@ -51,6 +62,7 @@ _public_ int sd_device_enumerator_new(sd_device_enumerator **ret) {
 
         enumerator->n_ref = 1;
         enumerator->type = _DEVICE_ENUMERATION_TYPE_INVALID;
+        enumerator->n_threads = 1;
 
         *ret = TAKE_PTR(enumerator);
 
@@ -246,6 +258,17 @@ _public_ int sd_device_enumerator_allow_uninitialized(sd_device_enumerator *enum
         return 0;
 }
 
+/* Sets the number of threads used to scan the subsystem directories of sysfs, 0 picks one per CPU up to a limit, and 1
+ * (the default) scans everything in the calling thread. Only for callers that know that nothing else uses sd-device
+ * while the scan runs, and that don't use the parent cache. */
+int device_enumerator_set_n_threads(sd_device_enumerator *enumerator, unsigned n_threads) {
+        assert_return(enumerator, -EINVAL);
+
+        enumerator->n_threads = n_threads;
+
+        return 0;
+}
+
 int device_enumerator_add_match_is_initialized(sd_device_enumerator *enumerator) {
         assert_return(enumerator, -EINVAL);
 
@@ -446,26 +469,22 @@ static bool match_sysname(sd_device_enumerator *enumerator, const char *sysname)
         return false;
 }
 
-static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator, const char *basedir, const char *subdir1, const char *subdir2) {
-        _cleanup_closedir_ DIR *dir = NULL;
-        char *path;
+typedef int (*device_found_func_t)(sd_device_enumerator *enumerator, sd_device *device, void *userdata);
+
+static int enumerator_add_found_device(sd_device_enumerator *enumerator, sd_device *device, void *userdata) {
+        return device_enumerator_add_device(enumerator, device);
+}
+
+/* Checks all entries of the directory 'path' (with a trailing slash) and hands the matching devices to 'found'. This
+ * only reads from the enumerator, hence it may run in several threads at the same time. */
+static int enumerator_scan_dir_full(sd_device_enumerator *enumerator, DIR *dir, const char *path, device_found_func_t found, void *userdata) {
         struct dirent *dent;
         int r = 0;
 
         assert(enumerator);
-        assert(basedir);
-
-        path = strjoina("/sys/", basedir, "/");
-
-        if (subdir1)
-                path = strjoina(path, subdir1, "/");
-
-        if (subdir2)
-                path = strjoina(path, subdir2, "/");
-
-        dir = opendir(path);
-        if (!dir)
-                return -errno;
+        assert(dir);
+        assert(path);
+        assert(found);
 
         FOREACH_DIRENT_ALL(dent, dir, return -errno) {
                 _cleanup_(sd_device_unrefp) sd_device *device = NULL;
@@ -535,7 +554,7 @@ static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator,
                 if (!match_sysattr(enumerator, device))
                         continue;
 
-                k = device_enumerator_add_device(enumerator, device);
+                k = found(enumerator, device, userdata);
                 if (k < 0)
                         r = k;
         }
@@ -543,6 +562,28 @@ static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator,
         return r;
 }
 
+static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator, const char *basedir, const char *subdir1, const char *subdir2) {
+        _cleanup_closedir_ DIR *dir = NULL;
+        char *path;
+
+        assert(enumerator);
+        assert(basedir);
+
+        path = strjoina("/sys/", basedir, "/");
+
+        if (subdir1)
+                path = strjoina(path, subdir1, "/");
+
+        if (subdir2)
+                path = strjoina(path, subdir2, "/");
+
+        dir = opendir(path);
+        if (!dir)
+                return -errno;
+
+        return enumerator_scan_dir_full(enumerator, dir, path, enumerator_add_found_device, NULL);
+}
+
 static bool match_subsystem(sd_device_enumerator *enumerator, const char *subsystem) {
         const char *subsystem_match;
         Iterator i;
@@ -566,10 +607,116 @@ static bool match_subsystem(sd_device_enumerator *enumerator, const char *subsys
         return false;
 }
 
+/* The subsystem directories below /sys/bus, /sys/class or /sys/subsystem are independent of each other, and on large
+ * machines reading them one after the other is what takes most of the time of a full scan. Hence they are handed out
+ * to a few threads, which collect the matching devices, and the results are merged into the sorted queue afterwards,
+ * so that the order of the enumerated devices does not depend on which thread found them. */
+typedef struct ScanContext {
+        sd_device_enumerator *enumerator;
+        int dir_fd;
+        const char *path;
+        const char *subdir;
+        char **dirs;
+        size_t n_dirs;
+        size_t next;
+        pthread_mutex_t mutex;
+} ScanContext;
+
+typedef struct ScanWorker {
+        ScanContext *context;
+        pthread_t thread;
+        sd_device **devices;
+        size_t n_devices, n_allocated;
+        int r;
+} ScanWorker;
+
+static int scan_worker_add_device(sd_device_enumerator *enumerator, sd_device *device, void *userdata) {
+        ScanWorker *w = userdata;
+
+        assert(w);
+
+        if (!GREEDY_REALLOC(w->devices, w->n_allocated, w->n_devices + 1))
+                return -ENOMEM;
+
+        w->devices[w->n_devices++] = sd_device_ref(device);
+
+        return 0;
+}
+
+static int scan_worker_scan_dir(ScanWorker *w, const char *name) {
+        _cleanup_closedir_ DIR *dir = NULL;
+        ScanContext *c = w->context;
+        const char *relpath, *path;
+        int fd;
+
+        relpath = c->subdir ? strjoina(name, "/", c->subdir) : name;
+        path = strjoina(c->path, relpath, "/");
+
+        fd = openat(c->dir_fd, relpath, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        dir = fdopendir(fd);
+        if (!dir) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        return enumerator_scan_dir_full(c->enumerator, dir, path, scan_worker_add_device, w);
+}
+
+static void *scan_worker_run(void *userdata) {
+        ScanWorker *w = userdata;
+        ScanContext *c = w->context;
+
+        for (;;) {
+                const char *name = NULL;
+                int k;
+
+                assert_se(pthread_mutex_lock(&c->mutex) == 0);
+                if (c->next < c->n_dirs)
+                        name = c->dirs[c->next++];
+                assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+                if (!name)
+                        break;
+
+                k = scan_worker_scan_dir(w, name);
+                if (k < 0)
+                        w->r = k;
+        }
+
+        return NULL;
+}
+
+static unsigned enumerator_get_n_threads(sd_device_enumerator *enumerator, size_t n_dirs) {
+        unsigned n;
+
+        assert(enumerator);
+
+        n = enumerator->n_threads;
+        if (n == 0) {
+                long cpus;
+
+                cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                n = cpus > 0 ? MIN((unsigned) cpus, DEVICE_ENUMERATE_MAX_THREADS) : 1;
+        }
+
+        if (n > n_dirs)
+                n = MAX(n_dirs, 1U);
+
+        return n;
+}
+
 static int enumerator_scan_dir(sd_device_enumerator *enumerator, const char *basedir, const char *subdir, const char *subsystem) {
         _cleanup_closedir_ DIR *dir = NULL;
-        char *path;
+        _cleanup_strv_free_ char **dirs = NULL;
+        _cleanup_free_ ScanWorker *workers = NULL;
+        unsigned n_workers, n_started = 1, i;
+        sigset_t ss, saved_ss;
+        ScanContext context;
         struct dirent *dent;
+        char *path;
         int r = 0;
 
         path = strjoina("/sys/", basedir);
@@ -581,17 +728,77 @@ static int enumerator_scan_dir(sd_device_enumerator *enumerator, const char *bas
         log_debug("  device-enumerator: scanning %s", path);
 
         FOREACH_DIRENT_ALL(dent, dir, return -errno) {
-                int k;
-
                 if (dent->d_name[0] == '.')
                         continue;
 
                 if (!match_subsystem(enumerator, subsystem ? : dent->d_name))
                         continue;
 
-                k = enumerator_scan_dir_and_add_devices(enumerator, basedir, dent->d_name, subdir);
-                if (k < 0)
-                        r = k;
+                if (strv_extend(&dirs, dent->d_name) < 0)
+                        return -ENOMEM;
+        }
+
+        context = (ScanContext) {
+                .enumerator = enumerator,
+                .dir_fd = dirfd(dir),
+                .path = strjoina(path, "/"),
+                .subdir = subdir,
+                .dirs = dirs,
+                .n_dirs = strv_length(dirs),
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+        };
+
+        n_workers = enumerator_get_n_threads(enumerator, context.n_dirs);
+
+        workers = new0(ScanWorker, n_workers);
+        if (!workers)
+                return -ENOMEM;
+
+        for (i = 0; i < n_workers; i++)
+                workers[i].context = &context;
+
+        /* The first worker is the calling thread itself, hence if no thread can be started we still get through the
+         * whole list, just slower. The other threads get all signals blocked. */
+        if (n_workers > 1) {
+                assert_se(sigfillset(&ss) >= 0);
+                assert_se(pthread_sigmask(SIG_BLOCK, &ss, &saved_ss) == 0);
+
+                for (; n_started < n_workers; n_started++) {
+                        int k;
+
+                        k = pthread_create(&workers[n_started].thread, NULL, scan_worker_run, workers + n_started);
+                        if (k > 0) {
+                                log_debug_errno(k, "device-enumerator: failed to start scan thread, continuing with %u threads: %m", n_started);
+                                break;
+                        }
+                }
+
+                assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+        }
+
+        (void) scan_worker_run(workers);
+
+        for (i = 1; i < n_started; i++)
+                assert_se(pthread_join(workers[i].thread, NULL) == 0);
+
+        for (i = 0; i < n_workers; i++) {
+                ScanWorker *w = workers + i;
+                size_t j;
+
+                if (w->r < 0)
+                        r = w->r;
+
+                for (j = 0; j < w->n_devices; j++) {
+                        int k;
+
+                        k = device_enumerator_add_device(enumerator, w->devices[j]);
+                        if (k < 0)
+                                r = k;
+
+                        sd_device_unref(w->devices[j]);
+                }
+
+                free(w->devices);
         }
 
         return r;
@@ -672,13 +879,97 @@ static int enumerator_scan_devices_tag(sd_device_enumerator *enumerator, const c
         return r;
 }
 
+static bool match_index_tag(sd_device_enumerator *enumerator, const DeviceIndexEntry *e) {
+        const char *tag;
+        Iterator i;
+
+        SET_FOREACH(tag, enumerator->match_tag, i)
+                if (device_index_entry_has_tag(e, tag))
+                        return true;
+
+        return false;
+}
+
+static int enumerator_scan_devices_tags_index(sd_device_enumerator *enumerator, DeviceIndex *index) {
+        const DeviceIndexEntry *e;
+        Iterator i = ITERATOR_FIRST;
+        int r = 0;
+
+        assert(enumerator);
+        assert(index);
+
+        while (device_index_iterate(index, &i, &e)) {
+                _cleanup_(sd_device_unrefp) sd_device *device = NULL;
+                _cleanup_free_ char *syspath = NULL;
+                const char *id, *sysname;
+                int k;
+
+                if (!match_index_tag(enumerator, e))
+                        continue;
+
+                if (!match_subsystem(enumerator, e->subsystem))
+                        continue;
+
+                syspath = strjoin("/sys", e->devpath);
+                if (!syspath)
+                        return -ENOMEM;
+
+                k = sd_device_new_from_syspath(&device, syspath);
+                if (k < 0) {
+                        if (!IN_SET(k, -ENODEV, -ENOENT))
+                                /* this is necessarily racy, so ignore missing devices */
+                                r = k;
+
+                        continue;
+                }
+
+                /* the devpath might belong to a different device by now */
+                k = device_get_id_filename(device, &id);
+                if (k < 0 || !streq(id, e->id))
+                        continue;
+
+                /* what we'd otherwise read from the database file */
+                (void) device_read_db_nulstr(device, e->db, e->db_size);
+
+                k = sd_device_get_sysname(device, &sysname);
+                if (k < 0) {
+                        r = k;
+                        continue;
+                }
+
+                if (!match_sysname(enumerator, sysname))
+                        continue;
+
+                if (!match_parent(enumerator, device))
+                        continue;
+
+                if (!match_property(enumerator, device))
+                        continue;
+
+                if (!match_sysattr(enumerator, device))
+                        continue;
+
+                k = device_enumerator_add_device(enumerator, device);
+                if (k < 0)
+                        r = k;
+        }
+
+        return r;
+}
+
 static int enumerator_scan_devices_tags(sd_device_enumerator *enumerator) {
+        _cleanup_(device_index_freep) DeviceIndex *index = NULL;
         const char *tag;
         Iterator i;
         int r = 0;
 
         assert(enumerator);
 
+        /* With the index maintained by udevd, one pass over a single file finds the devices with any of the tags,
+         * without opening the database file of each of them */
+        if (device_index_open(DEVICE_INDEX_PATH, &index) >= 0)
+                return enumerator_scan_devices_tags_index(enumerator, index);
+
         SET_FOREACH(tag, enumerator->match_tag, i) {
                 int k;
 
@@ -0,0 +1,642 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sd-device.h"
+
+#include "alloc-util.h"
+#include "device-index.h"
+#include "device-internal.h"
+#include "device-private.h"
+#include "device-util.h"
+#include "dirent-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "io-util.h"
+#include "mkdir.h"
+#include "string-util.h"
+
+/* The index is a single file with a record for every device which has a database file below /run/udev/data. The
+ * database files stay what everybody else reads and writes, the index is written in addition, so that tagged
+ * devices can be enumerated with a sequential scan of one file, instead of opening and parsing a file per device.
+ *
+ * Whenever a database file is written or removed, a record is appended to the index, hence the latest record of a
+ * device is the valid one. Appending happens under an exclusive lock. The file is only replaced as a whole, when
+ * udevd builds it from the database files or drops the outdated records, and that happens while holding the lock of
+ * the old file. Writers find the old file unlinked then, and append to the new one. Readers never lock, a record
+ * which is still being appended is simply incomplete and ignored. Nothing is appended while the file doesn't exist,
+ * as the index would miss devices then. */
+
+#define DEVICE_INDEX_SIGNATURE "UDEVIDX"
+#define DEVICE_INDEX_VERSION 1
+
+#define DEVICE_INDEX_RECORD_REMOVED 1U
+
+typedef struct DeviceIndexHeader {
+        char signature[8];
+        uint32_t version;
+        uint32_t header_size;
+} DeviceIndexHeader;
+
+/* Followed by the device id, the devpath, the subsystem and the database entries, all NUL terminated, and padded
+ * with NUL bytes to a multiple of 8 bytes */
+typedef struct DeviceIndexRecord {
+        uint32_t size;
+        uint32_t flags;
+        char payload[];
+} DeviceIndexRecord;
+
+struct DeviceIndex {
+        void *map;
+        size_t map_size;
+        Hashmap *entries;       /* id → DeviceIndexEntry */
+};
+
+static const char *payload_next(const char **p, const char *end) {
+        const char *s = *p;
+        size_t l;
+
+        if (s >= end)
+                return NULL;
+
+        l = strnlen(s, end - s);
+        if (l >= (size_t) (end - s))
+                return NULL;
+
+        *p = s + l + 1;
+        return s;
+}
+
+static int index_parse_record(const DeviceIndexRecord *r, size_t size, DeviceIndexEntry *e, bool *removed) {
+        const char *p = r->payload, *end = (const char*) r + size;
+
+        *e = (DeviceIndexEntry) {
+                .record = r,
+                .record_size = size,
+        };
+
+        e->id = payload_next(&p, end);
+        e->devpath = payload_next(&p, end);
+        e->subsystem = payload_next(&p, end);
+        if (!e->id || !e->devpath || !e->subsystem || isempty(e->id))
+                return -EBADMSG;
+
+        /* the padding guarantees that the last entry is terminated */
+        if (end[-1] != 0)
+                return -EBADMSG;
+
+        e->db = p;
+        e->db_size = end - p;
+        *removed = r->flags & DEVICE_INDEX_RECORD_REMOVED;
+
+        return 0;
+}
+
+static int index_load(DeviceIndex *index) {
+        const DeviceIndexHeader *h = index->map;
+        size_t offset;
+
+        if (index->map_size < sizeof(DeviceIndexHeader) ||
+            memcmp(h->signature, DEVICE_INDEX_SIGNATURE, sizeof(h->signature)) != 0 ||
+            h->version != DEVICE_INDEX_VERSION ||
+            h->header_size < sizeof(DeviceIndexHeader) ||
+            h->header_size > index->map_size)
+                return -EBADMSG;
+
+        index->entries = hashmap_new(&string_hash_ops);
+        if (!index->entries)
+                return -ENOMEM;
+
+        for (offset = h->header_size; offset + sizeof(DeviceIndexRecord) <= index->map_size;) {
+                const DeviceIndexRecord *r = (const DeviceIndexRecord*) ((const uint8_t*) index->map + offset);
+                _cleanup_free_ DeviceIndexEntry *e = NULL;
+                DeviceIndexEntry *old;
+                bool removed;
+                int k;
+
+                if (r->size < sizeof(DeviceIndexRecord) || r->size % 8 != 0)
+                        return -EBADMSG;
+
+                /* still being written */
+                if (r->size > index->map_size - offset)
+                        break;
+
+                offset += r->size;
+
+                e = new(DeviceIndexEntry, 1);
+                if (!e)
+                        return -ENOMEM;
+
+                k = index_parse_record(r, r->size, e, &removed);
+                if (k < 0)
+                        return k;
+
+                old = hashmap_remove(index->entries, e->id);
+                free(old);
+
+                if (removed)
+                        continue;
+
+                k = hashmap_put(index->entries, e->id, e);
+                if (k < 0)
+                        return k;
+
+                e = NULL;
+        }
+
+        return 0;
+}
+
+int device_index_open(const char *path, DeviceIndex **ret) {
+        _cleanup_(device_index_freep) DeviceIndex *index = NULL;
+        _cleanup_close_ int fd = -1;
+        struct stat st;
+        int r;
+
+        assert(path);
+        assert(ret);
+
+        fd = open(path, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        index = new0(DeviceIndex, 1);
+        if (!index)
+                return -ENOMEM;
+
+        index->map_size = st.st_size;
+        index->map = mmap(NULL, index->map_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (index->map == MAP_FAILED) {
+                index->map = NULL;
+                return -errno;
+        }
+
+        r = index_load(index);
+        if (r < 0)
+                return log_debug_errno(r, "sd-device: ignoring invalid device index '%s': %m", path);
+
+        *ret = TAKE_PTR(index);
+        return 0;
+}
+
+DeviceIndex *device_index_free(DeviceIndex *index) {
+        if (!index)
+                return NULL;
+
+        hashmap_free_free(index->entries);
+        if (index->map)
+                (void) munmap(index->map, index->map_size);
+
+        return mfree(index);
+}
+
+const DeviceIndexEntry *device_index_get(DeviceIndex *index, const char *id) {
+        assert(index);
+        assert(id);
+
+        return hashmap_get(index->entries, id);
+}
+
+bool device_index_iterate(DeviceIndex *index, Iterator *i, const DeviceIndexEntry **ret) {
+        void *e;
+        bool b;
+
+        assert(index);
+        assert(i);
+        assert(ret);
+
+        b = hashmap_iterate(index->entries, i, &e, NULL);
+        *ret = e;
+        return b;
+}
+
+unsigned device_index_size(DeviceIndex *index) {
+        return index ? hashmap_size(index->entries) : 0;
+}
+
+bool device_index_entry_has_tag(const DeviceIndexEntry *e, const char *tag) {
+        const char *p, *end;
+
+        assert(e);
+        assert(tag);
+
+        for (p = e->db, end = e->db + e->db_size; p < end; p += strlen(p) + 1)
+                if (p[0] == 'G' && streq(p + 1, tag))
+                        return true;
+
+        return false;
+}
+
+static int record_add(char **buf, size_t *allocated, size_t *size, char key, const char *value) {
+        size_t l;
+
+        l = strlen(value);
+        if (!GREEDY_REALLOC(*buf, *allocated, *size + !!key + l + 1))
+                return -ENOMEM;
+
+        if (key)
+                (*buf)[(*size)++] = key;
+        memcpy(*buf + *size, value, l + 1);
+        *size += l + 1;
+
+        return 0;
+}
+
+static int record_addf(char **buf, size_t *allocated, size_t *size, char key, const char *format, ...) _printf_(5, 6);
+static int record_addf(char **buf, size_t *allocated, size_t *size, char key, const char *format, ...) {
+        _cleanup_free_ char *value = NULL;
+        va_list ap;
+        int r;
+
+        va_start(ap, format);
+        r = vasprintf(&value, format, ap);
+        va_end(ap);
+        if (r < 0)
+                return -ENOMEM;
+
+        return record_add(buf, allocated, size, key, value);
+}
+
+static int record_begin(const char *id, const char *devpath, const char *subsystem,
+                        char **buf, size_t *allocated, size_t *size) {
+        int r;
+
+        *size = offsetof(DeviceIndexRecord, payload);
+        if (!GREEDY_REALLOC0(*buf, *allocated, *size))
+                return -ENOMEM;
+
+        r = record_add(buf, allocated, size, 0, id);
+        if (r < 0)
+                return r;
+
+        r = record_add(buf, allocated, size, 0, devpath);
+        if (r < 0)
+                return r;
+
+        return record_add(buf, allocated, size, 0, subsystem);
+}
+
+static int record_finish(char **buf, size_t *allocated, size_t *size, uint32_t flags) {
+        DeviceIndexRecord *r;
+        size_t padded;
+
+        /* pad, which also makes sure that the last entry is followed by a NUL byte */
+        padded = ALIGN_TO(*size + 1, 8);
+        if (!GREEDY_REALLOC(*buf, *allocated, padded))
+                return -ENOMEM;
+
+        memzero(*buf + *size, padded - *size);
+        *size = padded;
+
+        r = (DeviceIndexRecord*) *buf;
+        r->size = padded;
+        r->flags = flags;
+
+        return 0;
+}
+
+/* Serializes the same information device_update_db() writes to the database file */
+static int record_new(sd_device *device, bool removed, char **ret, size_t *ret_size) {
+        _cleanup_free_ char *buf = NULL;
+        const char *id, *devpath, *subsystem = "";
+        size_t allocated = 0, size;
+        int k;
+
+        assert(device);
+        assert(ret);
+        assert(ret_size);
+
+        k = device_get_id_filename(device, &id);
+        if (k < 0)
+                return k;
+
+        k = sd_device_get_devpath(device, &devpath);
+        if (k < 0)
+                return k;
+
+        (void) sd_device_get_subsystem(device, &subsystem);
+
+        k = record_begin(id, removed ? "" : devpath, removed ? "" : subsystem, &buf, &allocated, &size);
+        if (k < 0)
+                return k;
+
+        if (!removed && device_has_info(device)) {
+                const char *property, *value, *tag;
+                Iterator i;
+
+                if (major(device->devnum) > 0) {
+                        const char *devlink;
+
+                        FOREACH_DEVICE_DEVLINK(device, devlink) {
+                                k = record_add(&buf, &allocated, &size, 'S', devlink + STRLEN("/dev/"));
+                                if (k < 0)
+                                        return k;
+                        }
+
+                        if (device->devlink_priority != 0) {
+                                k = record_addf(&buf, &allocated, &size, 'L', "%i", device->devlink_priority);
+                                if (k < 0)
+                                        return k;
+                        }
+
+                        if (device->watch_handle >= 0) {
+                                k = record_addf(&buf, &allocated, &size, 'W', "%i", device->watch_handle);
+                                if (k < 0)
+                                        return k;
+                        }
+                }
+
+                if (device->usec_initialized > 0) {
+                        k = record_addf(&buf, &allocated, &size, 'I', USEC_FMT, device->usec_initialized);
+                        if (k < 0)
+                                return k;
+                }
+
+                ORDERED_HASHMAP_FOREACH_KEY(value, property, device->properties_db, i) {
+                        k = record_addf(&buf, &allocated, &size, 'E', "%s=%s", property, value);
+                        if (k < 0)
+                                return k;
+                }
+
+                FOREACH_DEVICE_TAG(device, tag) {
+                        k = record_add(&buf, &allocated, &size, 'G', tag);
+                        if (k < 0)
+                                return k;
+                }
+        }
+
+        k = record_finish(&buf, &allocated, &size, removed ? DEVICE_INDEX_RECORD_REMOVED : 0);
+        if (k < 0)
+                return k;
+
+        *ret = TAKE_PTR(buf);
+        *ret_size = size;
+        return 0;
+}
+
+/* Converts a database file, taking its lines as they are */
+static int record_new_from_db_file(sd_device *device, const char *db_path, char **ret, size_t *ret_size) {
+        _cleanup_free_ char *buf = NULL, *db = NULL;
+        const char *id, *devpath, *subsystem = "", *p;
+        size_t allocated = 0, size;
+        int k;
+
+        k = device_get_id_filename(device, &id);
+        if (k < 0)
+                return k;
+
+        k = sd_device_get_devpath(device, &devpath);
+        if (k < 0)
+                return k;
+
+        (void) sd_device_get_subsystem(device, &subsystem);
+
+        k = read_full_file(db_path, &db, NULL);
+        if (k < 0)
+                return k;
+
+        k = record_begin(id, devpath, subsystem, &buf, &allocated, &size);
+        if (k < 0)
+                return k;
+
+        for (p = db; *p;) {
+                size_t l;
+
+                l = strcspn(p, NEWLINE);
+                if (l >= 2 && p[1] == ':') {
+                        _cleanup_free_ char *value = NULL;
+
+                        value = strndup(p + 2, l - 2);
+                        if (!value)
+                                return -ENOMEM;
+
+                        k = record_add(&buf, &allocated, &size, p[0], value);
+                        if (k < 0)
+                                return k;
+                }
+
+                p += l;
+                p += strspn(p, NEWLINE);
+        }
+
+        k = record_finish(&buf, &allocated, &size, 0);
+        if (k < 0)
+                return k;
+
+        *ret = TAKE_PTR(buf);
+        *ret_size = size;
+        return 0;
+}
+
+/* Opens the current index file and locks it exclusively */
+static int index_open_locked(const char *path, int flags) {
+        for (;;) {
+                _cleanup_close_ int fd = -1;
+                struct stat st;
+
+                fd = open(path, flags|O_CLOEXEC|O_NOCTTY);
+                if (fd < 0)
+                        return -errno;
+
+                if (flock(fd, LOCK_EX) < 0)
+                        return -errno;
+
+                if (fstat(fd, &st) < 0)
+                        return -errno;
+
+                /* replaced while we were waiting for the lock, try the new one */
+                if (st.st_nlink > 0)
+                        return TAKE_FD(fd);
+        }
+}
+
+static int index_append(const char *path, sd_device *device, bool removed) {
+        _cleanup_free_ char *record = NULL;
+        _cleanup_close_ int fd = -1;
+        size_t size;
+        ssize_t l;
+        int r;
+
+        assert(path);
+        assert(device);
+
+        fd = index_open_locked(path, O_WRONLY|O_APPEND);
+        if (fd == -ENOENT)
+                return 0;
+        if (fd < 0)
+                return fd;
+
+        r = record_new(device, removed, &record, &size);
+        if (r < 0)
+                return r;
+
+        l = write(fd, record, size);
+        if (l != (ssize_t) size) {
+                r = l < 0 ? -errno : -EIO;
+
+                /* A partial record would break all following ones. Drop the index instead, readers fall back to
+                 * the database files until it is built again. */
+                (void) unlink(path);
+                return log_debug_errno(r, "sd-device: failed to append to device index '%s', removed it: %m", path);
+        }
+
+        return 0;
+}
+
+int device_index_update(const char *path, sd_device *device) {
+        return index_append(path, device, false);
+}
+
+int device_index_remove(const char *path, sd_device *device) {
+        return index_append(path, device, true);
+}
+
+static void unlink_tempp(char **p) {
+        if (!*p)
+                return;
+
+        (void) unlink(*p);
+        *p = mfree(*p);
+}
+
+static void index_write_header(FILE *f) {
+        DeviceIndexHeader h = {
+                .signature = DEVICE_INDEX_SIGNATURE,
+                .version = DEVICE_INDEX_VERSION,
+                .header_size = sizeof(DeviceIndexHeader),
+        };
+
+        fwrite(&h, sizeof(h), 1, f);
+}
+
+static int index_replace(const char *path, FILE *f, const char *path_tmp) {
+        int r;
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                return r;
+
+        if (fchmod(fileno(f), 0644) < 0)
+                return -errno;
+
+        if (rename(path_tmp, path) < 0)
+                return -errno;
+
+        return 0;
+}
+
+/* Builds the index from scratch, from the database files */
+int device_index_rebuild(const char *path, const char *db_dir) {
+        _cleanup_(unlink_tempp) char *path_tmp = NULL;
+        _cleanup_closedir_ DIR *dir = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_close_ int fd = -1;
+        struct dirent *dent;
+        unsigned n = 0;
+        int r;
+
+        assert(path);
+        assert(db_dir);
+
+        /* keep writers away while we are at it */
+        fd = index_open_locked(path, O_RDONLY);
+        if (fd < 0 && fd != -ENOENT)
+                return fd;
+
+        r = mkdir_parents(path, 0755);
+        if (r < 0)
+                return r;
+
+        r = fopen_temporary(path, &f, &path_tmp);
+        if (r < 0)
+                return r;
+
+        index_write_header(f);
+
+        dir = opendir(db_dir);
+        if (!dir && errno != ENOENT)
+                return -errno;
+
+        if (dir) {
+                FOREACH_DIRENT(dent, dir, return -errno) {
+                        _cleanup_(sd_device_unrefp) sd_device *device = NULL;
+                        _cleanup_free_ char *record = NULL, *db_path = NULL;
+                        size_t size;
+
+                        if (!IN_SET(dent->d_type, DT_REG, DT_UNKNOWN))
+                                continue;
+
+                        /* this is necessarily racy, devices which are gone are simply left out */
+                        if (sd_device_new_from_device_id(&device, dent->d_name) < 0)
+                                continue;
+
+                        db_path = strjoin(db_dir, "/", dent->d_name);
+                        if (!db_path)
+                                return -ENOMEM;
+
+                        if (record_new_from_db_file(device, db_path, &record, &size) < 0)
+                                continue;
+
+                        fwrite(record, size, 1, f);
+                        n++;
+                }
+        }
+
+        r = index_replace(path, f, path_tmp);
+        if (r < 0)
+                return r;
+
+        path_tmp = mfree(path_tmp);
+
+        log_debug("sd-device: built device index '%s' with %u devices", path, n);
+        return 0;
+}
+
+/* Drops all records which have been superseded by later ones */
+int device_index_compact(const char *path) {
+        _cleanup_(unlink_tempp) char *path_tmp = NULL;
+        _cleanup_(device_index_freep) DeviceIndex *index = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_close_ int fd = -1;
+        const DeviceIndexEntry *e;
+        Iterator i;
+        int r;
+
+        assert(path);
+
+        fd = index_open_locked(path, O_RDONLY);
+        if (fd < 0)
+                return fd;
+
+        r = device_index_open(path, &index);
+        if (r < 0)
+                return r;
+
+        r = fopen_temporary(path, &f, &path_tmp);
+        if (r < 0)
+                return r;
+
+        index_write_header(f);
+
+        HASHMAP_FOREACH(e, index->entries, i)
+                fwrite(e->record, e->record_size, 1, f);
+
+        r = index_replace(path, f, path_tmp);
+        if (r < 0)
+                return r;
+
+        path_tmp = mfree(path_tmp);
+
+        log_debug("sd-device: compacted device index '%s' to %u devices", path, device_index_size(index));
+        return 0;
+}
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sd-device.h"
+
+#include "hashmap.h"
+#include "macro.h"
+
+#define DEVICE_INDEX_PATH "/run/udev/index"
+
+typedef struct DeviceIndex DeviceIndex;
+
+/* A view of the latest record of a device in a mapped index */
+typedef struct DeviceIndexEntry {
+        const char *id;
+        const char *devpath;
+        const char *subsystem;
+        const char *db;         /* database entries, each a key character followed by the value, NUL separated */
+        size_t db_size;
+
+        const void *record;
+        size_t record_size;
+} DeviceIndexEntry;
+
+int device_index_open(const char *path, DeviceIndex **ret);
+DeviceIndex *device_index_free(DeviceIndex *index);
+DEFINE_TRIVIAL_CLEANUP_FUNC(DeviceIndex*, device_index_free);
+
+const DeviceIndexEntry *device_index_get(DeviceIndex *index, const char *id);
+bool device_index_iterate(DeviceIndex *index, Iterator *i, const DeviceIndexEntry **ret);
+unsigned device_index_size(DeviceIndex *index);
+bool device_index_entry_has_tag(const DeviceIndexEntry *e, const char *tag);
+
+int device_index_update(const char *path, sd_device *device);
+int device_index_remove(const char *path, sd_device *device);
+
+int device_index_rebuild(const char *path, const char *db_dir);
+int device_index_compact(const char *path);
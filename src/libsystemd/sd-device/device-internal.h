@@ -97,6 +97,8 @@ int device_add_property_aux(sd_device *device, const char *key, const char *valu
 int device_add_property_internal(sd_device *device, const char *key, const char *value);
 int device_read_uevent_file(sd_device *device);
 int device_read_db_aux(sd_device *device, bool force);
+int device_read_db_nulstr(sd_device *device, const char *db, size_t size);
+bool device_has_info(sd_device *device);
 
 int device_set_syspath(sd_device *device, const char *_syspath, bool verify);
 int device_set_ifindex(sd_device *device, const char *ifindex);
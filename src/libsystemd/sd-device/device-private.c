@@ -7,6 +7,7 @@
 #include "sd-device.h"
 
 #include "alloc-util.h"
+#include "device-index.h"
 #include "device-internal.h"
 #include "device-private.h"
 #include "device-util.h"
@@ -937,7 +938,7 @@ int device_tag_index(sd_device *device, sd_device *device_old, bool add) {
         return r;
 }
 
-static bool device_has_info(sd_device *device) {
+bool device_has_info(sd_device *device) {
         assert(device);
 
         if (!set_isempty(device->devlinks))
@@ -988,6 +989,7 @@ int device_update_db(sd_device *device) {
                 if (r < 0 && errno != ENOENT)
                         return -errno;
 
+                (void) device_index_remove(DEVICE_INDEX_PATH, device);
                 return 0;
         }
 
@@ -1058,6 +1060,10 @@ int device_update_db(sd_device *device) {
         log_debug("created %s file '%s' for '%s'", has_info ? "db" : "empty",
                   path, device->devpath);
 
+        r = device_index_update(DEVICE_INDEX_PATH, device);
+        if (r < 0)
+                log_debug_errno(r, "failed to add '%s' to the device index, ignoring: %m", device->devpath);
+
         return 0;
 
 fail:
@@ -1084,6 +1090,8 @@ int device_delete_db(sd_device *device) {
         if (r < 0 && errno != ENOENT)
                 return -errno;
 
+        (void) device_index_remove(DEVICE_INDEX_PATH, device);
+
         return 0;
 }
 
@@ -45,6 +45,13 @@ int device_clone_with_db(sd_device *old_device, sd_device **new_device);
 int device_copy_properties(sd_device *device_dst, sd_device *device_src);
 int device_new_from_synthetic_event(sd_device **new_device, const char *syspath, const char *action);
 
+typedef uint64_t (*device_generation_func_t)(const char *syspath, void *userdata);
+int device_parent_cache_enable(device_generation_func_t get_generation, void *userdata);
+void device_parent_cache_disable(void);
+void device_parent_cache_flush(void);
+bool device_parent_cache_validate(void);
+unsigned device_parent_cache_size(void);
+
 int device_tag_index(sd_device *dev, sd_device *dev_old, bool add);
 int device_update_db(sd_device *device);
 int device_delete_db(sd_device *device);
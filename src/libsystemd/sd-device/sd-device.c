@@ -673,6 +673,129 @@ _public_ int sd_device_get_syspath(sd_device *device, const char **ret) {
         return 0;
 }
 
+/* An optional cache of parent devices for processes which handle lots of devices below the same parents, like the
+ * udev workers. Cached devices keep their sysattr values and database properties between lookups. The cache doesn't
+ * know when a device changes, hence the owner supplies a generation for each syspath, which changes whenever the
+ * device might have. */
+typedef struct ParentCacheEntry {
+        char *syspath;
+        sd_device *device;      /* NULL if the path is not a device */
+        uint64_t generation;
+} ParentCacheEntry;
+
+static struct {
+        Hashmap *entries;       /* syspath → ParentCacheEntry */
+        device_generation_func_t get_generation;
+        void *userdata;
+} parent_cache = {};
+
+static ParentCacheEntry *parent_cache_entry_free(ParentCacheEntry *e) {
+        if (!e)
+                return NULL;
+
+        sd_device_unref(e->device);
+        free(e->syspath);
+        return mfree(e);
+}
+
+int device_parent_cache_enable(device_generation_func_t get_generation, void *userdata) {
+        assert(get_generation);
+
+        device_parent_cache_disable();
+
+        parent_cache.entries = hashmap_new(&string_hash_ops);
+        if (!parent_cache.entries)
+                return -ENOMEM;
+
+        parent_cache.get_generation = get_generation;
+        parent_cache.userdata = userdata;
+
+        return 0;
+}
+
+void device_parent_cache_flush(void) {
+        ParentCacheEntry *e;
+
+        while ((e = hashmap_steal_first(parent_cache.entries)))
+                parent_cache_entry_free(e);
+}
+
+void device_parent_cache_disable(void) {
+        device_parent_cache_flush();
+        parent_cache.entries = hashmap_free(parent_cache.entries);
+        parent_cache.get_generation = NULL;
+        parent_cache.userdata = NULL;
+}
+
+/* Cached devices reference their own parents, hence a changed device might still be reachable through the devices
+ * below it. As changes of cached devices are rare, simply start over if any of them changed. Returns true if the
+ * cache was flushed. Must not be called while any of the cached devices are in use. */
+bool device_parent_cache_validate(void) {
+        ParentCacheEntry *e;
+        Iterator i;
+
+        if (!parent_cache.get_generation)
+                return false;
+
+        HASHMAP_FOREACH(e, parent_cache.entries, i)
+                if (parent_cache.get_generation(e->syspath, parent_cache.userdata) != e->generation) {
+                        device_parent_cache_flush();
+                        return true;
+                }
+
+        return false;
+}
+
+unsigned device_parent_cache_size(void) {
+        return hashmap_size(parent_cache.entries);
+}
+
+static int parent_cache_get(const char *syspath, sd_device **ret) {
+        _cleanup_(sd_device_unrefp) sd_device *device = NULL;
+        ParentCacheEntry *e;
+        uint64_t generation;
+        int r;
+
+        assert(syspath);
+        assert(ret);
+
+        e = hashmap_get(parent_cache.entries, syspath);
+        if (!e) {
+                /* Take the generation first, so that a change while we read the device is noticed later */
+                generation = parent_cache.get_generation(syspath, parent_cache.userdata);
+
+                r = sd_device_new_from_syspath(&device, syspath);
+                if (r < 0 && !IN_SET(r, -ENODEV, -ENOENT))
+                        return r;
+
+                e = new(ParentCacheEntry, 1);
+                if (!e)
+                        return -ENOMEM;
+
+                *e = (ParentCacheEntry) {
+                        .syspath = strdup(syspath),
+                        .device = TAKE_PTR(device),
+                        .generation = generation,
+                };
+                if (!e->syspath) {
+                        parent_cache_entry_free(e);
+                        return -ENOMEM;
+                }
+
+                r = hashmap_put(parent_cache.entries, e->syspath, e);
+                if (r < 0) {
+                        parent_cache_entry_free(e);
+                        return r;
+                }
+        }
+
+        if (!e->device)
+                return -ENODEV;
+
+        *ret = sd_device_ref(e->device);
+        return 0;
+}
+
 static int device_new_from_child(sd_device **ret, sd_device *child) {
         _cleanup_free_ char *path = NULL;
         const char *subdir, *syspath;
@@ -699,7 +822,10 @@ static int device_new_from_child(sd_device **ret, sd_device *child) {
 
                 *pos = '\0';
 
-                r = sd_device_new_from_syspath(ret, path);
+                if (parent_cache.get_generation)
+                        r = parent_cache_get(path, ret);
+                else
+                        r = sd_device_new_from_syspath(ret, path);
                 if (r < 0)
                         continue;
 
@@ -1371,6 +1497,35 @@ int device_read_db_aux(sd_device *device, bool force) {
         return 0;
 }
 
+/* Loads the database entries of a device index record, the same as device_read_db_aux() would read from the
+ * database file */
+int device_read_db_nulstr(sd_device *device, const char *db, size_t size) {
+        const char *p;
+        int r;
+
+        assert(device);
+        assert(db || size == 0);
+
+        if (device->db_loaded || device->sealed)
+                return 0;
+
+        device->db_loaded = true;
+
+        /* devices with a database entry are initialized */
+        device->is_initialized = true;
+
+        for (p = db; p < db + size; p += strlen(p) + 1) {
+                if (isempty(p))
+                        continue;
+
+                r = handle_db_line(device, p[0], p + 1);
+                if (r < 0)
+                        log_debug_errno(r, "sd-device: failed to handle db entry '%c:%s': %m", p[0], p + 1);
+        }
+
+        return 0;
+}
+
 static int device_read_db(sd_device *device) {
         return device_read_db_aux(device, false);
 }
@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "alloc-util.h"
+#include "hwdb-internal.h"
+#include "siphash24.h"
+#include "string-util.h"
+
+/* The keys come from the hwdb sources, hence there is nothing to protect against, and a fixed hash key keeps hwdb.bin
+ * reproducible. The key is stored in the file anyway, so that it can be changed later. */
+static const uint8_t index_hash_key[16] = {
+        0x4e, 0x0b, 0x8a, 0x2f, 0x61, 0x9d, 0x37, 0xc4, 0xa5, 0x13, 0xf8, 0x76, 0xde, 0x52, 0x09, 0xb1,
+};
+
+uint64_t hwdb_index_hash(const char *key, const uint8_t hash_key[16]) {
+        return siphash24(key, strlen(key), hash_key);
+}
+
+/* Looks up a literal key in the index, and returns the offset of its node, or 0 if it isn't in there. The index has
+ * been checked to lie within the file, but the buckets haven't, hence every offset is checked against the size of the
+ * file before it is followed. */
+uint64_t hwdb_index_lookup(const char *map, uint64_t size, const struct trie_index_f *index, const char *search) {
+        const char *buckets;
+        uint64_t n_buckets, bucket_size, k, i;
+
+        assert(map);
+        assert(index);
+        assert(search);
+
+        n_buckets = le64toh(index->n_buckets);
+        bucket_size = le64toh(index->bucket_size);
+        buckets = (const char *) index + sizeof(struct trie_index_f);
+
+        k = hwdb_index_hash(search, index->hash_key) & (n_buckets - 1);
+        for (i = 0; i < n_buckets; i++, k = (k + 1) & (n_buckets - 1)) {
+                const struct trie_index_bucket_f *b = (const struct trie_index_bucket_f *) (buckets + k * bucket_size);
+                uint64_t key_off = le64toh(b->key_off), node_off = le64toh(b->node_off);
+
+                if (key_off == 0)
+                        break;
+
+                /* The key has to be terminated within the file, and the node has to fit into it */
+                if (key_off >= size || !memchr(map + key_off, 0, size - key_off) ||
+                    node_off == 0 || size < sizeof(struct trie_node_f) || node_off > size - sizeof(struct trie_node_f))
+                        return 0;
+
+                if (streq(map + key_off, search))
+                        return node_off;
+        }
+
+        return 0;
+}
+
+void hwdb_index_entries_free(HwdbIndexEntry *entries, size_t n_entries) {
+        size_t i;
+
+        for (i = 0; i < n_entries; i++)
+                free(entries[i].key);
+
+        free(entries);
+}
+
+/* Appends the key strings and the hash table to the file at the current position, and returns the offset and size of
+ * the table, as they are to be stored in the header. */
+int hwdb_index_write(FILE *f, const HwdbIndexEntry *entries, size_t n_entries, uint64_t *ret_off, uint64_t *ret_len) {
+        _cleanup_free_ struct trie_index_bucket_f *buckets = NULL;
+        static const uint8_t padding[8] = {};
+        struct trie_index_f h = {
+                .bucket_size = htole64(sizeof(struct trie_index_bucket_f)),
+        };
+        uint64_t n_buckets = 1, mask;
+        off_t off;
+        size_t i;
+
+        assert(f);
+        assert(entries || n_entries == 0);
+        assert(ret_off);
+        assert(ret_len);
+
+        /* At most half of the buckets are used, which keeps the probe sequences short */
+        while (n_buckets < n_entries * 2)
+                n_buckets <<= 1;
+        mask = n_buckets - 1;
+
+        buckets = new0(struct trie_index_bucket_f, n_buckets);
+        if (!buckets)
+                return -ENOMEM;
+
+        for (i = 0; i < n_entries; i++) {
+                uint64_t k;
+
+                off = ftello(f);
+                if (off < 0)
+                        return -errno;
+
+                fwrite(entries[i].key, strlen(entries[i].key) + 1, 1, f);
+
+                for (k = hwdb_index_hash(entries[i].key, index_hash_key) & mask; buckets[k].key_off != 0; k = (k + 1) & mask)
+                        ;
+
+                buckets[k] = (struct trie_index_bucket_f) {
+                        .key_off = htole64(off),
+                        .node_off = htole64(entries[i].node_off),
+                };
+        }
+
+        off = ftello(f);
+        if (off < 0)
+                return -errno;
+
+        if (off % 8 != 0) {
+                fwrite(padding, 8 - off % 8, 1, f);
+                off += 8 - off % 8;
+        }
+
+        memcpy(h.hash_key, index_hash_key, sizeof(h.hash_key));
+        h.n_buckets = htole64(n_buckets);
+
+        fwrite(&h, sizeof(h), 1, f);
+        fwrite(buckets, sizeof(struct trie_index_bucket_f), n_buckets, f);
+
+        if (ferror(f))
+                return errno > 0 ? -errno : -EIO;
+
+        *ret_off = off;
+        *ret_len = sizeof(h) + n_buckets * sizeof(struct trie_index_bucket_f);
+
+        return 0;
+}
@@ -2,6 +2,8 @@
 #pragma once
 
 
+#include <stdio.h>
+
 #include "sparse-endian.h"
 #include "util.h"
 
@@ -27,6 +29,11 @@ struct trie_header_f {
         /* size of the nodes and string section */
         le64_t nodes_len;
         le64_t strings_len;
+
+        /* location and size of the index of literal keys, only present if header_size includes these fields, and
+         * unused if 0 */
+        le64_t index_off;
+        le64_t index_len;
 } _packed_;
 
 struct trie_node_f {
@@ -63,3 +70,30 @@ struct trie_value_entry2_f {
         le16_t file_priority;
         le16_t padding;
 } _packed_;
+
+/* The index of literal keys: a hash table of the keys without glob characters, for which the trie search cannot find
+ * anything but the values of the key itself, because no node on the way to it, including its own, has a child for a
+ * glob character. Looking up such a key is a single hash lookup. The table uses open addressing with linear probing,
+ * and is followed by the bucket array. */
+struct trie_index_f {
+        uint8_t hash_key[16];
+        le64_t n_buckets;
+        le64_t bucket_size;
+} _packed_;
+
+struct trie_index_bucket_f {
+        /* offset of the key string, 0 for an empty bucket */
+        le64_t key_off;
+        /* offset of the node holding the values of the key */
+        le64_t node_off;
+} _packed_;
+
+typedef struct HwdbIndexEntry {
+        char *key;
+        uint64_t node_off;
+} HwdbIndexEntry;
+
+uint64_t hwdb_index_hash(const char *key, const uint8_t hash_key[16]);
+uint64_t hwdb_index_lookup(const char *map, uint64_t size, const struct trie_index_f *index, const char *search);
+int hwdb_index_write(FILE *f, const HwdbIndexEntry *entries, size_t n_entries, uint64_t *ret_off, uint64_t *ret_len);
+void hwdb_index_entries_free(HwdbIndexEntry *entries, size_t n_entries);
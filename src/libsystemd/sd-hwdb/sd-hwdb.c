@@ -32,11 +32,27 @@ struct sd_hwdb {
                 const char *map;
         };
 
+        const struct trie_index_f *index;
+
         OrderedHashmap *properties;
         Iterator properties_iterator;
         bool properties_modified;
+
+        Hashmap *cache;
 };
 
+/* The result of a lookup, as the list of value entries in the order they were added to the properties. The modalias
+ * is stored right behind the entries, and serves as the key in the cache. */
+typedef struct HwdbCacheEntry {
+        size_t n_entries;
+        const struct trie_value_entry_f *entries[];
+} HwdbCacheEntry;
+
+/* Lookups are memoized per modalias. During coldplug the same modaliases are looked up over and over, and the trie
+ * search walks every glob match below the path, which is the expensive part. The cache is simply dropped when it is
+ * full. */
+#define HWDB_CACHE_MAX 4096U
+
 struct linebuf {
         char bytes[LINE_MAX];
         size_t size;
@@ -227,12 +243,36 @@ static int trie_fnmatch_f(sd_hwdb *hwdb, const struct trie_node_f *node, size_t
         return 0;
 }
 
+static const struct trie_node_f *trie_index_lookup_f(sd_hwdb *hwdb, const char *search) {
+        uint64_t off;
+
+        if (!hwdb->index)
+                return NULL;
+
+        off = hwdb_index_lookup(hwdb->map, hwdb->st.st_size, hwdb->index, search);
+        if (off == 0)
+                return NULL;
+
+        return (const struct trie_node_f *) (hwdb->map + off);
+}
+
 static int trie_search_f(sd_hwdb *hwdb, const char *search) {
         struct linebuf buf;
         const struct trie_node_f *node;
         size_t i = 0;
         int err;
 
+        /* Literal keys without any glob on their way through the trie match nothing but themselves */
+        node = trie_index_lookup_f(hwdb, search);
+        if (node) {
+                for (i = 0; i < le64toh(node->values_count); i++) {
+                        err = hwdb_add_property(hwdb, trie_node_value(hwdb, node, i));
+                        if (err < 0)
+                                return err;
+                }
+                return 0;
+        }
+
         linebuf_init(&buf);
 
         node = trie_node_from_off(hwdb, hwdb->head->nodes_root_off);
@@ -356,6 +396,22 @@ _public_ int sd_hwdb_new(sd_hwdb **ret) {
         log_debug("strings           %8"PRIu64" bytes", le64toh(hwdb->head->strings_len));
         log_debug("nodes             %8"PRIu64" bytes", le64toh(hwdb->head->nodes_len));
 
+        if (le64toh(hwdb->head->header_size) >= offsetof(struct trie_header_f, index_len) + sizeof(le64_t) &&
+            hwdb->head->index_off != 0) {
+                uint64_t off = le64toh(hwdb->head->index_off), len = le64toh(hwdb->head->index_len);
+                const struct trie_index_f *index = (const struct trie_index_f *) (hwdb->map + off);
+
+                if (len < sizeof(struct trie_index_f) || off > (uint64_t) hwdb->st.st_size || len > hwdb->st.st_size - off ||
+                    le64toh(index->n_buckets) == 0 || (le64toh(index->n_buckets) & (le64toh(index->n_buckets) - 1)) != 0 ||
+                    le64toh(index->bucket_size) < sizeof(struct trie_index_bucket_f) ||
+                    le64toh(index->n_buckets) > (len - sizeof(struct trie_index_f)) / le64toh(index->bucket_size))
+                        log_debug("ignoring invalid index of literal keys in %s", hwdb_bin_path);
+                else {
+                        hwdb->index = index;
+                        log_debug("literal key index %8"PRIu64" bytes", len);
+                }
+        }
+
         *ret = TAKE_PTR(hwdb);
 
         return 0;
@@ -375,6 +431,7 @@ _public_ sd_hwdb *sd_hwdb_unref(sd_hwdb *hwdb) {
                         munmap((void *)hwdb->map, hwdb->st.st_size);
                 safe_fclose(hwdb->f);
                 ordered_hashmap_free(hwdb->properties);
+                hashmap_free_free(hwdb->cache);
                 free(hwdb);
         }
 
@@ -406,14 +463,78 @@ bool hwdb_validate(sd_hwdb *hwdb) {
         return false;
 }
 
+static int cache_put(sd_hwdb *hwdb, const char *modalias) {
+        _cleanup_free_ HwdbCacheEntry *c = NULL;
+        const struct trie_value_entry_f *entry;
+        size_t n;
+        char *key;
+        Iterator i;
+        int r;
+
+        if (hashmap_size(hwdb->cache) >= HWDB_CACHE_MAX)
+                hashmap_clear_free(hwdb->cache);
+
+        r = hashmap_ensure_allocated(&hwdb->cache, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        n = ordered_hashmap_size(hwdb->properties);
+        c = malloc(offsetof(HwdbCacheEntry, entries) + n * sizeof(c->entries[0]) + strlen(modalias) + 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->n_entries = 0;
+        ORDERED_HASHMAP_FOREACH(entry, hwdb->properties, i)
+                c->entries[c->n_entries++] = entry;
+
+        key = strcpy((char *) (c->entries + n), modalias);
+
+        r = hashmap_put(hwdb->cache, key, c);
+        if (r < 0)
+                return r;
+
+        c = NULL;
+
+        return 0;
+}
+
 static int properties_prepare(sd_hwdb *hwdb, const char *modalias) {
+        HwdbCacheEntry *c;
+        int r;
+
         assert(hwdb);
         assert(modalias);
 
         ordered_hashmap_clear(hwdb->properties);
         hwdb->properties_modified = true;
 
-        return trie_search_f(hwdb, modalias);
+        c = hashmap_get(hwdb->cache, modalias);
+        if (c) {
+                size_t i;
+
+                if (c->n_entries > 0) {
+                        r = ordered_hashmap_ensure_allocated(&hwdb->properties, &string_hash_ops);
+                        if (r < 0)
+                                return r;
+                }
+
+                for (i = 0; i < c->n_entries; i++) {
+                        r = ordered_hashmap_put(hwdb->properties, trie_string(hwdb, c->entries[i]->key_off) + 1, (void *) c->entries[i]);
+                        if (r < 0)
+                                return r;
+                }
+
+                return 0;
+        }
+
+        r = trie_search_f(hwdb, modalias);
+        if (r < 0)
+                return r;
+
+        /* Failing to remember the result is not fatal */
+        (void) cache_put(hwdb, modalias);
+
+        return 0;
 }
 
 _public_ int sd_hwdb_get(sd_hwdb *hwdb, const char *modalias, const char *key, const char **_value) {
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "hwdb-internal.h"
+#include "string-util.h"
+
+static const char *keys[] = {
+        "usb:v1D6Bp0001",
+        "usb:v1D6Bp0002",
+        "usb:v1D6Bp0003",
+        "input:b0003v046Dp C52B",
+        "acpi:PNP0A03:",
+};
+
+/* Room for the nodes the buckets point to, as the trie would be in front of the index in hwdb.bin */
+#define NODES_SIZE 256U
+static const char nodes[NODES_SIZE] = {};
+
+static struct trie_index_bucket_f *find_bucket(char *map, const struct trie_index_f *index, const char *key) {
+        char *buckets = (char *) index + sizeof(struct trie_index_f);
+        uint64_t i;
+
+        for (i = 0; i < le64toh(index->n_buckets); i++) {
+                struct trie_index_bucket_f *b = (struct trie_index_bucket_f *) (buckets + i * le64toh(index->bucket_size));
+
+                if (b->key_off != 0 && streq(map + le64toh(b->key_off), key))
+                        return b;
+        }
+
+        return NULL;
+}
+
+static void test_index(void) {
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *map = NULL;
+        HwdbIndexEntry entries[ELEMENTSOF(keys)];
+        const struct trie_index_f *index;
+        struct trie_index_bucket_f *b;
+        uint64_t off, len;
+        size_t size, i;
+
+        for (i = 0; i < ELEMENTSOF(keys); i++)
+                entries[i] = (HwdbIndexEntry) {
+                        .key = (char *) keys[i],
+                        .node_off = 8 + i * sizeof(struct trie_node_f),
+                };
+
+        assert_se(f = open_memstream(&map, &size));
+        assert_se(fwrite(nodes, sizeof(nodes), 1, f) == 1);
+        assert_se(hwdb_index_write(f, entries, ELEMENTSOF(entries), &off, &len) >= 0);
+        f = safe_fclose(f);
+
+        assert_se(off % 8 == 0);
+        assert_se(off + len == size);
+        index = (const struct trie_index_f *) (map + off);
+        assert_se(le64toh(index->n_buckets) >= 2 * ELEMENTSOF(keys));
+
+        for (i = 0; i < ELEMENTSOF(keys); i++)
+                assert_se(hwdb_index_lookup(map, size, index, keys[i]) == entries[i].node_off);
+
+        assert_se(hwdb_index_lookup(map, size, index, "usb:v1D6Bp0004") == 0);
+        assert_se(hwdb_index_lookup(map, size, index, "usb:v1D6Bp000") == 0);
+        assert_se(hwdb_index_lookup(map, size, index, "") == 0);
+
+        /* Offsets pointing outside of the file must not be followed */
+        assert_se(b = find_bucket(map, index, keys[0]));
+        b->node_off = htole64(size);
+        assert_se(hwdb_index_lookup(map, size, index, keys[0]) == 0);
+        b->node_off = htole64(size - sizeof(struct trie_node_f) + 1);
+        assert_se(hwdb_index_lookup(map, size, index, keys[0]) == 0);
+        b->node_off = htole64(UINT64_MAX);
+        assert_se(hwdb_index_lookup(map, size, index, keys[0]) == 0);
+        b->node_off = htole64(entries[0].node_off);
+        assert_se(hwdb_index_lookup(map, size, index, keys[0]) == entries[0].node_off);
+
+        assert_se(b = find_bucket(map, index, keys[1]));
+        off = le64toh(b->key_off);
+        b->key_off = htole64(size);
+        assert_se(hwdb_index_lookup(map, size, index, keys[1]) == 0);
+        b->key_off = htole64(UINT64_MAX);
+        assert_se(hwdb_index_lookup(map, size, index, keys[1]) == 0);
+
+        /* A key which isn't terminated before the end of the file. The keys are written in order, hence all
+         * others are terminated in front of the last one. */
+        b->key_off = htole64(off);
+        assert_se(hwdb_index_lookup(map, size, index, keys[1]) == entries[1].node_off);
+
+        assert_se(b = find_bucket(map, index, keys[ELEMENTSOF(keys) - 1]));
+        off = le64toh(b->key_off);
+        assert_se(hwdb_index_lookup(map, off + strlen(keys[ELEMENTSOF(keys) - 1]) + 1, index, keys[ELEMENTSOF(keys) - 1]) == entries[ELEMENTSOF(keys) - 1].node_off);
+        assert_se(hwdb_index_lookup(map, off + strlen(keys[ELEMENTSOF(keys) - 1]), index, keys[ELEMENTSOF(keys) - 1]) == 0);
+}
+
+int main(int argc, char *argv[]) {
+        test_index();
+
+        return 0;
+}
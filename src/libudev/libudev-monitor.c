@@ -17,6 +17,7 @@
 #include "fd-util.h"
 #include "fileio.h"
 #include "format-util.h"
+#include "io-util.h"
 #include "libudev-private.h"
 #include "missing.h"
 #include "mount-util.h"
@@ -45,6 +46,7 @@ struct udev_monitor {
         socklen_t addrlen;
         struct udev_list filter_subsystem_list;
         struct udev_list filter_tag_list;
+        struct udev_monitor_batch *batch;
         bool bound;
 };
 
@@ -78,6 +80,26 @@ struct udev_monitor_netlink_header {
         unsigned int filter_tag_bloom_lo;
 };
 
+union udev_monitor_buffer {
+        struct udev_monitor_netlink_header nlh;
+        char raw[8192];
+};
+
+union udev_monitor_cred_buffer {
+        struct cmsghdr cmsghdr;
+        uint8_t buf[CMSG_SPACE(sizeof(struct ucred))];
+};
+
+/* Everything needed to receive UDEV_MONITOR_BATCH_MAX messages with one recvmmsg() call. This is a quarter of a
+ * megabyte, hence it is only allocated for the monitors that actually use it. */
+struct udev_monitor_batch {
+        struct mmsghdr msgs[UDEV_MONITOR_BATCH_MAX];
+        struct iovec iovs[UDEV_MONITOR_BATCH_MAX];
+        union sockaddr_union addrs[UDEV_MONITOR_BATCH_MAX];
+        union udev_monitor_cred_buffer creds[UDEV_MONITOR_BATCH_MAX];
+        union udev_monitor_buffer bufs[UDEV_MONITOR_BATCH_MAX];
+};
+
 static struct udev_monitor *udev_monitor_new(struct udev *udev) {
         struct udev_monitor *udev_monitor;
 
@@ -475,6 +497,7 @@ _public_ struct udev_monitor *udev_monitor_unref(struct udev_monitor *udev_monit
                 close(udev_monitor->sock);
         udev_list_cleanup(&udev_monitor->filter_subsystem_list);
         udev_list_cleanup(&udev_monitor->filter_tag_list);
+        free(udev_monitor->batch);
         return mfree(udev_monitor);
 }
 
@@ -546,88 +569,43 @@ tag:
         return 0;
 }
 
-/**
- * udev_monitor_receive_device:
- * @udev_monitor: udev monitor
- *
- * Receive data from the udev monitor socket, allocate a new udev
- * device, fill in the received data, and return the device.
- *
- * Only socket connections with uid=0 are accepted.
- *
- * The monitor socket is by default set to NONBLOCK. A variant of poll() on
- * the file descriptor returned by udev_monitor_get_fd() should to be used to
- * wake up when new devices arrive, or alternatively the file descriptor
- * switched into blocking mode.
- *
- * The initial refcount is 1, and needs to be decremented to
- * release the resources of the udev device.
- *
- * Returns: a new udev device, or #NULL, in case of an error
- **/
-_public_ struct udev_device *udev_monitor_receive_device(struct udev_monitor *udev_monitor)
-{
+/* Checks the sender and the header of a received message and creates the device from it. Returns NULL with errno
+ * set to EAGAIN for messages which are to be ignored. */
+static struct udev_device *monitor_device_from_message(struct udev_monitor *udev_monitor,
+                                                       struct msghdr *smsg,
+                                                       const union sockaddr_union *snl,
+                                                       union udev_monitor_buffer *buf,
+                                                       ssize_t buflen) {
         struct udev_device *udev_device;
-        struct msghdr smsg;
-        struct iovec iov;
-        char cred_msg[CMSG_SPACE(sizeof(struct ucred))];
         struct cmsghdr *cmsg;
-        union sockaddr_union snl;
         struct ucred *cred;
-        union {
-                struct udev_monitor_netlink_header nlh;
-                char raw[8192];
-        } buf;
-        ssize_t buflen;
         ssize_t bufpos;
         bool is_initialized = false;
 
-retry:
-        if (udev_monitor == NULL) {
-                errno = EINVAL;
-                return NULL;
-        }
-        iov.iov_base = &buf;
-        iov.iov_len = sizeof(buf);
-        memzero(&smsg, sizeof(struct msghdr));
-        smsg.msg_iov = &iov;
-        smsg.msg_iovlen = 1;
-        smsg.msg_control = cred_msg;
-        smsg.msg_controllen = sizeof(cred_msg);
-        smsg.msg_name = &snl;
-        smsg.msg_namelen = sizeof(snl);
-
-        buflen = recvmsg(udev_monitor->sock, &smsg, 0);
-        if (buflen < 0) {
-                if (errno != EINTR)
-                        log_debug("unable to receive message");
-                return NULL;
-        }
-
-        if (buflen < 32 || (smsg.msg_flags & MSG_TRUNC)) {
+        if (buflen < 32 || (smsg->msg_flags & MSG_TRUNC)) {
                 log_debug("invalid message length");
                 errno = EINVAL;
                 return NULL;
         }
 
-        if (snl.nl.nl_groups == 0) {
+        if (snl->nl.nl_groups == 0) {
                 /* unicast message, check if we trust the sender */
                 if (udev_monitor->snl_trusted_sender.nl.nl_pid == 0 ||
-                    snl.nl.nl_pid != udev_monitor->snl_trusted_sender.nl.nl_pid) {
+                    snl->nl.nl_pid != udev_monitor->snl_trusted_sender.nl.nl_pid) {
                         log_debug("unicast netlink message ignored");
                         errno = EAGAIN;
                         return NULL;
                 }
-        } else if (snl.nl.nl_groups == UDEV_MONITOR_KERNEL) {
-                if (snl.nl.nl_pid > 0) {
+        } else if (snl->nl.nl_groups == UDEV_MONITOR_KERNEL) {
+                if (snl->nl.nl_pid > 0) {
                         log_debug("multicast kernel netlink message from PID %"PRIu32" ignored",
-                                  snl.nl.nl_pid);
+                                  snl->nl.nl_pid);
                         errno = EAGAIN;
                         return NULL;
                 }
         }
 
-        cmsg = CMSG_FIRSTHDR(&smsg);
+        cmsg = CMSG_FIRSTHDR(smsg);
         if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
                 log_debug("no sender credentials received, message ignored");
                 errno = EAGAIN;
@@ -641,28 +619,28 @@ retry:
                 return NULL;
         }
 
-        if (memcmp(buf.raw, "libudev", 8) == 0) {
+        if (memcmp(buf->raw, "libudev", 8) == 0) {
                 /* udev message needs proper version magic */
-                if (buf.nlh.magic != htobe32(UDEV_MONITOR_MAGIC)) {
+                if (buf->nlh.magic != htobe32(UDEV_MONITOR_MAGIC)) {
                         log_debug("unrecognized message signature (%x != %x)",
-                                 buf.nlh.magic, htobe32(UDEV_MONITOR_MAGIC));
+                                 buf->nlh.magic, htobe32(UDEV_MONITOR_MAGIC));
                         errno = EAGAIN;
                         return NULL;
                 }
-                if (buf.nlh.properties_off+32 > (size_t)buflen) {
+                if (buf->nlh.properties_off+32 > (size_t)buflen) {
                         log_debug("message smaller than expected (%u > %zd)",
-                                  buf.nlh.properties_off+32, buflen);
+                                  buf->nlh.properties_off+32, buflen);
                         errno = EAGAIN;
                         return NULL;
                 }
 
-                bufpos = buf.nlh.properties_off;
+                bufpos = buf->nlh.properties_off;
 
                 /* devices received from udev are always initialized */
                 is_initialized = true;
         } else {
                 /* kernel message with header */
-                bufpos = strlen(buf.raw) + 1;
+                bufpos = strnlen(buf->raw, buflen) + 1;
                 if ((size_t)bufpos < sizeof("a@/d") || bufpos >= buflen) {
                         log_debug("invalid message length");
                         errno = EAGAIN;
@@ -670,14 +648,14 @@ retry:
                 }
 
                 /* check message header */
-                if (strstr(buf.raw, "@/") == NULL) {
+                if (strstr(buf->raw, "@/") == NULL) {
                         log_debug("unrecognized message header");
                         errno = EAGAIN;
                         return NULL;
                 }
         }
 
-        udev_device = udev_device_new_from_nulstr(udev_monitor->udev, &buf.raw[bufpos], buflen - bufpos);
+        udev_device = udev_device_new_from_nulstr(udev_monitor->udev, &buf->raw[bufpos], buflen - bufpos);
         if (!udev_device) {
                 log_debug_errno(errno, "could not create device: %m");
                 return NULL;
@@ -686,6 +664,64 @@ retry:
         if (is_initialized)
                 udev_device_set_is_initialized(udev_device);
 
+        return udev_device;
+}
+
+/**
+ * udev_monitor_receive_device:
+ * @udev_monitor: udev monitor
+ *
+ * Receive data from the udev monitor socket, allocate a new udev
+ * device, fill in the received data, and return the device.
+ *
+ * Only socket connections with uid=0 are accepted.
+ *
+ * The monitor socket is by default set to NONBLOCK. A variant of poll() on
+ * the file descriptor returned by udev_monitor_get_fd() should to be used to
+ * wake up when new devices arrive, or alternatively the file descriptor
+ * switched into blocking mode.
+ *
+ * The initial refcount is 1, and needs to be decremented to
+ * release the resources of the udev device.
+ *
+ * Returns: a new udev device, or #NULL, in case of an error
+ **/
+_public_ struct udev_device *udev_monitor_receive_device(struct udev_monitor *udev_monitor)
+{
+        struct udev_device *udev_device;
+        struct msghdr smsg;
+        struct iovec iov;
+        union udev_monitor_cred_buffer cred_msg;
+        union sockaddr_union snl;
+        union udev_monitor_buffer buf;
+        ssize_t buflen;
+
+retry:
+        if (udev_monitor == NULL) {
+                errno = EINVAL;
+                return NULL;
+        }
+        iov.iov_base = &buf;
+        iov.iov_len = sizeof(buf);
+        memzero(&smsg, sizeof(struct msghdr));
+        smsg.msg_iov = &iov;
+        smsg.msg_iovlen = 1;
+        smsg.msg_control = &cred_msg;
+        smsg.msg_controllen = sizeof(cred_msg);
+        smsg.msg_name = &snl;
+        smsg.msg_namelen = sizeof(snl);
+
+        buflen = recvmsg(udev_monitor->sock, &smsg, 0);
+        if (buflen < 0) {
+                if (errno != EINTR)
+                        log_debug("unable to receive message");
+                return NULL;
+        }
+
+        udev_device = monitor_device_from_message(udev_monitor, &smsg, &snl, &buf, buflen);
+        if (!udev_device)
+                return NULL;
+
         /* skip device, if it does not pass the current filter */
         if (!passes_filter(udev_monitor, udev_device)) {
                 struct pollfd pfd[1];
@@ -707,6 +743,67 @@ retry:
         return udev_device;
 }
 
+/* Receives up to n (but at most UDEV_MONITOR_BATCH_MAX) queued messages with a single system call, and stores the
+ * devices created from them in ret. Messages which are invalid, come from an untrusted sender or don't pass the
+ * filter are skipped. Never blocks. Returns the number of devices stored, which might be zero even if messages were
+ * read, or -EAGAIN if nothing was queued. */
+int udev_monitor_receive_devices(struct udev_monitor *udev_monitor, struct udev_device **ret, size_t n) {
+        struct udev_monitor_batch *b;
+        size_t i, k = 0;
+        int r;
+
+        assert_return(udev_monitor, -EINVAL);
+        assert_return(ret, -EINVAL);
+
+        if (n == 0)
+                return 0;
+        n = MIN(n, (size_t) UDEV_MONITOR_BATCH_MAX);
+
+        if (!udev_monitor->batch) {
+                udev_monitor->batch = malloc(sizeof(struct udev_monitor_batch));
+                if (!udev_monitor->batch)
+                        return -ENOMEM;
+        }
+        b = udev_monitor->batch;
+
+        /* The kernel updates the lengths, hence the headers need to be reset on each call */
+        for (i = 0; i < n; i++) {
+                b->iovs[i] = IOVEC_MAKE(&b->bufs[i], sizeof(b->bufs[i]));
+                b->msgs[i] = (struct mmsghdr) {
+                        .msg_hdr = {
+                                .msg_iov = &b->iovs[i],
+                                .msg_iovlen = 1,
+                                .msg_control = &b->creds[i],
+                                .msg_controllen = sizeof(b->creds[i]),
+                                .msg_name = &b->addrs[i],
+                                .msg_namelen = sizeof(b->addrs[i]),
+                        },
+                };
+        }
+
+        r = recvmmsg(udev_monitor->sock, b->msgs, n, MSG_DONTWAIT, NULL);
+        if (r < 0)
+                return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+
+        for (i = 0; i < (size_t) r; i++) {
+                struct udev_device *udev_device;
+
+                udev_device = monitor_device_from_message(udev_monitor, &b->msgs[i].msg_hdr, &b->addrs[i],
+                                                          &b->bufs[i], b->msgs[i].msg_len);
+                if (!udev_device)
+                        continue;
+
+                if (!passes_filter(udev_monitor, udev_device)) {
+                        udev_device_unref(udev_device);
+                        continue;
+                }
+
+                ret[k++] = udev_device;
+        }
+
+        return (int) k;
+}
+
 int udev_monitor_send_device(struct udev_monitor *udev_monitor,
                              struct udev_monitor *destination, struct udev_device *udev_device)
 {
@@ -52,6 +52,9 @@ bool udev_device_get_db_persist(struct udev_device *udev_device);
 void udev_device_set_db_persist(struct udev_device *udev_device);
 void udev_device_read_db(struct udev_device *udev_device);
 
+/* libudev-enumerate.c */
+int udev_enumerate_set_n_threads(struct udev_enumerate *udev_enumerate, unsigned n_threads);
+
 /* libudev-device-private.c */
 int udev_device_update_db(struct udev_device *udev_device);
 int udev_device_delete_db(struct udev_device *udev_device);
@@ -62,6 +65,8 @@ int udev_monitor_disconnect(struct udev_monitor *udev_monitor);
 int udev_monitor_allow_unicast_sender(struct udev_monitor *udev_monitor, struct udev_monitor *sender);
 int udev_monitor_send_device(struct udev_monitor *udev_monitor,
                              struct udev_monitor *destination, struct udev_device *udev_device);
+#define UDEV_MONITOR_BATCH_MAX 32
+int udev_monitor_receive_devices(struct udev_monitor *udev_monitor, struct udev_device **ret, size_t n);
 struct udev_monitor *udev_monitor_new_from_netlink_fd(struct udev *udev, const char *name, int fd);
 
 /* libudev-list.c */
@@ -5,15 +5,23 @@
 #include <nss.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "sd-bus.h"
 
+#include "alloc-util.h"
 #include "bus-common-errors.h"
+#include "fd-util.h"
 #include "in-addr-util.h"
 #include "macro.h"
 #include "nss-util.h"
+#include "random-util.h"
 #include "resolved-def.h"
+#include "socket-util.h"
 #include "string-util.h"
+#include "strv.h"
+#include "time-util.h"
 #include "util.h"
 #include "signal-util.h"
 
@@ -27,94 +35,172 @@ static bool bus_error_shall_fallback(sd_bus_error *e) {
                sd_bus_error_has_name(e, SD_BUS_ERROR_ACCESS_DENIED);
 }
 
-static int count_addresses(sd_bus_message *m, int af, const char **canonical) {
-        int c = 0, r;
+typedef struct ResolvedAddress {
+        int ifindex;
+        int family;
+        union in_addr_union address;
+} ResolvedAddress;
+
+static int query_socket_send_request(int fd, uint8_t type, int family, const void *data, size_t size, uint32_t *ret_id) {
+        ResolvedQueryRequest req = {
+                .id = random_u32(),
+                .type = type,
+                .family = family,
+        };
+        struct iovec iov[2] = {
+                { .iov_base = &req, .iov_len = sizeof(req) },
+                { .iov_base = (void*) data, .iov_len = size },
+        };
+        struct msghdr mh = {
+                .msg_iov = iov,
+                .msg_iovlen = ELEMENTSOF(iov),
+        };
+
+        assert(fd >= 0);
+        assert(data);
+        assert(ret_id);
+
+        /* Returns 0 if resolved closed the connection already */
+
+        if (sendmsg(fd, &mh, MSG_NOSIGNAL) < 0)
+                return IN_SET(errno, ECONNRESET, EPIPE) ? 0 : -errno;
+
+        *ret_id = req.id;
+        return 1;
+}
 
-        assert(m);
-        assert(canonical);
+static int query_socket_receive_reply(int fd, uint32_t id, uint8_t **ret_reply, size_t *ret_size) {
+        _cleanup_free_ uint8_t *buf = NULL;
 
-        r = sd_bus_message_enter_container(m, 'a', "(iiay)");
-        if (r < 0)
-                return r;
+        assert(fd >= 0);
+        assert(ret_reply);
+        assert(ret_size);
 
-        while ((r = sd_bus_message_enter_container(m, 'r', "iiay")) > 0) {
-                int family, ifindex;
+        /* Returns 0 if resolved closed the connection without a reply */
 
-                assert_cc(sizeof(int32_t) == sizeof(int));
+        buf = malloc(SD_RESOLVED_QUERY_MESSAGE_MAX);
+        if (!buf)
+                return -ENOMEM;
 
-                r = sd_bus_message_read(m, "ii", &ifindex, &family);
-                if (r < 0)
-                        return r;
+        for (;;) {
+                ResolvedQueryReply reply;
+                ssize_t l;
 
-                r = sd_bus_message_skip(m, "ay");
-                if (r < 0)
-                        return r;
+                l = recv(fd, buf, SD_RESOLVED_QUERY_MESSAGE_MAX, 0);
+                if (l < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN)
+                                return -ETIMEDOUT;
+                        if (errno == ECONNRESET)
+                                return 0;
 
-                r = sd_bus_message_exit_container(m);
-                if (r < 0)
-                        return r;
+                        return -errno;
+                }
+                if (l == 0)
+                        return 0;
 
-                if (af != AF_UNSPEC && family != af)
-                        continue;
+                if ((size_t) l < sizeof(reply))
+                        return -EBADMSG;
 
-                c++;
+                memcpy(&reply, buf, sizeof(reply));
+                if (reply.id != id)
+                        return -EBADMSG;
+
+                *ret_reply = TAKE_PTR(buf);
+                *ret_size = l;
+                return 1;
         }
-        if (r < 0)
-                return r;
+}
 
-        r = sd_bus_message_exit_container(m);
-        if (r < 0)
-                return r;
+static int query_socket_call(const char *path, uint8_t type, int family, const void *data, size_t size, uint8_t **ret_reply, size_t *ret_size) {
+        union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+        };
+        _cleanup_close_ int fd = -1;
+        struct timeval tv;
+        uint32_t id;
+        int r;
+
+        assert(path);
+        assert(data);
+        assert(ret_reply);
+        assert(ret_size);
+
+        /* Sends a single request to resolved's query socket and waits for its reply. This saves us the round trips
+         * to the bus broker. Returns 0 if the socket cannot be used (for example, because resolved is an older
+         * version, or is not running, or we are not allowed to connect, or resolved closed the connection without
+         * a reply), in which case the caller should use the bus instead. */
+
+        if (strlen(path) >= sizeof(sa.un.sun_path))
+                return -EINVAL;
+        strncpy(sa.un.sun_path, path, sizeof(sa.un.sun_path));
+
+        fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                return 0;
 
-        r = sd_bus_message_read(m, "s", canonical);
-        if (r < 0)
-                return r;
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, timeval_store(&tv, SD_RESOLVED_QUERY_TIMEOUT_USEC), sizeof(tv)) < 0)
+                return 0;
 
-        r = sd_bus_message_rewind(m, true);
-        if (r < 0)
+        if (connect(fd, &sa.sa, SOCKADDR_UN_LEN(sa.un)) < 0)
+                return 0;
+
+        r = query_socket_send_request(fd, type, family, data, size, &id);
+        if (r <= 0)
                 return r;
 
-        return c;
+        return query_socket_receive_reply(fd, id, ret_reply, ret_size);
 }
 
-static uint32_t ifindex_to_scopeid(int family, const void *a, int ifindex) {
-        struct in6_addr in6;
+static enum nss_status query_socket_reply_check(const uint8_t *p, ResolvedQueryReply *ret, int *errnop, int *h_errnop) {
+        assert(p);
+        assert(ret);
 
-        if (family != AF_INET6)
-                return 0;
+        memcpy(ret, p, sizeof(*ret));
 
-        /* Some apps can't deal with the scope ID attached to non-link-local addresses. Hence, let's suppress that. */
+        switch (ret->status) {
 
-        assert(sizeof(in6) == FAMILY_ADDRESS_SIZE(AF_INET6));
-        memcpy(&in6, a, sizeof(struct in6_addr));
+        case SD_RESOLVED_QUERY_SUCCESS:
+                return NSS_STATUS_SUCCESS;
 
-        return IN6_IS_ADDR_LINKLOCAL(&in6) ? ifindex : 0;
+        case SD_RESOLVED_QUERY_NXDOMAIN:
+                *errnop = ESRCH;
+                *h_errnop = HOST_NOT_FOUND;
+                return NSS_STATUS_NOTFOUND;
+
+        case SD_RESOLVED_QUERY_FAILED:
+                /* Like with the bus, resolved talked to us, but the lookup failed. This includes DNSSEC errors and
+                 * suchlike. */
+                *errnop = ret->error > 0 ? ret->error : EIO;
+                *h_errnop = NO_RECOVERY;
+                return NSS_STATUS_NOTFOUND;
+
+        default:
+                *errnop = EBADMSG;
+                *h_errnop = NO_RECOVERY;
+                return NSS_STATUS_UNAVAIL;
+        }
 }
 
-enum nss_status _nss_resolve_gethostbyname4_r(
+static enum nss_status bus_resolve_hostname(
                 const char *name,
-                struct gaih_addrtuple **pat,
-                char *buffer, size_t buflen,
-                int *errnop, int *h_errnop,
-                int32_t *ttlp) {
+                int af,
+                ResolvedAddress **ret_addresses,
+                unsigned *ret_n_addresses,
+                char **ret_canonical,
+                int *errnop, int *h_errnop) {
 
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *req = NULL, *reply = NULL;
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
-        struct gaih_addrtuple *r_tuple, *r_tuple_first = NULL;
         _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        _cleanup_free_ ResolvedAddress *addresses = NULL;
         enum nss_status ret = NSS_STATUS_UNAVAIL;
-        const char *canonical = NULL;
-        size_t l, ms, idx;
-        char *r_name;
-        int c, r, i = 0;
-
-        BLOCK_SIGNALS(NSS_SIGNALS_BLOCK);
-
-        assert(name);
-        assert(pat);
-        assert(buffer);
-        assert(errnop);
-        assert(h_errnop);
+        size_t allocated = 0;
+        const char *canonical;
+        unsigned n = 0;
+        char *c;
+        int r;
 
         r = sd_bus_open_system(&bus);
         if (r < 0)
@@ -134,7 +220,7 @@ enum nss_status _nss_resolve_gethostbyname4_r(
         if (r < 0)
                 goto fail;
 
-        r = sd_bus_message_append(req, "isit", 0, name, AF_UNSPEC, (uint64_t) 0);
+        r = sd_bus_message_append(req, "isit", 0, name, af, (uint64_t) 0);
         if (r < 0)
                 goto fail;
 
@@ -157,36 +243,6 @@ enum nss_status _nss_resolve_gethostbyname4_r(
                 goto fail;
         }
 
-        c = count_addresses(reply, AF_UNSPEC, &canonical);
-        if (c < 0) {
-                r = c;
-                goto fail;
-        }
-        if (c == 0) {
-                *errnop = ESRCH;
-                *h_errnop = HOST_NOT_FOUND;
-                return NSS_STATUS_NOTFOUND;
-        }
-
-        if (isempty(canonical))
-                canonical = name;
-
-        l = strlen(canonical);
-        ms = ALIGN(l+1) + ALIGN(sizeof(struct gaih_addrtuple)) * c;
-        if (buflen < ms) {
-                *errnop = ERANGE;
-                *h_errnop = NETDB_INTERNAL;
-                return NSS_STATUS_TRYAGAIN;
-        }
-
-        /* First, append name */
-        r_name = buffer;
-        memcpy(r_name, canonical, l+1);
-        idx = ALIGN(l+1);
-
-        /* Second, append addresses */
-        r_tuple_first = (struct gaih_addrtuple*) (buffer + idx);
-
         r = sd_bus_message_enter_container(reply, 'a', "(iiay)");
         if (r < 0)
                 goto fail;
@@ -223,35 +279,38 @@ enum nss_status _nss_resolve_gethostbyname4_r(
                         goto fail;
                 }
 
-                r_tuple = (struct gaih_addrtuple*) (buffer + idx);
-                r_tuple->next = i == c-1 ? NULL : (struct gaih_addrtuple*) ((char*) r_tuple + ALIGN(sizeof(struct gaih_addrtuple)));
-                r_tuple->name = r_name;
-                r_tuple->family = family;
-                r_tuple->scopeid = ifindex_to_scopeid(family, a, ifindex);
-                memcpy(r_tuple->addr, a, sz);
+                if (!GREEDY_REALLOC(addresses, allocated, n + 1)) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
 
-                idx += ALIGN(sizeof(struct gaih_addrtuple));
-                i++;
+                addresses[n] = (ResolvedAddress) {
+                        .ifindex = ifindex,
+                        .family = family,
+                };
+                memcpy(&addresses[n].address, a, sz);
+                n++;
         }
         if (r < 0)
                 goto fail;
 
-        assert(i == c);
-        assert(idx == ms);
-
-        if (*pat)
-                **pat = *r_tuple_first;
-        else
-                *pat = r_tuple_first;
+        r = sd_bus_message_exit_container(reply);
+        if (r < 0)
+                goto fail;
 
-        if (ttlp)
-                *ttlp = 0;
+        r = sd_bus_message_read(reply, "s", &canonical);
+        if (r < 0)
+                goto fail;
 
-        /* Explicitly reset all error variables */
-        *errnop = 0;
-        *h_errnop = NETDB_SUCCESS;
-        h_errno = 0;
+        c = strdup(canonical);
+        if (!c) {
+                r = -ENOMEM;
+                goto fail;
+        }
 
+        *ret_addresses = TAKE_PTR(addresses);
+        *ret_n_addresses = n;
+        *ret_canonical = c;
         return NSS_STATUS_SUCCESS;
 
 fail:
@@ -260,39 +319,134 @@ fail:
         return ret;
 }
 
-enum nss_status _nss_resolve_gethostbyname3_r(
+/* Parses the items of a successful reply to a hostname lookup */
+static int query_socket_parse_hostname_reply(
+                const uint8_t *buf,
+                size_t size,
+                ResolvedAddress **ret_addresses,
+                unsigned *ret_n_addresses,
+                char **ret_canonical) {
+
+        _cleanup_free_ ResolvedAddress *addresses = NULL;
+        ResolvedQueryReply reply;
+        const uint8_t *p;
+        unsigned i, n = 0;
+        char *c;
+
+        assert(buf);
+        assert(size >= sizeof(reply));
+        assert(ret_addresses);
+        assert(ret_n_addresses);
+        assert(ret_canonical);
+
+        memcpy(&reply, buf, sizeof(reply));
+        p = buf + sizeof(reply);
+        size -= sizeof(reply);
+
+        if (size < reply.n_items * sizeof(ResolvedQueryAddress))
+                return -EBADMSG;
+
+        addresses = new(ResolvedAddress, reply.n_items);
+        if (!addresses)
+                return -ENOMEM;
+
+        for (i = 0; i < reply.n_items; i++) {
+                ResolvedQueryAddress a;
+
+                memcpy(&a, p, sizeof(a));
+                p += sizeof(a);
+                size -= sizeof(a);
+
+                if (a.ifindex < 0)
+                        return -EBADMSG;
+
+                if (!IN_SET(a.family, AF_INET, AF_INET6))
+                        continue;
+
+                addresses[n] = (ResolvedAddress) {
+                        .ifindex = a.ifindex,
+                        .family = a.family,
+                };
+                memcpy(&addresses[n].address, a.address, FAMILY_ADDRESS_SIZE(a.family));
+                n++;
+        }
+
+        /* The canonical name takes up the rest of the reply */
+        if (memchr(p, 0, size))
+                return -EBADMSG;
+
+        c = strndup((const char*) p, size);
+        if (!c)
+                return -ENOMEM;
+
+        *ret_addresses = TAKE_PTR(addresses);
+        *ret_n_addresses = n;
+        *ret_canonical = c;
+        return 0;
+}
+
+static enum nss_status resolve_hostname(
                 const char *name,
                 int af,
-                struct hostent *result,
-                char *buffer, size_t buflen,
-                int *errnop, int *h_errnop,
-                int32_t *ttlp,
-                char **canonp) {
+                ResolvedAddress **ret_addresses,
+                unsigned *ret_n_addresses,
+                char **ret_canonical,
+                int *errnop, int *h_errnop) {
 
-        _cleanup_(sd_bus_message_unrefp) sd_bus_message *req = NULL, *reply = NULL;
-        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
-        char *r_name, *r_aliases, *r_addr, *r_addr_list;
-        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
-        enum nss_status ret = NSS_STATUS_UNAVAIL;
-        size_t l, idx, ms, alen;
-        const char *canonical;
-        int c, r, i = 0;
-
-        BLOCK_SIGNALS(NSS_SIGNALS_BLOCK);
+        _cleanup_free_ uint8_t *buf = NULL;
+        ResolvedQueryReply reply;
+        enum nss_status ret;
+        size_t size;
+        int r;
 
         assert(name);
-        assert(result);
-        assert(buffer);
-        assert(errnop);
-        assert(h_errnop);
+        assert(ret_addresses);
+        assert(ret_n_addresses);
+        assert(ret_canonical);
 
-        if (af == AF_UNSPEC)
-                af = AF_INET;
+        /* resolved refuses such names anyway, don't bother it */
+        if (strlen(name) > SD_RESOLVED_QUERY_HOSTNAME_MAX) {
+                *errnop = EINVAL;
+                *h_errnop = NO_RECOVERY;
+                return NSS_STATUS_NOTFOUND;
+        }
 
-        if (!IN_SET(af, AF_INET, AF_INET6)) {
-                r = -EAFNOSUPPORT;
+        r = query_socket_call(SD_RESOLVED_QUERY_SOCKET_PATH, SD_RESOLVED_QUERY_HOSTNAME, af, name, strlen(name), &buf, &size);
+        if (r == 0)
+                return bus_resolve_hostname(name, af, ret_addresses, ret_n_addresses, ret_canonical, errnop, h_errnop);
+        if (r < 0)
                 goto fail;
-        }
+
+        ret = query_socket_reply_check(buf, &reply, errnop, h_errnop);
+        if (ret != NSS_STATUS_SUCCESS)
+                return ret;
+
+        r = query_socket_parse_hostname_reply(buf, size, ret_addresses, ret_n_addresses, ret_canonical);
+        if (r < 0)
+                goto fail;
+
+        return NSS_STATUS_SUCCESS;
+
+fail:
+        /* We sent the request to resolved, but couldn't get a (valid) reply */
+        *errnop = -r;
+        *h_errnop = NO_RECOVERY;
+        return NSS_STATUS_UNAVAIL;
+}
+
+static enum nss_status bus_resolve_address(
+                int af,
+                const void *addr, socklen_t len,
+                char ***ret_names,
+                int *errnop, int *h_errnop) {
+
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *req = NULL, *reply = NULL;
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        enum nss_status ret = NSS_STATUS_UNAVAIL;
+        _cleanup_strv_free_ char **names = NULL;
+        const char *n;
+        int r, ifindex;
 
         r = sd_bus_open_system(&bus);
         if (r < 0)
@@ -304,7 +458,7 @@ enum nss_status _nss_resolve_gethostbyname3_r(
                         "org.freedesktop.resolve1",
                         "/org/freedesktop/resolve1",
                         "org.freedesktop.resolve1.Manager",
-                        "ResolveHostname");
+                        "ResolveAddress");
         if (r < 0)
                 goto fail;
 
@@ -312,7 +466,15 @@ enum nss_status _nss_resolve_gethostbyname3_r(
         if (r < 0)
                 goto fail;
 
-        r = sd_bus_message_append(req, "isit", 0, name, af, (uint64_t) 0);
+        r = sd_bus_message_append(req, "ii", 0, af);
+        if (r < 0)
+                goto fail;
+
+        r = sd_bus_message_append_array(req, 'y', addr, len);
+        if (r < 0)
+                goto fail;
+
+        r = sd_bus_message_append(req, "t", (uint64_t) 0);
         if (r < 0)
                 goto fail;
 
@@ -330,22 +492,263 @@ enum nss_status _nss_resolve_gethostbyname3_r(
                 goto fail;
         }
 
-        c = count_addresses(reply, af, &canonical);
-        if (c < 0) {
-                r = c;
+        r = sd_bus_message_enter_container(reply, 'a', "(is)");
+        if (r < 0)
                 goto fail;
+
+        while ((r = sd_bus_message_read(reply, "(is)", &ifindex, &n)) > 0) {
+
+                if (ifindex < 0) {
+                        r = -EINVAL;
+                        goto fail;
+                }
+
+                r = strv_extend(&names, n);
+                if (r < 0)
+                        goto fail;
+        }
+        if (r < 0)
+                goto fail;
+
+        *ret_names = TAKE_PTR(names);
+        return NSS_STATUS_SUCCESS;
+
+fail:
+        *errnop = -r;
+        *h_errnop = NO_RECOVERY;
+        return ret;
+}
+
+/* Parses the items of a successful reply to an address lookup */
+static int query_socket_parse_address_reply(const uint8_t *buf, size_t size, char ***ret_names) {
+        _cleanup_strv_free_ char **names = NULL;
+        ResolvedQueryReply reply;
+        const uint8_t *p;
+        unsigned i;
+
+        assert(buf);
+        assert(size >= sizeof(reply));
+        assert(ret_names);
+
+        memcpy(&reply, buf, sizeof(reply));
+        p = buf + sizeof(reply);
+        size -= sizeof(reply);
+
+        names = new0(char*, reply.n_items + 1);
+        if (!names)
+                return -ENOMEM;
+
+        for (i = 0; i < reply.n_items; i++) {
+                ResolvedQueryName n;
+
+                if (size < sizeof(n))
+                        return -EBADMSG;
+
+                memcpy(&n, p, sizeof(n));
+                p += sizeof(n);
+                size -= sizeof(n);
+
+                if (n.ifindex < 0 || size < n.length || memchr(p, 0, n.length))
+                        return -EBADMSG;
+
+                names[i] = strndup((const char*) p, n.length);
+                if (!names[i])
+                        return -ENOMEM;
+
+                p += n.length;
+                size -= n.length;
         }
+
+        *ret_names = TAKE_PTR(names);
+        return 0;
+}
+
+static enum nss_status resolve_address(
+                int af,
+                const void *addr, socklen_t len,
+                char ***ret_names,
+                int *errnop, int *h_errnop) {
+
+        _cleanup_free_ uint8_t *buf = NULL;
+        ResolvedQueryReply reply;
+        enum nss_status ret;
+        size_t size;
+        int r;
+
+        assert(addr);
+        assert(ret_names);
+
+        r = query_socket_call(SD_RESOLVED_QUERY_SOCKET_PATH, SD_RESOLVED_QUERY_ADDRESS, af, addr, len, &buf, &size);
+        if (r == 0)
+                return bus_resolve_address(af, addr, len, ret_names, errnop, h_errnop);
+        if (r < 0)
+                goto fail;
+
+        ret = query_socket_reply_check(buf, &reply, errnop, h_errnop);
+        if (ret != NSS_STATUS_SUCCESS)
+                return ret;
+
+        r = query_socket_parse_address_reply(buf, size, ret_names);
+        if (r < 0)
+                goto fail;
+
+        return NSS_STATUS_SUCCESS;
+
+fail:
+        *errnop = -r;
+        *h_errnop = NO_RECOVERY;
+        return NSS_STATUS_UNAVAIL;
+}
+
+static uint32_t ifindex_to_scopeid(int family, const void *a, int ifindex) {
+        struct in6_addr in6;
+
+        if (family != AF_INET6)
+                return 0;
+
+        /* Some apps can't deal with the scope ID attached to non-link-local addresses. Hence, let's suppress that. */
+
+        assert(sizeof(in6) == FAMILY_ADDRESS_SIZE(AF_INET6));
+        memcpy(&in6, a, sizeof(struct in6_addr));
+
+        return IN6_IS_ADDR_LINKLOCAL(&in6) ? ifindex : 0;
+}
+
+enum nss_status _nss_resolve_gethostbyname4_r(
+                const char *name,
+                struct gaih_addrtuple **pat,
+                char *buffer, size_t buflen,
+                int *errnop, int *h_errnop,
+                int32_t *ttlp) {
+
+        struct gaih_addrtuple *r_tuple, *r_tuple_first = NULL;
+        _cleanup_free_ ResolvedAddress *addresses = NULL;
+        _cleanup_free_ char *canonical = NULL;
+        enum nss_status ret;
+        size_t l, ms, idx;
+        const char *cn;
+        unsigned c, i;
+        char *r_name;
+
+        BLOCK_SIGNALS(NSS_SIGNALS_BLOCK);
+
+        assert(name);
+        assert(pat);
+        assert(buffer);
+        assert(errnop);
+        assert(h_errnop);
+
+        ret = resolve_hostname(name, AF_UNSPEC, &addresses, &c, &canonical, errnop, h_errnop);
+        if (ret != NSS_STATUS_SUCCESS)
+                return ret;
+
+        if (c == 0) {
+                *errnop = ESRCH;
+                *h_errnop = HOST_NOT_FOUND;
+                return NSS_STATUS_NOTFOUND;
+        }
+
+        cn = isempty(canonical) ? name : canonical;
+
+        l = strlen(cn);
+        ms = ALIGN(l+1) + ALIGN(sizeof(struct gaih_addrtuple)) * c;
+        if (buflen < ms) {
+                *errnop = ERANGE;
+                *h_errnop = NETDB_INTERNAL;
+                return NSS_STATUS_TRYAGAIN;
+        }
+
+        /* First, append name */
+        r_name = buffer;
+        memcpy(r_name, cn, l+1);
+        idx = ALIGN(l+1);
+
+        /* Second, append addresses */
+        r_tuple_first = (struct gaih_addrtuple*) (buffer + idx);
+
+        for (i = 0; i < c; i++) {
+                const ResolvedAddress *a = addresses + i;
+
+                r_tuple = (struct gaih_addrtuple*) (buffer + idx);
+                r_tuple->next = i == c-1 ? NULL : (struct gaih_addrtuple*) ((char*) r_tuple + ALIGN(sizeof(struct gaih_addrtuple)));
+                r_tuple->name = r_name;
+                r_tuple->family = a->family;
+                r_tuple->scopeid = ifindex_to_scopeid(a->family, &a->address, a->ifindex);
+                memcpy(r_tuple->addr, &a->address, FAMILY_ADDRESS_SIZE(a->family));
+
+                idx += ALIGN(sizeof(struct gaih_addrtuple));
+        }
+
+        assert(idx == ms);
+
+        if (*pat)
+                **pat = *r_tuple_first;
+        else
+                *pat = r_tuple_first;
+
+        if (ttlp)
+                *ttlp = 0;
+
+        /* Explicitly reset all error variables */
+        *errnop = 0;
+        *h_errnop = NETDB_SUCCESS;
+        h_errno = 0;
+
+        return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status _nss_resolve_gethostbyname3_r(
+                const char *name,
+                int af,
+                struct hostent *result,
+                char *buffer, size_t buflen,
+                int *errnop, int *h_errnop,
+                int32_t *ttlp,
+                char **canonp) {
+
+        char *r_name, *r_aliases, *r_addr, *r_addr_list;
+        _cleanup_free_ ResolvedAddress *addresses = NULL;
+        _cleanup_free_ char *canonical = NULL;
+        size_t l, idx, ms, alen;
+        unsigned n, c = 0, i;
+        enum nss_status ret;
+        const char *cn;
+
+        BLOCK_SIGNALS(NSS_SIGNALS_BLOCK);
+
+        assert(name);
+        assert(result);
+        assert(buffer);
+        assert(errnop);
+        assert(h_errnop);
+
+        if (af == AF_UNSPEC)
+                af = AF_INET;
+
+        if (!IN_SET(af, AF_INET, AF_INET6)) {
+                *errnop = EAFNOSUPPORT;
+                *h_errnop = NO_RECOVERY;
+                return NSS_STATUS_UNAVAIL;
+        }
+
+        ret = resolve_hostname(name, af, &addresses, &n, &canonical, errnop, h_errnop);
+        if (ret != NSS_STATUS_SUCCESS)
+                return ret;
+
+        for (i = 0; i < n; i++)
+                if (addresses[i].family == af)
+                        c++;
+
         if (c == 0) {
                 *errnop = ESRCH;
                 *h_errnop = HOST_NOT_FOUND;
                 return NSS_STATUS_NOTFOUND;
         }
 
-        if (isempty(canonical))
-                canonical = name;
+        cn = isempty(canonical) ? name : canonical;
 
         alen = FAMILY_ADDRESS_SIZE(af);
-        l = strlen(canonical);
+        l = strlen(cn);
 
         ms = ALIGN(l+1) + c * ALIGN(alen) + (c+2) * sizeof(char*);
 
@@ -357,7 +760,7 @@ enum nss_status _nss_resolve_gethostbyname3_r(
 
         /* First, append name */
         r_name = buffer;
-        memcpy(r_name, canonical, l+1);
+        memcpy(r_name, cn, l+1);
         idx = ALIGN(l+1);
 
         /* Second, create empty aliases array */
@@ -368,47 +771,15 @@ enum nss_status _nss_resolve_gethostbyname3_r(
         /* Third, append addresses */
         r_addr = buffer + idx;
 
-        r = sd_bus_message_enter_container(reply, 'a', "(iiay)");
-        if (r < 0)
-                goto fail;
-
-        while ((r = sd_bus_message_enter_container(reply, 'r', "iiay")) > 0) {
-                int ifindex, family;
-                const void *a;
-                size_t sz;
-
-                r = sd_bus_message_read(reply, "ii", &ifindex, &family);
-                if (r < 0)
-                        goto fail;
-
-                if (ifindex < 0) {
-                        r = -EINVAL;
-                        goto fail;
-                }
-
-                r = sd_bus_message_read_array(reply, 'y', &a, &sz);
-                if (r < 0)
-                        goto fail;
-
-                r = sd_bus_message_exit_container(reply);
-                if (r < 0)
-                        goto fail;
-
-                if (family != af)
+        c = 0;
+        for (i = 0; i < n; i++) {
+                if (addresses[i].family != af)
                         continue;
 
-                if (sz != alen) {
-                        r = -EINVAL;
-                        goto fail;
-                }
-
-                memcpy(r_addr + i*ALIGN(alen), a, alen);
-                i++;
+                memcpy(r_addr + c*ALIGN(alen), &addresses[i].address, alen);
+                c++;
         }
-        if (r < 0)
-                goto fail;
 
-        assert(i == c);
         idx += c * ALIGN(alen);
 
         /* Fourth, append address pointer array */
@@ -439,11 +810,6 @@ enum nss_status _nss_resolve_gethostbyname3_r(
                 *canonp = r_name;
 
         return NSS_STATUS_SUCCESS;
-
-fail:
-        *errnop = -r;
-        *h_errnop = NO_RECOVERY;
-        return ret;
 }
 
 enum nss_status _nss_resolve_gethostbyaddr2_r(
@@ -454,15 +820,12 @@ enum nss_status _nss_resolve_gethostbyaddr2_r(
                 int *errnop, int *h_errnop,
                 int32_t *ttlp) {
 
-        _cleanup_(sd_bus_message_unrefp) sd_bus_message *req = NULL, *reply = NULL;
-        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
         char *r_name, *r_aliases, *r_addr, *r_addr_list;
-        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
-        enum nss_status ret = NSS_STATUS_UNAVAIL;
+        _cleanup_strv_free_ char **names = NULL;
+        enum nss_status ret;
         unsigned c = 0, i = 0;
         size_t ms = 0, idx;
-        const char *n;
-        int r, ifindex;
+        char **n;
 
         BLOCK_SIGNALS(NSS_SIGNALS_BLOCK);
 
@@ -484,70 +847,14 @@ enum nss_status _nss_resolve_gethostbyaddr2_r(
                 return NSS_STATUS_UNAVAIL;
         }
 
-        r = sd_bus_open_system(&bus);
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_message_new_method_call(
-                        bus,
-                        &req,
-                        "org.freedesktop.resolve1",
-                        "/org/freedesktop/resolve1",
-                        "org.freedesktop.resolve1.Manager",
-                        "ResolveAddress");
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_message_set_auto_start(req, false);
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_message_append(req, "ii", 0, af);
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_message_append_array(req, 'y', addr, len);
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_message_append(req, "t", (uint64_t) 0);
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_call(bus, req, SD_RESOLVED_QUERY_TIMEOUT_USEC, &error, &reply);
-        if (r < 0) {
-                if (sd_bus_error_has_name(&error, _BUS_ERROR_DNS "NXDOMAIN")) {
-                        *errnop = ESRCH;
-                        *h_errnop = HOST_NOT_FOUND;
-                        return NSS_STATUS_NOTFOUND;
-                }
-
-                if (!bus_error_shall_fallback(&error))
-                        ret = NSS_STATUS_NOTFOUND;
-
-                goto fail;
-        }
-
-        r = sd_bus_message_enter_container(reply, 'a', "(is)");
-        if (r < 0)
-                goto fail;
-
-        while ((r = sd_bus_message_read(reply, "(is)", &ifindex, &n)) > 0) {
-
-                if (ifindex < 0) {
-                        r = -EINVAL;
-                        goto fail;
-                }
+        ret = resolve_address(af, addr, len, &names, errnop, h_errnop);
+        if (ret != NSS_STATUS_SUCCESS)
+                return ret;
 
+        STRV_FOREACH(n, names) {
                 c++;
-                ms += ALIGN(strlen(n) + 1);
+                ms += ALIGN(strlen(*n) + 1);
         }
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_message_rewind(reply, false);
-        if (r < 0)
-                return r;
 
         if (c <= 0) {
                 *errnop = ESRCH;
@@ -583,13 +890,13 @@ enum nss_status _nss_resolve_gethostbyaddr2_r(
         /* Fourth, place aliases */
         i = 0;
         r_name = buffer + idx;
-        while ((r = sd_bus_message_read(reply, "(is)", &ifindex, &n)) > 0) {
+        STRV_FOREACH(n, names) {
                 char *p;
                 size_t l;
 
-                l = strlen(n);
+                l = strlen(*n);
                 p = buffer + idx;
-                memcpy(p, n, l+1);
+                memcpy(p, *n, l+1);
 
                 if (i > 0)
                         ((char**) r_aliases)[i-1] = p;
@@ -597,8 +904,6 @@ enum nss_status _nss_resolve_gethostbyaddr2_r(
 
                 idx += ALIGN(l+1);
         }
-        if (r < 0)
-                goto fail;
 
         ((char**) r_aliases)[c-1] = NULL;
         assert(idx == ms);
@@ -618,12 +923,6 @@ enum nss_status _nss_resolve_gethostbyaddr2_r(
         h_errno = 0;
 
         return NSS_STATUS_SUCCESS;
-
-fail:
-        *errnop = -r;
-        *h_errnop = NO_RECOVERY;
-        return ret;
 }
-
 NSS_GETHOSTBYNAME_FALLBACKS(resolve);
 NSS_GETHOSTBYADDR_FALLBACKS(resolve);
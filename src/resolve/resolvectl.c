@@ -22,6 +22,7 @@
 #include "resolvectl.h"
 #include "resolved-def.h"
 #include "resolved-dns-packet.h"
+#include "stdio-util.h"
 #include "string-table.h"
 #include "strv.h"
 #include "terminal-util.h"
@@ -971,7 +972,10 @@ static int show_statistics(int argc, char **argv, void *userdata) {
         sd_bus *bus = userdata;
         uint64_t n_current_transactions, n_total_transactions,
                 cache_size, n_cache_hit, n_cache_miss,
+                cache_memory, cache_memory_max, n_cache_evicted,
                 n_dnssec_secure, n_dnssec_insecure, n_dnssec_bogus, n_dnssec_indeterminate;
+        char buf_memory[FORMAT_BYTES_MAX], buf_memory_max[FORMAT_BYTES_MAX];
+        char buf_time[FORMAT_TIMESPAN_MAX] = "", label[3 + FORMAT_TIMESPAN_MAX];
         int r, dnssec_supported;
 
         assert(bus);
@@ -1037,15 +1041,40 @@ static int show_statistics(int argc, char **argv, void *userdata) {
         if (r < 0)
                 return bus_log_parse_error(r);
 
+        reply = sd_bus_message_unref(reply);
+
+        r = sd_bus_get_property(bus,
+                                "org.freedesktop.resolve1",
+                                "/org/freedesktop/resolve1",
+                                "org.freedesktop.resolve1.Manager",
+                                "CacheMemoryStatistics",
+                                &error,
+                                &reply,
+                                "(ttt)");
+        if (r < 0)
+                return log_error_errno(r, "Failed to get cache memory statistics: %s", bus_error_message(&error, r));
+
+        r = sd_bus_message_read(reply, "(ttt)",
+                                &cache_memory,
+                                &cache_memory_max,
+                                &n_cache_evicted);
+        if (r < 0)
+                return bus_log_parse_error(r);
+
         printf("\n%sCache%s\n"
                "  Current Cache Size: %" PRIu64 "\n"
+               "        Memory Usage: %s (limit %s)\n"
                "          Cache Hits: %" PRIu64 "\n"
-               "        Cache Misses: %" PRIu64 "\n",
+               "        Cache Misses: %" PRIu64 "\n"
+               "     Cache Evictions: %" PRIu64 "\n",
                ansi_highlight(),
                ansi_normal(),
                cache_size,
+               format_bytes(buf_memory, sizeof(buf_memory), cache_memory),
+               format_bytes(buf_memory_max, sizeof(buf_memory_max), cache_memory_max),
                n_cache_hit,
-               n_cache_miss);
+               n_cache_miss,
+               n_cache_evicted);
 
         reply = sd_bus_message_unref(reply);
 
@@ -1080,6 +1109,49 @@ static int show_statistics(int argc, char **argv, void *userdata) {
                n_dnssec_bogus,
                n_dnssec_indeterminate);
 
+        reply = sd_bus_message_unref(reply);
+
+        r = sd_bus_get_property(bus,
+                                "org.freedesktop.resolve1",
+                                "/org/freedesktop/resolve1",
+                                "org.freedesktop.resolve1.Manager",
+                                "ResponseTimeStatistics",
+                                &error,
+                                &reply,
+                                "a(tt)");
+        if (r < 0)
+                return log_error_errno(r, "Failed to get response time statistics: %s", bus_error_message(&error, r));
+
+        r = sd_bus_message_enter_container(reply, 'a', "(tt)");
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        printf("\n%sResponse Times%s\n",
+               ansi_highlight(),
+               ansi_normal());
+
+        for (;;) {
+                uint64_t max, n;
+
+                r = sd_bus_message_read(reply, "(tt)", &max, &n);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+                if (r == 0)
+                        break;
+
+                /* Each bucket counts the replies that took less than its bound, the last one everything slower */
+                if (max == USEC_INFINITY)
+                        xsprintf(label, ">= %s", buf_time);
+                else
+                        xsprintf(label, "< %s", format_timespan(buf_time, sizeof(buf_time), max, 0));
+
+                printf("%20s: %" PRIu64 "\n", label, n);
+        }
+
+        r = sd_bus_message_exit_container(reply);
+        if (r < 0)
+                return bus_log_parse_error(r);
+
         return 0;
 }
 
@@ -1412,6 +1412,31 @@ static int bus_property_get_cache_statistics(
         return sd_bus_message_append(reply, "(ttt)", size, hit, miss);
 }
 
+static int bus_property_get_cache_memory_statistics(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        uint64_t size = 0, max_size = 0, evicted = 0;
+        Manager *m = userdata;
+        DnsScope *s;
+
+        assert(reply);
+        assert(m);
+
+        LIST_FOREACH(scopes, s, m->dns_scopes) {
+                size += s->cache.size;
+                max_size += s->cache.max_size;
+                evicted += s->cache.n_evicted;
+        }
+
+        return sd_bus_message_append(reply, "(ttt)", size, max_size, evicted);
+}
+
 static int bus_property_get_dnssec_statistics(
                 sd_bus *bus,
                 const char *path,
@@ -1433,6 +1458,37 @@ static int bus_property_get_dnssec_statistics(
                                      (uint64_t) m->n_dnssec_verdict[DNSSEC_INDETERMINATE]);
 }
 
+static int bus_property_get_response_time_statistics(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        Manager *m = userdata;
+        unsigned i;
+        int r;
+
+        assert(reply);
+        assert(m);
+
+        r = sd_bus_message_open_container(reply, 'a', "(tt)");
+        if (r < 0)
+                return r;
+
+        for (i = 0; i < MANAGER_RESPONSE_TIME_BUCKETS; i++) {
+                r = sd_bus_message_append(reply, "(tt)",
+                                          (uint64_t) manager_response_time_bucket_max[i],
+                                          (uint64_t) m->n_response_time[i]);
+                if (r < 0)
+                        return r;
+        }
+
+        return sd_bus_message_close_container(reply);
+}
+
 static int bus_property_get_ntas(
                 sd_bus *bus,
                 const char *path,
@@ -1476,10 +1532,11 @@ static int bus_method_reset_statistics(sd_bus_message *message, void *userdata,
         assert(m);
 
         LIST_FOREACH(scopes, s, m->dns_scopes)
-                s->cache.n_hit = s->cache.n_miss = 0;
+                s->cache.n_hit = s->cache.n_miss = s->cache.n_evicted = 0;
 
         m->n_transactions_total = 0;
         zero(m->n_dnssec_verdict);
+        zero(m->n_response_time);
 
         return sd_bus_reply_method_return(message, NULL);
 }
@@ -1838,8 +1895,10 @@ static const sd_bus_vtable resolve_vtable[] = {
         SD_BUS_PROPERTY("Domains", "a(isb)", bus_property_get_domains, 0, 0),
         SD_BUS_PROPERTY("TransactionStatistics", "(tt)", bus_property_get_transaction_statistics, 0, 0),
         SD_BUS_PROPERTY("CacheStatistics", "(ttt)", bus_property_get_cache_statistics, 0, 0),
+        SD_BUS_PROPERTY("CacheMemoryStatistics", "(ttt)", bus_property_get_cache_memory_statistics, 0, 0),
         SD_BUS_PROPERTY("DNSSEC", "s", bus_property_get_dnssec_mode, 0, 0),
         SD_BUS_PROPERTY("DNSSECStatistics", "(tttt)", bus_property_get_dnssec_statistics, 0, 0),
+        SD_BUS_PROPERTY("ResponseTimeStatistics", "a(tt)", bus_property_get_response_time_statistics, 0, 0),
         SD_BUS_PROPERTY("DNSSECSupported", "b", bus_property_get_dnssec_supported, 0, 0),
         SD_BUS_PROPERTY("DNSSECNegativeTrustAnchors", "as", bus_property_get_ntas, 0, 0),
         SD_BUS_PROPERTY("DNSStubListener", "s", bus_property_get_dns_stub_listener_mode, offsetof(Manager, dns_stub_listener_mode), 0),
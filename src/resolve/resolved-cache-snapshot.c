@@ -0,0 +1,285 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdio_ext.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "fileio-label.h"
+#include "fileio.h"
+#include "resolved-cache-snapshot.h"
+#include "resolved-link.h"
+#include "sparse-endian.h"
+
+#define CACHE_SNAPSHOT_PATH "/run/systemd/resolve/cache"
+
+/* How often to write the snapshot, in addition to when shutting down */
+#define CACHE_SNAPSHOT_INTERVAL_USEC (5 * USEC_PER_MINUTE)
+
+/* The snapshot consists of the header, and a section for each unicast DNS scope, which contains the entries of the
+ * scope's cache as written by dns_cache_save(). A cache is flushed whenever the scope switches to another DNS server,
+ * hence the entries are restored when the scope switches to the server they were learnt from. */
+
+typedef struct CacheSnapshotHeader {
+        uint8_t signature[8];
+        le64_t realtime;
+} _packed_ CacheSnapshotHeader;
+
+typedef struct CacheSnapshotSection {
+        le32_t scope_ifindex;
+        le32_t size;
+        le32_t server_ifindex;
+        uint8_t server_family;
+        uint8_t reserved[3];
+        uint8_t server_address[16];
+} _packed_ CacheSnapshotSection;
+
+static const uint8_t cache_snapshot_signature[8] = { 'R', 'S', 'L', 'V', 'C', 'A', 'C', 'H' };
+
+static int cache_snapshot_write_section(FILE *f, DnsScope *scope, DnsServer *server) {
+        _cleanup_free_ char *buf = NULL;
+        _cleanup_fclose_ FILE *mf = NULL;
+        CacheSnapshotSection section;
+        size_t size = 0;
+        int r, n;
+
+        assert(f);
+        assert(scope);
+
+        if (!server)
+                return 0;
+
+        mf = open_memstream(&buf, &size);
+        if (!mf)
+                return -ENOMEM;
+
+        (void) __fsetlocking(mf, FSETLOCKING_BYCALLER);
+
+        n = dns_cache_save(&scope->cache, mf);
+        if (n < 0)
+                return n;
+
+        r = fflush_and_check(mf);
+        if (r < 0)
+                return r;
+
+        if (size == 0)
+                return 0;
+
+        section = (CacheSnapshotSection) {
+                .scope_ifindex = htole32(scope->link ? scope->link->ifindex : 0),
+                .size = htole32(size),
+                .server_ifindex = htole32(server->ifindex),
+                .server_family = server->family,
+        };
+        memcpy(section.server_address, &server->address, sizeof(section.server_address));
+
+        fwrite(&section, sizeof(section), 1, f);
+        fwrite(buf, size, 1, f);
+
+        return n;
+}
+
+int manager_cache_snapshot_save(Manager *m) {
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        CacheSnapshotHeader header = {};
+        unsigned n = 0;
+        Iterator i;
+        Link *l;
+        int r;
+
+        assert(m);
+
+        if (!m->persistent_cache || !m->enable_cache)
+                return 0;
+
+        r = fopen_temporary_label(CACHE_SNAPSHOT_PATH, CACHE_SNAPSHOT_PATH, &f, &temp_path);
+        if (r < 0)
+                return log_warning_errno(r, "Failed to open cache snapshot for writing: %m");
+
+        (void) __fsetlocking(f, FSETLOCKING_BYCALLER);
+        (void) fchmod(fileno(f), 0600);
+
+        memcpy(header.signature, cache_snapshot_signature, sizeof(header.signature));
+        header.realtime = htole64(now(CLOCK_REALTIME));
+        fwrite(&header, sizeof(header), 1, f);
+
+        if (m->unicast_scope) {
+                r = cache_snapshot_write_section(f, m->unicast_scope, m->current_dns_server);
+                if (r < 0)
+                        goto fail;
+                n += r;
+        }
+
+        HASHMAP_FOREACH(l, m->links, i) {
+                if (!l->unicast_scope)
+                        continue;
+
+                r = cache_snapshot_write_section(f, l->unicast_scope, l->current_dns_server);
+                if (r < 0)
+                        goto fail;
+                n += r;
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(temp_path, CACHE_SNAPSHOT_PATH) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        temp_path = mfree(temp_path);
+
+        log_debug("Saved %u cache entries to " CACHE_SNAPSHOT_PATH ".", n);
+        return 0;
+
+fail:
+        (void) unlink(temp_path);
+        return log_warning_errno(r, "Failed to write cache snapshot: %m");
+}
+
+int manager_cache_snapshot_load(Manager *m) {
+        _cleanup_free_ char *data = NULL;
+        CacheSnapshotHeader header;
+        size_t size;
+        int r;
+
+        assert(m);
+
+        if (!m->persistent_cache || !m->enable_cache) {
+                /* Don't pick up an old snapshot when this is turned on again later */
+                if (unlink(CACHE_SNAPSHOT_PATH) < 0 && errno != ENOENT)
+                        log_debug_errno(errno, "Failed to remove cache snapshot, ignoring: %m");
+
+                return 0;
+        }
+
+        r = read_full_file(CACHE_SNAPSHOT_PATH, &data, &size);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0)
+                return log_warning_errno(r, "Failed to read cache snapshot, ignoring: %m");
+
+        if (size < sizeof(header) || memcmp(data, cache_snapshot_signature, sizeof(cache_snapshot_signature)) != 0) {
+                log_warning("Cache snapshot has invalid header, ignoring.");
+                return 0;
+        }
+
+        memcpy(&header, data, sizeof(header));
+
+        m->cache_snapshot = TAKE_PTR(data);
+        m->cache_snapshot_size = size;
+        m->cache_snapshot_realtime = le64toh(header.realtime);
+
+        return 1;
+}
+
+void manager_cache_snapshot_restore(Manager *m, DnsScope *scope, DnsServer *server) {
+        const uint8_t *d, *e;
+        usec_t elapsed;
+        int ifindex, r;
+
+        assert(m);
+        assert(scope);
+
+        if (!m->cache_snapshot || !server)
+                return;
+
+        ifindex = scope->link ? scope->link->ifindex : 0;
+        elapsed = LESS_BY(now(CLOCK_REALTIME), m->cache_snapshot_realtime);
+
+        d = (const uint8_t*) m->cache_snapshot + sizeof(CacheSnapshotHeader);
+        e = (const uint8_t*) m->cache_snapshot + m->cache_snapshot_size;
+
+        while (d < e) {
+                CacheSnapshotSection section;
+                size_t size;
+
+                if ((size_t) (e - d) < sizeof(section))
+                        goto invalid;
+
+                memcpy(&section, d, sizeof(section));
+                d += sizeof(section);
+
+                size = le32toh(section.size);
+                if ((size_t) (e - d) < size)
+                        goto invalid;
+
+                if ((int) le32toh(section.scope_ifindex) == ifindex &&
+                    (int) le32toh(section.server_ifindex) == server->ifindex &&
+                    section.server_family == server->family &&
+                    memcmp(section.server_address, &server->address, sizeof(section.server_address)) == 0) {
+
+                        r = dns_cache_restore(&scope->cache, d, size, elapsed);
+                        if (r < 0) {
+                                log_warning_errno(r, "Failed to restore cache from snapshot, ignoring: %m");
+                                dns_cache_flush(&scope->cache);
+                                goto invalid;
+                        }
+
+                        log_debug("Restored %i cache entries for DNS server %s.", r, dns_server_string(server));
+                        return;
+                }
+
+                d += size;
+        }
+
+        return;
+
+invalid:
+        log_debug("Cache snapshot is invalid, forgetting it.");
+        m->cache_snapshot = mfree(m->cache_snapshot);
+        m->cache_snapshot_size = 0;
+}
+
+static int on_cache_snapshot_timer(sd_event_source *s, usec_t usec, void *userdata) {
+        Manager *m = userdata;
+        int r;
+
+        assert(s);
+        assert(m);
+
+        (void) manager_cache_snapshot_save(m);
+
+        /* Scopes pick up their entries from the snapshot when they switch to a DNS server, which they do early
+         * on. Don't keep the snapshot around forever in case some never do. */
+        m->cache_snapshot = mfree(m->cache_snapshot);
+        m->cache_snapshot_size = 0;
+
+        r = sd_event_source_set_time(s, usec + CACHE_SNAPSHOT_INTERVAL_USEC);
+        if (r < 0)
+                return log_error_errno(r, "Failed to reschedule cache snapshot timer: %m");
+
+        r = sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+        if (r < 0)
+                return log_error_errno(r, "Failed to enable cache snapshot timer: %m");
+
+        return 0;
+}
+
+int manager_cache_snapshot_start(Manager *m) {
+        usec_t t;
+        int r;
+
+        assert(m);
+
+        if (!m->persistent_cache || !m->enable_cache)
+                return 0;
+
+        assert_se(sd_event_now(m->event, clock_boottime_or_monotonic(), &t) >= 0);
+
+        r = sd_event_add_time(m->event,
+                              &m->cache_snapshot_event_source,
+                              clock_boottime_or_monotonic(),
+                              t + CACHE_SNAPSHOT_INTERVAL_USEC,
+                              USEC_PER_MINUTE,
+                              on_cache_snapshot_timer, m);
+        if (r < 0)
+                return log_error_errno(r, "Failed to add cache snapshot timer: %m");
+
+        (void) sd_event_source_set_description(m->cache_snapshot_event_source, "cache-snapshot");
+
+        return 0;
+}
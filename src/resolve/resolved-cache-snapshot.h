@@ -0,0 +1,11 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include "resolved-dns-scope.h"
+#include "resolved-dns-server.h"
+#include "resolved-manager.h"
+
+int manager_cache_snapshot_load(Manager *m);
+int manager_cache_snapshot_start(Manager *m);
+int manager_cache_snapshot_save(Manager *m);
+void manager_cache_snapshot_restore(Manager *m, DnsScope *scope, DnsServer *server);
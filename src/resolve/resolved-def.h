@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 
+#include "macro.h"
 #include "time-util.h"
 
 #define SD_RESOLVED_DNS           (UINT64_C(1) << 0)
@@ -25,3 +26,56 @@
 
 /* 127.0.0.53 in native endian */
 #define INADDR_DNS_STUB ((in_addr_t) 0x7f000035U)
+
+/* The socket for hostname and address lookups with a compact binary protocol, which saves the overhead of going
+ * through the bus broker. Clients connect an AF_UNIX SOCK_SEQPACKET socket, send one request and receive one reply
+ * on it. If the connection is closed without a reply, clients should use the bus instead. All fields are in native
+ * byte order. */
+#define SD_RESOLVED_QUERY_SOCKET_PATH "/run/systemd/resolve/query"
+
+/* The maximum size of requests and replies. Replies that would be larger are truncated to the items that fit. */
+#define SD_RESOLVED_QUERY_MESSAGE_MAX (64U * 1024U)
+
+/* The longest hostname accepted in requests: DNS_HOSTNAME_MAX characters, each of which might be escaped as \DDD */
+#define SD_RESOLVED_QUERY_HOSTNAME_MAX (253U * 4U)
+
+enum {
+        SD_RESOLVED_QUERY_HOSTNAME = 1,
+        SD_RESOLVED_QUERY_ADDRESS = 2,
+};
+
+enum {
+        SD_RESOLVED_QUERY_SUCCESS = 0,
+        SD_RESOLVED_QUERY_NXDOMAIN = 1,  /* The name or address does not exist */
+        SD_RESOLVED_QUERY_FAILED = 2,    /* The lookup failed otherwise, the reply's error field says why */
+};
+
+typedef struct ResolvedQueryRequest {
+        uint32_t id;                     /* Copied into the reply */
+        uint8_t type;                    /* SD_RESOLVED_QUERY_HOSTNAME or SD_RESOLVED_QUERY_ADDRESS */
+        uint8_t family;                  /* AF_INET, AF_INET6, or AF_UNSPEC for hostnames */
+        int32_t ifindex;
+        uint64_t flags;                  /* SD_RESOLVED_* */
+        /* Followed by the hostname without trailing NUL, or the address */
+} _packed_ ResolvedQueryRequest;
+
+typedef struct ResolvedQueryReply {
+        uint32_t id;
+        uint8_t status;                  /* SD_RESOLVED_QUERY_SUCCESS, _NXDOMAIN or _FAILED */
+        int32_t error;                   /* A positive errno-style error if the lookup failed */
+        uint64_t flags;                  /* SD_RESOLVED_FLAGS_MAKE() of the answer */
+        uint16_t n_items;
+        /* Followed by the items: ResolvedQueryAddress for hostname lookups, followed by the canonical name without
+         * trailing NUL, and ResolvedQueryName, each directly followed by the name, for address lookups */
+} _packed_ ResolvedQueryReply;
+
+typedef struct ResolvedQueryAddress {
+        int32_t ifindex;
+        uint8_t family;
+        uint8_t address[16];             /* Only the first 4 bytes are used for AF_INET */
+} _packed_ ResolvedQueryAddress;
+
+typedef struct ResolvedQueryName {
+        int32_t ifindex;
+        uint16_t length;                 /* The length of the following name, without trailing NUL */
+} _packed_ ResolvedQueryName;
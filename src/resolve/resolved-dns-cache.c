@@ -8,21 +8,29 @@
 #include "resolved-dns-answer.h"
 #include "resolved-dns-cache.h"
 #include "resolved-dns-packet.h"
+#include "sparse-endian.h"
 #include "string-util.h"
 
-/* Never cache more than 4K entries. RFC 1536, Section 5 suggests to
- * leave DNS caches unbounded, but that's crazy. */
-#define CACHE_MAX 4096
-
-/* We never keep any item longer than 2h in our cache */
-#define CACHE_TTL_MAX_USEC (2 * USEC_PER_HOUR)
+/* What we assume the RDATA of an RR to take up, unless we know its wire format. Most RRs are A, AAAA, CNAME or
+ * PTR RRs, which are small. */
+#define CACHE_RDATA_SIZE_ESTIMATE 64
 
 /* How long to cache strange rcodes, i.e. rcodes != SUCCESS and != NXDOMAIN (specifically: that's only SERVFAIL for
  * now) */
 #define CACHE_TTL_STRANGE_RCODE_USEC (30 * USEC_PER_SEC)
 
+/* The TTL of answers from expired entries, as suggested by RFC 8767, Section 4 */
+#define CACHE_TTL_STALE_USEC (30 * USEC_PER_SEC)
+
+/* Entries that were looked up at least this often are refreshed when they have less than a tenth of their TTL
+ * left */
+#define CACHE_PREFETCH_HITS_MIN 3U
+
+/* How long to wait before asking again for refreshing an entry, in case the previous attempt failed */
+#define CACHE_REFRESH_RETRY_USEC (30 * USEC_PER_SEC)
+
 typedef enum DnsCacheItemType DnsCacheItemType;
-typedef struct DnsCacheItem DnsCacheItem;
+typedef struct DnsCacheSnapshotEntry DnsCacheSnapshotEntry;
 
 enum DnsCacheItemType {
         DNS_CACHE_POSITIVE,
@@ -37,18 +45,45 @@ struct DnsCacheItem {
         DnsResourceRecord *rr;
         int rcode;
 
+        usec_t added;
         usec_t until;
         bool authenticated:1;
         bool shared_owner:1;
+        bool referenced:1;
 
         int ifindex;
         int owner_family;
         union in_addr_union owner_address;
 
+        size_t size;
+
+        /* Number of lookups, and when a refresh was asked for last */
+        unsigned n_hit;
+        usec_t refresh_usec;
+
         unsigned prioq_idx;
         LIST_FIELDS(DnsCacheItem, by_key);
+        LIST_FIELDS(DnsCacheItem, by_clock);
 };
 
+/* An entry in a cache snapshot, followed by the RR in DNS wire format for positive entries, and by the key
+ * otherwise */
+struct DnsCacheSnapshotEntry {
+        le32_t ifindex;
+        le64_t ttl_usec;
+        le16_t rcode;
+        le16_t size;
+        uint8_t type;
+        uint8_t flags;
+        uint8_t owner_family;
+        uint8_t reserved;
+        uint8_t owner_address[16];
+} _packed_;
+
+#define DNS_CACHE_SNAPSHOT_AUTHENTICATED (1U << 0)
+
+assert_cc(sizeof(union in_addr_union) == 16);
+
 static const char *dns_cache_item_type_to_string(DnsCacheItem *item) {
         assert(item);
 
@@ -81,6 +116,37 @@ static void dns_cache_item_free(DnsCacheItem *i) {
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(DnsCacheItem*, dns_cache_item_free);
 
+static size_t dns_cache_item_size(DnsCacheItem *i) {
+        size_t size;
+
+        assert(i);
+
+        /* Estimates the memory used by the item. The key and the RR are possibly shared with other items, but we
+         * count them for every item anyway. */
+
+        size = sizeof(DnsCacheItem) + sizeof(DnsResourceKey) + strlen(dns_resource_key_name(i->key)) + 1;
+        if (i->rr)
+                size += sizeof(DnsResourceRecord) + (i->rr->wire_format ? i->rr->wire_format_size : CACHE_RDATA_SIZE_ESTIMATE);
+
+        return size;
+}
+
+static void dns_cache_item_unlink_clock(DnsCache *c, DnsCacheItem *i) {
+        assert(c);
+        assert(i);
+
+        if (c->clock_hand == i) {
+                c->clock_hand = i->by_clock_next ?: c->by_clock;
+                if (c->clock_hand == i)
+                        c->clock_hand = NULL;
+        }
+
+        LIST_REMOVE(by_clock, c->by_clock, i);
+
+        assert(c->size >= i->size);
+        c->size -= i->size;
+}
+
 static void dns_cache_item_unlink_and_free(DnsCache *c, DnsCacheItem *i) {
         DnsCacheItem *first;
 
@@ -98,6 +164,7 @@ static void dns_cache_item_unlink_and_free(DnsCache *c, DnsCacheItem *i) {
                 hashmap_remove(c->by_key, i->key);
 
         prioq_remove(c->by_expiry, i, &i->prioq_idx);
+        dns_cache_item_unlink_clock(c, i);
 
         dns_cache_item_free(i);
 }
@@ -132,6 +199,7 @@ static bool dns_cache_remove_by_key(DnsCache *c, DnsResourceKey *key) {
 
         LIST_FOREACH_SAFE(by_key, i, n, first) {
                 prioq_remove(c->by_expiry, i, &i->prioq_idx);
+                dns_cache_item_unlink_clock(c, i);
                 dns_cache_item_free(i);
         }
 
@@ -148,34 +216,54 @@ void dns_cache_flush(DnsCache *c) {
 
         assert(hashmap_size(c->by_key) == 0);
         assert(prioq_size(c->by_expiry) == 0);
+        assert(!c->by_clock);
+        assert(c->size == 0);
 
         c->by_key = hashmap_free(c->by_key);
         c->by_expiry = prioq_free(c->by_expiry);
 }
 
-static void dns_cache_make_space(DnsCache *c, unsigned add) {
+static void dns_cache_make_space(DnsCache *c, size_t add) {
         assert(c);
 
         if (add <= 0)
                 return;
 
-        /* Makes space for n new entries. Note that we actually allow
-         * the cache to grow beyond CACHE_MAX, but only when we shall
-         * add more RRs to the cache than CACHE_MAX at once. In that
-         * case the cache will be emptied completely otherwise. */
+        /* Makes space for a new entry of the given size. Note that we
+         * actually allow the cache to grow beyond max_size, but only
+         * when a single entry is larger than max_size. In that case the
+         * cache will be emptied completely otherwise.
+         *
+         * Entries are evicted in CLOCK order: the hand sweeps over the
+         * ring of all entries, and evicts the first one that was not
+         * looked up since the hand passed it last. Entries that were
+         * get a second chance. Unlike evicting in order of expiry, this
+         * keeps popular entries with short TTLs around. */
 
         for (;;) {
                 _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
                 DnsCacheItem *i;
 
-                if (prioq_size(c->by_expiry) <= 0)
+                if (!c->clock_hand)
                         break;
 
-                if (prioq_size(c->by_expiry) + add < CACHE_MAX)
+                if (c->size + add <= c->max_size)
                         break;
 
-                i = prioq_peek(c->by_expiry);
-                assert(i);
+                i = c->clock_hand;
+
+                if (i->referenced) {
+                        i->referenced = false;
+                        c->clock_hand = i->by_clock_next ?: c->by_clock;
+                        continue;
+                }
+
+                c->n_evicted++;
+
+                if (i->shared_owner) {
+                        dns_cache_item_unlink_and_free(c, i);
+                        continue;
+                }
 
                 /* Take an extra reference to the key so that it
                  * doesn't go away in the middle of the remove call */
@@ -189,7 +277,7 @@ void dns_cache_prune(DnsCache *c) {
 
         assert(c);
 
-        /* Remove all entries that are past their TTL */
+        /* Remove all entries that are past their TTL, or past the time we keep them for serving them stale */
 
         for (;;) {
                 DnsCacheItem *i;
@@ -202,7 +290,7 @@ void dns_cache_prune(DnsCache *c) {
                 if (t <= 0)
                         t = now(clock_boottime_or_monotonic());
 
-                if (i->until > t)
+                if (usec_add(i->until, c->stale_retention_usec) > t)
                         break;
 
                 /* Depending whether this is an mDNS shared entry
@@ -262,6 +350,15 @@ static int dns_cache_link_item(DnsCache *c, DnsCacheItem *i) {
         if (r < 0)
                 return r;
 
+        /* Insert right behind the hand, so that the new item is the last one the hand gets to */
+        if (c->clock_hand)
+                LIST_INSERT_BEFORE(by_clock, c->by_clock, c->clock_hand, i);
+        else {
+                LIST_PREPEND(by_clock, c->by_clock, i);
+                c->clock_hand = i;
+        }
+        c->size += i->size;
+
         first = hashmap_get(c->by_key, i->key);
         if (first) {
                 _cleanup_(dns_resource_key_unrefp) DnsResourceKey *k = NULL;
@@ -283,6 +380,7 @@ static int dns_cache_link_item(DnsCache *c, DnsCacheItem *i) {
                 r = hashmap_put(c->by_key, i->key, i);
                 if (r < 0) {
                         prioq_remove(c->by_expiry, i, &i->prioq_idx);
+                        dns_cache_item_unlink_clock(c, i);
                         return r;
                 }
         }
@@ -303,10 +401,11 @@ static DnsCacheItem* dns_cache_get(DnsCache *c, DnsResourceRecord *rr) {
         return NULL;
 }
 
-static usec_t calculate_until(DnsResourceRecord *rr, uint32_t nsec_ttl, usec_t timestamp, bool use_soa_minimum) {
+static usec_t calculate_until(DnsCache *c, DnsResourceRecord *rr, uint32_t nsec_ttl, usec_t timestamp, bool use_soa_minimum) {
         uint32_t ttl;
         usec_t u;
 
+        assert(c);
         assert(rr);
 
         ttl = MIN(rr->ttl, nsec_ttl);
@@ -322,8 +421,8 @@ static usec_t calculate_until(DnsResourceRecord *rr, uint32_t nsec_ttl, usec_t t
         }
 
         u = ttl * USEC_PER_SEC;
-        if (u > CACHE_TTL_MAX_USEC)
-                u = CACHE_TTL_MAX_USEC;
+        if (u > c->max_ttl)
+                u = c->max_ttl;
 
         if (rr->expiry != USEC_INFINITY) {
                 usec_t left;
@@ -370,7 +469,8 @@ static void dns_cache_item_update_positive(
         dns_resource_key_unref(i->key);
         i->key = dns_resource_key_ref(rr->key);
 
-        i->until = calculate_until(rr, (uint32_t) -1, timestamp, false);
+        i->added = timestamp;
+        i->until = calculate_until(c, rr, (uint32_t) -1, timestamp, false);
         i->authenticated = authenticated;
         i->shared_owner = shared_owner;
 
@@ -379,6 +479,10 @@ static void dns_cache_item_update_positive(
         i->owner_family = owner_family;
         i->owner_address = *owner_address;
 
+        c->size -= i->size;
+        i->size = dns_cache_item_size(i);
+        c->size += i->size;
+
         prioq_reshuffle(c->by_expiry, i, &i->prioq_idx);
 }
 
@@ -437,8 +541,6 @@ static int dns_cache_put_positive(
         if (r < 0)
                 return r;
 
-        dns_cache_make_space(c, 1);
-
         i = new0(DnsCacheItem, 1);
         if (!i)
                 return -ENOMEM;
@@ -446,13 +548,17 @@ static int dns_cache_put_positive(
         i->type = DNS_CACHE_POSITIVE;
         i->key = dns_resource_key_ref(rr->key);
         i->rr = dns_resource_record_ref(rr);
-        i->until = calculate_until(rr, (uint32_t) -1, timestamp, false);
+        i->added = timestamp;
+        i->until = calculate_until(c, rr, (uint32_t) -1, timestamp, false);
         i->authenticated = authenticated;
         i->shared_owner = shared_owner;
         i->ifindex = ifindex;
         i->owner_family = owner_family;
         i->owner_address = *owner_address;
         i->prioq_idx = PRIOQ_IDX_NULL;
+        i->size = dns_cache_item_size(i);
+
+        dns_cache_make_space(c, i->size);
 
         r = dns_cache_link_item(c, i);
         if (r < 0)
@@ -521,8 +627,6 @@ static int dns_cache_put_negative(
         if (r < 0)
                 return r;
 
-        dns_cache_make_space(c, 1);
-
         i = new0(DnsCacheItem, 1);
         if (!i)
                 return -ENOMEM;
@@ -530,9 +634,10 @@ static int dns_cache_put_negative(
         i->type =
                 rcode == DNS_RCODE_SUCCESS ? DNS_CACHE_NODATA :
                 rcode == DNS_RCODE_NXDOMAIN ? DNS_CACHE_NXDOMAIN : DNS_CACHE_RCODE;
+        i->added = timestamp;
         i->until =
-                i->type == DNS_CACHE_RCODE ? timestamp + CACHE_TTL_STRANGE_RCODE_USEC :
-                calculate_until(soa, nsec_ttl, timestamp, true);
+                i->type == DNS_CACHE_RCODE ? timestamp + MIN(CACHE_TTL_STRANGE_RCODE_USEC, c->max_ttl) :
+                calculate_until(c, soa, nsec_ttl, timestamp, true);
         i->authenticated = authenticated;
         i->owner_family = owner_family;
         i->owner_address = *owner_address;
@@ -556,6 +661,10 @@ static int dns_cache_put_negative(
         } else
                 i->key = dns_resource_key_ref(key);
 
+        i->size = dns_cache_item_size(i);
+
+        dns_cache_make_space(c, i->size);
+
         r = dns_cache_link_item(c, i);
         if (r < 0)
                 return r;
@@ -635,12 +744,16 @@ int dns_cache_put(
         DnsResourceRecord *soa = NULL, *rr;
         bool weird_rcode = false;
         DnsAnswerFlags flags;
-        unsigned cache_keys;
         int r, ifindex;
 
         assert(c);
         assert(owner_address);
 
+        /* When we serve stale entries, a failure to refresh one shall not replace it (RFC 8767, Section 5) */
+        if (!IN_SET(rcode, DNS_RCODE_SUCCESS, DNS_RCODE_NXDOMAIN) &&
+            key && c->stale_retention_usec > 0 && hashmap_get(c->by_key, key))
+                return 0;
+
         dns_cache_remove_previous(c, key, answer);
 
         /* We only care for positive replies and NXDOMAINs, on all other replies we will simply flush the respective
@@ -668,13 +781,6 @@ int dns_cache_put(
                 weird_rcode = true;
         }
 
-        cache_keys = dns_answer_size(answer);
-        if (key)
-                cache_keys++;
-
-        /* Make some space for our new entries */
-        dns_cache_make_space(c, cache_keys);
-
         if (timestamp <= 0)
                 timestamp = now(clock_boottime_or_monotonic());
 
@@ -821,12 +927,33 @@ static DnsCacheItem *dns_cache_get_by_key_follow_cname_dname_nsec(DnsCache *c, D
         return NULL;
 }
 
-int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcode, DnsAnswer **ret, bool *authenticated) {
+static bool dns_cache_item_wants_refresh(DnsCache *c, DnsCacheItem *i, bool stale, usec_t current) {
+        assert(c);
+        assert(i);
+
+        /* Stale entries are always refreshed, popular ones also shortly before they expire */
+        if (!stale) {
+                if (!c->prefetch || i->n_hit < CACHE_PREFETCH_HITS_MIN)
+                        return false;
+
+                if (i->until - current > (i->until - i->added) / 10)
+                        return false;
+        }
+
+        /* Don't ask again while a refresh is likely still running */
+        if (i->refresh_usec > 0 && current < usec_add(i->refresh_usec, CACHE_REFRESH_RETRY_USEC))
+                return false;
+
+        i->refresh_usec = current;
+        return true;
+}
+
+int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcode, DnsAnswer **ret, bool *authenticated, bool *refresh) {
         _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
         char key_str[DNS_RESOURCE_KEY_STRING_MAX];
         unsigned n = 0;
         int r;
-        bool nxdomain = false;
+        bool nxdomain = false, stale = false;
         DnsCacheItem *j, *first, *nsec = NULL;
         bool have_authenticated = false, have_non_authenticated = false;
         usec_t current;
@@ -837,6 +964,7 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcod
         assert(rcode);
         assert(ret);
         assert(authenticated);
+        assert(refresh);
 
         if (key->type == DNS_TYPE_ANY || key->class == DNS_CLASS_ANY) {
                 /* If we have ANY lookups we don't use the cache, so
@@ -850,6 +978,7 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcod
                 *ret = NULL;
                 *rcode = DNS_RCODE_SUCCESS;
                 *authenticated = false;
+                *refresh = false;
 
                 return 0;
         }
@@ -866,11 +995,20 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcod
                 *ret = NULL;
                 *rcode = DNS_RCODE_SUCCESS;
                 *authenticated = false;
+                *refresh = false;
 
                 return 0;
         }
 
+        current = now(clock_boottime_or_monotonic());
+
         LIST_FOREACH(by_key, j, first) {
+                /* Give the items a second chance when the hand passes them next time */
+                j->referenced = true;
+
+                if (j->until <= current)
+                        stale = true;
+
                 if (j->rr) {
                         if (j->rr->key->type == DNS_TYPE_NSEC)
                                 nsec = j;
@@ -887,6 +1025,24 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcod
                         have_non_authenticated = true;
         }
 
+        /* Expired entries are only left in the cache if we may serve them stale, but failures are never served
+         * stale. */
+        if (stale && (c->stale_retention_usec <= 0 || found_rcode >= 0)) {
+                log_debug("Cache miss for %s, entry expired",
+                          dns_resource_key_to_string(key, key_str, sizeof key_str));
+
+                c->n_miss++;
+
+                *ret = NULL;
+                *rcode = DNS_RCODE_SUCCESS;
+                *authenticated = false;
+                *refresh = false;
+
+                return 0;
+        }
+
+        first->n_hit++;
+
         if (found_rcode >= 0) {
                 log_debug("RCODE %s cache hit for %s",
                           dns_rcode_to_string(found_rcode),
@@ -895,6 +1051,7 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcod
                 *ret = NULL;
                 *rcode = found_rcode;
                 *authenticated = false;
+                *refresh = false;
 
                 c->n_hit++;
                 return 1;
@@ -918,17 +1075,22 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcod
                 if (!bitmap_isset(nsec->rr->nsec.types, key->type) &&
                     !bitmap_isset(nsec->rr->nsec.types, DNS_TYPE_CNAME) &&
                     !bitmap_isset(nsec->rr->nsec.types, DNS_TYPE_DNAME)) {
+                        *refresh = dns_cache_item_wants_refresh(c, first, stale, current);
+
                         c->n_hit++;
                         return 1;
                 }
 
+                *refresh = false;
+
                 c->n_miss++;
                 return 0;
         }
 
-        log_debug("%s cache hit for %s",
+        log_debug("%s%s cache hit for %s",
                   n > 0    ? "Positive" :
                   nxdomain ? "NXDOMAIN" : "NODATA",
+                  stale ? " stale" : "",
                   dns_resource_key_to_string(key, key_str, sizeof key_str));
 
         if (n <= 0) {
@@ -937,6 +1099,7 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcod
                 *ret = NULL;
                 *rcode = nxdomain ? DNS_RCODE_NXDOMAIN : DNS_RCODE_SUCCESS;
                 *authenticated = have_authenticated && !have_non_authenticated;
+                *refresh = dns_cache_item_wants_refresh(c, first, stale, current);
                 return 1;
         }
 
@@ -944,19 +1107,17 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcod
         if (!answer)
                 return -ENOMEM;
 
-        if (clamp_ttl)
-                current = now(clock_boottime_or_monotonic());
-
         LIST_FOREACH(by_key, j, first) {
                 _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
 
                 if (!j->rr)
                         continue;
 
-                if (clamp_ttl) {
+                if (stale || clamp_ttl) {
                         rr = dns_resource_record_ref(j->rr);
 
-                        r = dns_resource_record_clamp_ttl(&rr, LESS_BY(j->until, current) / USEC_PER_SEC);
+                        r = dns_resource_record_clamp_ttl(&rr, stale ? CACHE_TTL_STALE_USEC / USEC_PER_SEC :
+                                                                       LESS_BY(j->until, current) / USEC_PER_SEC);
                         if (r < 0)
                                 return r;
                 }
@@ -971,6 +1132,7 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcod
         *ret = answer;
         *rcode = DNS_RCODE_SUCCESS;
         *authenticated = have_authenticated && !have_non_authenticated;
+        *refresh = dns_cache_item_wants_refresh(c, first, stale, current);
         answer = NULL;
 
         return n;
@@ -1113,3 +1275,170 @@ unsigned dns_cache_size(DnsCache *cache) {
 
         return hashmap_size(cache->by_key);
 }
+
+int dns_cache_save(DnsCache *c, FILE *f) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        Iterator iterator;
+        DnsCacheItem *i;
+        unsigned n = 0;
+        usec_t t;
+        int r;
+
+        assert(c);
+        assert(f);
+
+        /* Writes all entries that did not expire yet */
+
+        if (hashmap_isempty(c->by_key))
+                return 0;
+
+        r = dns_packet_new(&p, DNS_PROTOCOL_DNS, 0, DNS_PACKET_SIZE_MAX);
+        if (r < 0)
+                return r;
+
+        t = now(clock_boottime_or_monotonic());
+
+        HASHMAP_FOREACH(i, c->by_key, iterator) {
+                DnsCacheItem *j;
+
+                LIST_FOREACH(by_key, j, i) {
+                        DnsCacheSnapshotEntry entry;
+
+                        if (j->until <= t)
+                                continue;
+
+                        /* Shared entries are mDNS ones, which are not worth keeping */
+                        if (j->shared_owner)
+                                continue;
+
+                        dns_packet_truncate(p, DNS_PACKET_HEADER_SIZE);
+
+                        if (j->rr)
+                                r = dns_packet_append_rr(p, j->rr, 0, NULL, NULL);
+                        else
+                                r = dns_packet_append_key(p, j->key, 0, NULL);
+                        if (r < 0)
+                                return r;
+
+                        entry = (DnsCacheSnapshotEntry) {
+                                .ifindex = htole32(j->ifindex),
+                                .ttl_usec = htole64(j->until - t),
+                                .rcode = htole16(j->rcode),
+                                .size = htole16(p->size - DNS_PACKET_HEADER_SIZE),
+                                .type = j->type,
+                                .flags = j->authenticated ? DNS_CACHE_SNAPSHOT_AUTHENTICATED : 0,
+                                .owner_family = j->owner_family,
+                        };
+                        memcpy(entry.owner_address, &j->owner_address, sizeof(entry.owner_address));
+
+                        fwrite(&entry, sizeof(entry), 1, f);
+                        fwrite(DNS_PACKET_DATA(p) + DNS_PACKET_HEADER_SIZE, p->size - DNS_PACKET_HEADER_SIZE, 1, f);
+
+                        n++;
+                }
+        }
+
+        return n;
+}
+
+int dns_cache_restore(DnsCache *c, const void *data, size_t size, usec_t elapsed) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        const uint8_t *d = data, *e = d + size;
+        unsigned n = 0;
+        usec_t t;
+        int r;
+
+        assert(c);
+        assert(data || size == 0);
+
+        /* Adds the entries written with dns_cache_save(), whose TTLs did not run out in the time elapsed since */
+
+        r = dns_cache_init(c);
+        if (r < 0)
+                return r;
+
+        r = dns_packet_new(&p, DNS_PROTOCOL_DNS, 0, DNS_PACKET_SIZE_MAX);
+        if (r < 0)
+                return r;
+
+        t = now(clock_boottime_or_monotonic());
+
+        while (d < e) {
+                _cleanup_(dns_cache_item_freep) DnsCacheItem *i = NULL;
+                DnsCacheSnapshotEntry entry;
+                const uint8_t *wire;
+                usec_t ttl;
+                size_t sz;
+
+                if ((size_t) (e - d) < sizeof(entry))
+                        return -EBADMSG;
+
+                memcpy(&entry, d, sizeof(entry));
+                d += sizeof(entry);
+
+                sz = le16toh(entry.size);
+                if ((size_t) (e - d) < sz)
+                        return -EBADMSG;
+
+                wire = d;
+                d += sz;
+
+                ttl = le64toh(entry.ttl_usec);
+                if (ttl <= elapsed)
+                        continue;
+                ttl = MIN(ttl - elapsed, c->max_ttl);
+
+                if (entry.type > DNS_CACHE_RCODE ||
+                    !IN_SET(entry.owner_family, AF_UNSPEC, AF_INET, AF_INET6))
+                        return -EBADMSG;
+
+                dns_packet_truncate(p, DNS_PACKET_HEADER_SIZE);
+                r = dns_packet_append_blob(p, wire, sz, NULL);
+                if (r < 0)
+                        return r;
+                dns_packet_rewind(p, DNS_PACKET_HEADER_SIZE);
+
+                i = new0(DnsCacheItem, 1);
+                if (!i)
+                        return -ENOMEM;
+
+                if (entry.type == DNS_CACHE_POSITIVE) {
+                        r = dns_packet_read_rr(p, &i->rr, NULL, NULL);
+                        if (r < 0)
+                                return r;
+
+                        i->key = dns_resource_key_ref(i->rr->key);
+                } else {
+                        r = dns_packet_read_key(p, &i->key, NULL, NULL);
+                        if (r < 0)
+                                return r;
+                }
+                if (p->rindex != p->size)
+                        return -EBADMSG;
+
+                if (i->rr ? !!dns_cache_get(c, i->rr) : hashmap_contains(c->by_key, i->key))
+                        continue;
+
+                i->type = entry.type;
+                i->rcode = le16toh(entry.rcode);
+                i->authenticated = entry.flags & DNS_CACHE_SNAPSHOT_AUTHENTICATED;
+                i->ifindex = (int) le32toh(entry.ifindex);
+                i->owner_family = entry.owner_family;
+                memcpy(&i->owner_address, entry.owner_address, sizeof(i->owner_address));
+                i->added = t;
+                i->until = t + ttl;
+                i->prioq_idx = PRIOQ_IDX_NULL;
+                i->size = dns_cache_item_size(i);
+
+                dns_cache_make_space(c, i->size);
+
+                r = dns_cache_link_item(c, i);
+                if (r < 0)
+                        return r;
+
+                i = NULL;
+                n++;
+        }
+
+        return n;
+}
@@ -6,11 +6,35 @@
 #include "prioq.h"
 #include "time-util.h"
 
+/* The default limit of the estimated memory used by the cache of one scope */
+#define DNS_CACHE_SIZE_DEFAULT (4U * 1024U * 1024U)
+
+/* We never keep any item longer than 2h in our cache, by default */
+#define DNS_CACHE_MAX_TTL_DEFAULT_USEC (2 * USEC_PER_HOUR)
+
+typedef struct DnsCacheItem DnsCacheItem;
+
 typedef struct DnsCache {
         Hashmap *by_key;
         Prioq *by_expiry;
+
+        /* All items in a ring, which the hand sweeps over when space is needed */
+        LIST_HEAD(DnsCacheItem, by_clock);
+        DnsCacheItem *clock_hand;
+
+        size_t size;
+        size_t max_size;
+        usec_t max_ttl;
+
+        /* How long to keep entries after they expired, to answer with them until they are refreshed */
+        usec_t stale_retention_usec;
+
+        /* Whether to ask for refreshing popular entries before they expire */
+        bool prefetch;
+
         unsigned n_hit;
         unsigned n_miss;
+        unsigned n_evicted;
 } DnsCache;
 
 #include "resolved-dns-answer.h"
@@ -22,7 +46,7 @@ void dns_cache_flush(DnsCache *c);
 void dns_cache_prune(DnsCache *c);
 
 int dns_cache_put(DnsCache *c, DnsResourceKey *key, int rcode, DnsAnswer *answer, bool authenticated, uint32_t nsec_ttl, usec_t timestamp, int owner_family, const union in_addr_union *owner_address);
-int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcode, DnsAnswer **answer, bool *authenticated);
+int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, bool clamp_ttl, int *rcode, DnsAnswer **answer, bool *authenticated, bool *refresh);
 
 int dns_cache_check_conflicts(DnsCache *cache, DnsResourceRecord *rr, int owner_family, const union in_addr_union *owner_address);
 
@@ -32,3 +56,6 @@ bool dns_cache_is_empty(DnsCache *cache);
 unsigned dns_cache_size(DnsCache *cache);
 
 int dns_cache_export_shared_to_packet(DnsCache *cache, DnsPacket *p);
+
+int dns_cache_save(DnsCache *c, FILE *f);
+int dns_cache_restore(DnsCache *c, const void *data, size_t size, usec_t elapsed);
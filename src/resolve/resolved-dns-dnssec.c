@@ -25,6 +25,10 @@
 /* Maximum number of NSEC3 iterations we'll do. RFC5155 says 2500 shall be the maximum useful value */
 #define NSEC3_ITERATIONS_MAX 2500
 
+/* Number of successfully verified signatures we remember, and the size of their digest (SHA-256) */
+#define VERIFY_CACHE_SIZE 1024U
+#define VERIFY_CACHE_KEY_SIZE 32U
+
 /*
  * The DNSSEC Chain of trust:
  *
@@ -114,6 +118,14 @@ int dnssec_canonicalize(const char *n, char *buffer, size_t buffer_max) {
 
 #if HAVE_GCRYPT
 
+/* Verifying a signature is by far the most expensive step of DNSSEC validation, and the same signatures are verified
+ * over and over again: whenever an RRset is looked up again after it expired from the cache, when a query is sent to
+ * multiple scopes, and for the DNSKEY and DS RRsets on the chain of trust shared by many lookups. Hence, remember a
+ * digest of the signed data, the signature and the key of each signature we found valid, and skip the public key
+ * operation when we encounter them again. Only valid signatures are remembered, expiry is checked separately. The
+ * cache is direct-mapped, new entries simply replace whatever is in their slot. */
+static uint8_t verify_cache[VERIFY_CACHE_SIZE][VERIFY_CACHE_KEY_SIZE];
+
 static int rr_compare(const void *a, const void *b) {
         DnsResourceRecord **x = (DnsResourceRecord**) a, **y = (DnsResourceRecord**) b;
         size_t m;
@@ -524,6 +536,11 @@ static void md_add_uint16(gcry_md_hd_t md, uint16_t v) {
         gcry_md_write(md, &v, sizeof(v));
 }
 
+static void md_add_uint32(gcry_md_hd_t md, uint32_t v) {
+        v = htobe32(v);
+        gcry_md_write(md, &v, sizeof(v));
+}
+
 static void fwrite_uint8(FILE *fp, uint8_t v) {
         fwrite(&v, sizeof(v), 1, fp);
 }
@@ -687,6 +704,139 @@ static void dnssec_fix_rrset_ttl(
         rrsig->expiry = rrsig->rrsig.expiration * USEC_PER_SEC;
 }
 
+static int dnssec_verify_cache_key(
+                DnsResourceRecord *rrsig,
+                DnsResourceRecord *dnskey,
+                const void *data,
+                size_t size,
+                uint8_t ret[static VERIFY_CACHE_KEY_SIZE]) {
+
+        _cleanup_(gcry_md_closep) gcry_md_hd_t md = NULL;
+        void *h;
+
+        initialize_libgcrypt(false);
+
+        gcry_md_open(&md, GCRY_MD_SHA256, 0);
+        if (!md)
+                return -EIO;
+
+        assert(gcry_md_get_algo_dlen(GCRY_MD_SHA256) == VERIFY_CACHE_KEY_SIZE);
+
+        /* Prefix the fields with their size, so that they can't be shifted against each other */
+        md_add_uint8(md, dnskey->dnskey.algorithm);
+
+        md_add_uint32(md, size);
+        gcry_md_write(md, data, size);
+
+        md_add_uint32(md, rrsig->rrsig.signature_size);
+        gcry_md_write(md, rrsig->rrsig.signature, rrsig->rrsig.signature_size);
+
+        md_add_uint32(md, dnskey->dnskey.key_size);
+        gcry_md_write(md, dnskey->dnskey.key, dnskey->dnskey.key_size);
+
+        h = gcry_md_read(md, 0);
+        if (!h)
+                return -EIO;
+
+        memcpy(ret, h, VERIFY_CACHE_KEY_SIZE);
+        return 0;
+}
+
+static uint8_t *dnssec_verify_cache_slot(const uint8_t key[static VERIFY_CACHE_KEY_SIZE]) {
+        return verify_cache[(((size_t) key[0] << 8) | key[1]) % VERIFY_CACHE_SIZE];
+}
+
+static bool dnssec_verify_cache_find(const uint8_t key[static VERIFY_CACHE_KEY_SIZE]) {
+        return memcmp(dnssec_verify_cache_slot(key), key, VERIFY_CACHE_KEY_SIZE) == 0;
+}
+
+static void dnssec_verify_cache_add(const uint8_t key[static VERIFY_CACHE_KEY_SIZE]) {
+        memcpy(dnssec_verify_cache_slot(key), key, VERIFY_CACHE_KEY_SIZE);
+}
+
+static int dnssec_verify_signature(
+                DnsResourceRecord *rrsig,
+                DnsResourceRecord *dnskey,
+                const void *data,
+                size_t size) {
+
+        _cleanup_(gcry_md_closep) gcry_md_hd_t md = NULL;
+        int r, md_algorithm;
+        size_t hash_size;
+        void *hash;
+
+        /* Verifies the signature of "rrsig" over the data to sign with "dnskey". Returns > 0 if the signature is
+         * valid, 0 if it is not, and -EOPNOTSUPP if the algorithm is not supported. */
+
+        initialize_libgcrypt(false);
+
+        switch (rrsig->rrsig.algorithm) {
+#if GCRYPT_VERSION_NUMBER >= 0x010600
+        case DNSSEC_ALGORITHM_ED25519:
+                break;
+#else
+        case DNSSEC_ALGORITHM_ED25519:
+#endif
+        case DNSSEC_ALGORITHM_ED448:
+                return -EOPNOTSUPP;
+        default:
+                /* Let's calculate the digest of the data to sign */
+                md_algorithm = algorithm_to_gcrypt_md(rrsig->rrsig.algorithm);
+                if (md_algorithm < 0)
+                        return md_algorithm;
+
+                gcry_md_open(&md, md_algorithm, 0);
+                if (!md)
+                        return -EIO;
+
+                hash_size = gcry_md_get_algo_dlen(md_algorithm);
+                assert(hash_size > 0);
+
+                gcry_md_write(md, data, size);
+
+                hash = gcry_md_read(md, 0);
+                if (!hash)
+                        return -EIO;
+        }
+
+        switch (rrsig->rrsig.algorithm) {
+
+        case DNSSEC_ALGORITHM_RSASHA1:
+        case DNSSEC_ALGORITHM_RSASHA1_NSEC3_SHA1:
+        case DNSSEC_ALGORITHM_RSASHA256:
+        case DNSSEC_ALGORITHM_RSASHA512:
+                r = dnssec_rsa_verify(
+                                gcry_md_algo_name(md_algorithm),
+                                hash, hash_size,
+                                rrsig,
+                                dnskey);
+                break;
+
+        case DNSSEC_ALGORITHM_ECDSAP256SHA256:
+        case DNSSEC_ALGORITHM_ECDSAP384SHA384:
+                r = dnssec_ecdsa_verify(
+                                gcry_md_algo_name(md_algorithm),
+                                rrsig->rrsig.algorithm,
+                                hash, hash_size,
+                                rrsig,
+                                dnskey);
+                break;
+#if GCRYPT_VERSION_NUMBER >= 0x010600
+        case DNSSEC_ALGORITHM_ED25519:
+                r = dnssec_eddsa_verify(
+                                rrsig->rrsig.algorithm,
+                                data, size,
+                                rrsig,
+                                dnskey);
+                break;
+#endif
+        default:
+                return -EOPNOTSUPP;
+        }
+
+        return r;
+}
+
 int dnssec_verify_rrset(
                 DnsAnswer *a,
                 const DnsResourceKey *key,
@@ -696,16 +846,14 @@ int dnssec_verify_rrset(
                 DnssecResult *result) {
 
         uint8_t wire_format_name[DNS_WIRE_FORMAT_HOSTNAME_MAX];
+        uint8_t cache_key[VERIFY_CACHE_KEY_SIZE];
         DnsResourceRecord **list, *rr;
         const char *source, *name;
-        _cleanup_(gcry_md_closep) gcry_md_hd_t md = NULL;
-        int r, md_algorithm;
+        int r;
         size_t k, n = 0;
         size_t sig_size = 0;
         _cleanup_free_ char *sig_data = NULL;
         _cleanup_fclose_ FILE *f = NULL;
-        size_t hash_size;
-        void *hash;
         bool wildcard;
 
         assert(key);
@@ -856,76 +1004,23 @@ int dnssec_verify_rrset(
         if (r < 0)
                 return r;
 
-        initialize_libgcrypt(false);
+        r = dnssec_verify_cache_key(rrsig, dnskey, sig_data, sig_size, cache_key);
+        if (r < 0)
+                return r;
 
-        switch (rrsig->rrsig.algorithm) {
-#if GCRYPT_VERSION_NUMBER >= 0x010600
-        case DNSSEC_ALGORITHM_ED25519:
-                break;
-#else
-        case DNSSEC_ALGORITHM_ED25519:
-#endif
-        case DNSSEC_ALGORITHM_ED448:
-                *result = DNSSEC_UNSUPPORTED_ALGORITHM;
-                return 0;
-        default:
-                /* OK, the RRs are now in canonical order. Let's calculate the digest */
-                md_algorithm = algorithm_to_gcrypt_md(rrsig->rrsig.algorithm);
-                if (md_algorithm == -EOPNOTSUPP) {
+        if (dnssec_verify_cache_find(cache_key))
+                r = 1;
+        else {
+                r = dnssec_verify_signature(rrsig, dnskey, sig_data, sig_size);
+                if (r == -EOPNOTSUPP) {
                         *result = DNSSEC_UNSUPPORTED_ALGORITHM;
                         return 0;
                 }
-                if (md_algorithm < 0)
-                        return md_algorithm;
-
-                gcry_md_open(&md, md_algorithm, 0);
-                if (!md)
-                        return -EIO;
-
-                hash_size = gcry_md_get_algo_dlen(md_algorithm);
-                assert(hash_size > 0);
-
-                gcry_md_write(md, sig_data, sig_size);
-
-                hash = gcry_md_read(md, 0);
-                if (!hash)
-                        return -EIO;
-        }
-
-        switch (rrsig->rrsig.algorithm) {
-
-        case DNSSEC_ALGORITHM_RSASHA1:
-        case DNSSEC_ALGORITHM_RSASHA1_NSEC3_SHA1:
-        case DNSSEC_ALGORITHM_RSASHA256:
-        case DNSSEC_ALGORITHM_RSASHA512:
-                r = dnssec_rsa_verify(
-                                gcry_md_algo_name(md_algorithm),
-                                hash, hash_size,
-                                rrsig,
-                                dnskey);
-                break;
-
-        case DNSSEC_ALGORITHM_ECDSAP256SHA256:
-        case DNSSEC_ALGORITHM_ECDSAP384SHA384:
-                r = dnssec_ecdsa_verify(
-                                gcry_md_algo_name(md_algorithm),
-                                rrsig->rrsig.algorithm,
-                                hash, hash_size,
-                                rrsig,
-                                dnskey);
-                break;
-#if GCRYPT_VERSION_NUMBER >= 0x010600
-        case DNSSEC_ALGORITHM_ED25519:
-                r = dnssec_eddsa_verify(
-                                rrsig->rrsig.algorithm,
-                                sig_data, sig_size,
-                                rrsig,
-                                dnskey);
-                break;
-#endif
+                if (r < 0)
+                        return r;
+                if (r > 0)
+                        dnssec_verify_cache_add(cache_key);
         }
-        if (r < 0)
-                return r;
 
         /* Now, fix the ttl, expiry, and remember the synthesizing source and the signer */
         if (r > 0)
@@ -3,6 +3,7 @@
 #include "alloc-util.h"
 #include "dns-domain.h"
 #include "dns-type.h"
+#include "fd-util.h"
 #include "hostname-util.h"
 #include "local-addresses.h"
 #include "resolved-dns-query.h"
@@ -393,6 +394,8 @@ DnsQuery *dns_query_free(DnsQuery *q) {
                 dns_stream_unref(q->request_dns_stream);
         }
 
+        safe_close(q->request_socket_fd);
+
         free(q->request_address_string);
 
         if (q->manager) {
@@ -464,6 +467,7 @@ int dns_query_new(
         q->answer_dnssec_result = _DNSSEC_RESULT_INVALID;
         q->answer_protocol = _DNS_PROTOCOL_INVALID;
         q->answer_family = AF_UNSPEC;
+        q->request_socket_fd = -1;
 
         /* First dump UTF8  question */
         DNS_QUESTION_FOREACH(key, question_utf8)
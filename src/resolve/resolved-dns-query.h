@@ -85,6 +85,10 @@ struct DnsQuery {
         DnsStream *request_dns_stream;
         DnsPacket *reply_dns_packet;
 
+        /* Query socket client information */
+        int request_socket_fd;
+        uint32_t request_socket_id;
+
         /* Completion callback */
         void (*complete)(DnsQuery* q);
         unsigned block_ready;
@@ -9,6 +9,7 @@
 #include "hostname-util.h"
 #include "missing.h"
 #include "random-util.h"
+#include "resolved-cache-snapshot.h"
 #include "resolved-dnssd.h"
 #include "resolved-dns-scope.h"
 #include "resolved-dns-zone.h"
@@ -39,6 +40,8 @@ int dns_scope_new(Manager *m, DnsScope **ret, Link *l, DnsProtocol protocol, int
         s->protocol = protocol;
         s->family = family;
         s->resend_timeout = MULTICAST_RESEND_TIMEOUT_MIN_USEC;
+        s->cache.max_size = m->cache_size;
+        s->cache.max_ttl = m->cache_max_ttl;
 
         if (protocol == DNS_PROTOCOL_DNS) {
                 /* Copy DNSSEC mode from the link if it is set there,
@@ -55,6 +58,13 @@ int dns_scope_new(Manager *m, DnsScope **ret, Link *l, DnsProtocol protocol, int
                         s->dns_over_tls_mode = manager_get_dns_over_tls_mode(m);
                 }
 
+                /* Only unicast DNS entries are refreshed in the background, see dns_transaction_refresh() */
+                s->cache.prefetch = m->cache_prefetch;
+                s->cache.stale_retention_usec = m->stale_retention_usec;
+
+                /* Pick up entries from before a restart, if we already know which server we talk to */
+                manager_cache_snapshot_restore(m, s, l ? l->current_dns_server : m->current_dns_server);
+
         } else {
                 s->dnssec_mode = DNSSEC_NO;
                 s->dns_over_tls_mode = DNS_OVER_TLS_NO;
@@ -151,6 +161,36 @@ unsigned dns_scope_get_n_dns_servers(DnsScope *s) {
         return n;
 }
 
+DnsServer *dns_scope_get_race_dns_server(DnsScope *s) {
+        DnsServer *current, *i, *best = NULL;
+
+        assert(s);
+
+        /* Returns the server to race queries to alongside the current one: the one among the others with the lowest
+         * retransmission timeout, i.e. the one that answered fastest and most reliably recently. */
+
+        current = dns_scope_get_dns_server(s);
+        if (!current)
+                return NULL;
+
+        if (s->link)
+                i = s->link->dns_servers;
+        else if (current->type == DNS_SERVER_FALLBACK)
+                i = s->manager->fallback_dns_servers;
+        else
+                i = s->manager->dns_servers;
+
+        for (; i; i = i->servers_next) {
+                if (i == current)
+                        continue;
+
+                if (!best || i->resend_timeout < best->resend_timeout)
+                        best = i;
+        }
+
+        return best;
+}
+
 void dns_scope_next_dns_server(DnsScope *s) {
         assert(s);
 
@@ -3,6 +3,7 @@
 #include "sd-messages.h"
 
 #include "alloc-util.h"
+#include "resolved-cache-snapshot.h"
 #include "resolved-dns-server.h"
 #include "resolved-dns-stub.h"
 #include "resolved-resolv-conf.h"
@@ -17,6 +18,11 @@
 /* The number of times we will attempt a certain feature set before degrading */
 #define DNS_SERVER_FEATURE_RETRY_ATTEMPTS 3
 
+/* Bounds of the retransmission timeout of UDP queries. The upper bound is also used as long as we know nothing about
+ * the server. */
+#define DNS_SERVER_RESEND_TIMEOUT_MIN_USEC (500 * USEC_PER_MSEC)
+#define DNS_SERVER_RESEND_TIMEOUT_MAX_USEC (SD_RESOLVED_QUERY_TIMEOUT_USEC / DNS_TRANSACTION_ATTEMPTS_MAX)
+
 int dns_server_new(
                 Manager *m,
                 DnsServer **ret,
@@ -53,6 +59,8 @@ int dns_server_new(
         s->family = family;
         s->address = *in_addr;
         s->ifindex = ifindex;
+        s->srtt = USEC_INFINITY;
+        s->resend_timeout = DNS_SERVER_RESEND_TIMEOUT_MAX_USEC;
 
         dns_server_reset_features(s);
 
@@ -256,12 +264,39 @@ static void dns_server_reset_counters(DnsServer *s) {
          * incomplete. */
 }
 
-void dns_server_packet_received(DnsServer *s, int protocol, DnsServerFeatureLevel level, size_t size) {
+static void dns_server_rtt_sample(DnsServer *s, usec_t rtt) {
+        usec_t delta;
+
+        assert(s);
+
+        /* Update the smoothed round-trip time and its variation, and derive the retransmission timeout from them, see
+         * RFC 6298, Section 2 */
+
+        if (s->srtt == USEC_INFINITY) {
+                s->srtt = rtt;
+                s->rttvar = rtt / 2;
+        } else {
+                delta = s->srtt > rtt ? s->srtt - rtt : rtt - s->srtt;
+
+                s->rttvar = (3 * s->rttvar + delta) / 4;
+                s->srtt = (7 * s->srtt + rtt) / 8;
+        }
+
+        s->resend_timeout = CLAMP(s->srtt + 4 * s->rttvar,
+                                  DNS_SERVER_RESEND_TIMEOUT_MIN_USEC,
+                                  DNS_SERVER_RESEND_TIMEOUT_MAX_USEC);
+}
+
+void dns_server_packet_received(DnsServer *s, int protocol, DnsServerFeatureLevel level, size_t size, usec_t rtt) {
         assert(s);
 
         if (protocol == IPPROTO_UDP) {
                 if (s->possible_feature_level == level)
                         s->n_failed_udp = 0;
+
+                /* The caller passes USEC_INFINITY if it cannot tell which query this is the reply to */
+                if (rtt != USEC_INFINITY)
+                        dns_server_rtt_sample(s, rtt);
         } else if (protocol == IPPROTO_TCP) {
                 if (DNS_SERVER_FEATURE_LEVEL_IS_TLS(level)) {
                         if (s->possible_feature_level == level)
@@ -301,6 +336,10 @@ void dns_server_packet_lost(DnsServer *s, int protocol, DnsServerFeatureLevel le
         assert(s);
         assert(s->manager);
 
+        /* Back off exponentially until we get an answer again, see RFC 6298, Section 5 */
+        if (protocol == IPPROTO_UDP)
+                s->resend_timeout = MIN(s->resend_timeout * 2, DNS_SERVER_RESEND_TIMEOUT_MAX_USEC);
+
         if (s->possible_feature_level == level) {
                 if (protocol == IPPROTO_UDP)
                         s->n_failed_udp++;
@@ -723,8 +762,10 @@ DnsServer *manager_set_dns_server(Manager *m, DnsServer *s) {
         dns_server_unref(m->current_dns_server);
         m->current_dns_server = dns_server_ref(s);
 
-        if (m->unicast_scope)
+        if (m->unicast_scope) {
                 dns_cache_flush(&m->unicast_scope->cache);
+                manager_cache_snapshot_restore(m, m->unicast_scope, s);
+        }
 
         return s;
 }
@@ -860,6 +901,8 @@ void dns_server_reset_features_all(DnsServer *s) {
 }
 
 void dns_server_dump(DnsServer *s, FILE *f) {
+        char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX];
+
         assert(s);
 
         if (!f)
@@ -895,6 +938,14 @@ void dns_server_dump(DnsServer *s, FILE *f) {
         fputs(yes_no(dns_server_dnssec_supported(s)), f);
         fputc('\n', f);
 
+        if (s->srtt != USEC_INFINITY)
+                fprintf(f, "\tSmoothed round-trip time: %s (variation %s)\n",
+                        format_timespan(a, sizeof(a), s->srtt, USEC_PER_MSEC),
+                        format_timespan(b, sizeof(b), s->rttvar, USEC_PER_MSEC));
+
+        fprintf(f, "\tRetransmission timeout: %s\n",
+                format_timespan(a, sizeof(a), s->resend_timeout, USEC_PER_MSEC));
+
         fprintf(f,
                 "\tMaximum UDP packet size received: %zu\n"
                 "\tFailed UDP attempts: %u\n"
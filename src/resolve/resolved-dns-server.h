@@ -77,6 +77,12 @@ struct DnsServer {
         usec_t verified_usec;
         usec_t features_grace_period_usec;
 
+        /* Smoothed round-trip time of UDP queries and its variation, following RFC 6298, and the retransmission
+         * timeout derived from them. srtt is USEC_INFINITY as long as we have no sample. */
+        usec_t srtt;
+        usec_t rttvar;
+        usec_t resend_timeout;
+
         /* Whether we already warned about downgrading to non-DNSSEC mode for this server */
         bool warned_downgrade:1;
 
@@ -103,7 +109,7 @@ DnsServer* dns_server_unref(DnsServer *s);
 void dns_server_unlink(DnsServer *s);
 void dns_server_move_back_and_unmark(DnsServer *s);
 
-void dns_server_packet_received(DnsServer *s, int protocol, DnsServerFeatureLevel level, size_t size);
+void dns_server_packet_received(DnsServer *s, int protocol, DnsServerFeatureLevel level, size_t size, usec_t rtt);
 void dns_server_packet_lost(DnsServer *s, int protocol, DnsServerFeatureLevel level);
 void dns_server_packet_truncated(DnsServer *s, DnsServerFeatureLevel level);
 void dns_server_packet_rrsig_missing(DnsServer *s, DnsServerFeatureLevel level);
@@ -8,6 +8,7 @@
 #include "missing.h"
 #include "resolved-dns-stream.h"
 
+/* Streams are closed when nothing was sent or received on them for this long */
 #define DNS_STREAM_TIMEOUT_USEC (10 * USEC_PER_SEC)
 #define DNS_STREAMS_MAX 128
 
@@ -315,7 +316,8 @@ static int on_stream_timeout(sd_event_source *es, usec_t usec, void *userdata) {
 }
 
 static int on_stream_io(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
-        DnsStream *s = userdata;
+        _cleanup_(dns_stream_unrefp) DnsStream *s = dns_stream_ref(userdata); /* Packet handlers might drop the last reference */
+        bool progress = false;
         int r;
 
         assert(s);
@@ -361,9 +363,10 @@ static int on_stream_io(sd_event_source *es, int fd, uint32_t revents, void *use
                         return dns_stream_complete(s, -r);
         }
 
-        if ((revents & EPOLLOUT) &&
-            s->write_packet &&
-            s->n_written < sizeof(s->write_size) + s->write_packet->size) {
+        /* Write as many of the queued packets as the socket takes, so that pipelined queries go out right away */
+        while ((revents & EPOLLOUT) &&
+               s->write_packet &&
+               s->n_written < sizeof(s->write_size) + s->write_packet->size) {
 
                 struct iovec iov[2];
                 ssize_t ss;
@@ -379,10 +382,16 @@ static int on_stream_io(sd_event_source *es, int fd, uint32_t revents, void *use
                 if (ss < 0) {
                         if (!IN_SET(-ss, EINTR, EAGAIN))
                                 return dns_stream_complete(s, -ss);
-                } else
-                        s->n_written += ss;
+                        break;
+                }
+                if (ss == 0)
+                        break;
 
-                /* Are we done? If so, disable the event source for EPOLLOUT */
+                s->n_written += ss;
+                progress = true;
+
+                /* Are we done? If so, continue with the next packet in the queue, or disable the event source for
+                 * EPOLLOUT */
                 if (s->n_written >= sizeof(s->write_size) + s->write_packet->size) {
                         r = dns_stream_update_io(s);
                         if (r < 0)
@@ -390,89 +399,108 @@ static int on_stream_io(sd_event_source *es, int fd, uint32_t revents, void *use
                 }
         }
 
-        if ((revents & (EPOLLIN|EPOLLHUP|EPOLLRDHUP)) &&
-            (!s->read_packet ||
-             s->n_read < sizeof(s->read_size) + s->read_packet->size)) {
+        /* Read as many packets as are available, as replies to pipelined queries may arrive back to back. With TLS
+         * we would not even be woken up again for those which were already read from the socket and are buffered in
+         * the TLS session. */
+        while ((revents & (EPOLLIN|EPOLLHUP|EPOLLRDHUP)) &&
+               (!s->read_packet ||
+                s->n_read < sizeof(s->read_size) + s->read_packet->size)) {
 
-                if (s->n_read < sizeof(s->read_size)) {
-                        ssize_t ss;
+                ssize_t ss;
 
+                if (s->n_read < sizeof(s->read_size)) {
                         ss = dns_stream_read(s, (uint8_t*) &s->read_size + s->n_read, sizeof(s->read_size) - s->n_read);
                         if (ss < 0) {
                                 if (!IN_SET(-ss, EINTR, EAGAIN))
                                         return dns_stream_complete(s, -ss);
-                        } else if (ss == 0)
+                                break;
+                        }
+                        if (ss == 0)
                                 return dns_stream_complete(s, ECONNRESET);
-                        else
-                                s->n_read += ss;
-                }
 
-                if (s->n_read >= sizeof(s->read_size)) {
-
-                        if (be16toh(s->read_size) < DNS_PACKET_HEADER_SIZE)
-                                return dns_stream_complete(s, EBADMSG);
-
-                        if (s->n_read < sizeof(s->read_size) + be16toh(s->read_size)) {
-                                ssize_t ss;
-
-                                if (!s->read_packet) {
-                                        r = dns_packet_new(&s->read_packet, s->protocol, be16toh(s->read_size), DNS_PACKET_SIZE_MAX);
-                                        if (r < 0)
-                                                return dns_stream_complete(s, -r);
-
-                                        s->read_packet->size = be16toh(s->read_size);
-                                        s->read_packet->ipproto = IPPROTO_TCP;
-                                        s->read_packet->family = s->peer.sa.sa_family;
-                                        s->read_packet->ttl = s->ttl;
-                                        s->read_packet->ifindex = s->ifindex;
-
-                                        if (s->read_packet->family == AF_INET) {
-                                                s->read_packet->sender.in = s->peer.in.sin_addr;
-                                                s->read_packet->sender_port = be16toh(s->peer.in.sin_port);
-                                                s->read_packet->destination.in = s->local.in.sin_addr;
-                                                s->read_packet->destination_port = be16toh(s->local.in.sin_port);
-                                        } else {
-                                                assert(s->read_packet->family == AF_INET6);
-                                                s->read_packet->sender.in6 = s->peer.in6.sin6_addr;
-                                                s->read_packet->sender_port = be16toh(s->peer.in6.sin6_port);
-                                                s->read_packet->destination.in6 = s->local.in6.sin6_addr;
-                                                s->read_packet->destination_port = be16toh(s->local.in6.sin6_port);
-
-                                                if (s->read_packet->ifindex == 0)
-                                                        s->read_packet->ifindex = s->peer.in6.sin6_scope_id;
-                                                if (s->read_packet->ifindex == 0)
-                                                        s->read_packet->ifindex = s->local.in6.sin6_scope_id;
-                                        }
-                                }
+                        s->n_read += ss;
+                        progress = true;
 
-                                ss = dns_stream_read(s,
-                                          (uint8_t*) DNS_PACKET_DATA(s->read_packet) + s->n_read - sizeof(s->read_size),
-                                          sizeof(s->read_size) + be16toh(s->read_size) - s->n_read);
-                                if (ss < 0) {
-                                        if (!IN_SET(errno, EINTR, EAGAIN))
-                                                return dns_stream_complete(s, errno);
-                                } else if (ss == 0)
-                                        return dns_stream_complete(s, ECONNRESET);
-                                else
-                                        s->n_read += ss;
-                        }
+                        if (s->n_read < sizeof(s->read_size))
+                                continue;
+                }
 
-                        /* Are we done? If so, disable the event source for EPOLLIN */
-                        if (s->n_read >= sizeof(s->read_size) + be16toh(s->read_size)) {
-                                /* If there's a packet handler
-                                 * installed, call that. Note that
-                                 * this is optional... */
-                                if (s->on_packet) {
-                                        r = s->on_packet(s);
-                                        if (r < 0)
-                                                return r;
-                                }
+                if (be16toh(s->read_size) < DNS_PACKET_HEADER_SIZE)
+                        return dns_stream_complete(s, EBADMSG);
 
-                                r = dns_stream_update_io(s);
+                if (s->n_read < sizeof(s->read_size) + be16toh(s->read_size)) {
+
+                        if (!s->read_packet) {
+                                r = dns_packet_new(&s->read_packet, s->protocol, be16toh(s->read_size), DNS_PACKET_SIZE_MAX);
                                 if (r < 0)
                                         return dns_stream_complete(s, -r);
+
+                                s->read_packet->size = be16toh(s->read_size);
+                                s->read_packet->ipproto = IPPROTO_TCP;
+                                s->read_packet->family = s->peer.sa.sa_family;
+                                s->read_packet->ttl = s->ttl;
+                                s->read_packet->ifindex = s->ifindex;
+
+                                if (s->read_packet->family == AF_INET) {
+                                        s->read_packet->sender.in = s->peer.in.sin_addr;
+                                        s->read_packet->sender_port = be16toh(s->peer.in.sin_port);
+                                        s->read_packet->destination.in = s->local.in.sin_addr;
+                                        s->read_packet->destination_port = be16toh(s->local.in.sin_port);
+                                } else {
+                                        assert(s->read_packet->family == AF_INET6);
+                                        s->read_packet->sender.in6 = s->peer.in6.sin6_addr;
+                                        s->read_packet->sender_port = be16toh(s->peer.in6.sin6_port);
+                                        s->read_packet->destination.in6 = s->local.in6.sin6_addr;
+                                        s->read_packet->destination_port = be16toh(s->local.in6.sin6_port);
+
+                                        if (s->read_packet->ifindex == 0)
+                                                s->read_packet->ifindex = s->peer.in6.sin6_scope_id;
+                                        if (s->read_packet->ifindex == 0)
+                                                s->read_packet->ifindex = s->local.in6.sin6_scope_id;
+                                }
+                        }
+
+                        ss = dns_stream_read(s,
+                                  (uint8_t*) DNS_PACKET_DATA(s->read_packet) + s->n_read - sizeof(s->read_size),
+                                  sizeof(s->read_size) + be16toh(s->read_size) - s->n_read);
+                        if (ss < 0) {
+                                if (!IN_SET(-ss, EINTR, EAGAIN))
+                                        return dns_stream_complete(s, -ss);
+                                break;
                         }
+                        if (ss == 0)
+                                return dns_stream_complete(s, ECONNRESET);
+
+                        s->n_read += ss;
+                        progress = true;
+
+                        if (s->n_read < sizeof(s->read_size) + be16toh(s->read_size))
+                                continue;
                 }
+
+                /* We are done. If there's a packet handler installed, call that. Note that this is optional... If the
+                 * handler takes the packet, we continue with the next one. */
+                if (s->on_packet) {
+                        r = s->on_packet(s);
+                        if (r < 0)
+                                return r;
+
+                        /* The handler might have stopped the stream */
+                        if (s->fd < 0)
+                                return 0;
+                }
+
+                r = dns_stream_update_io(s);
+                if (r < 0)
+                        return dns_stream_complete(s, -r);
+        }
+
+        /* Streams are kept open while there is traffic on them, so that later queries to the same server can use
+         * them too */
+        if (progress && s->timeout_event_source) {
+                r = sd_event_source_set_time(s->timeout_event_source, now(clock_boottime_or_monotonic()) + DNS_STREAM_TIMEOUT_USEC);
+                if (r < 0)
+                        return dns_stream_complete(s, -r);
         }
 
         if ((s->write_packet && s->n_written >= sizeof(s->write_size) + s->write_packet->size) &&
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
 #include "fd-util.h"
+#include "io-util.h"
 #include "resolved-dns-stub.h"
 #include "socket-util.h"
 
@@ -8,6 +9,19 @@
  * IP and UDP header sizes */
 #define ADVERTISE_DATAGRAM_SIZE_MAX (65536U-14U-20U-8U)
 
+/* A UDP reply that is sent together with the others of the same batch of queries, see on_dns_stub_packet() */
+typedef struct DnsStubReply {
+        DnsPacket *packet;
+        struct in_addr destination;
+        struct in_addr source;
+        uint16_t port;
+} DnsStubReply;
+
+struct DnsStubReplyBatch {
+        DnsStubReply replies[MANAGER_RECV_BATCH_MAX];
+        size_t n_replies;
+};
+
 static int manager_dns_stub_udp_fd(Manager *m);
 static int manager_dns_stub_tcp_fd(Manager *m);
 
@@ -142,7 +156,20 @@ static int dns_stub_send(Manager *m, DnsStream *s, DnsPacket *p, DnsPacket *repl
 
         if (s)
                 r = dns_stream_write_packet(s, reply);
-        else {
+        else if (m->dns_stub_reply_batch &&
+                 p->family == AF_INET &&
+                 m->dns_stub_reply_batch->n_replies < ELEMENTSOF(m->dns_stub_reply_batch->replies)) {
+
+                /* Queries answered right away, i.e. from the cache, are replied to once the whole batch of queries
+                 * was processed */
+                m->dns_stub_reply_batch->replies[m->dns_stub_reply_batch->n_replies++] = (DnsStubReply) {
+                        .packet = dns_packet_ref(reply),
+                        .destination = p->sender.in,
+                        .source = p->destination.in,
+                        .port = p->sender_port,
+                };
+                return 0;
+        } else {
                 int fd;
 
                 fd = manager_dns_stub_udp_fd(m);
@@ -372,21 +399,115 @@ fail:
         dns_query_free(q);
 }
 
+static void dns_stub_flush_replies(Manager *m, int fd, DnsStubReplyBatch *b) {
+        union {
+                struct cmsghdr header; /* For alignment */
+                uint8_t buffer[CMSG_SPACE(sizeof(struct in_pktinfo))];
+        } controls[ELEMENTSOF(b->replies)];
+        struct mmsghdr msgs[ELEMENTSOF(b->replies)];
+        struct iovec iovs[ELEMENTSOF(b->replies)];
+        struct sockaddr_in addrs[ELEMENTSOF(b->replies)];
+        size_t i, k = 0;
+
+        assert(m);
+        assert(fd >= 0);
+        assert(b);
+
+        for (i = 0; i < b->n_replies; i++) {
+                DnsStubReply *reply = b->replies + i;
+                struct in_pktinfo *pi;
+                struct cmsghdr *cmsg;
+
+                iovs[i] = IOVEC_MAKE(DNS_PACKET_DATA(reply->packet), reply->packet->size);
+                addrs[i] = (struct sockaddr_in) {
+                        .sin_family = AF_INET,
+                        .sin_addr = reply->destination,
+                        .sin_port = htobe16(reply->port),
+                };
+
+                zero(controls[i]);
+                msgs[i] = (struct mmsghdr) {
+                        .msg_hdr = {
+                                .msg_name = &addrs[i],
+                                .msg_namelen = sizeof(addrs[i]),
+                                .msg_iov = &iovs[i],
+                                .msg_iovlen = 1,
+                                .msg_control = &controls[i],
+                                .msg_controllen = CMSG_LEN(sizeof(struct in_pktinfo)),
+                        },
+                };
+
+                /* As in dns_stub_send(), make sure the reply comes from 127.0.0.53 */
+                cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+                cmsg->cmsg_len = msgs[i].msg_hdr.msg_controllen;
+                cmsg->cmsg_level = IPPROTO_IP;
+                cmsg->cmsg_type = IP_PKTINFO;
+
+                pi = (struct in_pktinfo*) CMSG_DATA(cmsg);
+                pi->ipi_ifindex = LOOPBACK_IFINDEX;
+                pi->ipi_spec_dst = reply->source;
+        }
+
+        while (k < b->n_replies) {
+                union in_addr_union destination, source;
+                int n, r;
+
+                n = sendmmsg(fd, msgs + k, b->n_replies - k, MSG_DONTWAIT);
+                if (n > 0) {
+                        k += n;
+                        continue;
+                }
+                if (n < 0 && errno == EINTR)
+                        continue;
+
+                /* The socket buffer is full, or the first reply could not be sent. Send it the slow way, which waits
+                 * for the socket if needed, and try again with the others. */
+                destination.in = b->replies[k].destination;
+                source.in = b->replies[k].source;
+
+                r = manager_send(m, fd, LOOPBACK_IFINDEX, AF_INET, &destination, b->replies[k].port, &source, b->replies[k].packet);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to send reply packet: %m");
+
+                k++;
+        }
+
+        for (i = 0; i < b->n_replies; i++)
+                dns_packet_unref(b->replies[i].packet);
+        b->n_replies = 0;
+}
+
 static int on_dns_stub_packet(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
-        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        DnsPacket *packets[MANAGER_RECV_BATCH_MAX];
+        DnsStubReplyBatch batch = {};
         Manager *m = userdata;
-        int r;
+        int i, n;
 
-        r = manager_recv(m, fd, DNS_PROTOCOL_DNS, &p);
-        if (r <= 0)
-                return r;
+        /* Receive a number of queries at once, and reply to those which can be answered immediately, i.e. from the
+         * cache or /etc/hosts, with a single sendmmsg() call, to save on system calls when there are lots of
+         * queries. */
 
-        if (dns_packet_validate_query(p) > 0) {
-                log_debug("Got DNS stub UDP query packet for id %u", DNS_PACKET_ID(p));
+        n = manager_recv_many(m, fd, DNS_PROTOCOL_DNS, packets, ELEMENTSOF(packets));
+        if (n <= 0)
+                return n;
 
-                dns_stub_process_query(m, NULL, p);
-        } else
-                log_debug("Invalid DNS stub UDP packet, ignoring.");
+        m->dns_stub_reply_batch = &batch;
+
+        for (i = 0; i < n; i++) {
+                _cleanup_(dns_packet_unrefp) DnsPacket *p = packets[i];
+
+                if (dns_packet_validate_query(p) > 0) {
+                        log_debug("Got DNS stub UDP query packet for id %u", DNS_PACKET_ID(p));
+
+                        dns_stub_process_query(m, NULL, p);
+                } else
+                        log_debug("Invalid DNS stub UDP packet, ignoring.");
+        }
+
+        m->dns_stub_reply_batch = NULL;
+
+        if (batch.n_replies > 0)
+                dns_stub_flush_replies(m, fd, &batch);
 
         return 0;
 }
@@ -20,9 +20,6 @@
 #define TRANSACTIONS_MAX 4096
 #define TRANSACTION_TCP_TIMEOUT_USEC (10U*USEC_PER_SEC)
 
-/* After how much time to repeat classic DNS requests */
-#define DNS_TIMEOUT_USEC (SD_RESOLVED_QUERY_TIMEOUT_USEC / DNS_TRANSACTION_ATTEMPTS_MAX)
-
 static void dns_transaction_reset_answer(DnsTransaction *t) {
         assert(t);
 
@@ -48,6 +45,14 @@ static void dns_transaction_flush_dnssec_transactions(DnsTransaction *t) {
         }
 }
 
+static void dns_transaction_close_race(DnsTransaction *t) {
+        assert(t);
+
+        t->race_udp_event_source = sd_event_source_unref(t->race_udp_event_source);
+        t->race_udp_fd = safe_close(t->race_udp_fd);
+        t->race_server = dns_server_unref(t->race_server);
+}
+
 static void dns_transaction_close_connection(DnsTransaction *t) {
         assert(t);
 
@@ -63,6 +68,8 @@ static void dns_transaction_close_connection(DnsTransaction *t) {
 
         t->dns_udp_event_source = sd_event_source_unref(t->dns_udp_event_source);
         t->dns_udp_fd = safe_close(t->dns_udp_fd);
+
+        dns_transaction_close_race(t);
 }
 
 static void dns_transaction_stop_timeout(DnsTransaction *t) {
@@ -138,6 +145,10 @@ bool dns_transaction_gc(DnsTransaction *t) {
         if (t->block_gc > 0)
                 return true;
 
+        /* Refreshing transactions have nobody to notify, keep them until they are done */
+        if (t->refresh && DNS_TRANSACTION_IS_LIVE(t->state))
+                return true;
+
         if (set_isempty(t->notify_query_candidates) &&
             set_isempty(t->notify_query_candidates_done) &&
             set_isempty(t->notify_zone_items) &&
@@ -201,6 +212,7 @@ int dns_transaction_new(DnsTransaction **ret, DnsScope *s, DnsResourceKey *key)
                 return -ENOMEM;
 
         t->dns_udp_fd = -1;
+        t->race_udp_fd = -1;
         t->answer_source = _DNS_TRANSACTION_SOURCE_INVALID;
         t->answer_dnssec_result = _DNSSEC_RESULT_INVALID;
         t->answer_nsec_ttl = (uint32_t) -1;
@@ -540,7 +552,7 @@ static int on_stream_complete(DnsStream *s, int error) {
         LIST_FOREACH_SAFE(transactions_by_stream, t, n, s->transactions)
                 if (error != 0)
                         on_transaction_stream_error(t, error);
-                else if (DNS_PACKET_ID(s->read_packet) == t->id)
+                else if (s->read_packet && DNS_PACKET_ID(s->read_packet) == t->id)
                         /* As each transaction have a unique id the return code is only set once */
                         r = dns_transaction_on_stream_packet(t, s->read_packet);
 
@@ -556,10 +568,10 @@ static int dns_stream_on_packet(DnsStream *s) {
         p = TAKE_PTR(s->read_packet);
         s->n_read = 0;
 
+        /* Replies to pipelined queries may come in any order, hence look for the transaction by the packet's ID. Ignore
+         * IDs we don't know, as the transaction might have been canceled. */
         t = hashmap_get(s->manager->dns_transactions, UINT_TO_PTR(DNS_PACKET_ID(p)));
-
-        /* Ignore incorrect transaction id as transaction can have been canceled */
-        if (t)
+        if (t && t->stream == s)
                 r = dns_transaction_on_stream_packet(t, p);
         else {
                 if (dns_packet_validate_reply(p) <= 0) {
@@ -1137,8 +1149,12 @@ void dns_transaction_process_reply(DnsTransaction *t, DnsPacket *p) {
                 if (!p->opt)
                         dns_server_packet_bad_opt(t->server, t->current_feature_level);
 
-                /* Report that we successfully received a packet */
-                dns_server_packet_received(t->server, p->ipproto, t->current_feature_level, p->size);
+                /* Report that we successfully received a packet, and how long it took. Replies to a query that was
+                 * resent on the same socket say nothing about the round-trip time, see RFC 6298, Section 3. */
+                dns_server_packet_received(t->server, p->ipproto, t->current_feature_level, p->size,
+                                           p->ipproto == IPPROTO_UDP && !t->dns_udp_resent ? ts - t->start_usec : USEC_INFINITY);
+
+                manager_response_time(t->scope->manager, ts - t->first_attempt_usec);
         }
 
         /* See if we know things we didn't know before that indicate we better restart the lookup immediately. */
@@ -1210,6 +1226,26 @@ fail:
         dns_transaction_complete(t, DNS_TRANSACTION_ERRNO);
 }
 
+static void dns_transaction_take_race(DnsTransaction *t) {
+        assert(t);
+        assert(t->race_server);
+
+        /* The second server won the race, continue the transaction with it, as if we had picked it. The scope's
+         * current server stays as it is. */
+
+        t->dns_udp_event_source = sd_event_source_unref(t->dns_udp_event_source);
+        safe_close(t->dns_udp_fd);
+
+        t->dns_udp_fd = TAKE_FD(t->race_udp_fd);
+        t->dns_udp_event_source = TAKE_PTR(t->race_udp_event_source);
+        t->dns_udp_resent = false;
+
+        dns_server_unref(t->server);
+        t->server = TAKE_PTR(t->race_server);
+        t->clamp_feature_level = _DNS_SERVER_FEATURE_LEVEL_INVALID;
+        t->n_picked_servers++;
+}
+
 static int on_dns_packet(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
         _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
         DnsTransaction *t = userdata;
@@ -1219,6 +1255,18 @@ static int on_dns_packet(sd_event_source *s, int fd, uint32_t revents, void *use
         assert(t->scope);
 
         r = manager_recv(t->scope->manager, fd, DNS_PROTOCOL_DNS, &p);
+        if (fd == t->race_udp_fd) {
+                /* Problems with the second server of a race don't affect the transaction, it still waits for the
+                 * first one */
+                if (ERRNO_IS_DISCONNECT(-r)) {
+                        log_debug_errno(r, "Connection failure for raced DNS UDP packet: %m");
+                        dns_server_packet_lost(t->race_server, IPPROTO_UDP, t->current_feature_level);
+                }
+                if (r < 0) {
+                        dns_transaction_close_race(t);
+                        return 0;
+                }
+        }
         if (ERRNO_IS_DISCONNECT(-r)) {
                 usec_t usec;
 
@@ -1253,10 +1301,73 @@ static int on_dns_packet(sd_event_source *s, int fd, uint32_t revents, void *use
                 return 0;
         }
 
+        if (fd == t->race_udp_fd) {
+                /* Only take over replies from the second server that we can use right away. Everything else, such
+                 * as errors that would make us downgrade or switch servers, is left to the first server. */
+                if (DNS_PACKET_TC(p) || !IN_SET(DNS_PACKET_RCODE(p), DNS_RCODE_SUCCESS, DNS_RCODE_NXDOMAIN)) {
+                        log_debug("DNS server %s replied first with %s, ignoring.",
+                                  dns_server_string(t->race_server), dns_rcode_to_string(DNS_PACKET_RCODE(p)));
+                        dns_transaction_close_race(t);
+                        return 0;
+                }
+
+                log_debug("DNS server %s replied first, using its reply.", dns_server_string(t->race_server));
+                dns_transaction_take_race(t);
+        }
+
         dns_transaction_process_reply(t, p);
         return 0;
 }
 
+static int dns_transaction_emit_udp_race(DnsTransaction *t) {
+        DnsServerFeatureLevel level;
+        DnsServer *server;
+        int fd, r;
+
+        assert(t);
+
+        dns_transaction_close_race(t);
+
+        if (!t->scope->manager->race_dns_servers)
+                return 0;
+
+        server = dns_scope_get_race_dns_server(t->scope);
+        if (!server || server == t->server)
+                return 0;
+
+        /* The query is prepared for the features of the first server, hence only race it if the second server
+         * supports them too. Servers we talk to via TLS are not sent unencrypted queries. */
+        level = dns_server_possible_feature_level(server);
+        if (DNS_SERVER_FEATURE_LEVEL_IS_TLS(level) || level < t->current_feature_level)
+                return 0;
+
+        if (!dns_server_dnssec_supported(server) && dns_type_is_dnssec(t->key->type))
+                return 0;
+
+        fd = dns_scope_socket_udp(t->scope, server, 53);
+        if (fd < 0)
+                return fd;
+
+        r = sd_event_add_io(t->scope->manager->event, &t->race_udp_event_source, fd, EPOLLIN, on_dns_packet, t);
+        if (r < 0) {
+                safe_close(fd);
+                return r;
+        }
+
+        (void) sd_event_source_set_description(t->race_udp_event_source, "dns-transaction-udp-race");
+        t->race_udp_fd = fd;
+        t->race_server = dns_server_ref(server);
+
+        r = dns_scope_emit_udp(t->scope, t->race_udp_fd, t->sent);
+        if (r < 0) {
+                dns_transaction_close_race(t);
+                return r;
+        }
+
+        log_debug("Racing transaction %" PRIu16 " on DNS server %s.", t->id, dns_server_string(server));
+        return 0;
+}
+
 static int dns_transaction_emit_udp(DnsTransaction *t) {
         int r;
 
@@ -1274,6 +1385,8 @@ static int dns_transaction_emit_udp(DnsTransaction *t) {
                 if (!dns_server_dnssec_supported(t->server) && dns_type_is_dnssec(t->key->type))
                         return -EOPNOTSUPP;
 
+                t->dns_udp_resent = r == 0 && t->dns_udp_fd >= 0;
+
                 if (r > 0 || t->dns_udp_fd < 0) { /* Server changed, or no connection yet. */
                         int fd;
 
@@ -1303,6 +1416,12 @@ static int dns_transaction_emit_udp(DnsTransaction *t) {
         if (r < 0)
                 return r;
 
+        if (t->scope->protocol == DNS_PROTOCOL_DNS) {
+                r = dns_transaction_emit_udp_race(t);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to race transaction %" PRIu16 " on second DNS server, ignoring: %m", t->id);
+        }
+
         dns_transaction_reset_answer(t);
 
         return 0;
@@ -1321,6 +1440,8 @@ static int on_transaction_timeout(sd_event_source *s, usec_t usec, void *userdat
                 case DNS_PROTOCOL_DNS:
                         assert(t->server);
                         dns_server_packet_lost(t->server, t->stream ? IPPROTO_TCP : IPPROTO_UDP, t->current_feature_level);
+                        if (t->race_server)
+                                dns_server_packet_lost(t->race_server, IPPROTO_UDP, t->current_feature_level);
                         break;
 
                 case DNS_PROTOCOL_LLMNR:
@@ -1356,7 +1477,11 @@ static usec_t transaction_get_resend_timeout(DnsTransaction *t) {
                 if (t->stream)
                         return TRANSACTION_TCP_TIMEOUT_USEC;
 
-                return DNS_TIMEOUT_USEC;
+                /* When racing, give the slower of the two servers the time it needs */
+                if (t->race_server)
+                        return MAX(t->server->resend_timeout, t->race_server->resend_timeout);
+
+                return t->server->resend_timeout;
 
         case DNS_PROTOCOL_MDNS:
                 assert(t->n_attempts > 0);
@@ -1402,6 +1527,8 @@ static int dns_transaction_prepare(DnsTransaction *t, usec_t ts) {
 
         t->n_attempts++;
         t->start_usec = ts;
+        if (t->n_attempts == 1)
+                t->first_attempt_usec = ts;
 
         dns_transaction_reset_answer(t);
         dns_transaction_flush_dnssec_transactions(t);
@@ -1471,8 +1598,10 @@ static int dns_transaction_prepare(DnsTransaction *t, usec_t ts) {
         }
 
         /* Check the cache, but only if this transaction is not used
-         * for probing or verifying a zone item. */
-        if (set_isempty(t->notify_zone_items)) {
+         * for probing or verifying a zone item, or for refreshing the
+         * cache. */
+        if (set_isempty(t->notify_zone_items) && !t->refresh) {
+                bool refresh;
 
                 /* Before trying the cache, let's make sure we figured out a
                  * server to use. Should this cause a change of server this
@@ -1482,11 +1611,19 @@ static int dns_transaction_prepare(DnsTransaction *t, usec_t ts) {
                 /* Let's then prune all outdated entries */
                 dns_cache_prune(&t->scope->cache);
 
-                r = dns_cache_lookup(&t->scope->cache, t->key, t->clamp_ttl, &t->answer_rcode, &t->answer, &t->answer_authenticated);
+                r = dns_cache_lookup(&t->scope->cache, t->key, t->clamp_ttl, &t->answer_rcode, &t->answer, &t->answer_authenticated, &refresh);
                 if (r < 0)
                         return r;
                 if (r > 0) {
                         t->answer_source = DNS_TRANSACTION_CACHE;
+
+                        /* The entry expired or is about to, fetch it again while we answer from the cache */
+                        if (refresh && t->scope->protocol == DNS_PROTOCOL_DNS) {
+                                r = dns_transaction_refresh(t->scope, t->key);
+                                if (r < 0)
+                                        log_debug_errno(r, "Failed to refresh cache entry, ignoring: %m");
+                        }
+
                         if (t->answer_rcode == DNS_RCODE_SUCCESS)
                                 dns_transaction_complete(t, DNS_TRANSACTION_SUCCESS);
                         else
@@ -1807,6 +1944,38 @@ int dns_transaction_go(DnsTransaction *t) {
         return 1;
 }
 
+int dns_transaction_refresh(DnsScope *s, DnsResourceKey *key) {
+        DnsTransaction *t, *previous;
+        int r;
+
+        assert(s);
+        assert(key);
+
+        previous = hashmap_get(s->transactions_by_key, key);
+
+        r = dns_transaction_new(&t, s, key);
+        if (r < 0)
+                return r;
+
+        /* Queries shall keep being answered from the cache instead of waiting for this transaction, hence don't
+         * let them find it. */
+        if (previous)
+                assert_se(hashmap_replace(s->transactions_by_key, previous->key, previous) >= 0);
+        else
+                hashmap_remove_value(s->transactions_by_key, t->key, t);
+
+        t->refresh = true;
+
+        r = dns_transaction_go(t);
+        if (r < 0) {
+                t->answer_errno = -r;
+                dns_transaction_complete(t, DNS_TRANSACTION_ERRNO);
+                return r;
+        }
+
+        return 0;
+}
+
 static int dns_transaction_find_cyclic(DnsTransaction *t, DnsTransaction *aux) {
         DnsTransaction *n;
         Iterator i;
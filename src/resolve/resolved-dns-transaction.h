@@ -62,6 +62,9 @@ struct DnsTransaction {
 
         bool probing:1;
 
+        /* Refreshes a cache entry in the background: bypasses the cache, and nobody waits for it */
+        bool refresh:1;
+
         DnsPacket *sent, *received;
 
         DnsAnswer *answer;
@@ -86,6 +89,7 @@ struct DnsTransaction {
         DnsAnswer *validated_keys;
 
         usec_t start_usec;
+        usec_t first_attempt_usec;
         usec_t next_attempt_after;
         sd_event_source *timeout_event_source;
         unsigned n_attempts;
@@ -96,6 +100,15 @@ struct DnsTransaction {
         int dns_udp_fd;
         sd_event_source *dns_udp_event_source;
 
+        /* Set when the query was sent again on the same UDP socket, in which case a reply does not tell us the
+         * round-trip time, as we cannot know which of the queries it answers */
+        bool dns_udp_resent:1;
+
+        /* When racing queries, the second server the query is sent to, and the UDP socket for it */
+        DnsServer *race_server;
+        int race_udp_fd;
+        sd_event_source *race_udp_event_source;
+
         /* TCP connection logic, if we need it */
         DnsStream *stream;
 
@@ -138,6 +151,7 @@ DnsTransaction* dns_transaction_free(DnsTransaction *t);
 
 bool dns_transaction_gc(DnsTransaction *t);
 int dns_transaction_go(DnsTransaction *t);
+int dns_transaction_refresh(DnsScope *s, DnsResourceKey *key);
 
 void dns_transaction_process_reply(DnsTransaction *t, DnsPacket *p);
 void dns_transaction_complete(DnsTransaction *t, DnsTransactionState state);
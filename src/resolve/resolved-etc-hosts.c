@@ -1,205 +1,429 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
+#include "alloc-util.h"
 #include "fd-util.h"
 #include "fileio.h"
 #include "hostname-util.h"
+#include "random-util.h"
 #include "resolved-etc-hosts.h"
 #include "resolved-dns-synthesize.h"
+#include "siphash24.h"
 #include "string-util.h"
-#include "strv.h"
 #include "time-util.h"
 
 /* Recheck /etc/hosts at most once every 2s */
 #define ETC_HOSTS_RECHECK_USEC (2*USEC_PER_SEC)
 
-typedef struct EtcHostsItem {
+/* When a changed /etc/hosts is re-read, parse this many lines per event loop iteration, and keep answering from the
+ * old contents until we are done */
+#define ETC_HOSTS_LINES_PER_ITERATION 4096U
+
+#define ETC_HOSTS_NONE UINT32_MAX
+
+/* /etc/hosts files used as blocklists may contain hundreds of thousands of entries, hence we don't allocate an object
+ * for each of them. Instead, all host names are stored in a single string arena, and names, addresses and the
+ * (name, address) pairs of the file live in arrays, referring to each other by index. Two open-addressed hash tables
+ * map names and addresses to their index, for forward and reverse lookups. Names mapped to 0.0.0.0 or :: only get an
+ * entry without address. */
+
+typedef struct EtcHostsName {
+        uint32_t string;               /* offset into the string arena */
+        uint32_t first, last;          /* list of entries, linked via next_by_name */
+} EtcHostsName;
+
+typedef struct EtcHostsAddress {
         int family;
         union in_addr_union address;
+        uint32_t first, last;          /* list of entries, linked via next_by_address */
+} EtcHostsAddress;
 
-        char **names;
-} EtcHostsItem;
+typedef struct EtcHostsEntry {
+        uint32_t name;
+        uint32_t address;              /* ETC_HOSTS_NONE for names mapped to nothing */
+        uint32_t next_by_name;
+        uint32_t next_by_address;
+} EtcHostsEntry;
 
-typedef struct EtcHostsItemByName {
-        char *name;
+typedef struct EtcHostsSlot {
+        uint32_t index;                /* ETC_HOSTS_NONE for empty slots */
+        uint32_t hash;
+} EtcHostsSlot;
 
-        EtcHostsItem **items;
-        size_t n_items, n_allocated;
-} EtcHostsItemByName;
+typedef struct EtcHostsTable {
+        EtcHostsSlot *slots;
+        size_t n_slots;                /* always a power of two */
+        size_t n_used;
+} EtcHostsTable;
 
-void manager_etc_hosts_flush(Manager *m) {
-        EtcHostsItem *item;
-        EtcHostsItemByName *bn;
+struct EtcHosts {
+        uint8_t hash_key[16];
+
+        char *strings;
+        size_t n_strings, n_strings_allocated;
+
+        EtcHostsName *names;
+        size_t n_names, n_names_allocated;
+
+        EtcHostsAddress *addresses;
+        size_t n_addresses, n_addresses_allocated;
+
+        EtcHostsEntry *entries;
+        size_t n_entries, n_entries_allocated;
+
+        EtcHostsTable names_table, addresses_table;
+
+        usec_t mtime;
+};
+
+int etc_hosts_new(EtcHosts **ret) {
+        EtcHosts *hosts;
+
+        assert(ret);
+
+        hosts = new0(EtcHosts, 1);
+        if (!hosts)
+                return -ENOMEM;
+
+        random_bytes(hosts->hash_key, sizeof(hosts->hash_key));
+        hosts->mtime = USEC_INFINITY;
+
+        *ret = hosts;
+        return 0;
+}
 
-        while ((item = set_steal_first(m->etc_hosts_by_address))) {
-                strv_free(item->names);
-                free(item);
+EtcHosts *etc_hosts_free(EtcHosts *hosts) {
+        if (!hosts)
+                return NULL;
+
+        free(hosts->strings);
+        free(hosts->names);
+        free(hosts->addresses);
+        free(hosts->entries);
+        free(hosts->names_table.slots);
+        free(hosts->addresses_table.slots);
+
+        return mfree(hosts);
+}
+
+static bool etc_hosts_name_needs_normalization(const char *name) {
+        /* Names without escapes and without trailing dot are already in the form dns_name_normalize() returns,
+         * except for case, which we ignore anyway. */
+        return strchr(name, '\\') || endswith(name, ".");
+}
+
+static uint32_t etc_hosts_name_hash(const EtcHosts *hosts, const char *name) {
+        struct siphash state;
+        char buf[64];
+        size_t k = 0;
+
+        /* Names are compared case-insensitively, hence hash them in lower case */
+        siphash24_init(&state, hosts->hash_key);
+
+        for (; *name; name++) {
+                buf[k++] = ascii_tolower(*name);
+
+                if (k >= sizeof(buf)) {
+                        siphash24_compress(buf, k, &state);
+                        k = 0;
+                }
         }
 
-        while ((bn = hashmap_steal_first(m->etc_hosts_by_name))) {
-                free(bn->name);
-                free(bn->items);
-                free(bn);
+        siphash24_compress(buf, k, &state);
+
+        return (uint32_t) siphash24_finalize(&state);
+}
+
+static uint32_t etc_hosts_address_hash(const EtcHosts *hosts, int family, const union in_addr_union *address) {
+        struct siphash state;
+
+        siphash24_init(&state, hosts->hash_key);
+        siphash24_compress(&family, sizeof(family), &state);
+        siphash24_compress(address, FAMILY_ADDRESS_SIZE(family), &state);
+
+        return (uint32_t) siphash24_finalize(&state);
+}
+
+static int etc_hosts_table_reserve(EtcHostsTable *t) {
+        EtcHostsSlot *slots;
+        size_t n, i;
+
+        assert(t);
+
+        /* Make sure there's room for one more item, keeping the table at most half full */
+        if ((t->n_used + 1) * 2 <= t->n_slots)
+                return 0;
+
+        n = MAX(t->n_slots * 2, 64U);
+
+        slots = new(EtcHostsSlot, n);
+        if (!slots)
+                return -ENOMEM;
+
+        for (i = 0; i < n; i++)
+                slots[i].index = ETC_HOSTS_NONE;
+
+        for (i = 0; i < t->n_slots; i++) {
+                size_t j;
+
+                if (t->slots[i].index == ETC_HOSTS_NONE)
+                        continue;
+
+                for (j = t->slots[i].hash & (n - 1); slots[j].index != ETC_HOSTS_NONE; j = (j + 1) & (n - 1))
+                        ;
+
+                slots[j] = t->slots[i];
         }
 
-        m->etc_hosts_by_address = set_free(m->etc_hosts_by_address);
-        m->etc_hosts_by_name = hashmap_free(m->etc_hosts_by_name);
+        free_and_replace(t->slots, slots);
+        t->n_slots = n;
 
-        m->etc_hosts_mtime = USEC_INFINITY;
+        return 0;
 }
 
-static void etc_hosts_item_hash_func(const void *p, struct siphash *state) {
-        const EtcHostsItem *item = p;
+/* Returns the slot of the name, or the empty slot where it would go */
+static size_t etc_hosts_find_name(const EtcHosts *hosts, const char *name, uint32_t hash) {
+        const EtcHostsTable *t = &hosts->names_table;
+        size_t i;
+
+        assert(t->n_slots > 0);
+
+        for (i = hash & (t->n_slots - 1);; i = (i + 1) & (t->n_slots - 1)) {
+                const EtcHostsSlot *s = t->slots + i;
 
-        siphash24_compress(&item->family, sizeof(item->family), state);
+                if (s->index == ETC_HOSTS_NONE)
+                        return i;
 
-        if (item->family == AF_INET)
-                siphash24_compress(&item->address.in, sizeof(item->address.in), state);
-        else if (item->family == AF_INET6)
-                siphash24_compress(&item->address.in6, sizeof(item->address.in6), state);
+                if (s->hash == hash &&
+                    ascii_strcasecmp_nn(hosts->strings + hosts->names[s->index].string, strlen(hosts->strings + hosts->names[s->index].string),
+                                        name, strlen(name)) == 0)
+                        return i;
+        }
 }
 
-static int etc_hosts_item_compare_func(const void *a, const void *b) {
-        const EtcHostsItem *x = a, *y = b;
+static size_t etc_hosts_find_address(const EtcHosts *hosts, int family, const union in_addr_union *address, uint32_t hash) {
+        const EtcHostsTable *t = &hosts->addresses_table;
+        size_t i;
 
-        if (x->family != y->family)
-                return x->family - y->family;
+        assert(t->n_slots > 0);
 
-        if (x->family == AF_INET)
-                return memcmp(&x->address.in.s_addr, &y->address.in.s_addr, sizeof(struct in_addr));
+        for (i = hash & (t->n_slots - 1);; i = (i + 1) & (t->n_slots - 1)) {
+                const EtcHostsSlot *s = t->slots + i;
 
-        if (x->family == AF_INET6)
-                return memcmp(&x->address.in6.s6_addr, &y->address.in6.s6_addr, sizeof(struct in6_addr));
+                if (s->index == ETC_HOSTS_NONE)
+                        return i;
 
-        return trivial_compare_func(a, b);
+                if (s->hash == hash &&
+                    hosts->addresses[s->index].family == family &&
+                    memcmp(&hosts->addresses[s->index].address, address, FAMILY_ADDRESS_SIZE(family)) == 0)
+                        return i;
+        }
 }
 
-static const struct hash_ops etc_hosts_item_ops = {
-        .hash = etc_hosts_item_hash_func,
-        .compare = etc_hosts_item_compare_func,
-};
+static uint32_t etc_hosts_lookup_name(const EtcHosts *hosts, const char *name) {
+        if (hosts->names_table.n_slots == 0)
+                return ETC_HOSTS_NONE;
 
-static int add_item(Manager *m, int family, const union in_addr_union *address, char **names) {
+        return hosts->names_table.slots[etc_hosts_find_name(hosts, name, etc_hosts_name_hash(hosts, name))].index;
+}
 
-        EtcHostsItem key = {
-                .family = family,
-                .address = *address,
-        };
-        EtcHostsItem *item;
-        char **n;
-        int r;
+static uint32_t etc_hosts_lookup_address(const EtcHosts *hosts, int family, const union in_addr_union *address) {
+        if (hosts->addresses_table.n_slots == 0)
+                return ETC_HOSTS_NONE;
 
-        assert(m);
-        assert(address);
+        return hosts->addresses_table.slots[etc_hosts_find_address(hosts, family, address, etc_hosts_address_hash(hosts, family, address))].index;
+}
+
+static int etc_hosts_add_name(EtcHosts *hosts, const char *name, uint32_t *ret) {
+        EtcHostsSlot *s;
+        uint32_t hash;
+        size_t l;
+        int r;
 
-        r = in_addr_is_null(family, address);
+        r = etc_hosts_table_reserve(&hosts->names_table);
         if (r < 0)
                 return r;
-        if (r > 0)
-                /* This is an 0.0.0.0 or :: item, which we assume means that we shall map the specified hostname to
-                 * nothing. */
-                item = NULL;
-        else {
-                /* If this is a normal address, then, simply add entry mapping it to the specified names */
-
-                item = set_get(m->etc_hosts_by_address, &key);
-                if (item) {
-                        r = strv_extend_strv(&item->names, names, true);
-                        if (r < 0)
-                                return log_oom();
-                } else {
 
-                        r = set_ensure_allocated(&m->etc_hosts_by_address, &etc_hosts_item_ops);
-                        if (r < 0)
-                                return log_oom();
+        hash = etc_hosts_name_hash(hosts, name);
+        s = hosts->names_table.slots + etc_hosts_find_name(hosts, name, hash);
+        if (s->index != ETC_HOSTS_NONE) {
+                *ret = s->index;
+                return 0;
+        }
 
-                        item = new0(EtcHostsItem, 1);
-                        if (!item)
-                                return log_oom();
+        l = strlen(name) + 1;
+        if (hosts->n_strings + l > UINT32_MAX || hosts->n_names >= ETC_HOSTS_NONE)
+                return -E2BIG;
 
-                        item->family = family;
-                        item->address = *address;
-                        item->names = names;
+        if (!GREEDY_REALLOC(hosts->strings, hosts->n_strings_allocated, hosts->n_strings + l))
+                return -ENOMEM;
+        if (!GREEDY_REALLOC(hosts->names, hosts->n_names_allocated, hosts->n_names + 1))
+                return -ENOMEM;
 
-                        r = set_put(m->etc_hosts_by_address, item);
-                        if (r < 0) {
-                                free(item);
-                                return log_oom();
-                        }
-                }
+        memcpy(hosts->strings + hosts->n_strings, name, l);
+
+        hosts->names[hosts->n_names] = (EtcHostsName) {
+                .string = hosts->n_strings,
+                .first = ETC_HOSTS_NONE,
+                .last = ETC_HOSTS_NONE,
+        };
+        hosts->n_strings += l;
+
+        *s = (EtcHostsSlot) {
+                .index = hosts->n_names,
+                .hash = hash,
+        };
+        hosts->names_table.n_used++;
+
+        *ret = hosts->n_names++;
+        return 0;
+}
+
+static int etc_hosts_add_address(EtcHosts *hosts, int family, const union in_addr_union *address, uint32_t *ret) {
+        EtcHostsSlot *s;
+        uint32_t hash;
+        int r;
+
+        r = etc_hosts_table_reserve(&hosts->addresses_table);
+        if (r < 0)
+                return r;
+
+        hash = etc_hosts_address_hash(hosts, family, address);
+        s = hosts->addresses_table.slots + etc_hosts_find_address(hosts, family, address, hash);
+        if (s->index != ETC_HOSTS_NONE) {
+                *ret = s->index;
+                return 0;
         }
 
-        STRV_FOREACH(n, names) {
-                EtcHostsItemByName *bn;
+        if (hosts->n_addresses >= ETC_HOSTS_NONE)
+                return -E2BIG;
 
-                bn = hashmap_get(m->etc_hosts_by_name, *n);
-                if (!bn) {
-                        r = hashmap_ensure_allocated(&m->etc_hosts_by_name, &dns_name_hash_ops);
-                        if (r < 0)
-                                return log_oom();
+        if (!GREEDY_REALLOC(hosts->addresses, hosts->n_addresses_allocated, hosts->n_addresses + 1))
+                return -ENOMEM;
 
-                        bn = new0(EtcHostsItemByName, 1);
-                        if (!bn)
-                                return log_oom();
+        hosts->addresses[hosts->n_addresses] = (EtcHostsAddress) {
+                .family = family,
+                .address = *address,
+                .first = ETC_HOSTS_NONE,
+                .last = ETC_HOSTS_NONE,
+        };
 
-                        bn->name = strdup(*n);
-                        if (!bn->name) {
-                                free(bn);
-                                return log_oom();
-                        }
+        *s = (EtcHostsSlot) {
+                .index = hosts->n_addresses,
+                .hash = hash,
+        };
+        hosts->addresses_table.n_used++;
 
-                        r = hashmap_put(m->etc_hosts_by_name, bn->name, bn);
-                        if (r < 0) {
-                                free(bn->name);
-                                free(bn);
-                                return log_oom();
-                        }
-                }
+        *ret = hosts->n_addresses++;
+        return 0;
+}
 
-                if (item) {
-                        if (!GREEDY_REALLOC(bn->items, bn->n_allocated, bn->n_items+1))
-                                return log_oom();
+static int etc_hosts_add_entry(EtcHosts *hosts, uint32_t name, uint32_t address) {
+        EtcHostsName *n = hosts->names + name;
+        uint32_t i;
 
-                        bn->items[bn->n_items++] = item;
-                }
+        /* Lists are short, except for addresses with many names, which we walk the other way round */
+        for (i = n->first; i != ETC_HOSTS_NONE; i = hosts->entries[i].next_by_name)
+                if (hosts->entries[i].address == address)
+                        return 0;
+
+        if (hosts->n_entries >= ETC_HOSTS_NONE)
+                return -E2BIG;
+
+        if (!GREEDY_REALLOC(hosts->entries, hosts->n_entries_allocated, hosts->n_entries + 1))
+                return -ENOMEM;
+
+        hosts->entries[hosts->n_entries] = (EtcHostsEntry) {
+                .name = name,
+                .address = address,
+                .next_by_name = ETC_HOSTS_NONE,
+                .next_by_address = ETC_HOSTS_NONE,
+        };
+
+        if (n->last == ETC_HOSTS_NONE)
+                n->first = hosts->n_entries;
+        else
+                hosts->entries[n->last].next_by_name = hosts->n_entries;
+        n->last = hosts->n_entries;
+
+        if (address != ETC_HOSTS_NONE) {
+                EtcHostsAddress *a = hosts->addresses + address;
+
+                if (a->last == ETC_HOSTS_NONE)
+                        a->first = hosts->n_entries;
+                else
+                        hosts->entries[a->last].next_by_address = hosts->n_entries;
+                a->last = hosts->n_entries;
         }
 
+        hosts->n_entries++;
         return 0;
 }
 
-static int parse_line(Manager *m, unsigned nr, const char *line) {
-        _cleanup_free_ char *address = NULL;
-        _cleanup_strv_free_ char **names = NULL;
+static char *etc_hosts_next_word(char **p) {
+        char *w;
+
+        w = *p + strspn(*p, WHITESPACE);
+        if (*w == 0)
+                return NULL;
+
+        *p = w + strcspn(w, WHITESPACE);
+        if (**p != 0) {
+                **p = 0;
+                (*p)++;
+        }
+
+        return w;
+}
+
+static int etc_hosts_parse_line(EtcHosts *hosts, unsigned nr, char *line) {
         union in_addr_union in;
-        bool suppressed = false;
+        bool suppressed = false, found = false;
+        uint32_t address = ETC_HOSTS_NONE;
+        char *word;
         int family, r;
 
-        assert(m);
+        assert(hosts);
         assert(line);
 
-        r = extract_first_word(&line, &address, NULL, EXTRACT_RELAX);
+        /* Everything after a '#' is a comment */
+        line[strcspn(line, "#")] = 0;
+
+        word = etc_hosts_next_word(&line);
+        if (!word)
+                return 0;
+
+        r = in_addr_from_string_auto(word, &family, &in);
+        if (r < 0)
+                return log_error_errno(r, "Address '%s' is invalid, in line /etc/hosts:%u.", word, nr);
+
+        /* An 0.0.0.0 or :: item means that we shall map the specified hostname to nothing. */
+        r = in_addr_is_null(family, &in);
         if (r < 0)
-                return log_error_errno(r, "Couldn't extract address, in line /etc/hosts:%u.", nr);
+                return r;
         if (r == 0) {
-                log_error("Premature end of line, in line /etc/hosts:%u.", nr);
-                return -EINVAL;
+                r = etc_hosts_add_address(hosts, family, &in, &address);
+                if (r < 0)
+                        return r;
         }
 
-        r = in_addr_from_string_auto(address, &family, &in);
-        if (r < 0)
-                return log_error_errno(r, "Address '%s' is invalid, in line /etc/hosts:%u.", address, nr);
+        while ((word = etc_hosts_next_word(&line))) {
+                _cleanup_free_ char *normalized = NULL;
+                const char *name = word;
+                uint32_t n;
 
-        for (;;) {
-                _cleanup_free_ char *name = NULL;
+                r = dns_name_is_valid(word);
+                if (r <= 0) {
+                        log_error_errno(r, "Hostname %s is not valid, ignoring, in line /etc/hosts:%u.", word, nr);
+                        continue;
+                }
 
-                r = extract_first_word(&line, &name, NULL, EXTRACT_RELAX);
-                if (r < 0)
-                        return log_error_errno(r, "Couldn't extract host name, in line /etc/hosts:%u.", nr);
-                if (r == 0)
-                        break;
+                if (etc_hosts_name_needs_normalization(word)) {
+                        r = dns_name_normalize(word, &normalized);
+                        if (r < 0)
+                                return r;
 
-                r = dns_name_is_valid(name);
-                if (r <= 0)
-                        return log_error_errno(r, "Hostname %s is not valid, ignoring, in line /etc/hosts:%u.", name, nr);
+                        name = normalized;
+                }
 
                 if (is_localhost(name)) {
                         /* Suppress the "localhost" line that is often seen */
@@ -207,134 +431,82 @@ static int parse_line(Manager *m, unsigned nr, const char *line) {
                         continue;
                 }
 
-                r = strv_push(&names, name);
+                r = etc_hosts_add_name(hosts, name, &n);
                 if (r < 0)
-                        return log_oom();
-
-                name = NULL;
-        }
+                        return r;
 
-        if (strv_isempty(names)) {
+                r = etc_hosts_add_entry(hosts, n, address);
+                if (r < 0)
+                        return r;
 
-                if (suppressed)
-                        return 0;
+                found = true;
+        }
 
+        if (!found && !suppressed) {
                 log_error("Line is missing any host names, in line /etc/hosts:%u.", nr);
                 return -EINVAL;
         }
 
-        /* Takes possession of the names strv */
-        r = add_item(m, family, &in, names);
-        if (r < 0)
-                return r;
-
-        names = NULL;
-        return r;
+        return 0;
 }
 
-int manager_etc_hosts_read(Manager *m) {
-        _cleanup_fclose_ FILE *f = NULL;
-        char line[LINE_MAX];
-        struct stat st;
-        usec_t ts;
-        unsigned nr = 0;
+int etc_hosts_parse(EtcHosts *hosts, FILE *f, unsigned *line, unsigned n_lines) {
+        char buf[LINE_MAX];
+        unsigned i;
         int r;
 
-        assert_se(sd_event_now(m->event, clock_boottime_or_monotonic(), &ts) >= 0);
-
-        /* See if we checked /etc/hosts recently already */
-        if (m->etc_hosts_last != USEC_INFINITY && m->etc_hosts_last + ETC_HOSTS_RECHECK_USEC > ts)
-                return 0;
-
-        m->etc_hosts_last = ts;
-
-        if (m->etc_hosts_mtime != USEC_INFINITY) {
-                if (stat("/etc/hosts", &st) < 0) {
-                        if (errno == ENOENT) {
-                                r = 0;
-                                goto clear;
-                        }
+        assert(hosts);
+        assert(f);
+        assert(line);
 
-                        return log_error_errno(errno, "Failed to stat /etc/hosts: %m");
-                }
+        /* Parses at most n_lines more lines from the file. Returns 1 when the end of the file was reached, 0 if
+         * there's more to parse. */
 
-                /* Did the mtime change? If not, there's no point in re-reading the file. */
-                if (timespec_load(&st.st_mtim) == m->etc_hosts_mtime)
-                        return 0;
-        }
+        for (i = 0; i < n_lines; i++) {
+                if (!fgets(buf, sizeof(buf), f)) {
+                        if (ferror(f))
+                                return errno > 0 ? -errno : -EIO;
 
-        f = fopen("/etc/hosts", "re");
-        if (!f) {
-                if (errno == ENOENT) {
-                        r = 0;
-                        goto clear;
+                        return 1;
                 }
 
-                return log_error_errno(errno, "Failed to open /etc/hosts: %m");
-        }
-
-        /* Take the timestamp at the beginning of processing, so that any changes made later are read on the next
-         * invocation */
-        r = fstat(fileno(f), &st);
-        if (r < 0)
-                return log_error_errno(errno, "Failed to fstat() /etc/hosts: %m");
-
-        manager_etc_hosts_flush(m);
-
-        FOREACH_LINE(line, f, return log_error_errno(errno, "Failed to read /etc/hosts: %m")) {
-                char *l;
-
-                nr++;
+                (*line)++;
 
-                l = strstrip(line);
-                if (isempty(l))
-                        continue;
-                if (l[0] == '#')
-                        continue;
-
-                r = parse_line(m, nr, l);
-                if (r == -ENOMEM) /* On OOM we abandon the half-built-up structure. All other errors we ignore and proceed */
-                        goto clear;
+                r = etc_hosts_parse_line(hosts, *line, buf);
+                if (IN_SET(r, -ENOMEM, -E2BIG)) /* On OOM we abandon the half-built-up structure. All other errors we ignore and proceed */
+                        return r;
         }
 
-        m->etc_hosts_mtime = timespec_load(&st.st_mtim);
-        m->etc_hosts_last = ts;
-
-        return 1;
-
-clear:
-        manager_etc_hosts_flush(m);
-        return r;
+        return 0;
 }
 
-int manager_etc_hosts_lookup(Manager *m, DnsQuestion* q, DnsAnswer **answer) {
+int etc_hosts_lookup(EtcHosts *hosts, DnsQuestion* q, DnsAnswer **answer) {
+        _cleanup_free_ char *normalized = NULL;
         bool found_a = false, found_aaaa = false;
-        EtcHostsItemByName *bn;
-        EtcHostsItem k = {};
+        union in_addr_union address;
         DnsResourceKey *t;
         const char *name;
-        unsigned i;
-        int r;
+        uint32_t n, i;
+        unsigned k = 0;
+        int family, r;
 
-        assert(m);
         assert(q);
         assert(answer);
 
-        r = manager_etc_hosts_read(m);
-        if (r < 0)
-                return r;
+        if (!hosts)
+                return 0;
 
         name = dns_question_first_name(q);
         if (!name)
                 return 0;
 
-        r = dns_name_address(name, &k.family, &k.address);
+        r = dns_name_address(name, &family, &address);
         if (r > 0) {
-                EtcHostsItem *item;
                 DnsResourceKey *found_ptr = NULL;
+                uint32_t a;
 
-                item = set_get(m->etc_hosts_by_address, &k);
-                if (!item)
+                a = etc_hosts_lookup_address(hosts, family, &address);
+                if (a == ETC_HOSTS_NONE)
                         return 0;
 
                 /* We have an address in /etc/hosts that matches the queried name. Let's return successful. Actual data
@@ -356,20 +528,21 @@ int manager_etc_hosts_lookup(Manager *m, DnsQuestion* q, DnsAnswer **answer) {
                 }
 
                 if (found_ptr) {
-                        char **n;
+                        for (i = hosts->addresses[a].first; i != ETC_HOSTS_NONE; i = hosts->entries[i].next_by_address)
+                                k++;
 
-                        r = dns_answer_reserve(answer, strv_length(item->names));
+                        r = dns_answer_reserve(answer, k);
                         if (r < 0)
                                 return r;
 
-                        STRV_FOREACH(n, item->names) {
+                        for (i = hosts->addresses[a].first; i != ETC_HOSTS_NONE; i = hosts->entries[i].next_by_address) {
                                 _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
 
                                 rr = dns_resource_record_new(found_ptr);
                                 if (!rr)
                                         return -ENOMEM;
 
-                                rr->ptr.name = strdup(*n);
+                                rr->ptr.name = strdup(hosts->strings + hosts->names[hosts->entries[i].name].string);
                                 if (!rr->ptr.name)
                                         return -ENOMEM;
 
@@ -382,11 +555,23 @@ int manager_etc_hosts_lookup(Manager *m, DnsQuestion* q, DnsAnswer **answer) {
                 return 1;
         }
 
-        bn = hashmap_get(m->etc_hosts_by_name, name);
-        if (!bn)
+        if (etc_hosts_name_needs_normalization(name)) {
+                r = dns_name_normalize(name, &normalized);
+                if (r < 0)
+                        return r;
+
+                name = normalized;
+        }
+
+        n = etc_hosts_lookup_name(hosts, name);
+        if (n == ETC_HOSTS_NONE)
                 return 0;
 
-        r = dns_answer_reserve(answer, bn->n_items);
+        for (i = hosts->names[n].first; i != ETC_HOSTS_NONE; i = hosts->entries[i].next_by_name)
+                if (hosts->entries[i].address != ETC_HOSTS_NONE)
+                        k++;
+
+        r = dns_answer_reserve(answer, k);
         if (r < 0)
                 return r;
 
@@ -411,14 +596,20 @@ int manager_etc_hosts_lookup(Manager *m, DnsQuestion* q, DnsAnswer **answer) {
                         break;
         }
 
-        for (i = 0; i < bn->n_items; i++) {
+        for (i = hosts->names[n].first; i != ETC_HOSTS_NONE; i = hosts->entries[i].next_by_name) {
                 _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+                const EtcHostsAddress *a;
 
-                if ((!found_a && bn->items[i]->family == AF_INET) ||
-                    (!found_aaaa && bn->items[i]->family == AF_INET6))
+                if (hosts->entries[i].address == ETC_HOSTS_NONE)
                         continue;
 
-                r = dns_resource_record_new_address(&rr, bn->items[i]->family, &bn->items[i]->address, bn->name);
+                a = hosts->addresses + hosts->entries[i].address;
+
+                if ((!found_a && a->family == AF_INET) ||
+                    (!found_aaaa && a->family == AF_INET6))
+                        continue;
+
+                r = dns_resource_record_new_address(&rr, a->family, &a->address, hosts->strings + hosts->names[n].string);
                 if (r < 0)
                         return r;
 
@@ -429,3 +620,152 @@ int manager_etc_hosts_lookup(Manager *m, DnsQuestion* q, DnsAnswer **answer) {
 
         return found_a || found_aaaa;
 }
+
+static void manager_etc_hosts_drop_pending(Manager *m) {
+        assert(m);
+
+        m->etc_hosts_pending = etc_hosts_free(m->etc_hosts_pending);
+        m->etc_hosts_pending_file = safe_fclose(m->etc_hosts_pending_file);
+        m->etc_hosts_pending_line = 0;
+}
+
+void manager_etc_hosts_flush(Manager *m) {
+        assert(m);
+
+        manager_etc_hosts_drop_pending(m);
+        m->etc_hosts_event_source = sd_event_source_unref(m->etc_hosts_event_source);
+
+        m->etc_hosts = etc_hosts_free(m->etc_hosts);
+        m->etc_hosts_mtime = USEC_INFINITY;
+}
+
+static int manager_etc_hosts_continue(Manager *m, unsigned n_lines);
+
+static int on_etc_hosts_continue(sd_event_source *s, void *userdata) {
+        Manager *m = userdata;
+
+        assert(m);
+
+        (void) manager_etc_hosts_continue(m, ETC_HOSTS_LINES_PER_ITERATION);
+        return 0;
+}
+
+static int manager_etc_hosts_continue(Manager *m, unsigned n_lines) {
+        int r;
+
+        assert(m);
+        assert(m->etc_hosts_pending);
+
+        r = etc_hosts_parse(m->etc_hosts_pending, m->etc_hosts_pending_file, &m->etc_hosts_pending_line, n_lines);
+        if (r < 0) {
+                manager_etc_hosts_flush(m);
+                return log_error_errno(r, "Failed to read /etc/hosts: %m");
+        }
+        if (r == 0) {
+                /* Continue with the rest of the file once everything else has been processed */
+                if (m->etc_hosts_event_source)
+                        r = sd_event_source_set_enabled(m->etc_hosts_event_source, SD_EVENT_ONESHOT);
+                else {
+                        r = sd_event_add_defer(m->event, &m->etc_hosts_event_source, on_etc_hosts_continue, m);
+                        if (r >= 0) {
+                                (void) sd_event_source_set_priority(m->etc_hosts_event_source, SD_EVENT_PRIORITY_IDLE);
+                                (void) sd_event_source_set_description(m->etc_hosts_event_source, "etc-hosts");
+                        }
+                }
+                if (r < 0) {
+                        manager_etc_hosts_flush(m);
+                        return log_error_errno(r, "Failed to schedule reading the rest of /etc/hosts: %m");
+                }
+
+                return 0;
+        }
+
+        etc_hosts_free(m->etc_hosts);
+        m->etc_hosts = TAKE_PTR(m->etc_hosts_pending);
+        m->etc_hosts_mtime = m->etc_hosts->mtime;
+
+        log_debug("Read %u lines with %zu names and %zu addresses from /etc/hosts.",
+                  m->etc_hosts_pending_line, m->etc_hosts->n_names, m->etc_hosts->n_addresses);
+
+        manager_etc_hosts_drop_pending(m);
+
+        return 1;
+}
+
+int manager_etc_hosts_read(Manager *m) {
+        _cleanup_(etc_hosts_freep) EtcHosts *hosts = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        struct stat st;
+        usec_t ts;
+        int r;
+
+        /* A changed /etc/hosts is being read already */
+        if (m->etc_hosts_pending)
+                return 0;
+
+        assert_se(sd_event_now(m->event, clock_boottime_or_monotonic(), &ts) >= 0);
+
+        /* See if we checked /etc/hosts recently already */
+        if (m->etc_hosts_last != USEC_INFINITY && m->etc_hosts_last + ETC_HOSTS_RECHECK_USEC > ts)
+                return 0;
+
+        m->etc_hosts_last = ts;
+
+        if (m->etc_hosts_mtime != USEC_INFINITY) {
+                if (stat("/etc/hosts", &st) < 0) {
+                        if (errno == ENOENT) {
+                                manager_etc_hosts_flush(m);
+                                return 0;
+                        }
+
+                        return log_error_errno(errno, "Failed to stat /etc/hosts: %m");
+                }
+
+                /* Did the mtime change? If not, there's no point in re-reading the file. */
+                if (timespec_load(&st.st_mtim) == m->etc_hosts_mtime)
+                        return 0;
+        }
+
+        f = fopen("/etc/hosts", "re");
+        if (!f) {
+                if (errno == ENOENT) {
+                        manager_etc_hosts_flush(m);
+                        return 0;
+                }
+
+                return log_error_errno(errno, "Failed to open /etc/hosts: %m");
+        }
+
+        /* Take the timestamp at the beginning of processing, so that any changes made later are read on the next
+         * invocation */
+        r = fstat(fileno(f), &st);
+        if (r < 0)
+                return log_error_errno(errno, "Failed to fstat() /etc/hosts: %m");
+
+        r = etc_hosts_new(&hosts);
+        if (r < 0)
+                return log_oom();
+
+        hosts->mtime = timespec_load(&st.st_mtim);
+
+        m->etc_hosts_pending = TAKE_PTR(hosts);
+        m->etc_hosts_pending_file = TAKE_PTR(f);
+        m->etc_hosts_pending_line = 0;
+
+        /* If we have nothing to answer from in the meantime, read the whole file right away */
+        return manager_etc_hosts_continue(m, m->etc_hosts ? ETC_HOSTS_LINES_PER_ITERATION : UINT_MAX);
+}
+
+int manager_etc_hosts_lookup(Manager *m, DnsQuestion* q, DnsAnswer **answer) {
+        int r;
+
+        assert(m);
+        assert(q);
+        assert(answer);
+
+        r = manager_etc_hosts_read(m);
+        if (r < 0)
+                return r;
+
+        return etc_hosts_lookup(m->etc_hosts, q, answer);
+}
@@ -5,6 +5,13 @@
 #include "resolved-dns-question.h"
 #include "resolved-dns-answer.h"
 
+int etc_hosts_new(EtcHosts **ret);
+EtcHosts *etc_hosts_free(EtcHosts *hosts);
+DEFINE_TRIVIAL_CLEANUP_FUNC(EtcHosts*, etc_hosts_free);
+
+int etc_hosts_parse(EtcHosts *hosts, FILE *f, unsigned *line, unsigned n_lines);
+int etc_hosts_lookup(EtcHosts *hosts, DnsQuestion* q, DnsAnswer **answer);
+
 void manager_etc_hosts_flush(Manager *m);
 int manager_etc_hosts_read(Manager *m);
 int manager_etc_hosts_lookup(Manager *m, DnsQuestion* q, DnsAnswer **answer);
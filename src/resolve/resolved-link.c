@@ -11,6 +11,7 @@
 #include "missing.h"
 #include "mkdir.h"
 #include "parse-util.h"
+#include "resolved-cache-snapshot.h"
 #include "resolved-link.h"
 #include "resolved-llmnr.h"
 #include "resolved-mdns.h"
@@ -702,8 +703,10 @@ DnsServer* link_set_dns_server(Link *l, DnsServer *s) {
         dns_server_unref(l->current_dns_server);
         l->current_dns_server = dns_server_ref(s);
 
-        if (l->unicast_scope)
+        if (l->unicast_scope) {
                 dns_cache_flush(&l->unicast_scope->cache);
+                manager_cache_snapshot_restore(l->manager, l->unicast_scope, s);
+        }
 
         return s;
 }
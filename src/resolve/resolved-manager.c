@@ -23,6 +23,7 @@
 #include "parse-util.h"
 #include "random-util.h"
 #include "resolved-bus.h"
+#include "resolved-cache-snapshot.h"
 #include "resolved-conf.h"
 #include "resolved-dnssd.h"
 #include "resolved-dns-stub.h"
@@ -30,6 +31,7 @@
 #include "resolved-llmnr.h"
 #include "resolved-manager.h"
 #include "resolved-mdns.h"
+#include "resolved-query-socket.h"
 #include "resolved-resolv-conf.h"
 #include "socket-util.h"
 #include "string-table.h"
@@ -570,6 +572,7 @@ int manager_new(Manager **ret) {
         m->llmnr_ipv4_tcp_fd = m->llmnr_ipv6_tcp_fd = -1;
         m->mdns_ipv4_fd = m->mdns_ipv6_fd = -1;
         m->dns_stub_udp_fd = m->dns_stub_tcp_fd = -1;
+        m->query_socket_fd = -1;
         m->hostname_fd = -1;
 
         m->llmnr_support = RESOLVE_SUPPORT_YES;
@@ -577,6 +580,9 @@ int manager_new(Manager **ret) {
         m->dnssec_mode = DEFAULT_DNSSEC_MODE;
         m->dns_over_tls_mode = DEFAULT_DNS_OVER_TLS_MODE;
         m->enable_cache = true;
+        m->cache_size = DNS_CACHE_SIZE_DEFAULT;
+        m->cache_max_ttl = DNS_CACHE_MAX_TTL_DEFAULT_USEC;
+        m->cache_prefetch = true;
         m->dns_stub_listener_mode = DNS_STUB_LISTENER_UDP;
         m->read_resolv_conf = true;
         m->need_builtin_fallbacks = true;
@@ -607,6 +613,8 @@ int manager_new(Manager **ret) {
         if (r < 0)
                 log_warning_errno(r, "Failed to load DNS-SD configuration files: %m");
 
+        (void) manager_cache_snapshot_load(m);
+
         r = dns_scope_new(m, &m->unicast_scope, NULL, DNS_PROTOCOL_DNS, AF_UNSPEC);
         if (r < 0)
                 return r;
@@ -643,6 +651,14 @@ int manager_start(Manager *m) {
         if (r < 0)
                 return r;
 
+        r = manager_query_socket_start(m);
+        if (r < 0)
+                return r;
+
+        r = manager_cache_snapshot_start(m);
+        if (r < 0)
+                return r;
+
         return 0;
 }
 
@@ -682,6 +698,7 @@ Manager *manager_free(Manager *m) {
         manager_llmnr_stop(m);
         manager_mdns_stop(m);
         manager_dns_stub_stop(m);
+        manager_query_socket_stop(m);
 
         sd_bus_slot_unref(m->prepare_for_sleep_slot);
         sd_bus_unref(m->bus);
@@ -690,6 +707,11 @@ Manager *manager_free(Manager *m) {
         sd_event_source_unref(m->sigusr2_event_source);
         sd_event_source_unref(m->sigrtmin1_event_source);
 
+        sd_event_source_unref(m->cache_snapshot_event_source);
+        free(m->cache_snapshot);
+
+        free(m->recv_batch);
+
         sd_event_unref(m->event);
 
         dns_resource_key_unref(m->llmnr_host_ipv4_key);
@@ -714,71 +736,46 @@ Manager *manager_free(Manager *m) {
         return mfree(m);
 }
 
-int manager_recv(Manager *m, int fd, DnsProtocol protocol, DnsPacket **ret) {
-        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
-        union {
-                struct cmsghdr header; /* For alignment */
-                uint8_t buffer[CMSG_SPACE(MAXSIZE(struct in_pktinfo, struct in6_pktinfo))
-                               + CMSG_SPACE(int) /* ttl/hoplimit */
-                               + EXTRA_CMSG_SPACE /* kernel appears to require extra buffer space */];
-        } control;
-        union sockaddr_union sa;
-        struct msghdr mh = {};
+typedef union ManagerRecvControl {
+        struct cmsghdr header; /* For alignment */
+        uint8_t buffer[CMSG_SPACE(MAXSIZE(struct in_pktinfo, struct in6_pktinfo))
+                       + CMSG_SPACE(int) /* ttl/hoplimit */
+                       + EXTRA_CMSG_SPACE /* kernel appears to require extra buffer space */];
+} ManagerRecvControl;
+
+/* Everything needed to receive MANAGER_RECV_BATCH_MAX datagrams with one recvmmsg() call. This is more than 128K,
+ * hence it is only allocated once it is used. */
+struct ManagerRecvBatch {
+        struct mmsghdr msgs[MANAGER_RECV_BATCH_MAX];
+        struct iovec iovs[MANAGER_RECV_BATCH_MAX];
+        union sockaddr_union addrs[MANAGER_RECV_BATCH_MAX];
+        ManagerRecvControl controls[MANAGER_RECV_BATCH_MAX];
+        uint8_t bufs[MANAGER_RECV_BATCH_MAX][DNS_PACKET_UNICAST_SIZE_LARGE_MAX];
+};
+
+static int manager_recv_parse(Manager *m, DnsPacket *p, struct msghdr *mh) {
+        const union sockaddr_union *sa;
         struct cmsghdr *cmsg;
-        struct iovec iov;
-        ssize_t ms, l;
-        int r;
 
         assert(m);
-        assert(fd >= 0);
-        assert(ret);
-
-        ms = next_datagram_size_fd(fd);
-        if (ms < 0)
-                return ms;
-
-        r = dns_packet_new(&p, protocol, ms, DNS_PACKET_SIZE_MAX);
-        if (r < 0)
-                return r;
-
-        iov.iov_base = DNS_PACKET_DATA(p);
-        iov.iov_len = p->allocated;
-
-        mh.msg_name = &sa.sa;
-        mh.msg_namelen = sizeof(sa);
-        mh.msg_iov = &iov;
-        mh.msg_iovlen = 1;
-        mh.msg_control = &control;
-        mh.msg_controllen = sizeof(control);
-
-        l = recvmsg(fd, &mh, 0);
-        if (l == 0)
-                return 0;
-        if (l < 0) {
-                if (IN_SET(errno, EAGAIN, EINTR))
-                        return 0;
-
-                return -errno;
-        }
+        assert(p);
+        assert(mh);
 
-        assert(!(mh.msg_flags & MSG_CTRUNC));
-        assert(!(mh.msg_flags & MSG_TRUNC));
+        sa = mh->msg_name;
 
-        p->size = (size_t) l;
-
-        p->family = sa.sa.sa_family;
+        p->family = sa->sa.sa_family;
         p->ipproto = IPPROTO_UDP;
         if (p->family == AF_INET) {
-                p->sender.in = sa.in.sin_addr;
-                p->sender_port = be16toh(sa.in.sin_port);
+                p->sender.in = sa->in.sin_addr;
+                p->sender_port = be16toh(sa->in.sin_port);
         } else if (p->family == AF_INET6) {
-                p->sender.in6 = sa.in6.sin6_addr;
-                p->sender_port = be16toh(sa.in6.sin6_port);
-                p->ifindex = sa.in6.sin6_scope_id;
+                p->sender.in6 = sa->in6.sin6_addr;
+                p->sender_port = be16toh(sa->in6.sin6_port);
+                p->ifindex = sa->in6.sin6_scope_id;
         } else
                 return -EAFNOSUPPORT;
 
-        CMSG_FOREACH(cmsg, &mh) {
+        CMSG_FOREACH(cmsg, mh) {
 
                 if (cmsg->cmsg_level == IPPROTO_IPV6) {
                         assert(p->family == AF_INET6);
@@ -829,18 +826,158 @@ int manager_recv(Manager *m, int fd, DnsProtocol protocol, DnsPacket **ret) {
         if (p->ifindex == LOOPBACK_IFINDEX)
                 p->ifindex = 0;
 
-        if (protocol != DNS_PROTOCOL_DNS) {
+        if (p->protocol != DNS_PROTOCOL_DNS) {
                 /* If we don't know the interface index still, we look for the
                  * first local interface with a matching address. Yuck! */
                 if (p->ifindex <= 0)
                         p->ifindex = manager_find_ifindex(m, p->family, &p->destination);
         }
 
+        return 0;
+}
+
+int manager_recv(Manager *m, int fd, DnsProtocol protocol, DnsPacket **ret) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        ManagerRecvControl control;
+        union sockaddr_union sa;
+        struct msghdr mh = {};
+        struct iovec iov;
+        ssize_t ms, l;
+        int r;
+
+        assert(m);
+        assert(fd >= 0);
+        assert(ret);
+
+        ms = next_datagram_size_fd(fd);
+        if (ms < 0)
+                return ms;
+
+        r = dns_packet_new(&p, protocol, ms, DNS_PACKET_SIZE_MAX);
+        if (r < 0)
+                return r;
+
+        iov.iov_base = DNS_PACKET_DATA(p);
+        iov.iov_len = p->allocated;
+
+        mh.msg_name = &sa.sa;
+        mh.msg_namelen = sizeof(sa);
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = &control;
+        mh.msg_controllen = sizeof(control);
+
+        l = recvmsg(fd, &mh, 0);
+        if (l == 0)
+                return 0;
+        if (l < 0) {
+                if (IN_SET(errno, EAGAIN, EINTR))
+                        return 0;
+
+                return -errno;
+        }
+
+        assert(!(mh.msg_flags & MSG_CTRUNC));
+        assert(!(mh.msg_flags & MSG_TRUNC));
+
+        p->size = (size_t) l;
+
+        r = manager_recv_parse(m, p, &mh);
+        if (r < 0)
+                return r;
+
         *ret = TAKE_PTR(p);
 
         return 1;
 }
 
+int manager_recv_many(Manager *m, int fd, DnsProtocol protocol, DnsPacket **ret, size_t n) {
+        ManagerRecvBatch *b;
+        size_t i, k = 0;
+        int n_recv, r;
+
+        assert(m);
+        assert(fd >= 0);
+        assert(ret);
+
+        /* Like manager_recv(), but receives up to n datagrams at once. Only suitable for sockets that get small
+         * datagrams, i.e. queries, as datagrams larger than DNS_PACKET_UNICAST_SIZE_LARGE_MAX are dropped. Returns
+         * the number of packets stored in ret. */
+
+        n = MIN(n, (size_t) MANAGER_RECV_BATCH_MAX);
+        if (n == 0)
+                return 0;
+
+        if (!m->recv_batch) {
+                m->recv_batch = malloc(sizeof(ManagerRecvBatch));
+                if (!m->recv_batch)
+                        return -ENOMEM;
+        }
+        b = m->recv_batch;
+
+        /* The kernel updates the lengths, hence the headers need to be reset on each call */
+        for (i = 0; i < n; i++) {
+                b->iovs[i] = IOVEC_MAKE(b->bufs[i], sizeof(b->bufs[i]));
+                b->msgs[i] = (struct mmsghdr) {
+                        .msg_hdr = {
+                                .msg_name = &b->addrs[i],
+                                .msg_namelen = sizeof(b->addrs[i]),
+                                .msg_iov = &b->iovs[i],
+                                .msg_iovlen = 1,
+                                .msg_control = &b->controls[i],
+                                .msg_controllen = sizeof(b->controls[i]),
+                        },
+                };
+        }
+
+        n_recv = recvmmsg(fd, b->msgs, n, MSG_DONTWAIT, NULL);
+        if (n_recv < 0) {
+                if (IN_SET(errno, EAGAIN, EINTR))
+                        return 0;
+
+                return -errno;
+        }
+
+        for (i = 0; i < (size_t) n_recv; i++) {
+                _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+                struct msghdr *mh = &b->msgs[i].msg_hdr;
+                size_t l = b->msgs[i].msg_len;
+
+                if (l == 0)
+                        continue;
+
+                assert(!(mh->msg_flags & MSG_CTRUNC));
+
+                if (mh->msg_flags & MSG_TRUNC) {
+                        log_debug("Received oversized datagram, ignoring.");
+                        continue;
+                }
+
+                r = dns_packet_new(&p, protocol, l, DNS_PACKET_SIZE_MAX);
+                if (r < 0)
+                        goto fail;
+
+                memcpy(DNS_PACKET_DATA(p), b->bufs[i], l);
+                p->size = l;
+
+                r = manager_recv_parse(m, p, mh);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to parse received datagram, ignoring: %m");
+                        continue;
+                }
+
+                ret[k++] = TAKE_PTR(p);
+        }
+
+        return (int) k;
+
+fail:
+        while (k > 0)
+                dns_packet_unref(ret[--k]);
+
+        return r;
+}
+
 static int sendmsg_loop(int fd, struct msghdr *mh, int flags) {
         int r;
 
@@ -1389,6 +1526,32 @@ DnsOverTlsMode manager_get_dns_over_tls_mode(Manager *m) {
         return DNS_OVER_TLS_NO;
 }
 
+/* The upper bounds of the buckets of the response time histogram, the last one takes everything else */
+const usec_t manager_response_time_bucket_max[MANAGER_RESPONSE_TIME_BUCKETS] = {
+        10 * USEC_PER_MSEC,
+        50 * USEC_PER_MSEC,
+        100 * USEC_PER_MSEC,
+        250 * USEC_PER_MSEC,
+        500 * USEC_PER_MSEC,
+        1 * USEC_PER_SEC,
+        5 * USEC_PER_SEC,
+        USEC_INFINITY,
+};
+
+void manager_response_time(Manager *m, usec_t t) {
+        unsigned i;
+
+        assert(m);
+
+        /* Records the time from the first attempt of a transaction until the reply from a DNS server we act on */
+
+        for (i = 0; i < MANAGER_RESPONSE_TIME_BUCKETS - 1; i++)
+                if (t < manager_response_time_bucket_max[i])
+                        break;
+
+        m->n_response_time[i]++;
+}
+
 void manager_dnssec_verdict(Manager *m, DnssecVerdict verdict, const DnsResourceKey *key) {
 
         assert(verdict >= 0);
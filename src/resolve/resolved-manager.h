@@ -12,6 +12,9 @@
 #include "resolve-util.h"
 
 typedef struct Manager Manager;
+typedef struct ManagerRecvBatch ManagerRecvBatch;
+typedef struct DnsStubReplyBatch DnsStubReplyBatch;
+typedef struct EtcHosts EtcHosts;
 
 #include "resolved-conf.h"
 #include "resolved-dns-query.h"
@@ -24,6 +27,14 @@ typedef struct Manager Manager;
 #define MANAGER_SEARCH_DOMAINS_MAX 32
 #define MANAGER_DNS_SERVERS_MAX 32
 
+/* How many datagrams to receive with one call to manager_recv_many() at most */
+#define MANAGER_RECV_BATCH_MAX 32U
+
+/* The number of buckets of the histogram of the time it takes DNS servers to answer, see manager_response_time() */
+#define MANAGER_RESPONSE_TIME_BUCKETS 8
+
+extern const usec_t manager_response_time_bucket_max[MANAGER_RESPONSE_TIME_BUCKETS];
+
 struct Manager {
         sd_event *event;
 
@@ -31,7 +42,13 @@ struct Manager {
         ResolveSupport mdns_support;
         DnssecMode dnssec_mode;
         DnsOverTlsMode dns_over_tls_mode;
+        bool race_dns_servers;
         bool enable_cache;
+        size_t cache_size;
+        usec_t cache_max_ttl;
+        bool cache_prefetch;
+        usec_t stale_retention_usec;
+        bool persistent_cache;
         DnsStubListenerMode dns_stub_listener_mode;
 
         /* Network */
@@ -116,12 +133,22 @@ struct Manager {
 
         unsigned n_transactions_total;
         unsigned n_dnssec_verdict[_DNSSEC_VERDICT_MAX];
-
-        /* Data from /etc/hosts */
-        Set* etc_hosts_by_address;
-        Hashmap* etc_hosts_by_name;
+        unsigned n_response_time[MANAGER_RESPONSE_TIME_BUCKETS];
+
+        /* Data from /etc/hosts, and the new contents while a changed file is read */
+        EtcHosts *etc_hosts;
+        EtcHosts *etc_hosts_pending;
+        FILE *etc_hosts_pending_file;
+        unsigned etc_hosts_pending_line;
+        sd_event_source *etc_hosts_event_source;
         usec_t etc_hosts_last, etc_hosts_mtime;
 
+        /* Cache snapshot from before a restart, see resolved-cache-snapshot.c */
+        void *cache_snapshot;
+        size_t cache_snapshot_size;
+        usec_t cache_snapshot_realtime;
+        sd_event_source *cache_snapshot_event_source;
+
         /* Local DNS stub on 127.0.0.53:53 */
         int dns_stub_udp_fd;
         int dns_stub_tcp_fd;
@@ -129,6 +156,16 @@ struct Manager {
         sd_event_source *dns_stub_udp_event_source;
         sd_event_source *dns_stub_tcp_event_source;
 
+        /* Set while a batch of stub UDP queries is processed, collects the replies to send together */
+        DnsStubReplyBatch *dns_stub_reply_batch;
+
+        /* Local socket for hostname and address lookups, see resolved-query-socket.c */
+        int query_socket_fd;
+        sd_event_source *query_socket_event_source;
+        Set *query_socket_connections;
+
+        ManagerRecvBatch *recv_batch;
+
         Hashmap *polkit_registry;
 };
 
@@ -144,6 +181,7 @@ uint32_t manager_find_mtu(Manager *m);
 int manager_write(Manager *m, int fd, DnsPacket *p);
 int manager_send(Manager *m, int fd, int ifindex, int family, const union in_addr_union *destination, uint16_t port, const union in_addr_union *source, DnsPacket *p);
 int manager_recv(Manager *m, int fd, DnsProtocol protocol, DnsPacket **ret);
+int manager_recv_many(Manager *m, int fd, DnsProtocol protocol, DnsPacket **ret, size_t n);
 
 int manager_find_ifindex(Manager *m, int family, const union in_addr_union *in_addr);
 LinkAddress* manager_find_link_address(Manager *m, int family, const union in_addr_union *in_addr);
@@ -170,6 +208,7 @@ bool manager_dnssec_supported(Manager *m);
 
 DnsOverTlsMode manager_get_dns_over_tls_mode(Manager *m);
 
+void manager_response_time(Manager *m, usec_t t);
 void manager_dnssec_verdict(Manager *m, DnssecVerdict verdict, const DnsResourceKey *key);
 
 bool manager_routable(Manager *m, int family);
@@ -0,0 +1,875 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "alloc-util.h"
+#include "dns-domain.h"
+#include "fd-util.h"
+#include "mkdir.h"
+#include "resolved-def.h"
+#include "resolved-dns-synthesize.h"
+#include "resolved-query-socket.h"
+#include "socket-util.h"
+#include "umask-util.h"
+
+/* The largest request we accept */
+#define QUERY_SOCKET_REQUEST_MAX (sizeof(ResolvedQueryRequest) + SD_RESOLVED_QUERY_HOSTNAME_MAX)
+
+/* How long a connection may wait for its request. Clients send it right after connecting, hence one that doesn't is
+ * stuck or malicious, and only takes away a slot from others. */
+#define QUERY_SOCKET_REQUEST_TIMEOUT_USEC (1 * USEC_PER_SEC)
+
+/* How many addresses to return at most, leaving enough room for the canonical name */
+#define QUERY_SOCKET_ADDRESSES_MAX \
+        ((SD_RESOLVED_QUERY_MESSAGE_MAX - sizeof(ResolvedQueryReply) - SD_RESOLVED_QUERY_HOSTNAME_MAX) / sizeof(ResolvedQueryAddress))
+
+typedef struct QuerySocketReply {
+        uint8_t *data;
+        size_t size;
+        size_t allocated;
+} QuerySocketReply;
+
+/* A connection waiting for its request */
+typedef struct QuerySocketConnection {
+        Manager *manager;
+        int fd;
+        sd_event_source *io_event_source;
+        sd_event_source *timeout_event_source;
+} QuerySocketConnection;
+
+static int query_socket_reply_init(QuerySocketReply *reply, uint32_t id, uint8_t status, int error) {
+        ResolvedQueryReply header = {
+                .id = id,
+                .status = status,
+                .error = error,
+        };
+
+        assert(reply);
+
+        if (!GREEDY_REALLOC(reply->data, reply->allocated, sizeof(header)))
+                return -ENOMEM;
+
+        memcpy(reply->data, &header, sizeof(header));
+        reply->size = sizeof(header);
+
+        return 0;
+}
+
+static int query_socket_reply_append(QuerySocketReply *reply, const void *p, size_t n) {
+        assert(reply);
+        assert(p || n == 0);
+
+        if (reply->size + n > SD_RESOLVED_QUERY_MESSAGE_MAX)
+                return -E2BIG;
+
+        if (!GREEDY_REALLOC(reply->data, reply->allocated, reply->size + n))
+                return -ENOMEM;
+
+        memcpy_safe(reply->data + reply->size, p, n);
+        reply->size += n;
+
+        return 0;
+}
+
+static void query_socket_reply_finish(QuerySocketReply *reply, uint64_t flags, uint16_t n_items) {
+        ResolvedQueryReply header;
+
+        assert(reply);
+        assert(reply->size >= sizeof(header));
+
+        memcpy(&header, reply->data, sizeof(header));
+        header.flags = flags;
+        header.n_items = n_items;
+        memcpy(reply->data, &header, sizeof(header));
+}
+
+static void query_socket_send(int fd, const void *p, size_t size) {
+        assert(fd >= 0);
+        assert(p);
+
+        /* Never wait for a client. If it doesn't read its reply it is gone or broken. */
+        if (send(fd, p, size, MSG_DONTWAIT|MSG_NOSIGNAL) < 0)
+                log_debug_errno(errno, "Failed to send reply on query socket, ignoring: %m");
+}
+
+static void query_socket_send_error(int fd, uint32_t id, uint8_t status, int error) {
+        ResolvedQueryReply reply = {
+                .id = id,
+                .status = status,
+                .error = error,
+        };
+
+        query_socket_send(fd, &reply, sizeof(reply));
+}
+
+static void query_socket_send_query_error(DnsQuery *q, uint8_t status, int error) {
+        assert(q);
+
+        query_socket_send_error(q->request_socket_fd, q->request_socket_id, status, error);
+}
+
+static void query_socket_send_query_state(DnsQuery *q) {
+        int error;
+
+        assert(q);
+
+        /* The errors match those the bus errors of the same lookups map to */
+
+        switch (q->state) {
+
+        case DNS_TRANSACTION_NO_SERVERS:
+                error = ESRCH;
+                break;
+
+        case DNS_TRANSACTION_TIMEOUT:
+        case DNS_TRANSACTION_ATTEMPTS_MAX_REACHED:
+                error = ETIMEDOUT;
+                break;
+
+        case DNS_TRANSACTION_INVALID_REPLY:
+                error = EINVAL;
+                break;
+
+        case DNS_TRANSACTION_ERRNO:
+                error = q->answer_errno;
+                break;
+
+        case DNS_TRANSACTION_ABORTED:
+                error = ECANCELED;
+                break;
+
+        case DNS_TRANSACTION_DNSSEC_FAILED:
+        case DNS_TRANSACTION_NO_TRUST_ANCHOR:
+                error = EHOSTUNREACH;
+                break;
+
+        case DNS_TRANSACTION_RR_TYPE_UNSUPPORTED:
+                error = EOPNOTSUPP;
+                break;
+
+        case DNS_TRANSACTION_NETWORK_DOWN:
+                error = ENETDOWN;
+                break;
+
+        case DNS_TRANSACTION_NOT_FOUND:
+                /* Reported as NXDOMAIN, like on the bus */
+                query_socket_send_query_error(q, SD_RESOLVED_QUERY_NXDOMAIN, ENXIO);
+                return;
+
+        case DNS_TRANSACTION_RCODE_FAILURE:
+                if (q->answer_rcode == DNS_RCODE_NXDOMAIN) {
+                        query_socket_send_query_error(q, SD_RESOLVED_QUERY_NXDOMAIN, ENXIO);
+                        return;
+                }
+
+                error = q->answer_rcode == DNS_RCODE_REFUSED ? EACCES : EHOSTDOWN;
+                break;
+
+        case DNS_TRANSACTION_NULL:
+        case DNS_TRANSACTION_PENDING:
+        case DNS_TRANSACTION_VALIDATING:
+        case DNS_TRANSACTION_SUCCESS:
+        default:
+                assert_not_reached("Impossible state");
+        }
+
+        query_socket_send_query_error(q, SD_RESOLVED_QUERY_FAILED, error);
+}
+
+static int query_socket_append_address(QuerySocketReply *reply, int ifindex, int family, const void *address) {
+        ResolvedQueryAddress a = {
+                .ifindex = ifindex,
+                .family = family,
+        };
+
+        memcpy(a.address, address, FAMILY_ADDRESS_SIZE(family));
+
+        return query_socket_reply_append(reply, &a, sizeof(a));
+}
+
+int query_socket_hostname_reply(
+                uint32_t id,
+                DnsQuestion *question,
+                DnsAnswer *answer,
+                const char *search_domain,
+                uint64_t flags,
+                uint8_t **ret,
+                size_t *ret_size) {
+
+        _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *canonical = NULL;
+        _cleanup_free_ char *normalized = NULL;
+        QuerySocketReply reply = {};
+        DnsResourceRecord *rr;
+        unsigned added = 0;
+        int ifindex, r;
+
+        assert(ret);
+        assert(ret_size);
+
+        r = query_socket_reply_init(&reply, id, SD_RESOLVED_QUERY_SUCCESS, 0);
+        if (r < 0)
+                goto fail;
+
+        DNS_ANSWER_FOREACH_IFINDEX(rr, ifindex, answer) {
+
+                if (added >= QUERY_SOCKET_ADDRESSES_MAX)
+                        break;
+
+                r = dns_question_matches_rr(question, rr, search_domain);
+                if (r < 0)
+                        goto fail;
+                if (r == 0)
+                        continue;
+
+                if (rr->key->type == DNS_TYPE_A)
+                        r = query_socket_append_address(&reply, ifindex, AF_INET, &rr->a.in_addr);
+                else if (rr->key->type == DNS_TYPE_AAAA)
+                        r = query_socket_append_address(&reply, ifindex, AF_INET6, &rr->aaaa.in6_addr);
+                else
+                        continue;
+                if (r < 0)
+                        goto fail;
+
+                if (!canonical)
+                        canonical = dns_resource_record_ref(rr);
+
+                added++;
+        }
+
+        if (added <= 0) {
+                r = -ENOENT;
+                goto fail;
+        }
+
+        /* Return the precise spelling and uppercasing and CNAME target reported by the server, normalized as on the
+         * bus */
+        r = dns_name_normalize(dns_resource_key_name(canonical->key), &normalized);
+        if (r < 0)
+                goto fail;
+
+        r = query_socket_reply_append(&reply, normalized, strlen(normalized));
+        if (r < 0)
+                goto fail;
+
+        query_socket_reply_finish(&reply, flags, added);
+
+        *ret = reply.data;
+        *ret_size = reply.size;
+        return 0;
+
+fail:
+        free(reply.data);
+        return r;
+}
+
+static void query_socket_hostname_complete(DnsQuery *q) {
+        _cleanup_free_ uint8_t *data = NULL;
+        size_t size;
+        int r;
+
+        assert(q);
+
+        if (q->state != DNS_TRANSACTION_SUCCESS) {
+                query_socket_send_query_state(q);
+                r = 0;
+                goto finish;
+        }
+
+        r = dns_query_process_cname(q);
+        if (r == -ELOOP) {
+                query_socket_send_query_error(q, SD_RESOLVED_QUERY_FAILED, EDEADLK);
+                r = 0;
+                goto finish;
+        }
+        if (r < 0)
+                goto finish;
+        if (r == DNS_QUERY_RESTARTED) /* This was a cname, and the query was restarted. */
+                return;
+
+        r = query_socket_hostname_reply(q->request_socket_id,
+                                        dns_query_question_for_protocol(q, q->answer_protocol),
+                                        q->answer,
+                                        DNS_SEARCH_DOMAIN_NAME(q->answer_search_domain),
+                                        SD_RESOLVED_FLAGS_MAKE(q->answer_protocol, q->answer_family, dns_query_fully_authenticated(q)),
+                                        &data, &size);
+        if (r == -ENOENT) {
+                query_socket_send_query_error(q, SD_RESOLVED_QUERY_FAILED, ENOENT);
+                r = 0;
+                goto finish;
+        }
+        if (r < 0)
+                goto finish;
+
+        query_socket_send(q->request_socket_fd, data, size);
+
+finish:
+        if (r < 0) {
+                log_error_errno(r, "Failed to send hostname reply: %m");
+                query_socket_send_query_error(q, SD_RESOLVED_QUERY_FAILED, -r);
+        }
+
+        dns_query_free(q);
+}
+
+int query_socket_address_reply(
+                uint32_t id,
+                DnsQuestion *question,
+                DnsAnswer *answer,
+                uint64_t flags,
+                uint8_t **ret,
+                size_t *ret_size) {
+
+        QuerySocketReply reply = {};
+        DnsResourceRecord *rr;
+        unsigned added = 0;
+        int ifindex, r;
+
+        assert(ret);
+        assert(ret_size);
+
+        r = query_socket_reply_init(&reply, id, SD_RESOLVED_QUERY_SUCCESS, 0);
+        if (r < 0)
+                goto fail;
+
+        DNS_ANSWER_FOREACH_IFINDEX(rr, ifindex, answer) {
+                _cleanup_free_ char *normalized = NULL;
+                ResolvedQueryName n;
+                size_t size;
+
+                r = dns_question_matches_rr(question, rr, NULL);
+                if (r < 0)
+                        goto fail;
+                if (r == 0)
+                        continue;
+
+                r = dns_name_normalize(rr->ptr.name, &normalized);
+                if (r < 0)
+                        goto fail;
+
+                n = (ResolvedQueryName) {
+                        .ifindex = ifindex,
+                        .length = strlen(normalized),
+                };
+
+                /* Stop once the reply is full */
+                size = reply.size;
+                r = query_socket_reply_append(&reply, &n, sizeof(n));
+                if (r >= 0)
+                        r = query_socket_reply_append(&reply, normalized, n.length);
+                if (r == -E2BIG) {
+                        reply.size = size;
+                        break;
+                }
+                if (r < 0)
+                        goto fail;
+
+                added++;
+        }
+
+        if (added <= 0) {
+                r = -ENOENT;
+                goto fail;
+        }
+
+        query_socket_reply_finish(&reply, flags, added);
+
+        *ret = reply.data;
+        *ret_size = reply.size;
+        return 0;
+
+fail:
+        free(reply.data);
+        return r;
+}
+
+static void query_socket_address_complete(DnsQuery *q) {
+        _cleanup_free_ uint8_t *data = NULL;
+        size_t size;
+        int r;
+
+        assert(q);
+
+        if (q->state != DNS_TRANSACTION_SUCCESS) {
+                query_socket_send_query_state(q);
+                r = 0;
+                goto finish;
+        }
+
+        r = dns_query_process_cname(q);
+        if (r == -ELOOP) {
+                query_socket_send_query_error(q, SD_RESOLVED_QUERY_FAILED, EDEADLK);
+                r = 0;
+                goto finish;
+        }
+        if (r < 0)
+                goto finish;
+        if (r == DNS_QUERY_RESTARTED) /* This was a cname, and the query was restarted. */
+                return;
+
+        r = query_socket_address_reply(q->request_socket_id,
+                                       dns_query_question_for_protocol(q, q->answer_protocol),
+                                       q->answer,
+                                       SD_RESOLVED_FLAGS_MAKE(q->answer_protocol, q->answer_family, dns_query_fully_authenticated(q)),
+                                       &data, &size);
+        if (r == -ENOENT) {
+                query_socket_send_query_error(q, SD_RESOLVED_QUERY_FAILED, ENOENT);
+                r = 0;
+                goto finish;
+        }
+        if (r < 0)
+                goto finish;
+
+        query_socket_send(q->request_socket_fd, data, size);
+
+finish:
+        if (r < 0) {
+                log_error_errno(r, "Failed to send address reply: %m");
+                query_socket_send_query_error(q, SD_RESOLVED_QUERY_FAILED, -r);
+        }
+
+        dns_query_free(q);
+}
+
+static int query_socket_check_ifindex_flags(const ResolvedQueryRequest *req, uint64_t ok, uint64_t *ret_flags) {
+        uint64_t flags;
+
+        assert(req);
+        assert(ret_flags);
+
+        /* Same rules as on the bus */
+
+        if (req->ifindex < 0)
+                return -EINVAL;
+
+        flags = req->flags;
+        if (flags & ~(SD_RESOLVED_PROTOCOLS_ALL|SD_RESOLVED_NO_CNAME|ok))
+                return -EINVAL;
+
+        if ((flags & SD_RESOLVED_PROTOCOLS_ALL) == 0) /* If no protocol is enabled, enable all */
+                flags |= SD_RESOLVED_PROTOCOLS_ALL;
+
+        *ret_flags = flags;
+        return 0;
+}
+
+static int query_socket_parse_as_address(
+                int fd,
+                const ResolvedQueryRequest *req,
+                const char *hostname,
+                uint64_t flags) {
+
+        _cleanup_free_ char *canonical = NULL;
+        QuerySocketReply reply = {};
+        union in_addr_union parsed;
+        int r, ff, ifindex, parsed_ifindex = 0;
+
+        /* Check if the hostname is actually already an IP address formatted as string. In that case just parse it,
+         * let's not attempt to look it up. */
+
+        r = in_addr_ifindex_from_string_auto(hostname, &ff, &parsed, &parsed_ifindex);
+        if (r < 0) /* not an address */
+                return 0;
+
+        ifindex = req->ifindex;
+        if ((req->family != AF_UNSPEC && ff != req->family) ||
+            (ifindex > 0 && parsed_ifindex > 0 && parsed_ifindex != ifindex)) {
+                query_socket_send_error(fd, req->id, SD_RESOLVED_QUERY_FAILED, ENOENT);
+                return 1;
+        }
+
+        if (parsed_ifindex > 0)
+                ifindex = parsed_ifindex;
+
+        r = in_addr_ifindex_to_string(ff, &parsed, ifindex, &canonical);
+        if (r < 0)
+                return r;
+
+        r = query_socket_reply_init(&reply, req->id, SD_RESOLVED_QUERY_SUCCESS, 0);
+        if (r >= 0)
+                r = query_socket_append_address(&reply, ifindex, ff, &parsed);
+        if (r >= 0)
+                r = query_socket_reply_append(&reply, canonical, strlen(canonical));
+        if (r < 0) {
+                free(reply.data);
+                return r;
+        }
+
+        query_socket_reply_finish(&reply, SD_RESOLVED_FLAGS_MAKE(dns_synthesize_protocol(flags), ff, true), 1);
+        query_socket_send(fd, reply.data, reply.size);
+
+        free(reply.data);
+        return 1;
+}
+
+static int query_socket_resolve_hostname(
+                Manager *m,
+                int *fd,
+                const ResolvedQueryRequest *req,
+                const void *data,
+                size_t size) {
+
+        _cleanup_(dns_question_unrefp) DnsQuestion *question_idna = NULL, *question_utf8 = NULL;
+        _cleanup_free_ char *hostname = NULL;
+        uint64_t flags;
+        DnsQuery *q;
+        int r;
+
+        if (!IN_SET(req->family, AF_INET, AF_INET6, AF_UNSPEC))
+                return -EINVAL;
+
+        r = query_socket_check_ifindex_flags(req, SD_RESOLVED_NO_SEARCH, &flags);
+        if (r < 0)
+                return r;
+
+        if (size == 0 || memchr(data, 0, size))
+                return -EINVAL;
+
+        hostname = strndup(data, size);
+        if (!hostname)
+                return -ENOMEM;
+
+        r = query_socket_parse_as_address(*fd, req, hostname, flags);
+        if (r != 0)
+                return r;
+
+        r = dns_name_is_valid(hostname);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return -EINVAL;
+
+        r = dns_question_new_address(&question_utf8, req->family, hostname, false);
+        if (r < 0)
+                return r;
+
+        r = dns_question_new_address(&question_idna, req->family, hostname, true);
+        if (r < 0 && r != -EALREADY)
+                return r;
+
+        r = dns_query_new(m, &q, question_utf8, question_idna ?: question_utf8, req->ifindex, flags);
+        if (r < 0)
+                return r;
+
+        q->request_socket_fd = TAKE_FD(*fd);
+        q->request_socket_id = req->id;
+        q->request_family = req->family;
+        q->complete = query_socket_hostname_complete;
+        q->suppress_unroutable_family = req->family == AF_UNSPEC;
+
+        r = dns_query_go(q);
+        if (r < 0) {
+                /* Keep the connection, so that the error can be reported */
+                *fd = TAKE_FD(q->request_socket_fd);
+                dns_query_free(q);
+                return r;
+        }
+
+        return 0;
+}
+
+static int query_socket_resolve_address(
+                Manager *m,
+                int *fd,
+                const ResolvedQueryRequest *req,
+                const void *data,
+                size_t size) {
+
+        _cleanup_(dns_question_unrefp) DnsQuestion *question = NULL;
+        union in_addr_union a = {};
+        uint64_t flags;
+        DnsQuery *q;
+        int r;
+
+        if (!IN_SET(req->family, AF_INET, AF_INET6))
+                return -EINVAL;
+
+        if (size != FAMILY_ADDRESS_SIZE(req->family))
+                return -EINVAL;
+
+        r = query_socket_check_ifindex_flags(req, 0, &flags);
+        if (r < 0)
+                return r;
+
+        /* The address follows the header directly, hence isn't aligned */
+        memcpy(&a, data, size);
+
+        r = dns_question_new_reverse(&question, req->family, &a);
+        if (r < 0)
+                return r;
+
+        r = dns_query_new(m, &q, question, question, req->ifindex, flags|SD_RESOLVED_NO_SEARCH);
+        if (r < 0)
+                return r;
+
+        q->request_socket_fd = TAKE_FD(*fd);
+        q->request_socket_id = req->id;
+        q->request_family = req->family;
+        q->request_address = a;
+        q->complete = query_socket_address_complete;
+
+        r = dns_query_go(q);
+        if (r < 0) {
+                /* Keep the connection, so that the error can be reported */
+                *fd = TAKE_FD(q->request_socket_fd);
+                dns_query_free(q);
+                return r;
+        }
+
+        return 0;
+}
+
+static void query_socket_process(Manager *m, int *fd, const uint8_t *p, size_t size) {
+        ResolvedQueryRequest req;
+        int r;
+
+        assert(m);
+        assert(fd);
+        assert(p);
+
+        if (size < sizeof(req)) {
+                log_debug("Short request on query socket, ignoring.");
+                return;
+        }
+
+        memcpy(&req, p, sizeof(req));
+        p += sizeof(req);
+        size -= sizeof(req);
+
+        switch (req.type) {
+
+        case SD_RESOLVED_QUERY_HOSTNAME:
+                r = query_socket_resolve_hostname(m, fd, &req, p, size);
+                break;
+
+        case SD_RESOLVED_QUERY_ADDRESS:
+                r = query_socket_resolve_address(m, fd, &req, p, size);
+                break;
+
+        default:
+                r = -EOPNOTSUPP;
+        }
+        if (r < 0) {
+                log_debug_errno(r, "Failed to process request on query socket: %m");
+                query_socket_send_error(*fd, req.id, SD_RESOLVED_QUERY_FAILED, -r);
+        }
+}
+
+static QuerySocketConnection* query_socket_connection_free(QuerySocketConnection *c) {
+        if (!c)
+                return NULL;
+
+        if (c->manager)
+                (void) set_remove(c->manager->query_socket_connections, c);
+
+        sd_event_source_unref(c->io_event_source);
+        sd_event_source_unref(c->timeout_event_source);
+        safe_close(c->fd);
+
+        return mfree(c);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(QuerySocketConnection*, query_socket_connection_free);
+
+static int on_query_socket_request(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        uint8_t buf[QUERY_SOCKET_REQUEST_MAX];
+        QuerySocketConnection *c = userdata;
+        Manager *m;
+        ssize_t l;
+
+        assert(c);
+
+        m = c->manager;
+
+        /* Each connection carries a single request, and the reply is sent on the same connection, hence clients don't
+         * need an address resolved can send to. */
+
+        l = recv(fd, buf, sizeof(buf), MSG_DONTWAIT|MSG_TRUNC);
+        if (l < 0) {
+                if (IN_SET(errno, EAGAIN, EINTR))
+                        return 0;
+
+                log_debug_errno(errno, "Failed to receive request on query socket, ignoring: %m");
+        }
+
+        /* From now on the connection is ours, the query takes it over if one is started */
+        fd = TAKE_FD(c->fd);
+        query_socket_connection_free(c);
+
+        if (l > 0 && (size_t) l > sizeof(buf)) {
+                ResolvedQueryRequest req;
+
+                /* Tell the client right away, so that it doesn't wait for a reply in vain */
+                log_debug("Oversized request on query socket, refusing.");
+                memcpy(&req, buf, sizeof(req));
+                query_socket_send_error(fd, req.id, SD_RESOLVED_QUERY_FAILED, EMSGSIZE);
+        } else if (l > 0)
+                query_socket_process(m, &fd, buf, l);
+
+        safe_close(fd);
+        return 0;
+}
+
+static int on_query_socket_timeout(sd_event_source *s, uint64_t usec, void *userdata) {
+        QuerySocketConnection *c = userdata;
+
+        assert(c);
+
+        /* Clients fall back to the bus if the connection is closed without a reply */
+        log_debug("No request on query socket connection in time, closing.");
+        query_socket_connection_free(c);
+
+        return 0;
+}
+
+int manager_query_socket_add_connection(Manager *m, int fd) {
+        _cleanup_(query_socket_connection_freep) QuerySocketConnection *c = NULL;
+        int r;
+
+        assert(m);
+        assert(fd >= 0);
+
+        /* Takes over the fd in any case. Clients fall back to the bus if the connection is closed without a reply. */
+
+        c = new0(QuerySocketConnection, 1);
+        if (!c) {
+                safe_close(fd);
+                return -ENOMEM;
+        }
+
+        c->fd = fd;
+
+        if (set_size(m->query_socket_connections) >= QUERY_SOCKET_CONNECTIONS_MAX)
+                return -EBUSY;
+
+        r = set_ensure_allocated(&m->query_socket_connections, NULL);
+        if (r < 0)
+                return r;
+
+        r = sd_event_add_io(m->event, &c->io_event_source, fd, EPOLLIN, on_query_socket_request, c);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(c->io_event_source, "query-socket-connection");
+
+        r = sd_event_add_time(m->event, &c->timeout_event_source, clock_boottime_or_monotonic(),
+                              now(clock_boottime_or_monotonic()) + QUERY_SOCKET_REQUEST_TIMEOUT_USEC, 0,
+                              on_query_socket_timeout, c);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(c->timeout_event_source, "query-socket-connection-timeout");
+
+        r = set_put(m->query_socket_connections, c);
+        if (r < 0)
+                return r;
+
+        c->manager = m;
+        TAKE_PTR(c);
+
+        return 0;
+}
+
+static int on_query_socket_connection(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        Manager *m = userdata;
+        unsigned i;
+        int r;
+
+        assert(m);
+
+        /* Accept a number of connections per wakeup, to save on event loop iterations when there are lots of them */
+
+        for (i = 0; i < MANAGER_RECV_BATCH_MAX; i++) {
+                int cfd;
+
+                cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+                if (cfd < 0) {
+                        if (IN_SET(errno, EAGAIN, EINTR))
+                                return 0;
+                        if (errno == ECONNABORTED)
+                                continue;
+
+                        return log_error_errno(errno, "Failed to accept connection on query socket: %m");
+                }
+
+                r = manager_query_socket_add_connection(m, cfd);
+                if (r == -EBUSY)
+                        log_debug("Too many pending connections on query socket, refusing.");
+                else if (r < 0)
+                        log_debug_errno(r, "Failed to watch query socket connection, refusing: %m");
+        }
+
+        return 0;
+}
+
+int manager_query_socket_start(Manager *m) {
+        union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+                .un.sun_path = SD_RESOLVED_QUERY_SOCKET_PATH,
+        };
+        _cleanup_close_ int fd = -1;
+        int r;
+
+        assert(m);
+
+        if (m->query_socket_fd >= 0)
+                return 0;
+
+        /* Clients fall back to the bus if the socket isn't there or nobody accepts connections on it, hence none of
+         * the failures below are fatal */
+
+        fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+                log_warning_errno(errno, "Failed to create query socket, ignoring: %m");
+                return 0;
+        }
+
+        (void) mkdir_parents(SD_RESOLVED_QUERY_SOCKET_PATH, 0755);
+        (void) unlink(SD_RESOLVED_QUERY_SOCKET_PATH);
+
+        /* Anybody may resolve names, just like on the bus */
+        RUN_WITH_UMASK(0000)
+                r = bind(fd, &sa.sa, SOCKADDR_UN_LEN(sa.un));
+        if (r < 0) {
+                log_warning_errno(errno, "Failed to bind query socket to %s, ignoring: %m", SD_RESOLVED_QUERY_SOCKET_PATH);
+                return 0;
+        }
+
+        if (listen(fd, SOMAXCONN) < 0) {
+                log_warning_errno(errno, "Failed to listen on query socket, ignoring: %m");
+                goto fail;
+        }
+
+        r = sd_event_add_io(m->event, &m->query_socket_event_source, fd, EPOLLIN, on_query_socket_connection, m);
+        if (r < 0) {
+                log_warning_errno(r, "Failed to watch query socket, ignoring: %m");
+                goto fail;
+        }
+
+        (void) sd_event_source_set_description(m->query_socket_event_source, "query-socket");
+
+        m->query_socket_fd = TAKE_FD(fd);
+        return 0;
+
+fail:
+        /* Don't leave a socket behind nobody accepts connections on */
+        (void) unlink(SD_RESOLVED_QUERY_SOCKET_PATH);
+        return 0;
+}
+
+void manager_query_socket_stop(Manager *m) {
+        QuerySocketConnection *c;
+
+        assert(m);
+
+        while ((c = set_first(m->query_socket_connections)))
+                query_socket_connection_free(c);
+        m->query_socket_connections = set_free(m->query_socket_connections);
+
+        m->query_socket_event_source = sd_event_source_unref(m->query_socket_event_source);
+
+        if (m->query_socket_fd >= 0) {
+                (void) unlink(SD_RESOLVED_QUERY_SOCKET_PATH);
+                m->query_socket_fd = safe_close(m->query_socket_fd);
+        }
+}
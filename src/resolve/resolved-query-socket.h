@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include "resolved-manager.h"
+
+/* How many connections may wait for their request to arrive */
+#define QUERY_SOCKET_CONNECTIONS_MAX 128U
+
+int manager_query_socket_start(Manager *m);
+void manager_query_socket_stop(Manager *m);
+int manager_query_socket_add_connection(Manager *m, int fd);
+
+int query_socket_hostname_reply(uint32_t id, DnsQuestion *question, DnsAnswer *answer, const char *search_domain, uint64_t flags, uint8_t **ret, size_t *ret_size);
+int query_socket_address_reply(uint32_t id, DnsQuestion *question, DnsAnswer *answer, uint64_t flags, uint8_t **ret, size_t *ret_size);
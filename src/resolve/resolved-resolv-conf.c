@@ -144,17 +144,20 @@ int manager_read_resolv_conf(Manager *m) {
          * resetting the DNS server to use back to the first entry we
          * will continue to use the local one thus being unable to
          * resolve VPN domains. */
-        manager_set_dns_server(m, m->dns_servers);
 
         /* Unconditionally flush the cache when /etc/resolv.conf is
          * modified, even if the data it contained was completely
          * identical to the previous version we used. We do this
          * because altering /etc/resolv.conf is typically done when
          * the network configuration changes, and that should be
-         * enough to flush the global unicast DNS cache. */
+         * enough to flush the global unicast DNS cache. Do so before
+         * switching servers, so that entries restored from a cache
+         * snapshot for the new server are kept. */
         if (m->unicast_scope)
                 dns_cache_flush(&m->unicast_scope->cache);
 
+        manager_set_dns_server(m, m->dns_servers);
+
         /* If /etc/resolv.conf changed, make sure to forget everything we learned about the DNS servers. After all we
          * might now talk to a very different DNS server that just happens to have the same IP address as an old one
          * (think 192.168.1.1). */
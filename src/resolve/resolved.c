@@ -5,6 +5,7 @@
 
 #include "capability-util.h"
 #include "mkdir.h"
+#include "resolved-cache-snapshot.h"
 #include "resolved-conf.h"
 #include "resolved-manager.h"
 #include "resolved-resolv-conf.h"
@@ -99,6 +100,8 @@ int main(int argc, char *argv[]) {
 
         sd_event_get_exit_code(m->event, &r);
 
+        (void) manager_cache_snapshot_save(m);
+
 finish:
         sd_notify(false,
                   "STOPPING=1\n"
@@ -0,0 +1,314 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "log.h"
+#include "resolved-dns-cache.h"
+
+static void put_full(DnsCache *c, const char *name, uint32_t ttl, usec_t timestamp, bool authenticated) {
+        _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        union in_addr_union owner = {};
+
+        assert_se(rr = dns_resource_record_new_full(DNS_CLASS_IN, DNS_TYPE_A, name));
+        rr->ttl = ttl;
+        rr->a.in_addr.s_addr = htobe32(0x7f000001);
+
+        assert_se(answer = dns_answer_new(1));
+        assert_se(dns_answer_add(answer, rr, 0, DNS_ANSWER_CACHEABLE | (authenticated ? DNS_ANSWER_AUTHENTICATED : 0)) >= 0);
+
+        assert_se(dns_cache_put(c, rr->key, DNS_RCODE_SUCCESS, answer, authenticated, (uint32_t) -1, timestamp, AF_INET, &owner) >= 0);
+}
+
+static void put_at(DnsCache *c, const char *name, uint32_t ttl, usec_t timestamp) {
+        put_full(c, name, ttl, timestamp, false);
+}
+
+static void put(DnsCache *c, const char *name, uint32_t ttl) {
+        put_at(c, name, ttl, 0);
+}
+
+static void put_servfail(DnsCache *c, const char *name) {
+        _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+        union in_addr_union owner = {};
+
+        assert_se(key = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, name));
+        assert_se(dns_cache_put(c, key, DNS_RCODE_SERVFAIL, NULL, false, (uint32_t) -1, 0, AF_INET, &owner) >= 0);
+}
+
+static void put_nxdomain(DnsCache *c, const char *name) {
+        _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *soa = NULL;
+        _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        union in_addr_union owner = {};
+
+        assert_se(soa = dns_resource_record_new_full(DNS_CLASS_IN, DNS_TYPE_SOA, "example.com"));
+        soa->ttl = 3600;
+        assert_se(soa->soa.mname = strdup("ns.example.com"));
+        assert_se(soa->soa.rname = strdup("hostmaster.example.com"));
+        soa->soa.minimum = 3600;
+
+        assert_se(answer = dns_answer_new(1));
+        assert_se(dns_answer_add(answer, soa, 0, DNS_ANSWER_CACHEABLE) >= 0);
+
+        assert_se(key = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, name));
+        assert_se(dns_cache_put(c, key, DNS_RCODE_NXDOMAIN, answer, false, (uint32_t) -1, 0, AF_INET, &owner) >= 0);
+}
+
+static int lookup_full(DnsCache *c, const char *name, uint32_t *ret_ttl, bool *ret_refresh) {
+        _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        bool authenticated, refresh;
+        int r, rcode;
+
+        assert_se(key = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, name));
+
+        r = dns_cache_lookup(c, key, true, &rcode, &answer, &authenticated, &refresh);
+        assert_se(r >= 0);
+        assert_se(r > 0 || !refresh);
+
+        if (r > 0 && ret_ttl)
+                *ret_ttl = answer->items[0].rr->ttl;
+        if (ret_refresh)
+                *ret_refresh = refresh;
+
+        return r;
+}
+
+static int lookup(DnsCache *c, const char *name, uint32_t *ret_ttl) {
+        return lookup_full(c, name, ret_ttl, NULL);
+}
+
+static void test_dns_cache_evict(void) {
+        DnsCache c = {
+                .max_size = (size_t) -1,
+                .max_ttl = DNS_CACHE_MAX_TTL_DEFAULT_USEC,
+        };
+        size_t size;
+
+        log_info("/* %s */", __func__);
+
+        put(&c, "a.example.com", 3600);
+        size = c.size;
+        assert_se(size > 0);
+
+        /* Room for three entries of the same size */
+        c.max_size = 3 * size;
+        put(&c, "b.example.com", 3600);
+        put(&c, "c.example.com", 3600);
+        assert_se(c.size == 3 * size);
+        assert_se(c.n_evicted == 0);
+
+        /* a was used and gets a second chance, hence b goes instead */
+        assert_se(lookup(&c, "a.example.com", NULL) > 0);
+        put(&c, "d.example.com", 3600);
+        assert_se(c.size == 3 * size);
+        assert_se(c.n_evicted == 1);
+
+        assert_se(lookup(&c, "a.example.com", NULL) > 0);
+        assert_se(lookup(&c, "b.example.com", NULL) == 0);
+        assert_se(lookup(&c, "c.example.com", NULL) > 0);
+        assert_se(lookup(&c, "d.example.com", NULL) > 0);
+
+        /* All entries were used now, so the hand goes around once and evicts where it started */
+        put(&c, "e.example.com", 3600);
+        assert_se(c.n_evicted == 2);
+        assert_se(lookup(&c, "c.example.com", NULL) == 0);
+        assert_se(lookup(&c, "a.example.com", NULL) > 0);
+        assert_se(lookup(&c, "d.example.com", NULL) > 0);
+        assert_se(lookup(&c, "e.example.com", NULL) > 0);
+
+        /* Entries that do not fit at all still replace everything else */
+        c.max_size = size / 2;
+        put(&c, "f.example.com", 3600);
+        assert_se(c.size == size);
+        assert_se(lookup(&c, "f.example.com", NULL) > 0);
+
+        dns_cache_flush(&c);
+        assert_se(c.size == 0);
+        assert_se(!c.clock_hand);
+}
+
+static void test_dns_cache_max_ttl(void) {
+        DnsCache c = {
+                .max_size = DNS_CACHE_SIZE_DEFAULT,
+                .max_ttl = 10 * USEC_PER_SEC,
+        };
+        uint32_t ttl = 0;
+
+        log_info("/* %s */", __func__);
+
+        put(&c, "a.example.com", 3600);
+        assert_se(lookup(&c, "a.example.com", &ttl) > 0);
+        assert_se(ttl > 0 && ttl <= 10);
+
+        put(&c, "b.example.com", 5);
+        assert_se(lookup(&c, "b.example.com", &ttl) > 0);
+        assert_se(ttl <= 5);
+
+        dns_cache_flush(&c);
+}
+
+static void test_dns_cache_prefetch(void) {
+        DnsCache c = {
+                .max_size = DNS_CACHE_SIZE_DEFAULT,
+                .max_ttl = DNS_CACHE_MAX_TTL_DEFAULT_USEC,
+                .prefetch = true,
+        };
+        usec_t n = now(clock_boottime_or_monotonic());
+        bool refresh;
+
+        log_info("/* %s */", __func__);
+
+        /* Far from expiry, no matter how popular */
+        put_at(&c, "a.example.com", 100, n - 50 * USEC_PER_SEC);
+        assert_se(lookup_full(&c, "a.example.com", NULL, &refresh) > 0 && !refresh);
+        assert_se(lookup_full(&c, "a.example.com", NULL, &refresh) > 0 && !refresh);
+        assert_se(lookup_full(&c, "a.example.com", NULL, &refresh) > 0 && !refresh);
+        assert_se(lookup_full(&c, "a.example.com", NULL, &refresh) > 0 && !refresh);
+
+        /* Close to expiry, refreshed once it is popular, but only once */
+        put_at(&c, "b.example.com", 100, n - 95 * USEC_PER_SEC);
+        assert_se(lookup_full(&c, "b.example.com", NULL, &refresh) > 0 && !refresh);
+        assert_se(lookup_full(&c, "b.example.com", NULL, &refresh) > 0 && !refresh);
+        assert_se(lookup_full(&c, "b.example.com", NULL, &refresh) > 0 && refresh);
+        assert_se(lookup_full(&c, "b.example.com", NULL, &refresh) > 0 && !refresh);
+
+        /* Not when turned off */
+        c.prefetch = false;
+        put_at(&c, "c.example.com", 100, n - 95 * USEC_PER_SEC);
+        assert_se(lookup_full(&c, "c.example.com", NULL, &refresh) > 0 && !refresh);
+        assert_se(lookup_full(&c, "c.example.com", NULL, &refresh) > 0 && !refresh);
+        assert_se(lookup_full(&c, "c.example.com", NULL, &refresh) > 0 && !refresh);
+
+        dns_cache_flush(&c);
+}
+
+static void test_dns_cache_stale(void) {
+        DnsCache c = {
+                .max_size = DNS_CACHE_SIZE_DEFAULT,
+                .max_ttl = DNS_CACHE_MAX_TTL_DEFAULT_USEC,
+        };
+        usec_t n = now(clock_boottime_or_monotonic());
+        uint32_t ttl = 0;
+        bool refresh;
+
+        log_info("/* %s */", __func__);
+
+        /* Expired entries are not used, unless they may be served stale */
+        put_at(&c, "a.example.com", 60, n - 120 * USEC_PER_SEC);
+        assert_se(lookup(&c, "a.example.com", NULL) == 0);
+        dns_cache_prune(&c);
+        assert_se(dns_cache_is_empty(&c));
+
+        c.stale_retention_usec = USEC_PER_HOUR;
+        put_at(&c, "a.example.com", 60, n - 120 * USEC_PER_SEC);
+        dns_cache_prune(&c);
+        assert_se(lookup_full(&c, "a.example.com", &ttl, &refresh) > 0);
+        assert_se(ttl == 30);
+        assert_se(refresh);
+        assert_se(lookup_full(&c, "a.example.com", &ttl, &refresh) > 0);
+        assert_se(!refresh);
+
+        /* A failure to refresh keeps the stale entry */
+        put_servfail(&c, "a.example.com");
+        assert_se(lookup(&c, "a.example.com", NULL) > 0);
+
+        /* Until it is too old */
+        put_at(&c, "b.example.com", 60, n - USEC_PER_HOUR - 120 * USEC_PER_SEC);
+        dns_cache_prune(&c);
+        assert_se(lookup(&c, "b.example.com", NULL) == 0);
+        assert_se(lookup(&c, "a.example.com", NULL) > 0);
+
+        /* Refreshing replaces it */
+        put(&c, "a.example.com", 3600);
+        assert_se(lookup_full(&c, "a.example.com", &ttl, &refresh) > 0);
+        assert_se(ttl > 30);
+        assert_se(!refresh);
+
+        dns_cache_flush(&c);
+}
+
+static void test_dns_cache_snapshot(void) {
+        DnsCache c = {
+                .max_size = DNS_CACHE_SIZE_DEFAULT,
+                .max_ttl = DNS_CACHE_MAX_TTL_DEFAULT_USEC,
+        }, d = c, e = c;
+        _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        _cleanup_free_ char *buf = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        usec_t n = now(clock_boottime_or_monotonic());
+        bool authenticated, refresh;
+        uint32_t ttl = 0;
+        size_t size = 0;
+        int rcode;
+
+        log_info("/* %s */", __func__);
+
+        put_at(&c, "a.example.com", 3600, n - 600 * USEC_PER_SEC);
+        put_full(&c, "b.example.com", 60, 0, true);
+        put_at(&c, "c.example.com", 60, n - 120 * USEC_PER_SEC);
+        put_nxdomain(&c, "d.example.com");
+        assert_se(dns_cache_size(&c) == 5);
+
+        /* The expired entry is not written, the SOA RR that came with the NXDOMAIN is */
+        assert_se(f = open_memstream(&buf, &size));
+        assert_se(dns_cache_save(&c, f) == 4);
+        assert_se(fflush_and_check(f) >= 0);
+        assert_se(size > 0);
+
+        assert_se(dns_cache_restore(&d, buf, size, 0) == 4);
+        assert_se(lookup(&d, "a.example.com", &ttl) > 0);
+        assert_se(ttl > 2900 && ttl <= 3000);
+        assert_se(lookup(&d, "c.example.com", NULL) == 0);
+
+        assert_se(key = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, "b.example.com"));
+        assert_se(dns_cache_lookup(&d, key, false, &rcode, &answer, &authenticated, &refresh) > 0);
+        assert_se(rcode == DNS_RCODE_SUCCESS);
+        assert_se(authenticated);
+        key = dns_resource_key_unref(key);
+        answer = dns_answer_unref(answer);
+
+        assert_se(key = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, "d.example.com"));
+        assert_se(dns_cache_lookup(&d, key, false, &rcode, &answer, &authenticated, &refresh) > 0);
+        assert_se(rcode == DNS_RCODE_NXDOMAIN);
+        assert_se(!authenticated);
+
+        /* Entries are added only once */
+        assert_se(dns_cache_restore(&d, buf, size, 0) == 0);
+        assert_se(dns_cache_size(&d) == 4);
+
+        /* Entries whose TTL ran out in the meantime are dropped, the others are shortened */
+        assert_se(dns_cache_restore(&e, buf, size, 120 * USEC_PER_SEC) == 3);
+        assert_se(lookup(&e, "a.example.com", &ttl) > 0);
+        assert_se(ttl > 2800 && ttl <= 2880);
+        assert_se(lookup(&e, "b.example.com", NULL) == 0);
+
+        /* Garbage is refused */
+        dns_cache_flush(&e);
+        assert_se(dns_cache_restore(&e, buf, size - 1, 0) == -EBADMSG);
+
+        dns_cache_flush(&c);
+        dns_cache_flush(&d);
+        dns_cache_flush(&e);
+}
+
+int main(int argc, char **argv) {
+
+        log_set_max_level(LOG_DEBUG);
+        log_parse_environment();
+        log_open();
+
+        test_dns_cache_evict();
+        test_dns_cache_max_ttl();
+        test_dns_cache_prefetch();
+        test_dns_cache_stale();
+        test_dns_cache_snapshot();
+
+        return 0;
+}
@@ -6,6 +6,7 @@
 #include "sd-id128.h"
 
 #include "alloc-util.h"
+#include "env-util.h"
 #include "fileio.h"
 #include "glob-util.h"
 #include "log.h"
@@ -15,10 +16,13 @@
 #include "string-util.h"
 #include "strv.h"
 #include "tests.h"
+#include "time-util.h"
 #include "unaligned.h"
 
 #define HASH_KEY SD_ID128_MAKE(d3,1e,48,90,4b,fa,4c,fe,af,9d,d5,a1,d7,2e,8a,b1)
 
+static bool arg_slow = false;
+
 static void verify_rr_copy(DnsResourceRecord *rr) {
         _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *copy = NULL;
         const char *a, *b;
@@ -90,13 +94,84 @@ static void test_packet_from_file(const char* filename, bool canonical) {
         }
 }
 
+static void test_packet_extract_speed(void) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *reply = NULL;
+        _cleanup_(dns_question_unrefp) DnsQuestion *question = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *cname = NULL;
+        _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+        unsigned i, n_packets = arg_slow ? 200000 : 20000;
+        char buf[FORMAT_TIMESPAN_MAX];
+        usec_t ts;
+
+        log_info("/* %s */", __func__);
+
+        /* A typical reply from a CDN: a CNAME, and a number of A RRs, all of which refer to earlier names in the
+         * packet via compression pointers */
+        assert_se(key = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, "www.example.com"));
+        assert_se(question = dns_question_new(1));
+        assert_se(dns_question_add(question, key) >= 0);
+
+        assert_se(answer = dns_answer_new(17));
+        assert_se(cname = dns_resource_record_new_full(DNS_CLASS_IN, DNS_TYPE_CNAME, "www.example.com"));
+        assert_se(cname->cname.name = strdup("www.example.com.cdn.example.net"));
+        cname->ttl = 300;
+        assert_se(dns_answer_add(answer, cname, 0, 0) >= 0);
+
+        for (i = 0; i < 16; i++) {
+                _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+
+                assert_se(rr = dns_resource_record_new_full(DNS_CLASS_IN, DNS_TYPE_A, "www.example.com.cdn.example.net"));
+                rr->a.in_addr.s_addr = htobe32(0xc0000200 + i);
+                rr->ttl = 60;
+                assert_se(dns_answer_add(answer, rr, 0, 0) >= 0);
+        }
+
+        assert_se(dns_packet_new(&reply, DNS_PROTOCOL_DNS, 0, DNS_PACKET_SIZE_MAX) >= 0);
+        DNS_PACKET_HEADER(reply)->flags = htobe16(DNS_PACKET_MAKE_FLAGS(1, 0, 0, 0, 1, 1, 0, 0, DNS_RCODE_SUCCESS));
+        assert_se(dns_packet_append_question(reply, question) >= 0);
+        DNS_PACKET_HEADER(reply)->qdcount = htobe16(dns_question_size(question));
+        assert_se(dns_packet_append_answer(reply, answer) >= 0);
+        DNS_PACKET_HEADER(reply)->ancount = htobe16(dns_answer_size(answer));
+
+        ts = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n_packets; i++) {
+                _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+
+                assert_se(dns_packet_new(&p, DNS_PROTOCOL_DNS, reply->size, DNS_PACKET_SIZE_MAX) >= 0);
+                dns_packet_truncate(p, 0);
+                assert_se(dns_packet_append_blob(p, DNS_PACKET_DATA(reply), reply->size, NULL) >= 0);
+                assert_se(dns_packet_extract(p) >= 0);
+
+                if (i == 0) {
+                        assert_se(dns_question_is_equal(p->question, question) > 0);
+                        assert_se(dns_answer_size(p->answer) == dns_answer_size(answer));
+                        assert_se(dns_answer_contains_rr(p->answer, cname, NULL) > 0);
+                        assert_se(dns_answer_contains_rr(p->answer, answer->items[16].rr, NULL) > 0);
+                }
+        }
+
+        ts = now(CLOCK_MONOTONIC) - ts;
+
+        log_info("Extracting %u packets of %zu bytes with %zu RRs took %s, %llu packets/s",
+                 n_packets, reply->size, dns_answer_size(answer),
+                 format_timespan(buf, sizeof(buf), ts, 1),
+                 (unsigned long long) (n_packets * USEC_PER_SEC / MAX(ts, (usec_t) 1)));
+}
+
 int main(int argc, char **argv) {
-        int i, N;
+        int i, N, r;
         _cleanup_globfree_ glob_t g = {};
         char **fnames;
 
         log_parse_environment();
 
+        r = getenv_bool("SYSTEMD_SLOW_TESTS");
+        arg_slow = r >= 0 ? r : SYSTEMD_SLOW_TESTS_DEFAULT;
+
+        test_packet_extract_speed();
+
         if (argc >= 2) {
                 N = argc - 1;
                 fnames = argv + 1;
@@ -369,6 +369,25 @@ static void test_dnssec_verify_rrset(void) {
         /* Validate the RR as it if was 2015-12-2 today */
         assert_se(dnssec_verify_rrset(answer, a->key, rrsig, dnskey, 1449092754*USEC_PER_SEC, &result) >= 0);
         assert_se(result == DNSSEC_VALIDATED);
+
+        /* Once more, now the signature is known to be valid already */
+        assert_se(dnssec_verify_rrset(answer, a->key, rrsig, dnskey, 1449092754*USEC_PER_SEC, &result) >= 0);
+        assert_se(result == DNSSEC_VALIDATED);
+
+        /* A modified RR must not validate with the same signature, even though it was found valid before */
+        answer = dns_answer_unref(answer);
+        a = dns_resource_record_unref(a);
+
+        a = dns_resource_record_new_full(DNS_CLASS_IN, DNS_TYPE_A, "nAsA.gov");
+        assert_se(a);
+        a->a.in_addr.s_addr = inet_addr("52.0.14.117");
+
+        answer = dns_answer_new(1);
+        assert_se(answer);
+        assert_se(dns_answer_add(answer, a, 0, DNS_ANSWER_AUTHENTICATED) >= 0);
+
+        assert_se(dnssec_verify_rrset(answer, a->key, rrsig, dnskey, 1449092754*USEC_PER_SEC, &result) >= 0);
+        assert_se(result == DNSSEC_INVALID);
 }
 
 static void test_dnssec_verify_rrset2(void) {
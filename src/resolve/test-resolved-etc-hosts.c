@@ -0,0 +1,220 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdio.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "log.h"
+#include "resolved-etc-hosts.h"
+#include "string-util.h"
+
+static const char etc_hosts[] =
+        "1.2.3.4 some.where\n"
+        "1.2.3.5 some.where other.where  # a comment\n"
+        "\t::1  localhost  six.where\n"
+        "fe80::1 six.where\n"
+        "# 1.2.3.6 commented.out\n"
+        "1.2.3.4 some.where\n"
+        "\n"
+        "0.0.0.0 blocked.where ads.blocked.where\n"
+        ":: blocked.where\n"
+        "1.2.3.4.5 bad.address\n"
+        "1.2.3.7\n"
+        "1.2.3.8 dot.where.\n"
+        "127.0.0.1 localhost\n"
+        "1.2.3.9 Mixed.Case\n";
+
+static int lookup(EtcHosts *hosts, DnsQuestion *q, DnsAnswer **ret) {
+        *ret = dns_answer_unref(*ret);
+
+        return etc_hosts_lookup(hosts, q, ret);
+}
+
+static void test_lookup(EtcHosts *hosts) {
+        _cleanup_(dns_question_unrefp) DnsQuestion *q = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *a = NULL;
+        union in_addr_union u;
+
+        assert_se(dns_question_new_address(&q, AF_UNSPEC, "some.where", false) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 2);
+        assert_se(a->items[0].rr->key->type == DNS_TYPE_A);
+        assert_se(be32toh(a->items[0].rr->a.in_addr.s_addr) == 0x01020304);
+        assert_se(be32toh(a->items[1].rr->a.in_addr.s_addr) == 0x01020305);
+        q = dns_question_unref(q);
+
+        /* Names are case-insensitive, and may have a trailing dot */
+        assert_se(dns_question_new_address(&q, AF_INET, "OTHER.where.", false) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 1);
+        assert_se(be32toh(a->items[0].rr->a.in_addr.s_addr) == 0x01020305);
+        q = dns_question_unref(q);
+
+        assert_se(dns_question_new_address(&q, AF_INET, "dot.where", false) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 1);
+        q = dns_question_unref(q);
+
+        assert_se(dns_question_new_address(&q, AF_INET, "mixed.case", false) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 1);
+        assert_se(streq(dns_resource_key_name(a->items[0].rr->key), "Mixed.Case"));
+        q = dns_question_unref(q);
+
+        /* Only the addresses of the requested family are returned */
+        assert_se(dns_question_new_address(&q, AF_INET6, "six.where", false) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 2);
+        assert_se(a->items[0].rr->key->type == DNS_TYPE_AAAA);
+        q = dns_question_unref(q);
+
+        assert_se(dns_question_new_address(&q, AF_INET, "six.where", false) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 0);
+        q = dns_question_unref(q);
+
+        /* Names mapped to 0.0.0.0 or :: exist, but have no addresses */
+        assert_se(dns_question_new_address(&q, AF_UNSPEC, "ads.blocked.where", false) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 0);
+        q = dns_question_unref(q);
+
+        assert_se(dns_question_new_address(&q, AF_UNSPEC, "blocked.where", false) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 0);
+        q = dns_question_unref(q);
+
+        /* Comments, localhost, and broken lines are ignored */
+        assert_se(dns_question_new_address(&q, AF_UNSPEC, "commented.out", false) >= 0);
+        assert_se(lookup(hosts, q, &a) == 0);
+        q = dns_question_unref(q);
+
+        assert_se(dns_question_new_address(&q, AF_UNSPEC, "localhost", false) >= 0);
+        assert_se(lookup(hosts, q, &a) == 0);
+        q = dns_question_unref(q);
+
+        assert_se(dns_question_new_address(&q, AF_UNSPEC, "bad.address", false) >= 0);
+        assert_se(lookup(hosts, q, &a) == 0);
+        q = dns_question_unref(q);
+
+        assert_se(dns_question_new_address(&q, AF_UNSPEC, "nowhere", false) >= 0);
+        assert_se(lookup(hosts, q, &a) == 0);
+        q = dns_question_unref(q);
+
+        /* Reverse lookups */
+        assert_se(in_addr_from_string(AF_INET, "1.2.3.5", &u) >= 0);
+        assert_se(dns_question_new_reverse(&q, AF_INET, &u) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 2);
+        assert_se(a->items[0].rr->key->type == DNS_TYPE_PTR);
+        assert_se(streq(a->items[0].rr->ptr.name, "some.where"));
+        assert_se(streq(a->items[1].rr->ptr.name, "other.where"));
+        q = dns_question_unref(q);
+
+        assert_se(in_addr_from_string(AF_INET6, "::1", &u) >= 0);
+        assert_se(dns_question_new_reverse(&q, AF_INET6, &u) >= 0);
+        assert_se(lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 1);
+        assert_se(streq(a->items[0].rr->ptr.name, "six.where"));
+        q = dns_question_unref(q);
+
+        assert_se(in_addr_from_string(AF_INET, "1.2.3.6", &u) >= 0);
+        assert_se(dns_question_new_reverse(&q, AF_INET, &u) >= 0);
+        assert_se(lookup(hosts, q, &a) == 0);
+}
+
+static void test_parse_one(unsigned n_lines, unsigned n_calls_expected) {
+        _cleanup_(etc_hosts_freep) EtcHosts *hosts = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        unsigned line = 0, n_calls = 0;
+        int r;
+
+        assert_se(f = fmemopen((void*) etc_hosts, strlen(etc_hosts), "re"));
+        assert_se(etc_hosts_new(&hosts) >= 0);
+
+        do {
+                assert_se((r = etc_hosts_parse(hosts, f, &line, n_lines)) >= 0);
+                n_calls++;
+        } while (r == 0);
+
+        assert_se(line == 14);
+        assert_se(n_calls == n_calls_expected);
+
+        test_lookup(hosts);
+}
+
+static void test_parse(void) {
+        log_info("/* %s */", __func__);
+
+        /* Read the whole file at once, and in small steps */
+        test_parse_one(UINT_MAX, 1);
+        test_parse_one(2, 8);
+}
+
+static void test_parse_many(void) {
+        _cleanup_(etc_hosts_freep) EtcHosts *hosts = NULL;
+        _cleanup_(dns_question_unrefp) DnsQuestion *q = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *a = NULL;
+        _cleanup_free_ char *buf = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        size_t size = 0;
+        unsigned i, line = 0;
+        union in_addr_union u;
+
+        log_info("/* %s */", __func__);
+
+        /* Make sure the hash tables grow */
+        assert_se(f = open_memstream(&buf, &size));
+        for (i = 0; i < 2000; i++)
+                fprintf(f, "%s %u.example.com\n", i % 2 == 0 ? "0.0.0.0" : "10.0.0.1", i);
+        fprintf(f, "10.0.0.2 last.example.com\n");
+        assert_se(fflush_and_check(f) >= 0);
+        f = safe_fclose(f);
+
+        assert_se(f = fmemopen(buf, size, "re"));
+        assert_se(etc_hosts_new(&hosts) >= 0);
+        assert_se(etc_hosts_parse(hosts, f, &line, UINT_MAX) == 1);
+        assert_se(line == 2001);
+
+        assert_se(dns_question_new_address(&q, AF_INET, "1998.example.com", false) >= 0);
+        assert_se(etc_hosts_lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 0);
+        q = dns_question_unref(q);
+        a = dns_answer_unref(a);
+
+        assert_se(dns_question_new_address(&q, AF_INET, "1999.example.com", false) >= 0);
+        assert_se(etc_hosts_lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 1);
+        q = dns_question_unref(q);
+        a = dns_answer_unref(a);
+
+        assert_se(dns_question_new_address(&q, AF_INET, "2000.example.com", false) >= 0);
+        assert_se(etc_hosts_lookup(hosts, q, &a) == 0);
+        q = dns_question_unref(q);
+
+        assert_se(in_addr_from_string(AF_INET, "10.0.0.1", &u) >= 0);
+        assert_se(dns_question_new_reverse(&q, AF_INET, &u) >= 0);
+        assert_se(etc_hosts_lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 1000);
+        q = dns_question_unref(q);
+        a = dns_answer_unref(a);
+
+        assert_se(in_addr_from_string(AF_INET, "10.0.0.2", &u) >= 0);
+        assert_se(dns_question_new_reverse(&q, AF_INET, &u) >= 0);
+        assert_se(etc_hosts_lookup(hosts, q, &a) > 0);
+        assert_se(dns_answer_size(a) == 1);
+        assert_se(streq(a->items[0].rr->ptr.name, "last.example.com"));
+}
+
+int main(int argc, char **argv) {
+
+        log_set_max_level(LOG_DEBUG);
+        log_parse_environment();
+        log_open();
+
+        test_parse();
+        test_parse_many();
+
+        return 0;
+}
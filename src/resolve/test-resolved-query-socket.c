@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "alloc-util.h"
+#include "dns-domain.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "log.h"
+#include "resolved-dns-answer.h"
+#include "resolved-dns-question.h"
+#include "resolved-dns-rr.h"
+#include "resolved-etc-hosts.h"
+#include "resolved-manager.h"
+#include "resolved-query-socket.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "strv.h"
+
+/* The client side, to check what resolved sends against what nss-resolve actually parses */
+#include "../nss-resolve/nss-resolve.c"
+
+#define FLAGS SD_RESOLVED_FLAGS_MAKE(DNS_PROTOCOL_DNS, AF_INET, true)
+
+static uint8_t *memdup_exact(const uint8_t *p, size_t size) {
+        uint8_t *q;
+
+        /* A copy of exactly the given size, so that reading past the end of a truncated reply is caught */
+        assert_se(q = malloc(MAX(size, 1U)));
+        memcpy_safe(q, p, size);
+        return q;
+}
+
+static void add_address(DnsAnswer **answer, const char *name, int family, const char *address, int ifindex) {
+        _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+        union in_addr_union a;
+
+        assert_se(in_addr_from_string(family, address, &a) >= 0);
+        assert_se(dns_resource_record_new_address(&rr, family, &a, name) >= 0);
+        assert_se(dns_answer_add_extend(answer, rr, ifindex, DNS_ANSWER_CACHEABLE) >= 0);
+}
+
+static void add_ptr(DnsAnswer **answer, const char *name, const char *target, int ifindex) {
+        _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+
+        assert_se(rr = dns_resource_record_new_full(DNS_CLASS_IN, DNS_TYPE_PTR, name));
+        assert_se(rr->ptr.name = strdup(target));
+        assert_se(dns_answer_add_extend(answer, rr, ifindex, DNS_ANSWER_CACHEABLE) >= 0);
+}
+
+static void set_reply_header(uint8_t *buf, uint8_t status, int32_t error, uint16_t n_items) {
+        ResolvedQueryReply h;
+
+        memcpy(&h, buf, sizeof(h));
+        h.status = status;
+        h.error = error;
+        h.n_items = n_items;
+        memcpy(buf, &h, sizeof(h));
+}
+
+static enum nss_status check_reply(const uint8_t *buf, int *ret_errno) {
+        ResolvedQueryReply h;
+        int h_error = 0;
+
+        *ret_errno = 0;
+        return query_socket_reply_check(buf, &h, ret_errno, &h_error);
+}
+
+static void test_hostname_reply(void) {
+        _cleanup_(dns_question_unrefp) DnsQuestion *question = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        _cleanup_free_ ResolvedAddress *addresses = NULL;
+        _cleanup_free_ uint8_t *buf = NULL;
+        _cleanup_free_ char *canonical = NULL;
+        ResolvedQueryReply h;
+        unsigned n;
+        size_t size, l, items_end;
+        int error;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(dns_question_new_address(&question, AF_UNSPEC, "example.com", false) >= 0);
+
+        /* Only the addresses of the name asked for are returned, in order, and the spelling of the first one */
+        add_address(&answer, "Example.COM", AF_INET, "192.168.1.1", 2);
+        add_address(&answer, "other.example.com", AF_INET, "192.168.1.2", 2);
+        add_address(&answer, "example.com", AF_INET6, "fe80::1", 3);
+        add_address(&answer, "example.com", AF_INET, "10.0.0.1", 0);
+
+        assert_se(query_socket_hostname_reply(4711, question, answer, NULL, FLAGS, &buf, &size) >= 0);
+        assert_se(size <= SD_RESOLVED_QUERY_MESSAGE_MAX);
+
+        memcpy(&h, buf, sizeof(h));
+        assert_se(h.id == 4711);
+        assert_se(h.flags == FLAGS);
+        assert_se(h.n_items == 3);
+        assert_se(check_reply(buf, &error) == NSS_STATUS_SUCCESS);
+
+        assert_se(query_socket_parse_hostname_reply(buf, size, &addresses, &n, &canonical) >= 0);
+        assert_se(n == 3);
+        assert_se(streq(canonical, "Example.COM"));
+        assert_se(addresses[0].family == AF_INET && addresses[0].ifindex == 2);
+        assert_se(be32toh(addresses[0].address.in.s_addr) == 0xc0a80101);
+        assert_se(addresses[1].family == AF_INET6 && addresses[1].ifindex == 3);
+        assert_se(IN6_IS_ADDR_LINKLOCAL(&addresses[1].address.in6));
+        assert_se(addresses[2].family == AF_INET && addresses[2].ifindex == 0);
+        assert_se(be32toh(addresses[2].address.in.s_addr) == 0x0a000001);
+        addresses = mfree(addresses);
+        canonical = mfree(canonical);
+
+        /* Cut anywhere in the addresses, the reply is invalid. The canonical name takes up the rest of the reply,
+         * hence cutting it only shortens it. */
+        items_end = sizeof(h) + 3 * sizeof(ResolvedQueryAddress);
+        for (l = sizeof(h); l < size; l++) {
+                _cleanup_free_ uint8_t *t = NULL;
+                int r;
+
+                t = memdup_exact(buf, l);
+                r = query_socket_parse_hostname_reply(t, l, &addresses, &n, &canonical);
+                if (l < items_end)
+                        assert_se(r == -EBADMSG);
+                else {
+                        assert_se(r >= 0);
+                        assert_se(n == 3);
+                        assert_se(strlen(canonical) == l - items_end);
+                        addresses = mfree(addresses);
+                        canonical = mfree(canonical);
+                }
+        }
+
+        /* More items than there is room for */
+        set_reply_header(buf, SD_RESOLVED_QUERY_SUCCESS, 0, 4);
+        assert_se(query_socket_parse_hostname_reply(buf, size, &addresses, &n, &canonical) == -EBADMSG);
+        set_reply_header(buf, SD_RESOLVED_QUERY_SUCCESS, 0, UINT16_MAX);
+        assert_se(query_socket_parse_hostname_reply(buf, size, &addresses, &n, &canonical) == -EBADMSG);
+
+        /* A NUL byte in the canonical name */
+        set_reply_header(buf, SD_RESOLVED_QUERY_SUCCESS, 0, 3);
+        buf[size - 3] = 0;
+        assert_se(query_socket_parse_hostname_reply(buf, size, &addresses, &n, &canonical) == -EBADMSG);
+        buf[size - 3] = 'C';
+
+        /* Addresses of unknown families are skipped, negative interface indexes are refused */
+        {
+                ResolvedQueryAddress a;
+
+                memcpy(&a, buf + sizeof(h), sizeof(a));
+                a.family = AF_UNIX;
+                memcpy(buf + sizeof(h), &a, sizeof(a));
+                assert_se(query_socket_parse_hostname_reply(buf, size, &addresses, &n, &canonical) >= 0);
+                assert_se(n == 2);
+                assert_se(addresses[0].family == AF_INET6);
+                addresses = mfree(addresses);
+                canonical = mfree(canonical);
+
+                a.family = AF_INET;
+                a.ifindex = -1;
+                memcpy(buf + sizeof(h), &a, sizeof(a));
+                assert_se(query_socket_parse_hostname_reply(buf, size, &addresses, &n, &canonical) == -EBADMSG);
+        }
+
+        /* Nothing to return */
+        buf = mfree(buf);
+        answer = dns_answer_unref(answer);
+        add_address(&answer, "other.example.com", AF_INET, "192.168.1.2", 2);
+        assert_se(query_socket_hostname_reply(1, question, answer, NULL, FLAGS, &buf, &size) == -ENOENT);
+}
+
+static void test_address_reply(void) {
+        _cleanup_(dns_question_unrefp) DnsQuestion *question = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        _cleanup_strv_free_ char **names = NULL;
+        _cleanup_free_ uint8_t *buf = NULL;
+        union in_addr_union a;
+        ResolvedQueryReply h;
+        ResolvedQueryName name;
+        size_t size, l;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(in_addr_from_string(AF_INET, "192.168.1.1", &a) >= 0);
+        assert_se(dns_question_new_reverse(&question, AF_INET, &a) >= 0);
+
+        add_ptr(&answer, "1.1.168.192.in-addr.arpa", "foo.example.com", 1);
+        add_ptr(&answer, "2.1.168.192.in-addr.arpa", "other.example.com", 1);
+        add_ptr(&answer, "1.1.168.192.in-addr.arpa", "bar\\.baz.example.com", 2);
+
+        assert_se(query_socket_address_reply(42, question, answer, FLAGS, &buf, &size) >= 0);
+
+        memcpy(&h, buf, sizeof(h));
+        assert_se(h.id == 42);
+        assert_se(h.n_items == 2);
+
+        assert_se(query_socket_parse_address_reply(buf, size, &names) >= 0);
+        assert_se(strv_equal(names, STRV_MAKE("foo.example.com", "bar\\.baz.example.com")));
+        names = strv_free(names);
+
+        /* The names are counted, hence any truncation is noticed */
+        for (l = sizeof(h); l < size; l++) {
+                _cleanup_free_ uint8_t *t = NULL;
+
+                t = memdup_exact(buf, l);
+                assert_se(query_socket_parse_address_reply(t, l, &names) == -EBADMSG);
+        }
+
+        /* A name longer than the rest of the reply, or with a NUL byte */
+        memcpy(&name, buf + sizeof(h), sizeof(name));
+        name.length = UINT16_MAX;
+        memcpy(buf + sizeof(h), &name, sizeof(name));
+        assert_se(query_socket_parse_address_reply(buf, size, &names) == -EBADMSG);
+
+        name.length = strlen("foo.example.com");
+        memcpy(buf + sizeof(h), &name, sizeof(name));
+        buf[sizeof(h) + sizeof(name) + 3] = 0;
+        assert_se(query_socket_parse_address_reply(buf, size, &names) == -EBADMSG);
+        buf[sizeof(h) + sizeof(name) + 3] = '.';
+
+        name.ifindex = -1;
+        memcpy(buf + sizeof(h), &name, sizeof(name));
+        assert_se(query_socket_parse_address_reply(buf, size, &names) == -EBADMSG);
+}
+
+static void test_reply_max(void) {
+        _cleanup_(dns_question_unrefp) DnsQuestion *question = NULL, *reverse = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL, *ptrs = NULL;
+        _cleanup_free_ ResolvedAddress *addresses = NULL;
+        _cleanup_strv_free_ char **names = NULL;
+        _cleanup_free_ uint8_t *buf = NULL;
+        _cleanup_free_ char *canonical = NULL;
+        union in_addr_union a;
+        ResolvedQueryReply h;
+        unsigned i, n;
+        size_t size;
+
+        log_info("/* %s */", __func__);
+
+        /* More addresses than fit, the reply is cut after the last one that does, and the canonical name is kept */
+        assert_se(dns_question_new_address(&question, AF_INET, "example.com", false) >= 0);
+        for (i = 0; i < 4000; i++) {
+                char address[INET_ADDRSTRLEN];
+
+                xsprintf(address, "10.0.%u.%u", i / 256, i % 256);
+                add_address(&answer, "example.com", AF_INET, address, 1);
+        }
+
+        assert_se(query_socket_hostname_reply(1, question, answer, NULL, FLAGS, &buf, &size) >= 0);
+        assert_se(size <= SD_RESOLVED_QUERY_MESSAGE_MAX);
+        memcpy(&h, buf, sizeof(h));
+        assert_se(h.n_items > 0 && h.n_items < 4000);
+
+        assert_se(query_socket_parse_hostname_reply(buf, size, &addresses, &n, &canonical) >= 0);
+        assert_se(n == h.n_items);
+        assert_se(streq(canonical, "example.com"));
+        for (i = 0; i < n; i++)
+                assert_se(be32toh(addresses[i].address.in.s_addr) == (0x0a000000U | i));
+        buf = mfree(buf);
+
+        /* Same for names, each of which is about 250 bytes long */
+        assert_se(in_addr_from_string(AF_INET, "10.0.0.1", &a) >= 0);
+        assert_se(dns_question_new_reverse(&reverse, AF_INET, &a) >= 0);
+        for (i = 0; i < 400; i++) {
+                char target[DNS_HOSTNAME_MAX + 1], *p;
+                unsigned k;
+
+                p = target;
+                for (k = 0; k < 4; k++) {
+                        memset(p, 'a' + k, 60);
+                        p[60] = '.';
+                        p += 61;
+                }
+                assert_se(snprintf(p, target + sizeof(target) - p, "%u", i) > 0);
+
+                add_ptr(&ptrs, "1.0.0.10.in-addr.arpa", target, 1);
+        }
+
+        assert_se(query_socket_address_reply(1, reverse, ptrs, FLAGS, &buf, &size) >= 0);
+        assert_se(size <= SD_RESOLVED_QUERY_MESSAGE_MAX);
+        assert_se(size > SD_RESOLVED_QUERY_MESSAGE_MAX - sizeof(ResolvedQueryName) - DNS_HOSTNAME_MAX);
+        memcpy(&h, buf, sizeof(h));
+        assert_se(h.n_items > 0 && h.n_items < 400);
+
+        assert_se(query_socket_parse_address_reply(buf, size, &names) >= 0);
+        assert_se(strv_length(names) == h.n_items);
+        for (i = 0; i < h.n_items; i++) {
+                char suffix[DECIMAL_STR_MAX(unsigned) + 1];
+
+                xsprintf(suffix, ".%u", i);
+                assert_se(endswith(names[i], suffix));
+        }
+}
+
+static void test_reply_status(void) {
+        _cleanup_free_ uint8_t *buf = NULL;
+        ResolvedQueryReply h = {};
+        int error;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(buf = memdup_exact((const uint8_t*) &h, sizeof(h)));
+
+        set_reply_header(buf, SD_RESOLVED_QUERY_NXDOMAIN, ENXIO, 0);
+        assert_se(check_reply(buf, &error) == NSS_STATUS_NOTFOUND);
+        assert_se(error == ESRCH);
+
+        set_reply_header(buf, SD_RESOLVED_QUERY_FAILED, ETIMEDOUT, 0);
+        assert_se(check_reply(buf, &error) == NSS_STATUS_NOTFOUND);
+        assert_se(error == ETIMEDOUT);
+
+        /* A failure without an error is still a failure */
+        set_reply_header(buf, SD_RESOLVED_QUERY_FAILED, 0, 0);
+        assert_se(check_reply(buf, &error) == NSS_STATUS_NOTFOUND);
+        assert_se(error == EIO);
+
+        set_reply_header(buf, 77, 0, 0);
+        assert_se(check_reply(buf, &error) == NSS_STATUS_UNAVAIL);
+        assert_se(error == EBADMSG);
+}
+
+/* Hands one end of a socket pair to the manager, as if it had been accepted on the query socket, and returns the
+ * other one */
+static int connect_manager(Manager *m) {
+        int fds[2];
+
+        assert_se(socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, fds) >= 0);
+        assert_se(fd_nonblock(fds[0], true) >= 0);
+        assert_se(manager_query_socket_add_connection(m, fds[0]) >= 0);
+
+        return fds[1];
+}
+
+static void run_until_readable(Manager *m, int fd) {
+        usec_t until = now(CLOCK_MONOTONIC) + 10 * USEC_PER_SEC;
+
+        /* Readable includes the end of the connection */
+        while (fd_wait_for_event(fd, POLLIN, 0) == 0) {
+                assert_se(now(CLOCK_MONOTONIC) < until);
+                assert_se(sd_event_run(m->event, 100 * USEC_PER_MSEC) >= 0);
+        }
+}
+
+static int call_raw(Manager *m, const void *request, size_t request_size, uint8_t **ret, size_t *ret_size) {
+        _cleanup_close_ int fd = -1;
+        ResolvedQueryRequest req;
+
+        assert_se(request_size >= sizeof(req));
+        memcpy(&req, request, sizeof(req));
+
+        fd = connect_manager(m);
+        assert_se(send(fd, request, request_size, MSG_NOSIGNAL) == (ssize_t) request_size);
+        run_until_readable(m, fd);
+
+        return query_socket_receive_reply(fd, req.id, ret, ret_size);
+}
+
+static int call(Manager *m, uint8_t type, int family, const void *data, size_t size, uint8_t **ret, size_t *ret_size) {
+        _cleanup_close_ int fd = -1;
+        uint32_t id;
+
+        fd = connect_manager(m);
+        assert_se(query_socket_send_request(fd, type, family, data, size, &id) > 0);
+        run_until_readable(m, fd);
+
+        return query_socket_receive_reply(fd, id, ret, ret_size);
+}
+
+static void assert_call_fails(Manager *m, const ResolvedQueryRequest *req, const void *data, size_t size, int error) {
+        _cleanup_free_ uint8_t *request = NULL, *buf = NULL;
+        size_t l;
+        int e;
+
+        assert_se(request = malloc(sizeof(*req) + size));
+        memcpy(request, req, sizeof(*req));
+        memcpy_safe(request + sizeof(*req), data, size);
+
+        assert_se(call_raw(m, request, sizeof(*req) + size, &buf, &l) > 0);
+        assert_se(check_reply(buf, &e) == NSS_STATUS_NOTFOUND);
+        assert_se(e == error);
+}
+
+static void test_connection(void) {
+        _cleanup_free_ ResolvedAddress *addresses = NULL;
+        _cleanup_strv_free_ char **names = NULL;
+        _cleanup_free_ uint8_t *buf = NULL, *big = NULL;
+        _cleanup_free_ char *canonical = NULL;
+        ResolvedQueryRequest req = {
+                .id = 7,
+                .type = SD_RESOLVED_QUERY_HOSTNAME,
+                .family = AF_UNSPEC,
+        };
+        int fds[QUERY_SOCKET_CONNECTIONS_MAX], fd, e;
+        union in_addr_union a;
+        Manager m = {
+                .query_socket_fd = -1,
+        };
+        unsigned i, n;
+        size_t size;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_event_default(&m.event) >= 0);
+
+        /* Addresses are parsed right away */
+        assert_se(call(&m, SD_RESOLVED_QUERY_HOSTNAME, AF_UNSPEC, "192.168.1.1", strlen("192.168.1.1"), &buf, &size) > 0);
+        assert_se(check_reply(buf, &e) == NSS_STATUS_SUCCESS);
+        assert_se(query_socket_parse_hostname_reply(buf, size, &addresses, &n, &canonical) >= 0);
+        assert_se(n == 1 && addresses[0].family == AF_INET);
+        assert_se(streq(canonical, "192.168.1.1"));
+        addresses = mfree(addresses);
+        canonical = mfree(canonical);
+        buf = mfree(buf);
+
+        /* Without any scopes, localhost is still synthesized, or found in /etc/hosts, in both directions */
+        assert_se(call(&m, SD_RESOLVED_QUERY_HOSTNAME, AF_INET, "localhost", strlen("localhost"), &buf, &size) > 0);
+        assert_se(check_reply(buf, &e) == NSS_STATUS_SUCCESS);
+        assert_se(query_socket_parse_hostname_reply(buf, size, &addresses, &n, &canonical) >= 0);
+        assert_se(n == 1 && addresses[0].family == AF_INET);
+        assert_se(be32toh(addresses[0].address.in.s_addr) == INADDR_LOOPBACK);
+        assert_se(streq(canonical, "localhost"));
+        buf = mfree(buf);
+
+        a.in.s_addr = htobe32(INADDR_LOOPBACK);
+        assert_se(call(&m, SD_RESOLVED_QUERY_ADDRESS, AF_INET, &a.in, sizeof(a.in), &buf, &size) > 0);
+        assert_se(check_reply(buf, &e) == NSS_STATUS_SUCCESS);
+        assert_se(query_socket_parse_address_reply(buf, size, &names) >= 0);
+        assert_se(!strv_isempty(names));
+        buf = mfree(buf);
+
+        /* ... anything else fails like it does on the bus */
+        assert_se(call(&m, SD_RESOLVED_QUERY_HOSTNAME, AF_INET, "example.com", strlen("example.com"), &buf, &size) > 0);
+        assert_se(check_reply(buf, &e) == NSS_STATUS_NOTFOUND);
+        assert_se(e == ESRCH);
+        buf = mfree(buf);
+
+        /* Invalid requests */
+        assert_call_fails(&m, &req, "example.com", 0, EINVAL);
+        assert_call_fails(&m, &req, "exa\0mple.com", strlen("exa") + 1 + strlen("mple.com"), EINVAL);
+        assert_call_fails(&m, &req, "example..com", strlen("example..com"), EINVAL);
+
+        req.family = AF_UNIX;
+        assert_call_fails(&m, &req, "example.com", strlen("example.com"), EINVAL);
+        req.family = AF_INET;
+        req.ifindex = -1;
+        assert_call_fails(&m, &req, "example.com", strlen("example.com"), EINVAL);
+        req.ifindex = 0;
+        req.flags = SD_RESOLVED_AUTHENTICATED;
+        assert_call_fails(&m, &req, "example.com", strlen("example.com"), EINVAL);
+        req.flags = 0;
+
+        req.type = SD_RESOLVED_QUERY_ADDRESS;
+        assert_call_fails(&m, &req, &a.in, sizeof(a.in) - 1, EINVAL);
+        req.family = AF_UNSPEC;
+        assert_call_fails(&m, &req, &a.in, sizeof(a.in), EINVAL);
+        req.family = AF_INET;
+        req.flags = SD_RESOLVED_NO_SEARCH;
+        assert_call_fails(&m, &req, &a.in, sizeof(a.in), EINVAL);
+        req.flags = 0;
+
+        req.type = 77;
+        assert_call_fails(&m, &req, &a.in, sizeof(a.in), EOPNOTSUPP);
+        req.type = SD_RESOLVED_QUERY_HOSTNAME;
+
+        /* Oversized requests are refused explicitly, so that the client doesn't try the bus with them */
+        assert_se(big = malloc(SD_RESOLVED_QUERY_HOSTNAME_MAX + 1));
+        memset(big, 'a', SD_RESOLVED_QUERY_HOSTNAME_MAX + 1);
+        assert_call_fails(&m, &req, big, SD_RESOLVED_QUERY_HOSTNAME_MAX + 1, EMSGSIZE);
+
+        /* Requests too short to answer are dropped, the client uses the bus then */
+        fd = connect_manager(&m);
+        assert_se(send(fd, &req, sizeof(req) - 1, MSG_NOSIGNAL) == sizeof(req) - 1);
+        run_until_readable(&m, fd);
+        assert_se(query_socket_receive_reply(fd, req.id, &buf, &size) == 0);
+        fd = safe_close(fd);
+
+        /* So are connections which don't send anything in time */
+        fd = connect_manager(&m);
+        assert_se(set_size(m.query_socket_connections) == 1);
+        run_until_readable(&m, fd);
+        assert_se(query_socket_receive_reply(fd, req.id, &buf, &size) == 0);
+        assert_se(set_size(m.query_socket_connections) == 0);
+        fd = safe_close(fd);
+
+        /* ... and the ones beyond the limit */
+        for (i = 0; i < ELEMENTSOF(fds); i++)
+                fds[i] = connect_manager(&m);
+
+        {
+                int pair[2];
+
+                assert_se(socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, pair) >= 0);
+                assert_se(manager_query_socket_add_connection(&m, pair[0]) == -EBUSY);
+                assert_se(query_socket_receive_reply(pair[1], req.id, &buf, &size) == 0);
+                safe_close(pair[1]);
+        }
+
+        manager_query_socket_stop(&m);
+        for (i = 0; i < ELEMENTSOF(fds); i++) {
+                assert_se(query_socket_receive_reply(fds[i], req.id, &buf, &size) == 0);
+                safe_close(fds[i]);
+        }
+
+        /* Without the socket, the bus is used */
+        assert_se(query_socket_call("/dev/null/query", SD_RESOLVED_QUERY_HOSTNAME, AF_UNSPEC,
+                                    "example.com", strlen("example.com"), &buf, &size) == 0);
+
+        manager_etc_hosts_flush(&m);
+        sd_event_unref(m.event);
+}
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_DEBUG);
+        log_parse_environment();
+        log_open();
+
+        test_hostname_reply();
+        test_address_reply();
+        test_reply_max();
+        test_reply_status();
+        test_connection();
+
+        return 0;
+}
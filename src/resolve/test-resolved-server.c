@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <netinet/in.h>
+
+#include "fd-util.h"
+#include "log.h"
+#include "resolved-dns-packet.h"
+#include "resolved-dns-server.h"
+#include "resolved-manager.h"
+
+static void test_dns_server_resend_timeout(void) {
+        union in_addr_union a = { .in.s_addr = htobe32(0x7f000001) };
+        Manager m = {};
+        DnsServerFeatureLevel level = DNS_SERVER_FEATURE_LEVEL_EDNS0;
+        DnsServer *s;
+        unsigned i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_event_default(&m.event) >= 0);
+        assert_se(dns_server_new(&m, &s, DNS_SERVER_SYSTEM, NULL, AF_INET, &a, 0) >= 0);
+
+        /* Nothing known yet, use the maximum */
+        assert_se(s->srtt == USEC_INFINITY);
+        assert_se(s->resend_timeout == 5 * USEC_PER_SEC);
+
+        /* Replies we cannot attribute to a query don't count */
+        dns_server_packet_received(s, IPPROTO_UDP, level, 512, USEC_INFINITY);
+        assert_se(s->srtt == USEC_INFINITY);
+
+        /* The first sample sets the variation to half of it */
+        dns_server_packet_received(s, IPPROTO_UDP, level, 512, 200 * USEC_PER_MSEC);
+        assert_se(s->srtt == 200 * USEC_PER_MSEC);
+        assert_se(s->rttvar == 100 * USEC_PER_MSEC);
+        assert_se(s->resend_timeout == 600 * USEC_PER_MSEC);
+
+        dns_server_packet_received(s, IPPROTO_UDP, level, 512, 600 * USEC_PER_MSEC);
+        assert_se(s->srtt == 250 * USEC_PER_MSEC);
+        assert_se(s->rttvar == 175 * USEC_PER_MSEC);
+        assert_se(s->resend_timeout == 950 * USEC_PER_MSEC);
+
+        /* TCP replies don't tell us anything about UDP */
+        dns_server_packet_received(s, IPPROTO_TCP, level, 512, 3 * USEC_PER_SEC);
+        assert_se(s->srtt == 250 * USEC_PER_MSEC);
+
+        /* A fast and steady server ends up at the minimum */
+        for (i = 0; i < 32; i++)
+                dns_server_packet_received(s, IPPROTO_UDP, level, 512, 2 * USEC_PER_MSEC);
+        assert_se(s->srtt < 10 * USEC_PER_MSEC);
+        assert_se(s->resend_timeout == 500 * USEC_PER_MSEC);
+
+        /* Losses back off exponentially, up to the maximum */
+        dns_server_packet_lost(s, IPPROTO_UDP, level);
+        assert_se(s->resend_timeout == 1 * USEC_PER_SEC);
+        dns_server_packet_lost(s, IPPROTO_UDP, level);
+        dns_server_packet_lost(s, IPPROTO_UDP, level);
+        assert_se(s->resend_timeout == 4 * USEC_PER_SEC);
+        dns_server_packet_lost(s, IPPROTO_UDP, level);
+        assert_se(s->resend_timeout == 5 * USEC_PER_SEC);
+
+        /* ... and the next reply brings it back */
+        dns_server_packet_received(s, IPPROTO_UDP, level, 512, 2 * USEC_PER_MSEC);
+        assert_se(s->resend_timeout == 500 * USEC_PER_MSEC);
+
+        dns_server_unlink_all(m.dns_servers);
+        assert_se(!m.dns_servers);
+
+        sd_event_unref(m.event);
+}
+
+static void test_manager_response_time(void) {
+        Manager m = {};
+
+        log_info("/* %s */", __func__);
+
+        manager_response_time(&m, 0);
+        manager_response_time(&m, 10 * USEC_PER_MSEC - 1);
+        manager_response_time(&m, 10 * USEC_PER_MSEC);
+        manager_response_time(&m, 5 * USEC_PER_SEC);
+        manager_response_time(&m, USEC_INFINITY - 1);
+
+        assert_se(m.n_response_time[0] == 2);
+        assert_se(m.n_response_time[1] == 1);
+        assert_se(m.n_response_time[MANAGER_RESPONSE_TIME_BUCKETS - 1] == 2);
+}
+
+static void test_manager_recv_many(void) {
+        union sockaddr_union sa = {
+                .in.sin_family = AF_INET,
+                .in.sin_addr.s_addr = htobe32(INADDR_LOOPBACK),
+        };
+        socklen_t salen = sizeof(sa.in);
+        _cleanup_close_ int fd = -1, client = -1;
+        DnsPacket *packets[MANAGER_RECV_BATCH_MAX];
+        DnsPacketHeader h = {};
+        Manager m = {};
+        int n, i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se((fd = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0)) >= 0);
+        assert_se(bind(fd, &sa.sa, salen) >= 0);
+        assert_se(getsockname(fd, &sa.sa, &salen) >= 0);
+        assert_se((client = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0)) >= 0);
+
+        /* All datagrams read by one call are returned, not just the first one */
+        for (i = 0; i < 3; i++) {
+                h.id = htobe16(i);
+                assert_se(sendto(client, &h, sizeof(h), 0, &sa.sa, salen) == sizeof(h));
+        }
+
+        n = manager_recv_many(&m, fd, DNS_PROTOCOL_DNS, packets, ELEMENTSOF(packets));
+        assert_se(n == 3);
+
+        for (i = 0; i < n; i++) {
+                assert_se(DNS_PACKET_ID(packets[i]) == htobe16(i));
+                dns_packet_unref(packets[i]);
+        }
+
+        assert_se(manager_recv_many(&m, fd, DNS_PROTOCOL_DNS, packets, ELEMENTSOF(packets)) == 0);
+
+        free(m.recv_batch);
+}
+
+int main(int argc, char **argv) {
+
+        log_set_max_level(LOG_DEBUG);
+        log_parse_environment();
+        log_open();
+
+        test_dns_server_resend_timeout();
+        test_manager_response_time();
+        test_manager_recv_many();
+
+        return 0;
+}
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "fd-util.h"
+#include "io-util.h"
+#include "log.h"
+#include "resolved-dns-packet.h"
+#include "resolved-dns-stream.h"
+#include "resolved-manager.h"
+#include "socket-util.h"
+
+#define N_QUERIES 16U
+
+static uint16_t received[N_QUERIES];
+static unsigned n_received = 0;
+
+/* A stand-in for a DNS server on TCP: reads all queries first, then replies to them in reverse order with a single
+ * write, so that the client sees the replies out of order and back to back */
+static void *tcp_dns_server(void *p) {
+        _cleanup_close_ int fd = -1;
+        uint8_t queries[N_QUERIES][2 + DNS_PACKET_HEADER_SIZE];
+        uint8_t replies[sizeof(queries)];
+        unsigned i;
+
+        assert_se((fd = accept4(PTR_TO_INT(p), NULL, NULL, SOCK_CLOEXEC)) >= 0);
+
+        for (i = 0; i < N_QUERIES; i++) {
+                assert_se(loop_read_exact(fd, queries[i], sizeof(queries[i]), false) >= 0);
+                assert_se(be16toh(*(be16_t*) queries[i]) == DNS_PACKET_HEADER_SIZE);
+        }
+
+        for (i = 0; i < N_QUERIES; i++) {
+                uint8_t *reply = replies + i * sizeof(queries[0]);
+
+                memcpy(reply, queries[N_QUERIES - 1 - i], sizeof(queries[0]));
+                ((DnsPacketHeader*) (reply + 2))->flags = htobe16(DNS_PACKET_MAKE_FLAGS(1, 0, 0, 0, 1, 1, 0, 0, DNS_RCODE_SUCCESS));
+        }
+
+        assert_se(loop_write(fd, replies, sizeof(replies), false) >= 0);
+
+        return NULL;
+}
+
+static int on_stream_packet(DnsStream *s) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+
+        p = TAKE_PTR(s->read_packet);
+        s->n_read = 0;
+
+        assert_se(DNS_PACKET_QR(p));
+        assert_se(n_received < N_QUERIES);
+        received[n_received++] = be16toh(DNS_PACKET_ID(p));
+
+        if (n_received == N_QUERIES)
+                assert_se(sd_event_exit(s->manager->event, 0) >= 0);
+
+        return 0;
+}
+
+static int on_stream_complete(DnsStream *s, int error) {
+        /* The server closes the connection after the last reply, which we might read in one go with the replies.
+         * The stream is ours, hence don't let the default completion action drop it. */
+        assert_se(IN_SET(error, 0, ECONNRESET));
+
+        return 0;
+}
+
+static void test_dns_stream_pipelining(void) {
+        _cleanup_close_ int listen_fd = -1, fd = -1;
+        _cleanup_(dns_stream_unrefp) DnsStream *s = NULL;
+        union sockaddr_union sa = {
+                .in.sin_family = AF_INET,
+                .in.sin_addr.s_addr = htobe32(INADDR_LOOPBACK),
+        };
+        socklen_t salen = sizeof(sa.in);
+        Manager m = {};
+        pthread_t server;
+        unsigned i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se((listen_fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0)) >= 0);
+        assert_se(bind(listen_fd, &sa.sa, salen) >= 0);
+        assert_se(getsockname(listen_fd, &sa.sa, &salen) >= 0);
+        assert_se(listen(listen_fd, 1) >= 0);
+
+        assert_se(pthread_create(&server, NULL, tcp_dns_server, INT_TO_PTR(listen_fd)) == 0);
+
+        assert_se(sd_event_default(&m.event) >= 0);
+
+        assert_se((fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0)) >= 0);
+        assert_se(connect(fd, &sa.sa, salen) >= 0 || errno == EINPROGRESS);
+
+        assert_se(dns_stream_new(&m, &s, DNS_PROTOCOL_DNS, fd, NULL) >= 0);
+        fd = -1;
+        s->on_packet = on_stream_packet;
+        s->complete = on_stream_complete;
+
+        /* Queue all queries at once, they are all sent without waiting for replies */
+        for (i = 0; i < N_QUERIES; i++) {
+                _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+
+                assert_se(dns_packet_new_query(&p, DNS_PROTOCOL_DNS, 0, false) >= 0);
+                DNS_PACKET_HEADER(p)->id = htobe16(i + 1);
+                assert_se(dns_stream_write_packet(s, p) >= 0);
+        }
+
+        assert_se(sd_event_loop(m.event) >= 0);
+        assert_se(pthread_join(server, NULL) == 0);
+
+        assert_se(n_received == N_QUERIES);
+        for (i = 0; i < N_QUERIES; i++)
+                assert_se(received[i] == N_QUERIES - i);
+
+        s = dns_stream_unref(s);
+        assert_se(!m.dns_streams);
+        assert_se(m.n_dns_streams == 0);
+
+        sd_event_unref(m.event);
+}
+
+int main(int argc, char **argv) {
+
+        log_set_max_level(LOG_DEBUG);
+        log_parse_environment();
+        log_open();
+
+        test_dns_stream_pipelining();
+
+        return 0;
+}
@@ -0,0 +1,270 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "log.h"
+#include "process-util.h"
+#include "socket-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "udev-helper.h"
+
+int udev_helper_send_request(int fd, char **argv, char **envp, int fd_stdout, int fd_stderr) {
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(int) * 2)];
+        } control = {};
+        const int fds[2] = { fd_stdout, fd_stderr };
+        _cleanup_free_ char *buf = NULL;
+        size_t size = sizeof(UdevHelperRequest);
+        struct iovec iov;
+        struct msghdr mh = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+        struct cmsghdr *cmsg;
+        char **s, *p;
+
+        assert(fd >= 0);
+        assert(!strv_isempty(argv));
+        assert(fd_stdout >= 0);
+        assert(fd_stderr >= 0);
+
+        STRV_FOREACH(s, argv)
+                size += strlen(*s) + 1;
+        STRV_FOREACH(s, envp)
+                size += strlen(*s) + 1;
+        if (size > UDEV_HELPER_REQUEST_MAX)
+                return -E2BIG;
+
+        buf = malloc(size);
+        if (!buf)
+                return -ENOMEM;
+
+        *(UdevHelperRequest *) buf = (UdevHelperRequest) {
+                .n_argv = strv_length(argv),
+                .n_envp = strv_length(envp),
+        };
+
+        p = buf + sizeof(UdevHelperRequest);
+        STRV_FOREACH(s, argv)
+                p = stpcpy(p, *s) + 1;
+        STRV_FOREACH(s, envp)
+                p = stpcpy(p, *s) + 1;
+
+        iov = IOVEC_MAKE(buf, size);
+
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        if (sendmsg(fd, &mh, MSG_NOSIGNAL) < 0)
+                return -errno;
+
+        return 0;
+}
+
+int udev_helper_receive_reply(int fd, int *ret_code, int *ret_status) {
+        UdevHelperReply reply;
+        ssize_t n;
+
+        assert(fd >= 0);
+        assert(ret_code);
+        assert(ret_status);
+
+        n = recv(fd, &reply, sizeof(reply), MSG_DONTWAIT);
+        if (n < 0)
+                return -errno;
+        if (n == 0)
+                return -ECONNRESET;
+        if (n != sizeof(reply))
+                return -EBADMSG;
+
+        *ret_code = reply.code;
+        *ret_status = reply.status;
+
+        return 0;
+}
+
+/* Returns 0 when the other side went away, 1 if the request was handled */
+static int helper_handle_request(int fd, char *buf, udev_helper_run_t run) {
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(int) * 2)];
+        } control = {};
+        struct iovec iov = IOVEC_INIT(buf, UDEV_HELPER_REQUEST_MAX);
+        struct msghdr mh = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+        _cleanup_close_pair_ int fds[2] = { -1, -1 };
+        _cleanup_free_ char **argv = NULL, **envp = NULL;
+        UdevHelperRequest req;
+        UdevHelperReply reply;
+        struct cmsghdr *cmsg;
+        siginfo_t si = {};
+        char *p, *e;
+        ssize_t n;
+        size_t i;
+        pid_t pid;
+        int r;
+
+        n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+                if (errno == EINTR)
+                        return 1;
+
+                return log_error_errno(errno, "Failed to receive request: %m");
+        }
+        if (n == 0)
+                return 0;
+
+        cmsg = cmsg_find(&mh, SOL_SOCKET, SCM_RIGHTS, CMSG_LEN(sizeof(fds)));
+        if (!cmsg) {
+                cmsg_close_all(&mh);
+                return log_error_errno(EBADMSG, "Received request without file descriptors.");
+        }
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+        if ((size_t) n < sizeof(req) || (mh.msg_flags & (MSG_TRUNC|MSG_CTRUNC)))
+                return log_error_errno(EBADMSG, "Received truncated request.");
+
+        memcpy(&req, buf, sizeof(req));
+        if (req.n_argv == 0 || req.n_argv > (size_t) n || req.n_envp > (size_t) n)
+                return log_error_errno(EBADMSG, "Received request with invalid number of arguments.");
+
+        argv = new(char*, req.n_argv + 1);
+        envp = new(char*, req.n_envp + 1);
+        if (!argv || !envp)
+                return log_oom();
+
+        p = buf + sizeof(req);
+        e = buf + n;
+        for (i = 0; i < req.n_argv + req.n_envp; i++) {
+                char *z;
+
+                z = memchr(p, 0, e - p);
+                if (!z)
+                        return log_error_errno(EBADMSG, "Received request with unterminated string.");
+
+                if (i < req.n_argv)
+                        argv[i] = p;
+                else
+                        envp[i - req.n_argv] = p;
+
+                p = z + 1;
+        }
+        argv[req.n_argv] = NULL;
+        envp[req.n_envp] = NULL;
+
+        r = safe_fork("(udev-helper)", FORK_RESET_SIGNALS|FORK_DEATHSIG|FORK_LOG, &pid);
+        if (r < 0)
+                return r;
+        if (r == 0) {
+                /* Child */
+                fd = safe_close(fd);
+
+                /* The worker kills the helper with SIGKILL when a command times out, which must take the command
+                 * down as well, whether it handles SIGTERM or not */
+                if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0)
+                        _exit(EXIT_FAILURE);
+
+                if (rearrange_stdio(-1, fds[0], fds[1]) < 0)
+                        _exit(EXIT_FAILURE);
+
+                environ = envp;
+
+                exit(run(req.n_argv, argv));
+        }
+
+        /* The caller reads the output until the pipes are closed, so do not keep them open while waiting */
+        fds[0] = safe_close(fds[0]);
+        fds[1] = safe_close(fds[1]);
+
+        r = wait_for_terminate(pid, &si);
+        if (r < 0)
+                return log_error_errno(r, "Failed to wait for child: %m");
+
+        reply = (UdevHelperReply) {
+                .code = si.si_code,
+                .status = si.si_status,
+        };
+
+        if (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) < 0) {
+                if (errno == EPIPE)
+                        return 0;
+
+                return log_error_errno(errno, "Failed to send reply: %m");
+        }
+
+        return 1;
+}
+
+int udev_helper_serve(int fd, udev_helper_run_t run) {
+        _cleanup_free_ char *buf = NULL;
+        int r;
+
+        assert(fd >= 0);
+        assert(run);
+
+        buf = malloc(UDEV_HELPER_REQUEST_MAX);
+        if (!buf)
+                return log_oom();
+
+        /* Tell the worker that we speak the protocol */
+        if (send(fd, &(UdevHelperReply) {}, sizeof(UdevHelperReply), MSG_NOSIGNAL) < 0)
+                return log_error_errno(errno, "Failed to send greeting: %m");
+
+        do
+                r = helper_handle_request(fd, buf, run);
+        while (r > 0);
+
+        return r;
+}
+
+int udev_helper_main(int argc, char *argv[], udev_helper_run_t run) {
+        _cleanup_close_ int fd = -1;
+        int r;
+
+        assert(run);
+
+        if (argc != 2 || !streq(argv[1], UDEV_HELPER_ARG))
+                return run(argc, argv);
+
+        log_set_target(LOG_TARGET_AUTO);
+        log_parse_environment();
+        log_open();
+
+        /* Move the socket out of the way, the children get their stdio from the requests */
+        fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+        if (fd < 0) {
+                log_error_errno(errno, "Failed to duplicate socket: %m");
+                return EXIT_FAILURE;
+        }
+
+        r = make_null_stdio();
+        if (r < 0) {
+                log_error_errno(r, "Failed to connect stdio to /dev/null: %m");
+                return EXIT_FAILURE;
+        }
+
+        r = udev_helper_serve(fd, run);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
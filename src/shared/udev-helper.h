@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Persistent helpers: programs shipped with udev that a udev worker may start once and then send requests over a
+ * socket, instead of executing them for every event. A request carries the command line, the environment and the
+ * file descriptors to use as stdout and stderr of one invocation. The helper forks off a child which runs the
+ * program's main function for the request, and replies with how the child terminated.
+ *
+ * A helper is started with UDEV_HELPER_ARG as its only argument and the socket as stdin. It sends an empty reply
+ * first, to tell that it speaks the protocol.
+ */
+
+#define UDEV_HELPER_ARG "--udev-helper"
+
+/* The environment of a udev event is limited to 4k, and the command line to a path */
+#define UDEV_HELPER_REQUEST_MAX (16U * 1024U)
+
+typedef struct UdevHelperRequest {
+        uint32_t n_argv;
+        uint32_t n_envp;
+        /* followed by n_argv + n_envp NUL-terminated strings */
+} UdevHelperRequest;
+
+typedef struct UdevHelperReply {
+        /* as si_code and si_status of the siginfo_t of the child */
+        int32_t code;
+        int32_t status;
+} UdevHelperReply;
+
+typedef int (*udev_helper_run_t)(int argc, char *argv[]);
+
+int udev_helper_send_request(int fd, char **argv, char **envp, int fd_stdout, int fd_stderr);
+int udev_helper_receive_reply(int fd, int *ret_code, int *ret_status);
+
+int udev_helper_serve(int fd, udev_helper_run_t run);
+int udev_helper_main(int argc, char *argv[], udev_helper_run_t run);
+
+#define DEFINE_UDEV_HELPER_MAIN(run)                                    \
+        int main(int argc, char *argv[]) {                              \
+                return udev_helper_main(argc, argv, run);               \
+        }
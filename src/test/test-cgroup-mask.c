@@ -92,6 +92,21 @@ static int test_cgroup_mask(void) {
         assert_se(unit_get_target_mask(parent) == ((CGROUP_MASK_CPU | CGROUP_MASK_CPUACCT | CGROUP_MASK_IO | CGROUP_MASK_BLKIO | CGROUP_MASK_MEMORY) & m->cgroup_supported));
         assert_se(unit_get_target_mask(root) == ((CGROUP_MASK_CPU | CGROUP_MASK_CPUACCT | CGROUP_MASK_IO | CGROUP_MASK_BLKIO | CGROUP_MASK_MEMORY) & m->cgroup_supported));
 
+        /* Verify bookkeeping of written attribute values. */
+        assert_se(unit_remember_cgroup_attribute(son, "cpu/cpu.weight", "100\n") >= 0);
+        assert_se(unit_remember_cgroup_attribute(son, "cpu/cpu.weight", "200\n") >= 0);
+        assert_se(unit_remember_cgroup_attribute(son, "io/io.weight:8:0", "8:0 50\n") >= 0);
+        assert_se(unit_remember_cgroup_attribute(son, "memory/memory.max", "max") >= 0);
+        assert_se(hashmap_size(son->cgroup_attributes) == 3);
+        assert_se(streq(hashmap_get(son->cgroup_attributes, "cpu/cpu.weight"), "200\n"));
+        unit_forget_cgroup_attributes(son, CGROUP_MASK_IO | CGROUP_MASK_PIDS);
+        assert_se(hashmap_size(son->cgroup_attributes) == 2);
+        assert_se(!hashmap_get(son->cgroup_attributes, "io/io.weight:8:0"));
+        unit_forget_cgroup_attribute(son, "memory/memory.max");
+        assert_se(hashmap_size(son->cgroup_attributes) == 1);
+        unit_forget_cgroup_attributes(son, _CGROUP_MASK_ALL);
+        assert_se(hashmap_isempty(son->cgroup_attributes));
+
         return 0;
 }
 
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <sched.h>
+#include <stdio.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sd-device.h"
+
+#include "alloc-util.h"
+#include "device-enumerator-private.h"
+#include "device-util.h"
+#include "env-util.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "log.h"
+#include "mkdir.h"
+#include "rm-rf.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "time-util.h"
+
+static bool arg_slow = false;
+
+static void make_device(const char *root, unsigned i, unsigned j) {
+        _cleanup_free_ char *name = NULL, *dev = NULL, *link = NULL, *target = NULL, *subsystem = NULL;
+        bool md = j % 7 == 0;
+
+        /* Every seventh device looks like an md device, so that the ordering has something to do */
+        assert_se(asprintf(&name, "%s%u", md ? "block/md" : "dev", j) >= 0);
+        assert_se(asprintf(&dev, "%s/devices/virtual/test%u/%s", root, i, name) >= 0);
+        assert_se(asprintf(&link, "%s/class/test%u/%s", root, i, basename(name)) >= 0);
+        assert_se(asprintf(&target, "../../devices/virtual/test%u/%s", i, name) >= 0);
+        assert_se(asprintf(&subsystem, "%s../../../../class/test%u", md ? "../" : "", i) >= 0);
+
+        assert_se(mkdir_p(dev, 0755) >= 0);
+        assert_se(write_string_file(strjoina(dev, "/uevent"), "", WRITE_STRING_FILE_CREATE) >= 0);
+        assert_se(symlink(subsystem, strjoina(dev, "/subsystem")) >= 0);
+        assert_se(symlink(target, link) >= 0);
+}
+
+/* Creates a sysfs lookalike with a number of classes and devices below /sys/devices/virtual, and mounts it over
+ * /sys in a new mount namespace */
+static int setup_fake_sysfs(char **ret, unsigned n_classes, unsigned n_devices) {
+        _cleanup_(rm_rf_physical_and_freep) char *root = NULL;
+        char template[] = "/tmp/test-device-enumerator.XXXXXX";
+        unsigned i, j;
+
+        if (geteuid() != 0)
+                return log_notice_errno(EPERM, "Not running as root, cannot mount a fake sysfs.");
+
+        assert_se(mkdtemp(template));
+        assert_se(root = strdup(template));
+
+        assert_se(mkdir_p(strjoina(root, "/bus"), 0755) >= 0);
+
+        for (i = 0; i < n_classes; i++) {
+                _cleanup_free_ char *class = NULL;
+
+                assert_se(asprintf(&class, "%s/class/test%u", root, i) >= 0);
+                assert_se(mkdir_p(class, 0755) >= 0);
+
+                for (j = 0; j < n_devices; j++)
+                        make_device(root, i, j);
+        }
+
+        if (unshare(CLONE_NEWNS) < 0)
+                return log_notice_errno(errno, "Failed to create mount namespace: %m");
+
+        assert_se(mount(NULL, "/", NULL, MS_PRIVATE|MS_REC, NULL) >= 0);
+
+        if (mount(root, "/sys", NULL, MS_BIND, NULL) < 0)
+                return log_notice_errno(errno, "Failed to mount fake sysfs: %m");
+
+        *ret = TAKE_PTR(root);
+        return 0;
+}
+
+static char **enumerate(unsigned n_threads, usec_t *ret_duration) {
+        _cleanup_(sd_device_enumerator_unrefp) sd_device_enumerator *e = NULL;
+        size_t n = 0, allocated = 0;
+        char **l = NULL;
+        sd_device *d;
+        usec_t ts;
+
+        assert_se(sd_device_enumerator_new(&e) >= 0);
+        assert_se(device_enumerator_set_n_threads(e, n_threads) >= 0);
+
+        ts = now(CLOCK_MONOTONIC);
+
+        FOREACH_DEVICE(e, d) {
+                const char *devpath;
+
+                assert_se(sd_device_get_devpath(d, &devpath) >= 0);
+                assert_se(GREEDY_REALLOC(l, allocated, n + 2));
+                assert_se(l[n++] = strdup(devpath));
+                l[n] = NULL;
+        }
+
+        *ret_duration = now(CLOCK_MONOTONIC) - ts;
+
+        return l;
+}
+
+static void test_enumerate_threads(void) {
+        _cleanup_(rm_rf_physical_and_freep) char *root = NULL;
+        _cleanup_strv_free_ char **serial = NULL;
+        unsigned n_classes = arg_slow ? 200 : 40, n_devices = arg_slow ? 200 : 25;
+        static const unsigned threads[] = { 0, 2, 4, 8 };
+        char buf[FORMAT_TIMESPAN_MAX];
+        usec_t duration;
+        unsigned i;
+
+        log_info("/* %s */", __func__);
+
+        if (setup_fake_sysfs(&root, n_classes, n_devices) < 0) {
+                log_notice("Skipping %s", __func__);
+                return;
+        }
+
+        serial = enumerate(1, &duration);
+        assert_se(strv_length(serial) == n_classes * n_devices);
+        log_info("Enumerating %u devices with 1 thread took %s",
+                 strv_length(serial), format_timespan(buf, sizeof(buf), duration, 1));
+
+        /* md devices are delayed to the end */
+        assert_se(strstr(serial[strv_length(serial) - 1], "/block/md"));
+        assert_se(!strstr(serial[0], "/block/md"));
+
+        for (i = 0; i < ELEMENTSOF(threads); i++) {
+                _cleanup_strv_free_ char **l = NULL;
+
+                l = enumerate(threads[i], &duration);
+                assert_se(strv_equal(serial, l));
+
+                log_info("Enumerating %u devices with %u threads took %s",
+                         strv_length(l), threads[i], format_timespan(buf, sizeof(buf), duration, 1));
+        }
+}
+
+int main(int argc, char *argv[]) {
+        int r;
+
+        log_set_max_level(LOG_INFO);
+        log_parse_environment();
+        log_open();
+
+        r = getenv_bool("SYSTEMD_SLOW_TESTS");
+        arg_slow = r >= 0 ? r : SYSTEMD_SLOW_TESTS_DEFAULT;
+
+        test_enumerate_threads();
+
+        return 0;
+}
@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sd-device.h"
+
+#include "alloc-util.h"
+#include "device-index.h"
+#include "device-internal.h"
+#include "device-private.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "log.h"
+#include "rm-rf.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+
+static sd_device *make_device(const char *devpath, const char *subsystem, const char *major, const char *minor) {
+        _cleanup_strv_free_ char **l = NULL;
+        sd_device *device;
+
+        assert_se(l = strv_new("ACTION=add", "SEQNUM=1", NULL));
+        assert_se(strv_extendf(&l, "DEVPATH=%s", devpath) >= 0);
+        assert_se(strv_extendf(&l, "SUBSYSTEM=%s", subsystem) >= 0);
+        if (major) {
+                assert_se(strv_extendf(&l, "MAJOR=%s", major) >= 0);
+                assert_se(strv_extendf(&l, "MINOR=%s", minor) >= 0);
+        }
+
+        assert_se(device_new_from_strv(&device, l) >= 0);
+        return device;
+}
+
+static void test_index(void) {
+        _cleanup_(rm_rf_physical_and_freep) char *dir = NULL;
+        _cleanup_(sd_device_unrefp) sd_device *a = NULL, *b = NULL, *c = NULL, *loaded = NULL;
+        _cleanup_(device_index_freep) DeviceIndex *index = NULL;
+        const DeviceIndexEntry *e;
+        _cleanup_close_ int fd = -1;
+        const char *path, *value;
+        struct stat st;
+        off_t size;
+        unsigned n;
+        Iterator i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(mkdtemp_malloc("/tmp/test-device-index-XXXXXX", &dir) >= 0);
+        path = strjoina(dir, "/index");
+
+        a = make_device("/devices/virtual/mem/null", "mem", "1", "3");
+        b = make_device("/devices/virtual/net/test0", "net", NULL, NULL);
+        c = make_device("/devices/virtual/tty/tty9", "tty", "4", "9");
+
+        assert_se(device_add_tag(a, "uaccess") >= 0);
+        assert_se(device_add_tag(a, "systemd") >= 0);
+        assert_se(device_add_property(a, "FOO", "bar") >= 0);
+        assert_se(device_add_devlink(a, "/dev/nullish") >= 0);
+        assert_se(device_add_tag(c, "systemd") >= 0);
+
+        /* Nothing is written as long as there is no index */
+        assert_se(device_index_update(path, a) >= 0);
+        assert_se(access(path, F_OK) < 0 && errno == ENOENT);
+        assert_se(device_index_open(path, &index) == -ENOENT);
+
+        /* An index built from an empty database */
+        assert_se(device_index_rebuild(path, "/nonexistent") >= 0);
+        assert_se(device_index_open(path, &index) >= 0);
+        assert_se(device_index_size(index) == 0);
+        index = device_index_free(index);
+
+        assert_se(device_index_update(path, a) >= 0);
+        assert_se(device_index_update(path, b) >= 0);
+        assert_se(device_index_update(path, c) >= 0);
+        assert_se(device_index_remove(path, b) >= 0);
+        assert_se(device_add_property(c, "BAZ", "1") >= 0);
+        assert_se(device_index_update(path, c) >= 0);
+
+        assert_se(device_index_open(path, &index) >= 0);
+        assert_se(device_index_size(index) == 2);
+        assert_se(!device_index_get(index, "+net:test0"));
+
+        assert_se(e = device_index_get(index, "c1:3"));
+        assert_se(streq(e->devpath, "/devices/virtual/mem/null"));
+        assert_se(streq(e->subsystem, "mem"));
+        assert_se(device_index_entry_has_tag(e, "uaccess"));
+        assert_se(device_index_entry_has_tag(e, "systemd"));
+        assert_se(!device_index_entry_has_tag(e, "seat"));
+
+        /* The entries load like a database file */
+        assert_se(device_new_aux(&loaded) >= 0);
+        assert_se(device_set_syspath(loaded, "/sys/devices/virtual/mem/null", false) >= 0);
+        assert_se(device_read_db_nulstr(loaded, e->db, e->db_size) >= 0);
+        assert_se(sd_device_has_tag(loaded, "uaccess") > 0);
+        assert_se(sd_device_get_property_value(loaded, "FOO", &value) >= 0);
+        assert_se(streq(value, "bar"));
+        assert_se(streq(sd_device_get_devlink_first(loaded), "/dev/nullish"));
+
+        /* Only the latest record of a device counts */
+        assert_se(e = device_index_get(index, "c4:9"));
+        assert_se(device_index_entry_has_tag(e, "systemd"));
+        assert_se(memmem(e->db, e->db_size, "EBAZ=1", STRLEN("EBAZ=1") + 1));
+
+        n = 0;
+        i = ITERATOR_FIRST;
+        while (device_index_iterate(index, &i, &e))
+                n++;
+        assert_se(n == 2);
+        index = device_index_free(index);
+
+        /* A record which is still being written is ignored */
+        assert_se(stat(path, &st) >= 0);
+        size = st.st_size;
+        assert_se((fd = open(path, O_WRONLY|O_APPEND|O_CLOEXEC)) >= 0);
+        assert_se(write(fd, &(uint32_t[]) { 64, 0 }, 2 * sizeof(uint32_t)) == 2 * sizeof(uint32_t));
+        fd = safe_close(fd);
+        assert_se(device_index_open(path, &index) >= 0);
+        assert_se(device_index_size(index) == 2);
+        index = device_index_free(index);
+
+        /* Compaction keeps the latest records only */
+        assert_se(device_index_compact(path) >= 0);
+        assert_se(stat(path, &st) >= 0);
+        assert_se(st.st_size < size);
+        assert_se(device_index_open(path, &index) >= 0);
+        assert_se(device_index_size(index) == 2);
+        assert_se(e = device_index_get(index, "c4:9"));
+        assert_se(memmem(e->db, e->db_size, "EBAZ=1", STRLEN("EBAZ=1") + 1));
+        index = device_index_free(index);
+
+        /* Not an index at all */
+        assert_se(write_string_file(path, "garbage", WRITE_STRING_FILE_CREATE) >= 0);
+        assert_se(device_index_open(path, &index) == -EBADMSG);
+}
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_DEBUG);
+        log_parse_environment();
+        log_open();
+
+        test_index();
+
+        return 0;
+}
@@ -5,11 +5,93 @@
 #include <string.h>
 
 #include "bus-util.h"
+#include "env-util.h"
 #include "manager.h"
 #include "rm-rf.h"
+#include "stdio-util.h"
+#include "target.h"
 #include "test-helper.h"
 #include "tests.h"
 
+static void test_large_transaction(Manager *m) {
+        _cleanup_free_ Unit **units = NULL;
+        char buf[FORMAT_TIMESPAN_MAX];
+        Unit *hub;
+        unsigned i, n;
+        usec_t ts;
+        Job *j;
+        int r;
+
+        /* Lots of units pulled in by one target, ordered in one long chain which is closed into a cycle. The
+         * transaction has to break the cycle by dropping one of the (non-essential) jobs. */
+
+        r = getenv_bool("SYSTEMD_SLOW_TESTS");
+        n = (r >= 0 ? r : SYSTEMD_SLOW_TESTS_DEFAULT) ? 20000 : 500;
+
+        assert_se(units = new(Unit*, n));
+        assert_se(unit_new_for_name(m, sizeof(Target), "large.target", &hub) >= 0);
+        hub->load_state = UNIT_LOADED;
+
+        for (i = 0; i < n; i++) {
+                char name[STRLEN("large-.target") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(name, "large-%u.target", i);
+                assert_se(unit_new_for_name(m, sizeof(Target), name, &units[i]) >= 0);
+                units[i]->load_state = UNIT_LOADED;
+
+                assert_se(unit_add_two_dependencies(hub, UNIT_AFTER, UNIT_WANTS, units[i], true, UNIT_DEPENDENCY_FILE) >= 0);
+                if (i > 0)
+                        assert_se(unit_add_dependency(units[i], UNIT_AFTER, units[i - 1], true, UNIT_DEPENDENCY_FILE) >= 0);
+        }
+
+        assert_se(unit_add_dependency(units[0], UNIT_AFTER, units[n - 1], true, UNIT_DEPENDENCY_FILE) >= 0);
+
+        ts = now(CLOCK_MONOTONIC);
+        assert_se(manager_add_job(m, JOB_START, hub, JOB_REPLACE, NULL, &j) == 0);
+        log_info("Start transaction of %u units with an ordering cycle took %s",
+                 n + 1, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - ts, 1));
+
+        /* Exactly one job got dropped to break the cycle */
+        assert_se(hashmap_size(m->jobs) == n);
+
+        manager_clear_jobs(m);
+}
+
+static Unit* test_new_target(Manager *m, const char *name) {
+        Unit *u;
+
+        assert_se(unit_new_for_name(m, sizeof(Target), name, &u) >= 0);
+        u->load_state = UNIT_LOADED;
+
+        return u;
+}
+
+static void test_mixed_cycles(Manager *m) {
+        Unit *hub, *w1, *w2, *r1, *r2;
+
+        /* One ordering cycle between wanted units, which could be broken, and one between required units, which
+         * can't. The transaction has to fail as a whole. */
+
+        hub = test_new_target(m, "mixed.target");
+        w1 = test_new_target(m, "mixed-wanted-1.target");
+        w2 = test_new_target(m, "mixed-wanted-2.target");
+        r1 = test_new_target(m, "mixed-required-1.target");
+        r2 = test_new_target(m, "mixed-required-2.target");
+
+        assert_se(unit_add_dependency(hub, UNIT_WANTS, w1, true, UNIT_DEPENDENCY_FILE) >= 0);
+        assert_se(unit_add_dependency(hub, UNIT_WANTS, w2, true, UNIT_DEPENDENCY_FILE) >= 0);
+        assert_se(unit_add_dependency(w1, UNIT_AFTER, w2, true, UNIT_DEPENDENCY_FILE) >= 0);
+        assert_se(unit_add_dependency(w2, UNIT_AFTER, w1, true, UNIT_DEPENDENCY_FILE) >= 0);
+
+        assert_se(unit_add_dependency(hub, UNIT_REQUIRES, r1, true, UNIT_DEPENDENCY_FILE) >= 0);
+        assert_se(unit_add_dependency(hub, UNIT_REQUIRES, r2, true, UNIT_DEPENDENCY_FILE) >= 0);
+        assert_se(unit_add_dependency(r1, UNIT_AFTER, r2, true, UNIT_DEPENDENCY_FILE) >= 0);
+        assert_se(unit_add_dependency(r2, UNIT_AFTER, r1, true, UNIT_DEPENDENCY_FILE) >= 0);
+
+        assert_se(manager_add_job(m, JOB_START, hub, JOB_REPLACE, NULL, NULL) == -EDEADLK);
+        assert_se(hashmap_isempty(m->jobs));
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
         _cleanup_(sd_bus_error_free) sd_bus_error err = SD_BUS_ERROR_NULL;
@@ -100,37 +182,45 @@ int main(int argc, char *argv[]) {
         assert_se(manager_add_job(m, JOB_START, h, JOB_FAIL, NULL, &j) == 0);
         manager_dump_jobs(m, stdout, "\t");
 
-        assert_se(!hashmap_get(a->dependencies[UNIT_PROPAGATES_RELOAD_TO], b));
-        assert_se(!hashmap_get(b->dependencies[UNIT_RELOAD_PROPAGATED_FROM], a));
-        assert_se(!hashmap_get(a->dependencies[UNIT_PROPAGATES_RELOAD_TO], c));
-        assert_se(!hashmap_get(c->dependencies[UNIT_RELOAD_PROPAGATED_FROM], a));
+        assert_se(!unit_has_dependency(a, UNIT_PROPAGATES_RELOAD_TO, b));
+        assert_se(!unit_has_dependency(b, UNIT_RELOAD_PROPAGATED_FROM, a));
+        assert_se(!unit_has_dependency(a, UNIT_PROPAGATES_RELOAD_TO, c));
+        assert_se(!unit_has_dependency(c, UNIT_RELOAD_PROPAGATED_FROM, a));
 
         assert_se(unit_add_dependency(a, UNIT_PROPAGATES_RELOAD_TO, b, true, UNIT_DEPENDENCY_UDEV) == 0);
         assert_se(unit_add_dependency(a, UNIT_PROPAGATES_RELOAD_TO, c, true, UNIT_DEPENDENCY_PROC_SWAP) == 0);
 
-        assert_se(hashmap_get(a->dependencies[UNIT_PROPAGATES_RELOAD_TO], b));
-        assert_se(hashmap_get(b->dependencies[UNIT_RELOAD_PROPAGATED_FROM], a));
-        assert_se(hashmap_get(a->dependencies[UNIT_PROPAGATES_RELOAD_TO], c));
-        assert_se(hashmap_get(c->dependencies[UNIT_RELOAD_PROPAGATED_FROM], a));
+        assert_se(unit_has_dependency(a, UNIT_PROPAGATES_RELOAD_TO, b));
+        assert_se(unit_has_dependency(b, UNIT_RELOAD_PROPAGATED_FROM, a));
+        assert_se(unit_has_dependency(a, UNIT_PROPAGATES_RELOAD_TO, c));
+        assert_se(unit_has_dependency(c, UNIT_RELOAD_PROPAGATED_FROM, a));
 
         unit_remove_dependencies(a, UNIT_DEPENDENCY_UDEV);
 
-        assert_se(!hashmap_get(a->dependencies[UNIT_PROPAGATES_RELOAD_TO], b));
-        assert_se(!hashmap_get(b->dependencies[UNIT_RELOAD_PROPAGATED_FROM], a));
-        assert_se(hashmap_get(a->dependencies[UNIT_PROPAGATES_RELOAD_TO], c));
-        assert_se(hashmap_get(c->dependencies[UNIT_RELOAD_PROPAGATED_FROM], a));
+        assert_se(!unit_has_dependency(a, UNIT_PROPAGATES_RELOAD_TO, b));
+        assert_se(!unit_has_dependency(b, UNIT_RELOAD_PROPAGATED_FROM, a));
+        assert_se(unit_has_dependency(a, UNIT_PROPAGATES_RELOAD_TO, c));
+        assert_se(unit_has_dependency(c, UNIT_RELOAD_PROPAGATED_FROM, a));
 
         unit_remove_dependencies(a, UNIT_DEPENDENCY_PROC_SWAP);
 
-        assert_se(!hashmap_get(a->dependencies[UNIT_PROPAGATES_RELOAD_TO], b));
-        assert_se(!hashmap_get(b->dependencies[UNIT_RELOAD_PROPAGATED_FROM], a));
-        assert_se(!hashmap_get(a->dependencies[UNIT_PROPAGATES_RELOAD_TO], c));
-        assert_se(!hashmap_get(c->dependencies[UNIT_RELOAD_PROPAGATED_FROM], a));
+        assert_se(!unit_has_dependency(a, UNIT_PROPAGATES_RELOAD_TO, b));
+        assert_se(!unit_has_dependency(b, UNIT_RELOAD_PROPAGATED_FROM, a));
+        assert_se(!unit_has_dependency(a, UNIT_PROPAGATES_RELOAD_TO, c));
+        assert_se(!unit_has_dependency(c, UNIT_RELOAD_PROPAGATED_FROM, a));
 
         assert_se(manager_load_unit(m, "unit-with-multiple-dashes.service", NULL, NULL, &unit_with_multiple_dashes) >= 0);
 
         assert_se(strv_equal(unit_with_multiple_dashes->documentation, STRV_MAKE("man:test", "man:override2", "man:override3")));
         assert_se(streq_ptr(unit_with_multiple_dashes->description, "override4"));
 
+        printf("Test11: (Large transaction with ordering cycle)\n");
+        manager_clear_jobs(m);
+        test_large_transaction(m);
+
+        printf("Test12: (Fixable and unfixable ordering cycles)\n");
+        manager_clear_jobs(m);
+        test_mixed_cycles(m);
+
         return 0;
 }
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#include "sd-device.h"
+
+#include "device-util.h"
+#include "device-private.h"
+#include "log.h"
+#include "string-util.h"
+#include "tests.h"
+#include "udev-device-generations.h"
+
+static void test_generations(void) {
+        _cleanup_(device_generations_freep) DeviceGenerations *g = NULL;
+        uint32_t a, b;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(device_generations_new(&g) >= 0);
+
+        a = device_generations_get(g, "/devices/pci0000:00");
+        b = device_generations_get(g, "/devices/pci0000:00/0000:00:1f.2");
+
+        device_generations_bump(g, "/devices/pci0000:00");
+        assert_se(device_generations_get(g, "/devices/pci0000:00") == a + 1);
+
+        /* unless the two paths share a slot, the other one is unaffected */
+        assert_se(device_generations_get(g, "/devices/pci0000:00/0000:00:1f.2") == b ||
+                  device_generations_get(g, "/devices/pci0000:00/0000:00:1f.2") == b + 1);
+
+        device_generations_bump(g, NULL);
+        device_generations_bump(NULL, "/devices/pci0000:00");
+}
+
+static void test_parent_cache(void) {
+        _cleanup_(sd_device_enumerator_unrefp) sd_device_enumerator *e = NULL;
+        _cleanup_(device_generations_freep) DeviceGenerations *g = NULL;
+        _cleanup_(sd_device_unrefp) sd_device *child1 = NULL, *child2 = NULL;
+        sd_device *d, *parent1 = NULL, *parent2 = NULL;
+        const char *syspath = NULL, *parent_syspath;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_device_enumerator_new(&e) >= 0);
+        assert_se(sd_device_enumerator_allow_uninitialized(e) >= 0);
+
+        FOREACH_DEVICE(e, d) {
+                sd_device *p;
+
+                if (sd_device_get_parent(d, &p) >= 0) {
+                        assert_se(sd_device_get_syspath(d, &syspath) >= 0);
+                        break;
+                }
+        }
+
+        if (!syspath) {
+                log_notice("Skipping %s: no device with a parent device found", __func__);
+                return;
+        }
+
+        assert_se(device_generations_new(&g) >= 0);
+        assert_se(device_generations_enable_parent_cache(g) >= 0);
+        assert_se(device_parent_cache_size() == 0);
+
+        /* Two objects for the same device share their parents */
+        assert_se(sd_device_new_from_syspath(&child1, syspath) >= 0);
+        assert_se(sd_device_new_from_syspath(&child2, syspath) >= 0);
+        assert_se(sd_device_get_parent(child1, &parent1) >= 0);
+        assert_se(sd_device_get_parent(child2, &parent2) >= 0);
+        assert_se(parent1 == parent2);
+        assert_se(device_parent_cache_size() > 0);
+
+        assert_se(!device_parent_cache_validate());
+
+        /* An event for the parent drops it */
+        assert_se(sd_device_get_syspath(parent1, &parent_syspath) >= 0);
+        device_generations_bump(g, startswith(parent_syspath, "/sys"));
+        assert_se(device_parent_cache_validate());
+        assert_se(device_parent_cache_size() == 0);
+
+        /* The objects handed out before stay valid */
+        assert_se(sd_device_get_syspath(parent1, &parent_syspath) >= 0);
+
+        child2 = sd_device_unref(child2);
+        assert_se(sd_device_new_from_syspath(&child2, syspath) >= 0);
+        assert_se(sd_device_get_parent(child2, &parent2) >= 0);
+        assert_se(parent1 != parent2);
+
+        device_parent_cache_disable();
+        assert_se(device_parent_cache_size() == 0);
+}
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_INFO);
+        log_parse_environment();
+        log_open();
+
+        test_generations();
+        test_parent_cache();
+
+        return 0;
+}
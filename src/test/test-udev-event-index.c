@@ -0,0 +1,302 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+
+#include "alloc-util.h"
+#include "env-util.h"
+#include "log.h"
+#include "random-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "time-util.h"
+#include "udev-event-index.h"
+
+static bool arg_slow = false;
+
+/* The linear scan udevd used before the index existed, kept here as the reference for the expected ordering */
+static bool reference_is_busy(EventIndexEntry *entries, const bool *present, size_t k) {
+        EventIndexEntry *e = entries + k;
+        size_t i, l, common;
+
+        l = strlen(e->devpath);
+
+        for (i = 0; i < k; i++) {
+                EventIndexEntry *o = entries + i;
+                size_t ol;
+
+                if (!present[i])
+                        continue;
+
+                if (major(e->devnum) != 0 && e->devnum == o->devnum && e->is_block == o->is_block)
+                        return true;
+
+                if (e->ifindex != 0 && e->ifindex == o->ifindex)
+                        return true;
+
+                if (e->devpath_old && streq(o->devpath, e->devpath_old))
+                        return true;
+
+                ol = strlen(o->devpath);
+                common = MIN(l, ol);
+
+                if (memcmp(o->devpath, e->devpath, common) != 0)
+                        continue;
+
+                if (l == ol) {
+                        if (major(e->devnum) != 0 && (e->devnum != o->devnum || e->is_block != o->is_block))
+                                continue;
+                        if (e->ifindex != 0 && e->ifindex != o->ifindex)
+                                continue;
+                        return true;
+                }
+
+                if (e->devpath[common] == '/' || o->devpath[common] == '/')
+                        return true;
+        }
+
+        return false;
+}
+
+static void test_basic(void) {
+        _cleanup_(event_index_freep) EventIndex *index = NULL;
+        EventIndexEntry e[] = {
+                { .seqnum = 1, .devpath = "/devices/pci0000:00/0000:00:1f.2" },
+                { .seqnum = 2, .devpath = "/devices/pci0000:00/0000:00:1f.2/ata1/host0/target0:0:0/0:0:0:0/block/sda",
+                  .devnum = makedev(8, 0), .is_block = true },
+                { .seqnum = 3, .devpath = "/devices/pci0000:00/0000:00:1f.20" },
+                { .seqnum = 4, .devpath = "/devices/virtual/net/foo", .ifindex = 5 },
+                { .seqnum = 5, .devpath = "/devices/virtual/net/bar", .devpath_old = "/devices/virtual/net/foo", .ifindex = 5 },
+                { .seqnum = 6, .devpath = "/devices/virtual/block/loop0", .devnum = makedev(7, 0), .is_block = true },
+                { .seqnum = 7, .devpath = "/devices/virtual/block/loop0", .devnum = makedev(7, 1), .is_block = true },
+                { .seqnum = 8, .devpath = "/devices/virtual/misc/loop-control", .devnum = makedev(7, 0) },
+                { .seqnum = 9, .devpath = "/devices/virtual/block/loop9", .devnum = makedev(7, 0), .is_block = true },
+        };
+        unsigned i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(index = event_index_new());
+
+        for (i = 0; i < ELEMENTSOF(e); i++)
+                assert_se(event_index_add(index, e + i) >= 0);
+        assert_se(event_index_size(index) == ELEMENTSOF(e));
+
+        assert_se(!event_index_find_blocker(index, e + 0));
+        assert_se(event_index_find_blocker(index, e + 1) == e + 0);     /* parent */
+        assert_se(!event_index_find_blocker(index, e + 2));             /* common prefix is no parent */
+        assert_se(!event_index_find_blocker(index, e + 3));
+        assert_se(event_index_find_blocker(index, e + 4) == e + 3);     /* old name and ifindex */
+        assert_se(!event_index_find_blocker(index, e + 5));
+        assert_se(!event_index_find_blocker(index, e + 6));             /* same devpath, but devnum changed */
+        assert_se(!event_index_find_blocker(index, e + 7));             /* same devnum, but not a block device */
+        assert_se(event_index_find_blocker(index, e + 8) == e + 5);     /* same block devnum */
+
+        assert_se(event_index_get_devpath(index, "/devices/virtual/block/loop0") == e + 5);
+        assert_se(e[5].same_devpath_next == e + 6);
+        assert_se(!event_index_get_devpath(index, "/devices/virtual/block"));
+        assert_se(!event_index_get_devpath(index, "/devices/virtual/block/loop1"));
+
+        /* Once the parent is gone, the child event becomes runnable */
+        event_index_remove(index, e + 0);
+        assert_se(!event_index_find_blocker(index, e + 1));
+
+        /* A child queued earlier blocks its parent */
+        e[0].seqnum = 10;
+        assert_se(event_index_add(index, e + 0) >= 0);
+        assert_se(event_index_find_blocker(index, e + 0) == e + 1);
+        event_index_remove(index, e + 1);
+        assert_se(!event_index_find_blocker(index, e + 0));
+
+        event_index_remove(index, e + 3);
+        assert_se(!event_index_find_blocker(index, e + 4));
+        event_index_remove(index, e + 5);
+        assert_se(!event_index_find_blocker(index, e + 8));
+
+        for (i = 0; i < ELEMENTSOF(e); i++)
+                event_index_remove(index, e + i);
+        assert_se(event_index_size(index) == 0);
+}
+
+static void test_random(void) {
+        static const char *const paths[] = {
+                "/devices/a",
+                "/devices/a/b",
+                "/devices/a/b/c",
+                "/devices/a/bc",
+                "/devices/a/b/d",
+                "/devices/ab",
+                "/devices/x/y",
+        };
+        _cleanup_(event_index_freep) EventIndex *index = NULL;
+        _cleanup_free_ EventIndexEntry *entries = NULL;
+        _cleanup_free_ bool *present = NULL;
+        unsigned i, k, n = 500;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(index = event_index_new());
+        assert_se(entries = new0(EventIndexEntry, n));
+        assert_se(present = new0(bool, n));
+
+        for (i = 0; i < n; i++) {
+                uint64_t r = random_u64();
+
+                entries[i] = (EventIndexEntry) {
+                        .seqnum = i + 1,
+                        .devpath = paths[r % ELEMENTSOF(paths)],
+                        .devpath_old = (r >> 8) % 8 == 0 ? paths[(r >> 16) % ELEMENTSOF(paths)] : NULL,
+                        .devnum = (r >> 24) % 3 == 0 ? makedev(8, (r >> 32) % 4) : 0,
+                        .is_block = (r >> 40) % 2,
+                        .ifindex = (r >> 48) % 4 == 0 ? (int) ((r >> 56) % 3) + 1 : 0,
+                };
+        }
+
+        /* Queue events and let random ones finish, and compare with the linear scan all the time */
+        for (i = 0, k = 0; i < n; i++) {
+                unsigned j;
+
+                assert_se(event_index_add(index, entries + i) >= 0);
+                present[i] = true;
+
+                for (j = k; j <= i; j++)
+                        if (present[j])
+                                assert_se(!!event_index_find_blocker(index, entries + j) ==
+                                          reference_is_busy(entries, present, j));
+
+                if (random_u64() % 3 == 0) {
+                        j = k + random_u64() % (i - k + 1);
+                        if (present[j]) {
+                                event_index_remove(index, entries + j);
+                                present[j] = false;
+                        }
+                }
+
+                while (k < i && !present[k])
+                        k++;
+        }
+
+        for (i = 0; i < n; i++)
+                if (present[i])
+                        event_index_remove(index, entries + i);
+        assert_se(event_index_size(index) == 0);
+}
+
+static void test_coldplug_benchmark(void) {
+        _cleanup_(event_index_freep) EventIndex *index = NULL;
+        _cleanup_free_ EventIndexEntry *entries = NULL;
+        _cleanup_free_ bool *present = NULL, *runnable = NULL;
+        _cleanup_strv_free_ char **paths = NULL;
+        unsigned i, n = 0, n_max, n_left, n_added, rounds = 0, n_wanted = arg_slow ? 50000 : 2000;
+        char buf[FORMAT_TIMESPAN_MAX];
+        bool check = !arg_slow;
+        usec_t ts, total = 0;
+
+        log_info("/* %s */", __func__);
+
+        /* A synthetic coldplug: a number of PCI functions with lots of virtual functions below, each with a network
+         * interface and every fourth one with a disk, enumerated parents first like 'udevadm trigger' does, followed
+         * by a 'change' event for every disk. */
+
+        n_max = n_wanted * 3;
+        assert_se(index = event_index_new());
+        assert_se(entries = new0(EventIndexEntry, n_max));
+        assert_se(present = new0(bool, n_max));
+        assert_se(runnable = new0(bool, n_max));
+        assert_se(paths = new0(char*, n_max + 1));
+
+        for (i = 0; n < n_wanted; i++) {
+                unsigned pf = i / 512, vf = i % 512;
+
+                if (vf == 0) {
+                        assert_se(asprintf(&paths[n], "/devices/pci0000:00/0000:00:%02x.0", pf) >= 0);
+                        entries[n] = (EventIndexEntry) { .devpath = paths[n] };
+                        n++;
+                }
+
+                assert_se(asprintf(&paths[n], "/devices/pci0000:00/0000:00:%02x.0/0000:%02x:%02x.%u",
+                                   pf, pf + 1, vf / 8, vf % 8) >= 0);
+                entries[n] = (EventIndexEntry) { .devpath = paths[n] };
+                n++;
+
+                assert_se(asprintf(&paths[n], "%s/net/eth%u", paths[n - 1], i) >= 0);
+                entries[n] = (EventIndexEntry) { .devpath = paths[n], .ifindex = i + 2 };
+                n++;
+
+                if (i % 4 == 0) {
+                        assert_se(asprintf(&paths[n], "%s/host%u/block/sd%u", paths[n - 2], i, i) >= 0);
+                        entries[n] = (EventIndexEntry) {
+                                .devpath = paths[n],
+                                .devnum = makedev(8 + i / 16, (i % 16) * 16),
+                                .is_block = true,
+                        };
+                        n++;
+                }
+        }
+
+        n_added = n;
+        for (i = 0; i < n_added; i++)
+                if (entries[i].is_block)
+                        entries[n++] = entries[i];
+
+        for (i = 0; i < n; i++)
+                entries[i].seqnum = i + 1;
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                assert_se(event_index_add(index, entries + i) >= 0);
+                present[i] = true;
+        }
+        total += now(CLOCK_MONOTONIC) - ts;
+
+        /* Run everything that is not blocked in one go, wait for all of it to finish, and repeat */
+        for (n_left = n; n_left > 0; rounds++) {
+                unsigned n_run = 0;
+
+                ts = now(CLOCK_MONOTONIC);
+                for (i = 0; i < n; i++)
+                        runnable[i] = present[i] && !event_index_find_blocker(index, entries + i);
+                total += now(CLOCK_MONOTONIC) - ts;
+
+                if (check)
+                        for (i = 0; i < n; i++)
+                                if (present[i])
+                                        assert_se(runnable[i] == !reference_is_busy(entries, present, i));
+
+                ts = now(CLOCK_MONOTONIC);
+                for (i = 0; i < n; i++)
+                        if (runnable[i]) {
+                                event_index_remove(index, entries + i);
+                                present[i] = false;
+                                n_run++;
+                        }
+                total += now(CLOCK_MONOTONIC) - ts;
+
+                assert_se(n_run > 0);
+                n_left -= n_run;
+        }
+
+        assert_se(event_index_size(index) == 0);
+
+        log_info("Scheduling %u events in %u rounds took %s", n, rounds, format_timespan(buf, sizeof(buf), total, 1));
+}
+
+int main(int argc, char *argv[]) {
+        int r;
+
+        log_set_max_level(LOG_INFO);
+        log_parse_environment();
+        log_open();
+
+        r = getenv_bool("SYSTEMD_SLOW_TESTS");
+        arg_slow = r >= 0 ? r : SYSTEMD_SLOW_TESTS_DEFAULT;
+
+        test_basic();
+        test_random();
+        test_coldplug_benchmark();
+
+        return 0;
+}
@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "io-util.h"
+#include "log.h"
+#include "parse-util.h"
+#include "process-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "udev-helper.h"
+
+static int run(int argc, char *argv[]) {
+        _cleanup_free_ char *args = NULL;
+
+        assert_se(args = strv_join(argv + 1, ","));
+        printf("%s %s\n", args, strempty(getenv("DEVNAME")));
+        fprintf(stderr, "%i\n", argc);
+
+        if (streq(argv[1], "kill"))
+                raise(SIGUSR1);
+
+        if (streq(argv[1], "hang")) {
+                /* Only SIGKILL takes this down */
+                assert_se(signal(SIGTERM, SIG_IGN) != SIG_ERR);
+                printf(PID_FMT "\n", getpid_cached());
+                fflush(stdout);
+
+                for (;;)
+                        pause();
+        }
+
+        return atoi(argv[1]);
+}
+
+static void request(int fd, char **argv, char **envp, const char *expected_out, const char *expected_err,
+                    int expected_code, int expected_status) {
+        _cleanup_close_pair_ int out[2] = { -1, -1 }, err[2] = { -1, -1 };
+        _cleanup_fclose_ FILE *f_out = NULL, *f_err = NULL;
+        _cleanup_free_ char *s_out = NULL, *s_err = NULL;
+        size_t size;
+        int code, status;
+
+        assert_se(pipe2(out, O_CLOEXEC) >= 0);
+        assert_se(pipe2(err, O_CLOEXEC) >= 0);
+
+        assert_se(udev_helper_send_request(fd, argv, envp, out[1], err[1]) >= 0);
+        out[1] = safe_close(out[1]);
+        err[1] = safe_close(err[1]);
+
+        assert_se(f_out = fdopen(out[0], "r"));
+        out[0] = -1;
+        assert_se(f_err = fdopen(err[0], "r"));
+        err[0] = -1;
+
+        assert_se(read_full_stream(f_out, &s_out, &size) >= 0);
+        assert_se(read_full_stream(f_err, &s_err, &size) >= 0);
+        assert_se(streq(s_out, expected_out));
+        assert_se(streq(s_err, expected_err));
+
+        assert_se(fd_wait_for_event(fd, POLLIN, 10 * USEC_PER_SEC) > 0);
+        assert_se(udev_helper_receive_reply(fd, &code, &status) >= 0);
+        assert_se(code == expected_code);
+        assert_se(status == expected_status);
+}
+
+static pid_t start_helper(int *ret_fd) {
+        int pair[2], r, code, status;
+        pid_t pid;
+
+        assert_se(socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, pair) >= 0);
+
+        r = safe_fork("(test-helper)", FORK_DEATHSIG|FORK_LOG, &pid);
+        assert_se(r >= 0);
+        if (r == 0) {
+                pair[0] = safe_close(pair[0]);
+                _exit(udev_helper_serve(pair[1], run) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+        safe_close(pair[1]);
+
+        /* greeting */
+        assert_se(fd_wait_for_event(pair[0], POLLIN, 10 * USEC_PER_SEC) > 0);
+        assert_se(udev_helper_receive_reply(pair[0], &code, &status) >= 0);
+        assert_se(udev_helper_receive_reply(pair[0], &code, &status) == -EAGAIN);
+
+        *ret_fd = pair[0];
+        return pid;
+}
+
+static void test_udev_helper(void) {
+        _cleanup_close_ int fd = -1;
+        _cleanup_free_ char *big = NULL;
+        siginfo_t si;
+        pid_t pid;
+
+        log_info("/* %s */", __func__);
+
+        pid = start_helper(&fd);
+
+        request(fd, STRV_MAKE("helper", "0", "--export"), STRV_MAKE("DEVNAME=/dev/sda"),
+                "0,--export /dev/sda\n", "3\n", CLD_EXITED, 0);
+        request(fd, STRV_MAKE("helper", "3"), NULL,
+                "3 \n", "2\n", CLD_EXITED, 3);
+        request(fd, STRV_MAKE("helper", "kill"), STRV_MAKE("DEVNAME=/dev/sdb", "FOO=bar"),
+                "", "2\n", CLD_KILLED, SIGUSR1);
+        request(fd, STRV_MAKE("helper", "0", "", "x y"), STRV_MAKE("DEVNAME=/dev/sdc"),
+                "0,,x y /dev/sdc\n", "4\n", CLD_EXITED, 0);
+
+        assert_se(big = malloc(UDEV_HELPER_REQUEST_MAX));
+        memset(big, 'x', UDEV_HELPER_REQUEST_MAX - 1);
+        big[UDEV_HELPER_REQUEST_MAX - 1] = '\0';
+        assert_se(udev_helper_send_request(fd, STRV_MAKE("helper", big), NULL, STDOUT_FILENO, STDERR_FILENO) == -E2BIG);
+
+        /* nothing was sent, the helper is still usable */
+        request(fd, STRV_MAKE("helper", "0"), NULL, "0 \n", "2\n", CLD_EXITED, 0);
+
+        /* the helper exits when the worker goes away */
+        fd = safe_close(fd);
+        assert_se(wait_for_terminate(pid, &si) >= 0);
+        assert_se(si.si_code == CLD_EXITED);
+        assert_se(si.si_status == EXIT_SUCCESS);
+}
+
+static void test_udev_helper_kill(void) {
+        _cleanup_close_pair_ int out[2] = { -1, -1 };
+        _cleanup_close_ int fd = -1, fd_null = -1;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *line = NULL;
+        pid_t pid, child;
+        siginfo_t si;
+
+        log_info("/* %s */", __func__);
+
+        /* The worker kills a helper whose command timed out, which must take down the command, too. Become the
+         * subreaper, so that the command is reparented to us and can be waited for. */
+        assert_se(prctl(PR_SET_CHILD_SUBREAPER, 1) >= 0);
+
+        pid = start_helper(&fd);
+
+        assert_se(pipe2(out, O_CLOEXEC) >= 0);
+        assert_se((fd_null = open("/dev/null", O_WRONLY|O_CLOEXEC)) >= 0);
+        assert_se(udev_helper_send_request(fd, STRV_MAKE("helper", "hang"), NULL, out[1], fd_null) >= 0);
+        out[1] = safe_close(out[1]);
+
+        assert_se(f = fdopen(out[0], "r"));
+        out[0] = -1;
+        assert_se(read_line(f, LINE_MAX, &line) > 0);
+        assert_se(streq(line, "hang "));
+        line = mfree(line);
+        assert_se(read_line(f, LINE_MAX, &line) > 0);
+        assert_se(parse_pid(line, &child) >= 0);
+
+        assert_se(kill(pid, SIGKILL) >= 0);
+        assert_se(wait_for_terminate(pid, &si) >= 0);
+        assert_se(si.si_code == CLD_KILLED);
+
+        assert_se(wait_for_terminate(child, &si) >= 0);
+        assert_se(si.si_code == CLD_KILLED);
+        assert_se(si.si_status == SIGKILL);
+
+        assert_se(prctl(PR_SET_CHILD_SUBREAPER, 0) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_DEBUG);
+        log_parse_environment();
+        log_open();
+
+        test_udev_helper();
+        test_udev_helper_kill();
+
+        return 0;
+}
@@ -0,0 +1,349 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fileio.h"
+#include "libudev-private.h"
+#include "log.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "time-util.h"
+#include "udev.h"
+#include "udev-util.h"
+
+static struct udev_device *fake_device(struct udev *udev, const char *action, const char *subsystem, const char *devpath) {
+        char buf[1024];
+        struct udev_device *dev;
+        int l;
+
+        /* the fields of a uevent, separated by NUL bytes, with a device node so that NAME= etc. are considered */
+        l = snprintf(buf, sizeof(buf), "ACTION=%s%cDEVPATH=%s%cSUBSYSTEM=%s%cMAJOR=1%cMINOR=3%cSEQNUM=1",
+                     action, 0, devpath, 0, subsystem, 0, 0, 0);
+        assert_se(l > 0 && (size_t) l < sizeof(buf));
+
+        assert_se(dev = udev_device_new_from_nulstr(udev, buf, l + 1));
+        return dev;
+}
+
+static struct udev_rules *load_rules(struct udev *udev, const char *dir, const char *text) {
+        struct udev_rules_options options = {
+                .dirs = STRV_MAKE((char*) dir),
+        };
+        _cleanup_free_ char *p = NULL;
+
+        assert_se(p = path_join(NULL, dir, "50-test.rules"));
+        assert_se(write_string_file(p, text, WRITE_STRING_FILE_CREATE) >= 0);
+
+        return udev_rules_new_full(udev, 1, &options);
+}
+
+static bool needs_worker(struct udev *udev, const char *dir, const char *text) {
+        _cleanup_(udev_device_unrefp) struct udev_device *dev = NULL;
+        _cleanup_(udev_rules_unrefp) struct udev_rules *rules = NULL;
+
+        assert_se(rules = load_rules(udev, dir, text));
+        dev = fake_device(udev, "add", "test", "/devices/virtual/test/test0");
+
+        return udev_rules_event_needs_worker(rules, dev);
+}
+
+static void test_needs_worker(void) {
+        _cleanup_(rm_rf_physical_and_freep) char *dir = NULL;
+        _cleanup_(udev_unrefp) struct udev *udev = NULL;
+
+        static const char *const worker[] = {
+                /* external programs and builtins */
+                "RUN+=\"/bin/true\"\n",
+                "PROGRAM==\"/bin/true\"\n",
+                "IMPORT{program}=\"/bin/true\"\n",
+                "IMPORT{builtin}=\"net_id\"\n",
+                "RUN{builtin}+=\"hwdb\"\n",
+                "IMPORT{builtin}=\"hwdb --subsystem=usb\"\n",
+                /* reading sysfs attributes, /proc/sys, the parents, or arbitrary files */
+                "ATTR{foo}==\"bar\", ENV{FOO}=\"1\"\n",
+                "ATTRS{foo}==\"bar\", ENV{FOO}=\"1\"\n",
+                "SYSCTL{kernel/foo}==\"1\", ENV{FOO}=\"1\"\n",
+                "SUBSYSTEMS==\"usb\", ENV{FOO}=\"1\"\n",
+                "KERNELS==\"foo\", ENV{FOO}=\"1\"\n",
+                "DRIVERS==\"foo\", ENV{FOO}=\"1\"\n",
+                "TAGS==\"foo\", ENV{FOO}=\"1\"\n",
+                "IMPORT{parent}=\"FOO\"\n",
+                "IMPORT{file}=\"/run/foo\"\n",
+                "TEST==\"/run/foo\", ENV{FOO}=\"1\"\n",
+                /* substitutions reading sysfs attributes */
+                "ENV{FOO}=\"$attr{foo}\"\n",
+                "ENV{FOO}=\"$sysfs{foo}\"\n",
+                "SYMLINK+=\"disk/%s{serial}\"\n",
+                "ENV{FOO}=\"[net/lo]address\"\n",
+                "ENV{$attr{foo}}=\"1\"\n",
+                /* writing sysfs or /proc/sys, renaming, resolving names at runtime */
+                "ATTR{foo}=\"bar\"\n",
+                "SYSCTL{kernel/foo}=\"1\"\n",
+                "NAME=\"foo\"\n",
+                /* candidate rules matching the device */
+                "SUBSYSTEM==\"test\", RUN+=\"/bin/true\"\n",
+                "KERNEL==\"test0\", ATTR{foo}==\"bar\", ENV{FOO}=\"1\"\n",
+                "ACTION==\"add\", SUBSYSTEM==\"test|usb\", IMPORT{file}=\"/run/foo\"\n",
+                /* a GOTO which depends on something else is not followed */
+                "ENV{SKIP}==\"1\", GOTO=\"end\"\nRUN+=\"/bin/true\"\nLABEL=\"end\"\n",
+        };
+        static const char *const inline_[] = {
+                "",
+                "ENV{FOO}=\"1\", TAG+=\"foo\", SYMLINK+=\"foo\"\n",
+                "ENV{FOO}=\"$kernel $devpath %k $env{BAR}\"\n",
+                "ENV{FOO}==\"1\", ENV{BAR}=\"2\"\n",
+                "DRIVER==\"foo\", ENV{FOO}=\"1\"\n",
+                "IMPORT{db}=\"FOO\"\n",
+                "IMPORT{cmdline}=\"foo\"\n",
+                "MODE=\"0600\", OWNER=\"root\", GROUP=\"root\"\n",
+                /* rules which can't match the device */
+                "SUBSYSTEM==\"usb\", RUN+=\"/bin/true\"\n",
+                "KERNEL==\"test1\", ATTR{foo}==\"bar\", ENV{FOO}=\"1\"\n",
+                "ACTION==\"remove\", IMPORT{builtin}=\"hwdb\"\n",
+                "SUBSYSTEM!=\"test\", RUN+=\"/bin/true\"\n",
+                "DEVPATH==\"/devices/pci*\", IMPORT{file}=\"/run/foo\"\n",
+                /* a GOTO which is always taken skips what's in between */
+                "SUBSYSTEM==\"test\", GOTO=\"end\"\nRUN+=\"/bin/true\"\nLABEL=\"end\"\nENV{FOO}=\"1\"\n",
+        };
+        unsigned i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(udev = udev_new());
+        assert_se(mkdtemp_malloc("/tmp/test-udev-rules.XXXXXX", &dir) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(worker); i++) {
+                log_debug("worker: %s", worker[i]);
+                assert_se(needs_worker(udev, dir, worker[i]));
+        }
+
+        for (i = 0; i < ELEMENTSOF(inline_); i++) {
+                log_debug("inline: %s", inline_[i]);
+                assert_se(!needs_worker(udev, dir, inline_[i]));
+        }
+}
+
+/* Rules files written less than two seconds ago are not cached, move the timestamp back, to a different time for
+ * every call, so that rewriting a file with the same size is noticed */
+static void make_old(const char *path) {
+        static usec_t offset = 0;
+        struct timespec ts[2];
+
+        offset += USEC_PER_SEC;
+        timespec_store(&ts[0], now(CLOCK_REALTIME) - 1000 * USEC_PER_SEC + offset);
+        ts[1] = ts[0];
+
+        assert_se(utimensat(AT_FDCWD, path, ts, 0) >= 0);
+}
+
+static void write_old(const char *dir, const char *name, const char *text) {
+        _cleanup_free_ char *p = NULL;
+
+        assert_se(p = path_join(NULL, dir, name));
+        assert_se(write_string_file(p, text, WRITE_STRING_FILE_CREATE) >= 0);
+        make_old(p);
+}
+
+/* Each rule appends its name to TRACE, hence TRACE tells which rules were applied, in which order */
+static const char trace_rules[] =
+        "SUBSYSTEM==\"block\", ENV{TRACE}=\"$env{TRACE} block\"\n"
+        "KERNEL==\"sda|sdb\", ENV{TRACE}=\"$env{TRACE} sda-sdb\"\n"
+        "ACTION==\"add\", ENV{TRACE}=\"$env{TRACE} add\"\n"
+        "ENV{TRACE}=\"$env{TRACE} any\"\n"
+        "SUBSYSTEM==\"block\", GOTO=\"block_end\"\n"
+        "ENV{TRACE}=\"$env{TRACE} not-block\"\n"
+        "SUBSYSTEM==\"net\", KERNEL==\"eth*\", ENV{TRACE}=\"$env{TRACE} eth\"\n"
+        "LABEL=\"block_end\"\n"
+        "SUBSYSTEM==\"usb|block\", ACTION==\"remove\", ENV{TRACE}=\"$env{TRACE} usb-block-remove\"\n"
+        "KERNEL==\"sd*\", ENV{TRACE}=\"$env{TRACE} sd\"\n"
+        "SUBSYSTEM!=\"block\", ENV{TRACE}=\"$env{TRACE} not-block-2\"\n"
+        "ENV{TRACE}==\"* sda-sdb*\", GOTO=\"end\"\n"
+        "ACTION==\"change|add\", SUBSYSTEM==\"usb\", ENV{TRACE}=\"$env{TRACE} usb\"\n"
+        "ENV{TRACE}=\"$env{TRACE} before-end\"\n"
+        "LABEL=\"end\"\n"
+        "KERNEL==\"1-1\", ENV{TRACE}=\"$env{TRACE} 1-1\"\n"
+        "ENV{TRACE}=\"$env{TRACE} last\"\n";
+
+static char *apply_rules(struct udev *udev, struct udev_rules *rules,
+                         const char *action, const char *subsystem, const char *devpath) {
+        _cleanup_(udev_device_unrefp) struct udev_device *dev = NULL;
+        _cleanup_(udev_event_unrefp) struct udev_event *event = NULL;
+        char *trace;
+
+        dev = fake_device(udev, action, subsystem, devpath);
+        assert_se(event = udev_event_new(dev));
+
+        udev_rules_apply_to_event(rules, event, 10 * USEC_PER_SEC, 10 * USEC_PER_SEC, NULL);
+
+        assert_se(trace = strdup(strempty(udev_device_get_property_value(dev, "TRACE"))));
+        return trace;
+}
+
+static void test_index(void) {
+        _cleanup_(rm_rf_physical_and_freep) char *dir = NULL, *cache_dir = NULL;
+        _cleanup_(udev_rules_unrefp) struct udev_rules *linear = NULL, *indexed = NULL, *cached = NULL;
+        _cleanup_(udev_unrefp) struct udev *udev = NULL;
+        _cleanup_free_ char *cache_file = NULL, *sda = NULL, *eth0 = NULL, *usb = NULL;
+        struct udev_rules_options options = {};
+        static const char *const devices[][3] = {
+                { "add",    "block", "/devices/virtual/block/sda" },
+                { "remove", "block", "/devices/virtual/block/sdb" },
+                { "add",    "block", "/devices/virtual/block/sdc" },
+                { "add",    "net",   "/devices/virtual/net/eth0" },
+                { "move",   "net",   "/devices/virtual/net/lo" },
+                { "change", "usb",   "/devices/virtual/usb/1-1" },
+                { "remove", "usb",   "/devices/virtual/usb/1-1" },
+        };
+        unsigned i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(udev = udev_new());
+        assert_se(mkdtemp_malloc("/tmp/test-udev-rules.XXXXXX", &dir) >= 0);
+        assert_se(mkdtemp_malloc("/tmp/test-udev-rules-cache.XXXXXX", &cache_dir) >= 0);
+        assert_se(cache_file = path_join(NULL, cache_dir, "rules.bin"));
+
+        /* The same rules, checked one by one, through the index, and through the index of the mapped cache */
+        write_old(dir, "50-test.rules", trace_rules);
+        options.dirs = STRV_MAKE((char*) dir);
+        options.no_index = true;
+        assert_se(linear = udev_rules_new_full(udev, 1, &options));
+
+        options.no_index = false;
+        options.cache_file = cache_file;
+        assert_se(indexed = udev_rules_new_full(udev, 1, &options));
+        assert_se(!udev_rules_is_cached(indexed));
+        assert_se(cached = udev_rules_new_full(udev, 1, &options));
+        assert_se(udev_rules_is_cached(cached));
+
+        for (i = 0; i < ELEMENTSOF(devices); i++) {
+                _cleanup_free_ char *a = NULL, *b = NULL, *c = NULL;
+
+                a = apply_rules(udev, linear, devices[i][0], devices[i][1], devices[i][2]);
+                b = apply_rules(udev, indexed, devices[i][0], devices[i][1], devices[i][2]);
+                c = apply_rules(udev, cached, devices[i][0], devices[i][1], devices[i][2]);
+
+                log_debug("%s %s: %s", devices[i][0], devices[i][2], a);
+                assert_se(!isempty(a));
+                assert_se(streq(a, b));
+                assert_se(streq(a, c));
+        }
+
+        /* Check a few explicitly, so that it's not only the same wrong result everywhere */
+        sda = apply_rules(udev, indexed, "add", "block", "/devices/virtual/block/sda");
+        assert_se(streq(sda, " block sda-sdb add any sd last"));
+
+        eth0 = apply_rules(udev, indexed, "add", "net", "/devices/virtual/net/eth0");
+        assert_se(streq(eth0, " add any not-block eth not-block-2 before-end last"));
+
+        usb = apply_rules(udev, indexed, "change", "usb", "/devices/virtual/usb/1-1");
+        assert_se(streq(usb, " any not-block not-block-2 usb before-end 1-1 last"));
+}
+
+/* Loads the rules and returns whether they came from the cache, then checks that they were cached for the next time */
+static bool load_cached(struct udev *udev, int resolve_names, const struct udev_rules_options *options) {
+        _cleanup_(udev_rules_unrefp) struct udev_rules *rules = NULL;
+        bool cached;
+
+        assert_se(rules = udev_rules_new_full(udev, resolve_names, options));
+        cached = udev_rules_is_cached(rules);
+        rules = udev_rules_unref(rules);
+
+        assert_se(rules = udev_rules_new_full(udev, resolve_names, options));
+        assert_se(udev_rules_is_cached(rules));
+
+        return cached;
+}
+
+static void test_cache(void) {
+        _cleanup_(rm_rf_physical_and_freep) char *dir = NULL, *etc = NULL;
+        _cleanup_(udev_rules_unrefp) struct udev_rules *rules = NULL;
+        _cleanup_(udev_unrefp) struct udev *udev = NULL;
+        _cleanup_free_ char *cache_file = NULL, *passwd = NULL, *group = NULL, *other = NULL;
+        struct udev_rules_options options = {};
+
+        log_info("/* %s */", __func__);
+
+        assert_se(udev = udev_new());
+        assert_se(mkdtemp_malloc("/tmp/test-udev-rules.XXXXXX", &dir) >= 0);
+        assert_se(mkdtemp_malloc("/tmp/test-udev-rules-etc.XXXXXX", &etc) >= 0);
+        assert_se(cache_file = path_join(NULL, etc, "rules.bin"));
+        assert_se(passwd = path_join(NULL, etc, "passwd"));
+        assert_se(group = path_join(NULL, etc, "group"));
+
+        write_old(dir, "50-test.rules", "ENV{FOO}=\"1\"\n");
+        write_old(etc, "passwd", "root:x:0:0::/root:/bin/sh\n");
+        write_old(etc, "group", "root:x:0:\n");
+
+        options.dirs = STRV_MAKE((char*) dir);
+        options.cache_file = cache_file;
+        options.cache_extra_files = STRV_MAKE(passwd, group);
+
+        assert_se(!load_cached(udev, 1, &options));
+        assert_se(load_cached(udev, 1, &options));
+
+        /* a changed rules file, even with the same size */
+        write_old(dir, "50-test.rules", "ENV{FOO}=\"2\"\n");
+        assert_se(!load_cached(udev, 1, &options));
+        assert_se(load_cached(udev, 1, &options));
+
+        /* an added and a removed rules file */
+        write_old(dir, "60-other.rules", "ENV{BAR}=\"1\"\n");
+        assert_se(!load_cached(udev, 1, &options));
+        assert_se(load_cached(udev, 1, &options));
+
+        assert_se(other = path_join(NULL, dir, "60-other.rules"));
+        assert_se(unlink(other) >= 0);
+        assert_se(!load_cached(udev, 1, &options));
+        assert_se(load_cached(udev, 1, &options));
+
+        /* user and group names are resolved while parsing, the databases are checked too */
+        make_old(passwd);
+        assert_se(!load_cached(udev, 1, &options));
+        assert_se(load_cached(udev, 1, &options));
+
+        make_old(group);
+        assert_se(!load_cached(udev, 1, &options));
+        assert_se(load_cached(udev, 1, &options));
+
+        /* rules parsed with a different resolve_names setting differ */
+        assert_se(!load_cached(udev, 0, &options));
+        assert_se(load_cached(udev, 0, &options));
+        assert_se(!load_cached(udev, 1, &options));
+
+        /* so do the rules of a different version */
+        options.cache_version = "0-test";
+        assert_se(!load_cached(udev, 1, &options));
+        assert_se(load_cached(udev, 1, &options));
+        options.cache_version = NULL;
+        assert_se(!load_cached(udev, 1, &options));
+        assert_se(load_cached(udev, 1, &options));
+
+        /* a file which is too new isn't cached at all, and the old cache isn't used either */
+        assert_se(write_string_file(other, "ENV{BAR}=\"1\"\n", WRITE_STRING_FILE_CREATE) >= 0);
+        assert_se(rules = udev_rules_new_full(udev, 1, &options));
+        assert_se(!udev_rules_is_cached(rules));
+        rules = udev_rules_unref(rules);
+        assert_se(rules = udev_rules_new_full(udev, 1, &options));
+        assert_se(!udev_rules_is_cached(rules));
+}
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_INFO);
+        log_parse_environment();
+        log_open();
+
+        test_needs_worker();
+        test_index();
+        test_cache();
+
+        return 0;
+}
@@ -0,0 +1,299 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "alloc-util.h"
+#include "env-util.h"
+#include "format-util.h"
+#include "manager.h"
+#include "random-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "target.h"
+#include "test-helper.h"
+#include "tests.h"
+#include "time-util.h"
+#include "unit-dependency.h"
+
+static bool arg_slow = false;
+
+static struct Unit *fake_unit(char *base, unsigned i) {
+        /* The table never dereferences the unit pointers, hence any distinct addresses do */
+        return (struct Unit*) (base + i);
+}
+
+/* Returns the numbers 0…n-1 in random order, so that the table doesn't only ever see ascending pointers */
+static unsigned *shuffled(unsigned n) {
+        unsigned *a, i;
+
+        assert_se(a = new(unsigned, n));
+        for (i = 0; i < n; i++)
+                a[i] = i;
+
+        for (i = n; i > 1; i--) {
+                unsigned k = random_u64() % i;
+
+                SWAP_TWO(a[i - 1], a[k]);
+        }
+
+        return a;
+}
+
+/* Every entry of the group can be looked up, and none is there twice */
+static void assert_group_consistent(UnitDependencyTable *t, UnitDependency d) {
+        unsigned i;
+
+        for (i = 0; i < unit_dependency_table_size(t, d); i++)
+                assert_se(unit_dependency_table_find(t, d, unit_dependency_table_nth_unit(t, d, i)) ==
+                          unit_dependency_table_nth(t, d, i));
+}
+
+static void test_table_basic(void) {
+        _cleanup_(unit_dependency_table_freep) UnitDependencyTable *t = NULL;
+        UnitDependencyInfo di = { .origin_mask = UNIT_DEPENDENCY_FILE };
+        UnitDependencyEntry *e;
+        static char base[64];
+        unsigned i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(unit_dependency_table_size(t, UNIT_WANTS) == 0);
+        assert_se(!unit_dependency_table_find(t, UNIT_WANTS, fake_unit(base, 0)));
+        assert_se(!unit_dependency_table_remove(t, UNIT_WANTS, fake_unit(base, 0)));
+
+        /* Insert out of order, into a type in the middle, the first and the last one */
+        for (i = 0; i < 32; i++) {
+                unsigned k = (i * 7) % 32;
+
+                assert_se(unit_dependency_table_put(&t, UNIT_AFTER, fake_unit(base, k), di) == 1);
+                assert_se(unit_dependency_table_put(&t, UNIT_REQUIRES, fake_unit(base, 31 - k), di) == 1);
+                assert_se(unit_dependency_table_put(&t, UNIT_REFERENCED_BY, fake_unit(base, k), di) == 1);
+        }
+
+        assert_se(unit_dependency_table_size(t, UNIT_AFTER) == 32);
+        assert_se(unit_dependency_table_size(t, UNIT_REQUIRES) == 32);
+        assert_se(unit_dependency_table_size(t, UNIT_REFERENCED_BY) == 32);
+        assert_se(unit_dependency_table_size(t, UNIT_BEFORE) == 0);
+        assert_group_consistent(t, UNIT_AFTER);
+        assert_group_consistent(t, UNIT_REQUIRES);
+        assert_group_consistent(t, UNIT_REFERENCED_BY);
+
+        /* Updating an existing entry doesn't add a new one */
+        di.destination_mask = UNIT_DEPENDENCY_UDEV;
+        assert_se(unit_dependency_table_put(&t, UNIT_AFTER, fake_unit(base, 5), di) == 0);
+        assert_se(unit_dependency_table_size(t, UNIT_AFTER) == 32);
+        assert_se(e = unit_dependency_table_find(t, UNIT_AFTER, fake_unit(base, 5)));
+        assert_se(e->info.destination_mask == UNIT_DEPENDENCY_UDEV);
+        assert_se(e = unit_dependency_table_find(t, UNIT_REQUIRES, fake_unit(base, 5)));
+        assert_se(e->info.destination_mask == 0);
+
+        assert_se(unit_dependency_table_remove(t, UNIT_AFTER, fake_unit(base, 5)));
+        assert_se(!unit_dependency_table_remove(t, UNIT_AFTER, fake_unit(base, 5)));
+        assert_se(!unit_dependency_table_find(t, UNIT_AFTER, fake_unit(base, 5)));
+        assert_se(unit_dependency_table_find(t, UNIT_REQUIRES, fake_unit(base, 5)));
+        assert_se(unit_dependency_table_find(t, UNIT_REFERENCED_BY, fake_unit(base, 5)));
+        assert_se(unit_dependency_table_size(t, UNIT_AFTER) == 31);
+        assert_group_consistent(t, UNIT_AFTER);
+
+        /* A reservation guarantees that the following insertions won't reallocate */
+        assert_se(unit_dependency_table_reserve(&t, UNIT_BEFORE, 40) >= 0);
+        e = unit_dependency_table_nth(t, UNIT_AFTER, 0);
+        for (i = 0; i < 40; i++)
+                assert_se(unit_dependency_table_put(&t, UNIT_BEFORE, fake_unit(base, 63 - i), di) == 1);
+        assert_se(e == unit_dependency_table_nth(t, UNIT_AFTER, 0));
+        assert_group_consistent(t, UNIT_BEFORE);
+
+        unit_dependency_table_clear(t, UNIT_REQUIRES);
+        assert_se(unit_dependency_table_size(t, UNIT_REQUIRES) == 0);
+        assert_se(unit_dependency_table_size(t, UNIT_AFTER) == 31);
+        assert_se(!unit_dependency_table_nth(t, UNIT_REQUIRES, 0));
+}
+
+static void test_table_shuffled(void) {
+        _cleanup_(unit_dependency_table_freep) UnitDependencyTable *t = NULL;
+        UnitDependencyInfo di = { .origin_mask = UNIT_DEPENDENCY_FILE };
+        _cleanup_free_ unsigned *order = NULL;
+        _cleanup_free_ bool *present = NULL;
+        _cleanup_free_ char *base = NULL;
+        unsigned i, k, n = 5000, n_present = 0;
+
+        log_info("/* %s */", __func__);
+
+        /* Random insertions and removals, checked against a plain array */
+
+        assert_se(base = new(char, n));
+        assert_se(present = new0(bool, n));
+        order = shuffled(n);
+
+        for (i = 0; i < 4 * n; i++) {
+                k = order[i % n];
+
+                if (i % 3 == 2) {
+                        k = random_u64() % n;
+
+                        assert_se(unit_dependency_table_remove(t, UNIT_AFTER, fake_unit(base, k)) == present[k]);
+                        if (present[k])
+                                n_present--;
+                        present[k] = false;
+                } else {
+                        assert_se(unit_dependency_table_put(&t, UNIT_AFTER, fake_unit(base, k), di) == !present[k]);
+                        if (!present[k])
+                                n_present++;
+                        present[k] = true;
+                }
+
+                assert_se(unit_dependency_table_size(t, UNIT_AFTER) == n_present);
+
+                if (i % 97 == 0)
+                        assert_group_consistent(t, UNIT_AFTER);
+        }
+
+        for (k = 0; k < n; k++)
+                assert_se(!!unit_dependency_table_find(t, UNIT_AFTER, fake_unit(base, k)) == present[k]);
+        assert_group_consistent(t, UNIT_AFTER);
+
+        unit_dependency_table_clear(t, UNIT_AFTER);
+        for (i = 0; i < n; i++)
+                assert_se(unit_dependency_table_put(&t, UNIT_AFTER, fake_unit(base, order[i]), di) == 1);
+        for (k = 0; k < n; k++)
+                assert_se(unit_dependency_table_find(t, UNIT_AFTER, fake_unit(base, k)));
+        assert_group_consistent(t, UNIT_AFTER);
+}
+
+static void test_table_memory(void) {
+        _cleanup_free_ UnitDependencyTable **tables = NULL;
+        _cleanup_free_ unsigned *order = NULL;
+        _cleanup_free_ char *base = NULL;
+        char buf[FORMAT_TIMESPAN_MAX];
+        unsigned i, n = 50000;
+        size_t total = 0;
+        usec_t ts;
+
+        log_info("/* %s */", __func__);
+
+        /* One unit everything is pulled in by and ordered against, similar to multi-user.target, and lots of units
+         * with a handful of dependencies each. The units are added in random order, as their addresses are in
+         * practice. */
+
+        assert_se(base = new(char, n + 1));
+        assert_se(tables = new0(UnitDependencyTable*, n + 1));
+        order = shuffled(n);
+
+        ts = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n; i++) {
+                UnitDependencyInfo di = { .origin_mask = UNIT_DEPENDENCY_FILE };
+                unsigned k = order[i];
+
+                assert_se(unit_dependency_table_put(&tables[n], UNIT_WANTS, fake_unit(base, k), di) == 1);
+                assert_se(unit_dependency_table_put(&tables[n], UNIT_AFTER, fake_unit(base, k), di) == 1);
+                assert_se(unit_dependency_table_put(&tables[n], UNIT_REFERENCES, fake_unit(base, k), di) == 1);
+
+                di = (UnitDependencyInfo) { .destination_mask = UNIT_DEPENDENCY_FILE };
+                assert_se(unit_dependency_table_put(&tables[k], UNIT_WANTED_BY, fake_unit(base, n), di) == 1);
+                assert_se(unit_dependency_table_put(&tables[k], UNIT_BEFORE, fake_unit(base, n), di) == 1);
+                assert_se(unit_dependency_table_put(&tables[k], UNIT_REFERENCED_BY, fake_unit(base, n), di) == 1);
+        }
+
+        for (i = 0; i < n; i++)
+                assert_se(unit_dependency_table_find(tables[n], UNIT_AFTER, fake_unit(base, i)));
+
+        for (i = 0; i <= n; i++)
+                total += unit_dependency_table_allocated(tables[i]);
+
+        log_info("%u units, %u dependencies: %zu bytes of dependency tables, %s",
+                 n + 1, n * 6, total, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - ts, 1));
+
+        for (i = 0; i <= n; i++)
+                unit_dependency_table_free(tables[i]);
+}
+
+static void test_transaction_benchmark(void) {
+        _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
+        _cleanup_(manager_freep) Manager *m = NULL;
+        unsigned i, n = arg_slow ? 50000 : 1000;
+        _cleanup_free_ unsigned *order = NULL;
+        _cleanup_free_ Unit **units = NULL;
+        Unit *hub, *u;
+        char buf[FORMAT_TIMESPAN_MAX];
+        size_t total = 0;
+        Iterator it;
+        usec_t ts;
+        Job *j;
+        int r;
+
+        log_info("/* %s */", __func__);
+
+        r = enter_cgroup_subroot();
+        if (r == -ENOMEDIUM) {
+                log_notice_errno(r, "Skipping %s: cgroupfs not available", __func__);
+                return;
+        }
+
+        assert_se(set_unit_path(get_testdata_dir("")) >= 0);
+        assert_se(runtime_dir = setup_fake_runtime_dir());
+        r = manager_new(UNIT_FILE_USER, MANAGER_TEST_RUN_BASIC, &m);
+        if (MANAGER_SKIP_TEST(r)) {
+                log_notice_errno(r, "Skipping %s: manager_new: %m", __func__);
+                return;
+        }
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        assert_se(unit_new_for_name(m, sizeof(Target), "bench.target", &hub) >= 0);
+        hub->load_state = UNIT_LOADED;
+
+        assert_se(units = new(Unit*, n));
+        for (i = 0; i < n; i++) {
+                char name[STRLEN("bench-.target") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(name, "bench-%u.target", i);
+                assert_se(unit_new_for_name(m, sizeof(Target), name, &units[i]) >= 0);
+                units[i]->load_state = UNIT_LOADED;
+        }
+
+        /* Units are loaded in whatever order they are referenced in, not in the order of their addresses */
+        order = shuffled(n);
+
+        ts = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n; i++) {
+                unsigned k = order[i];
+
+                assert_se(unit_add_two_dependencies(hub, UNIT_AFTER, UNIT_WANTS, units[k], true, UNIT_DEPENDENCY_FILE) >= 0);
+                if (k > 0)
+                        assert_se(unit_add_dependency(units[k], UNIT_AFTER, units[k - 1], true, UNIT_DEPENDENCY_FILE) >= 0);
+        }
+
+        HASHMAP_FOREACH(u, m->units, it)
+                total += unit_dependency_table_allocated(u->dependencies);
+
+        log_info("Adding dependencies of %u units took %s, %zu bytes of dependency tables",
+                 n, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - ts, 1), total);
+
+        ts = now(CLOCK_MONOTONIC);
+        assert_se(manager_add_job(m, JOB_START, hub, JOB_REPLACE, NULL, &j) == 0);
+        log_info("Building start transaction for %u units took %s",
+                 n + 1, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - ts, 1));
+
+        assert_se(hashmap_size(m->jobs) == n + 1);
+}
+
+int main(int argc, char *argv[]) {
+        int r;
+
+        log_set_max_level(LOG_INFO);
+        log_parse_environment();
+        log_open();
+
+        r = getenv_bool("SYSTEMD_SLOW_TESTS");
+        arg_slow = r >= 0 ? r : SYSTEMD_SLOW_TESTS_DEFAULT;
+
+        test_table_basic();
+        test_table_shuffled();
+        test_table_memory();
+        test_transaction_benchmark();
+
+        return 0;
+}
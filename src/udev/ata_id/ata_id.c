@@ -29,6 +29,7 @@
 #include "fd-util.h"
 #include "libudev-private.h"
 #include "log.h"
+#include "udev-helper.h"
 #include "udev-util.h"
 
 #define COMMAND_TIMEOUT_MSEC (30 * 1000)
@@ -391,7 +392,7 @@ out:
         return ret;
 }
 
-int main(int argc, char *argv[]) {
+static int run(int argc, char *argv[]) {
         _cleanup_(udev_unrefp) struct udev *udev = NULL;
         struct hd_driveid id;
         union {
@@ -659,3 +660,5 @@ int main(int argc, char *argv[]) {
 
         return 0;
 }
+
+DEFINE_UDEV_HELPER_MAIN(run);
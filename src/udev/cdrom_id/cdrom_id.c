@@ -26,6 +26,7 @@
 
 #include "libudev-private.h"
 #include "random-util.h"
+#include "udev-helper.h"
 #include "udev-util.h"
 
 /* device info */
@@ -832,7 +833,7 @@ static int cd_media_toc(struct udev *udev, int fd)
         return 0;
 }
 
-int main(int argc, char *argv[]) {
+static int run(int argc, char *argv[]) {
         struct udev *udev;
         static const struct option options[] = {
                 { "lock-media", no_argument, NULL, 'l' },
@@ -1073,3 +1074,5 @@ exit:
         log_close();
         return rc;
 }
+
+DEFINE_UDEV_HELPER_MAIN(run);
@@ -31,8 +31,9 @@
 #include "alloc-util.h"
 #include "fd-util.h"
 #include "mtd_probe.h"
+#include "udev-helper.h"
 
-int main(int argc, char** argv) {
+static int run(int argc, char** argv) {
         _cleanup_close_ int mtd_fd = -1;
         mtd_info_t mtd_info;
 
@@ -57,3 +58,5 @@ int main(int argc, char** argv) {
 
         return EXIT_SUCCESS;
 }
+
+DEFINE_UDEV_HELPER_MAIN(run);
@@ -24,6 +24,7 @@
 #include "libudev-private.h"
 #include "scsi_id.h"
 #include "string-util.h"
+#include "udev-helper.h"
 #include "udev-util.h"
 
 static const struct option options[] = {
@@ -556,7 +557,7 @@ out:
         return retval;
 }
 
-int main(int argc, char **argv) {
+static int run(int argc, char **argv) {
         _cleanup_(udev_unrefp) struct udev *udev;
         int retval = 0;
         char maj_min_dev[MAX_PATH_LEN];
@@ -611,3 +612,5 @@ exit:
         log_close();
         return retval;
 }
+
+DEFINE_UDEV_HELPER_MAIN(run);
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "device-private.h"
+#include "random-util.h"
+#include "siphash24.h"
+#include "string-util.h"
+#include "udev-device-generations.h"
+
+#define DEVICE_GENERATIONS_SLOTS 65536U
+
+/* A table of counters, indexed by the hash of a devpath, which the main daemon increases whenever an event for the
+ * device is queued or finished. It lives in shared memory set up before any worker is forked, hence the workers
+ * always see the current values, and can tell whether what they remember about a device might be outdated. Devices
+ * which share a slot only cause needless invalidations. */
+struct DeviceGenerations {
+        uint8_t hash_key[16];
+        uint32_t slots[DEVICE_GENERATIONS_SLOTS];
+};
+
+int device_generations_new(DeviceGenerations **ret) {
+        DeviceGenerations *g;
+
+        assert(ret);
+
+        g = mmap(NULL, sizeof(DeviceGenerations), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (g == MAP_FAILED)
+                return -errno;
+
+        random_bytes(g->hash_key, sizeof(g->hash_key));
+
+        *ret = g;
+        return 0;
+}
+
+DeviceGenerations *device_generations_free(DeviceGenerations *g) {
+        if (g)
+                (void) munmap(g, sizeof(DeviceGenerations));
+
+        return NULL;
+}
+
+static uint32_t *slot(DeviceGenerations *g, const char *devpath) {
+        return g->slots + siphash24(devpath, strlen(devpath), g->hash_key) % DEVICE_GENERATIONS_SLOTS;
+}
+
+void device_generations_bump(DeviceGenerations *g, const char *devpath) {
+        if (!g || !devpath)
+                return;
+
+        __sync_fetch_and_add(slot(g, devpath), 1);
+}
+
+uint32_t device_generations_get(DeviceGenerations *g, const char *devpath) {
+        assert(g);
+        assert(devpath);
+
+        return *(volatile uint32_t*) slot(g, devpath);
+}
+
+static uint64_t get_generation(const char *syspath, void *userdata) {
+        const char *devpath;
+
+        devpath = startswith(syspath, "/sys");
+        if (!devpath)
+                return 0;
+
+        return device_generations_get(userdata, devpath);
+}
+
+/* Lets sd-device keep the parents of the devices we handle, together with their sysfs attributes and database
+ * properties, until an event for them comes along. */
+int device_generations_enable_parent_cache(DeviceGenerations *g) {
+        assert(g);
+
+        return device_parent_cache_enable(get_generation, g);
+}
@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+#pragma once
+
+#include <inttypes.h>
+
+#include "macro.h"
+
+typedef struct DeviceGenerations DeviceGenerations;
+
+int device_generations_new(DeviceGenerations **ret);
+DeviceGenerations *device_generations_free(DeviceGenerations *g);
+DEFINE_TRIVIAL_CLEANUP_FUNC(DeviceGenerations*, device_generations_free);
+
+void device_generations_bump(DeviceGenerations *g, const char *devpath);
+uint32_t device_generations_get(DeviceGenerations *g, const char *devpath);
+
+int device_generations_enable_parent_cache(DeviceGenerations *g);
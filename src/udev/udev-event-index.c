@@ -0,0 +1,403 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+
+#include "alloc-util.h"
+#include "hash-funcs.h"
+#include "hashmap.h"
+#include "string-util.h"
+#include "udev-event-index.h"
+
+/* A node of the devpath trie, one per path component. A devpath is split at each '/', including the empty component
+ * in front of the leading slash, which makes "being a parent or child device" exactly the same as "being an ancestor
+ * or descendant in the trie". */
+struct EventIndexNode {
+        EventIndexNode *parent;
+        Hashmap *children;                    /* component name → EventIndexNode */
+        LIST_HEAD(EventIndexEntry, entries);  /* events for exactly this devpath, in seqnum order */
+        unsigned n_below;                     /* number of events for devpaths below this node */
+        char name[];
+};
+
+struct EventIndex {
+        EventIndexNode *root;
+        Hashmap *by_devnum[2];                /* dev_t → first event, for character and block devices */
+        Hashmap *by_ifindex;                  /* ifindex → first event */
+        unsigned n_entries;
+};
+
+static EventIndexNode *node_new(EventIndexNode *parent, const char *name) {
+        EventIndexNode *n;
+        size_t l;
+
+        l = strlen(name);
+        n = malloc0(offsetof(EventIndexNode, name) + l + 1);
+        if (!n)
+                return NULL;
+
+        memcpy(n->name, name, l + 1);
+
+        if (parent) {
+                if (hashmap_ensure_allocated(&parent->children, &string_hash_ops) < 0 ||
+                    hashmap_put(parent->children, n->name, n) < 0)
+                        return mfree(n);
+
+                n->parent = parent;
+        }
+
+        return n;
+}
+
+static void node_free(EventIndexNode *n) {
+        EventIndexNode *c;
+
+        if (!n)
+                return;
+
+        while ((c = hashmap_steal_first(n->children)))
+                node_free(c);
+
+        hashmap_free(n->children);
+        free(n);
+}
+
+/* Drops the node and all ancestors that became unused, but never the root */
+static void node_prune(EventIndexNode *n) {
+        while (n && n->parent && !n->entries && hashmap_isempty(n->children)) {
+                EventIndexNode *parent = n->parent;
+
+                hashmap_remove(parent->children, n->name);
+                hashmap_free(n->children);
+                free(n);
+
+                n = parent;
+        }
+}
+
+static int node_get(EventIndex *index, const char *devpath, EventIndexNode **ret) {
+        EventIndexNode *n;
+        char *path, *p;
+
+        path = strdupa(devpath);
+        n = index->root;
+
+        for (p = path;;) {
+                EventIndexNode *c;
+                char *slash;
+
+                slash = strchr(p, '/');
+                if (slash)
+                        *slash = 0;
+
+                c = hashmap_get(n->children, p);
+                if (!c) {
+                        c = node_new(n, p);
+                        if (!c) {
+                                node_prune(n);
+                                return -ENOMEM;
+                        }
+                }
+
+                n = c;
+                if (!slash)
+                        break;
+
+                p = slash + 1;
+        }
+
+        *ret = n;
+        return 0;
+}
+
+static EventIndexNode *node_find(EventIndex *index, const char *devpath) {
+        EventIndexNode *n;
+        char *path, *p;
+
+        path = strdupa(devpath);
+        n = index->root;
+
+        for (p = path; n;) {
+                char *slash;
+
+                slash = strchr(p, '/');
+                if (slash)
+                        *slash = 0;
+
+                n = hashmap_get(n->children, p);
+                if (!slash)
+                        break;
+
+                p = slash + 1;
+        }
+
+        return n;
+}
+
+/* Returns any event below the node which was queued before the given seqnum. Subtrees without events are never
+ * entered, hence for the common case of leaf devices this is a single check. */
+static EventIndexEntry *node_find_earlier_below(EventIndexNode *n, unsigned long long int seqnum) {
+        EventIndexNode *c;
+        Iterator i;
+
+        if (n->n_below == 0)
+                return NULL;
+
+        HASHMAP_FOREACH(c, n->children, i) {
+                EventIndexEntry *b;
+
+                if (c->entries && c->entries->seqnum < seqnum)
+                        return c->entries;
+
+                b = node_find_earlier_below(c, seqnum);
+                if (b)
+                        return b;
+        }
+
+        return NULL;
+}
+
+EventIndex *event_index_new(void) {
+        EventIndex *index;
+
+        index = new0(EventIndex, 1);
+        if (!index)
+                return NULL;
+
+        index->root = node_new(NULL, "");
+        if (!index->root)
+                return mfree(index);
+
+        return index;
+}
+
+EventIndex *event_index_free(EventIndex *index) {
+        if (!index)
+                return NULL;
+
+        /* The entries are owned by the caller, we only drop our own bookkeeping */
+        node_free(index->root);
+        hashmap_free(index->by_devnum[false]);
+        hashmap_free(index->by_devnum[true]);
+        hashmap_free(index->by_ifindex);
+
+        return mfree(index);
+}
+
+int event_index_add(EventIndex *index, EventIndexEntry *e) {
+        EventIndexEntry *devnum_head = NULL, *ifindex_head = NULL;
+        bool devnum_added = false;
+        Hashmap **devnum_map = NULL;
+        EventIndexNode *node, *p;
+        int r;
+
+        assert(index);
+        assert(e);
+        assert(e->devpath);
+        assert(!e->node);
+
+        /* Allocate everything first, so that we don't have to undo any list changes on failure */
+        if (major(e->devnum) != 0) {
+                devnum_map = &index->by_devnum[e->is_block];
+
+                r = hashmap_ensure_allocated(devnum_map, &devt_hash_ops);
+                if (r < 0)
+                        return r;
+        }
+
+        if (e->ifindex != 0) {
+                r = hashmap_ensure_allocated(&index->by_ifindex, NULL);
+                if (r < 0)
+                        return r;
+        }
+
+        r = node_get(index, e->devpath, &node);
+        if (r < 0)
+                return r;
+
+        if (devnum_map) {
+                devnum_head = hashmap_get(*devnum_map, &e->devnum);
+                if (!devnum_head) {
+                        r = hashmap_put(*devnum_map, &e->devnum, e);
+                        if (r < 0)
+                                goto fail;
+
+                        devnum_added = true;
+                }
+        }
+
+        if (e->ifindex != 0) {
+                ifindex_head = hashmap_get(index->by_ifindex, INT_TO_PTR(e->ifindex));
+                if (!ifindex_head) {
+                        r = hashmap_put(index->by_ifindex, INT_TO_PTR(e->ifindex), e);
+                        if (r < 0)
+                                goto fail;
+                }
+        }
+
+        /* Events are added in seqnum order, hence appending keeps every list sorted, and the head of each list is
+         * always the earliest event for its key. */
+        LIST_INIT(same_devpath, e);
+        LIST_INIT(same_devnum, e);
+        LIST_INIT(same_ifindex, e);
+
+        LIST_APPEND(same_devpath, node->entries, e);
+        if (devnum_head)
+                LIST_APPEND(same_devnum, devnum_head, e);
+        if (ifindex_head)
+                LIST_APPEND(same_ifindex, ifindex_head, e);
+
+        for (p = node->parent; p; p = p->parent)
+                p->n_below++;
+
+        e->node = node;
+        index->n_entries++;
+
+        return 0;
+
+fail:
+        if (devnum_added)
+                hashmap_remove(*devnum_map, &e->devnum);
+        node_prune(node);
+        return r;
+}
+
+void event_index_remove(EventIndex *index, EventIndexEntry *e) {
+        EventIndexEntry *head;
+        EventIndexNode *p;
+
+        assert(index);
+        assert(e);
+
+        if (!e->node)
+                return;
+
+        if (major(e->devnum) != 0) {
+                Hashmap *h = index->by_devnum[e->is_block];
+
+                head = hashmap_get(h, &e->devnum);
+                if (head == e) {
+                        if (e->same_devnum_next)
+                                /* The key points into the entry, hence it needs to be replaced too */
+                                (void) hashmap_replace(h, &e->same_devnum_next->devnum, e->same_devnum_next);
+                        else
+                                hashmap_remove(h, &e->devnum);
+                }
+
+                LIST_REMOVE(same_devnum, head, e);
+        }
+
+        if (e->ifindex != 0) {
+                head = hashmap_get(index->by_ifindex, INT_TO_PTR(e->ifindex));
+                if (head == e) {
+                        if (e->same_ifindex_next)
+                                (void) hashmap_update(index->by_ifindex, INT_TO_PTR(e->ifindex), e->same_ifindex_next);
+                        else
+                                hashmap_remove(index->by_ifindex, INT_TO_PTR(e->ifindex));
+                }
+
+                LIST_REMOVE(same_ifindex, head, e);
+        }
+
+        LIST_REMOVE(same_devpath, e->node->entries, e);
+        for (p = e->node->parent; p; p = p->parent)
+                p->n_below--;
+
+        node_prune(e->node);
+        e->node = NULL;
+
+        assert(index->n_entries > 0);
+        index->n_entries--;
+}
+
+/* Returns the earliest event for exactly this devpath, the others follow in seqnum order */
+EventIndexEntry *event_index_get_devpath(EventIndex *index, const char *devpath) {
+        EventIndexNode *n;
+
+        assert(index);
+        assert(devpath);
+
+        n = node_find(index, devpath);
+        return n ? n->entries : NULL;
+}
+
+/* Returns an earlier event the given one has to wait for, i.e. one for the same device node or network interface, for
+ * the old name of a renamed device, for the same devpath, or for a parent or child device. This is the same set of
+ * events the whole queue used to be scanned for, but every check is a lookup now. */
+EventIndexEntry *event_index_find_blocker(EventIndex *index, const EventIndexEntry *e) {
+        EventIndexEntry *b;
+        EventIndexNode *n;
+        char *path, *p;
+
+        assert(index);
+        assert(e);
+        assert(e->devpath);
+
+        /* check major/minor */
+        if (major(e->devnum) != 0) {
+                b = hashmap_get(index->by_devnum[e->is_block], &e->devnum);
+                if (b && b->seqnum < e->seqnum)
+                        return b;
+        }
+
+        /* check network device ifindex */
+        if (e->ifindex != 0) {
+                b = hashmap_get(index->by_ifindex, INT_TO_PTR(e->ifindex));
+                if (b && b->seqnum < e->seqnum)
+                        return b;
+        }
+
+        /* check our old name */
+        if (e->devpath_old) {
+                n = node_find(index, e->devpath_old);
+                if (n && n->entries && n->entries->seqnum < e->seqnum)
+                        return n->entries;
+        }
+
+        /* walk down our devpath, any event found on the way is for a parent device */
+        path = strdupa(e->devpath);
+        n = index->root;
+
+        for (p = path;;) {
+                char *slash;
+
+                slash = strchr(p, '/');
+                if (slash)
+                        *slash = 0;
+
+                n = hashmap_get(n->children, p);
+                if (!n)
+                        return NULL;
+
+                if (!slash)
+                        break;
+
+                if (n->entries && n->entries->seqnum < e->seqnum)
+                        return n->entries;
+
+                p = slash + 1;
+        }
+
+        /* identical device event found */
+        LIST_FOREACH(same_devpath, b, n->entries) {
+                if (b->seqnum >= e->seqnum)
+                        break;
+
+                /* devices names might have changed/swapped in the meantime */
+                if (major(e->devnum) != 0 && (e->devnum != b->devnum || e->is_block != b->is_block))
+                        continue;
+                if (e->ifindex != 0 && e->ifindex != b->ifindex)
+                        continue;
+
+                return b;
+        }
+
+        /* child device event found */
+        return node_find_earlier_below(n, e->seqnum);
+}
+
+unsigned event_index_size(EventIndex *index) {
+        return index ? index->n_entries : 0;
+}
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "list.h"
+#include "macro.h"
+
+typedef struct EventIndex EventIndex;
+typedef struct EventIndexNode EventIndexNode;
+typedef struct EventIndexEntry EventIndexEntry;
+
+/* The part of a queued or running uevent that decides which other events it has to wait for. Entries are embedded in
+ * the event object by the caller, and must be added to the index in seqnum order. */
+struct EventIndexEntry {
+        unsigned long long int seqnum;
+        const char *devpath;
+        const char *devpath_old;
+        dev_t devnum;
+        int ifindex;
+        bool is_block;
+
+        /* private */
+        EventIndexNode *node;
+        LIST_FIELDS(EventIndexEntry, same_devpath);
+        LIST_FIELDS(EventIndexEntry, same_devnum);
+        LIST_FIELDS(EventIndexEntry, same_ifindex);
+};
+
+EventIndex *event_index_new(void);
+EventIndex *event_index_free(EventIndex *index);
+DEFINE_TRIVIAL_CLEANUP_FUNC(EventIndex*, event_index_free);
+
+int event_index_add(EventIndex *index, EventIndexEntry *e);
+void event_index_remove(EventIndex *index, EventIndexEntry *e);
+
+EventIndexEntry *event_index_get_devpath(EventIndex *index, const char *devpath);
+EventIndexEntry *event_index_find_blocker(EventIndex *index, const EventIndexEntry *e);
+unsigned event_index_size(EventIndex *index);
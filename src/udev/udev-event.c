@@ -15,26 +15,47 @@
 #include <sys/epoll.h>
 #include <sys/prctl.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "alloc-util.h"
 #include "fd-util.h"
 #include "format-util.h"
+#include "hashmap.h"
+#include "io-util.h"
 #include "netlink-util.h"
+#include "path-util.h"
 #include "process-util.h"
 #include "signal-util.h"
 #include "string-util.h"
+#include "strv.h"
+#include "udev-helper.h"
 #include "udev.h"
 
+/* A persistent helper started by this process, see udev-helper.h. A helper which died or broke the protocol is
+ * stopped (fd < 0) and started again for the next command. A program which could not be started as helper is not
+ * tried again, it stays in the table with failed set. */
+typedef struct Helper {
+        char *path;
+        pid_t pid;
+        int fd;
+        bool failed;
+} Helper;
+
 typedef struct Spawn {
         const char *cmd;
         pid_t pid;
+        Helper *helper;
         usec_t timeout_warn;
         usec_t timeout;
         bool accept_failure;
 } Spawn;
 
+#define HELPER_START_TIMEOUT_USEC (5 * USEC_PER_SEC)
+
+static Hashmap *helpers = NULL;
+
 struct udev_event *udev_event_new(struct udev_device *dev) {
         struct udev *udev = udev_device_get_udev(dev);
         struct udev_event *event;
@@ -404,60 +425,94 @@ out:
         return l;
 }
 
-static int spawn_exec(struct udev_event *event,
-                      const char *cmd, char *const argv[], char **envp,
-                      int fd_stdout, int fd_stderr) {
-        _cleanup_close_ int fd = -1;
-        int r;
-
-        /* discard child output or connect to pipe */
-        fd = open("/dev/null", O_RDWR);
-        if (fd >= 0) {
-                r = dup2(fd, STDIN_FILENO);
-                if (r < 0)
-                        log_warning_errno(errno, "redirecting stdin failed: %m");
-
-                if (fd_stdout < 0) {
-                        r = dup2(fd, STDOUT_FILENO);
-                        if (r < 0)
-                                log_warning_errno(errno, "redirecting stdout failed: %m");
+/* Until the child calls execve() it runs on the memory of the parent, hence everything is prepared in advance, the
+ * child only makes system calls, and reports a failed execve() through exec_errno. */
+static pid_t spawn_vfork(const int fds[static 3], char *const argv[], char **envp, volatile int *exec_errno) {
+        sigset_t mask, saved_mask;
+        pid_t pid;
+        int i;
+
+        /* no signal handler of ours may run in the child, it would do so on our memory */
+        assert_se(sigfillset(&mask) >= 0);
+        assert_se(sigprocmask(SIG_SETMASK, &mask, &saved_mask) >= 0);
+
+        pid = vfork();
+        if (pid == 0) {
+                /* Child */
+                (void) reset_all_signal_handlers();
+
+                for (i = 0; i < 3; i++) {
+                        /* dup2() does nothing if the fd is already in place, and in particular keeps O_CLOEXEC set,
+                         * hence clear it explicitly in that case */
+                        if (fds[i] == i) {
+                                if (fcntl(i, F_SETFD, 0) < 0) {
+                                        *exec_errno = errno;
+                                        _exit(EXIT_FAILURE);
+                                }
+                        } else if (dup2(fds[i], i) < 0) {
+                                *exec_errno = errno;
+                                _exit(EXIT_FAILURE);
+                        }
                 }
 
-                if (fd_stderr < 0) {
-                        r = dup2(fd, STDERR_FILENO);
-                        if (r < 0)
-                                log_warning_errno(errno, "redirecting stderr failed: %m");
-                }
-        } else
-                log_warning_errno(errno, "open /dev/null failed: %m");
+                /* terminate child in case parent goes away */
+                (void) prctl(PR_SET_PDEATHSIG, SIGTERM);
 
-        /* connect pipes to std{out,err} */
-        if (fd_stdout >= 0) {
-                r = dup2(fd_stdout, STDOUT_FILENO);
-                if (r < 0)
-                        log_warning_errno(errno, "redirecting stdout failed: %m");
+                /* restore sigmask before exec */
+                (void) reset_signal_mask();
+
+                execve(argv[0], argv, envp);
 
-                fd_stdout = safe_close(fd_stdout);
+                *exec_errno = errno;
+                _exit(EXIT_FAILURE);
         }
+        if (pid < 0)
+                pid = -errno;
 
-        if (fd_stderr >= 0) {
-                r = dup2(fd_stderr, STDERR_FILENO);
-                if (r < 0)
-                        log_warning_errno(errno, "redirecting stdout failed: %m");
+        assert_se(sigprocmask(SIG_SETMASK, &saved_mask, NULL) >= 0);
+
+        return pid;
+}
+
+/* Starts the program with vfork(), which saves copying the page tables of the worker */
+static int spawn_exec(const char *cmd, char *const argv[], char **envp,
+                      int fd_stdin, int fd_stdout, int fd_stderr,
+                      pid_t *ret_pid) {
+        int fds[3] = { fd_stdin, fd_stdout, fd_stderr };
+        _cleanup_close_ int fd_null = -1;
+        volatile int exec_errno = 0;
+        pid_t pid;
+        int i;
 
-                fd_stderr = safe_close(fd_stderr);
+        assert(argv);
+        assert(ret_pid);
+
+        /* discard child output or connect to pipe */
+        for (i = 0; i < 3; i++) {
+                if (fds[i] >= 0)
+                        continue;
+
+                if (fd_null < 0) {
+                        fd_null = open("/dev/null", O_RDWR|O_CLOEXEC);
+                        if (fd_null < 0)
+                                return log_error_errno(errno, "open /dev/null failed: %m");
+                }
+
+                fds[i] = fd_null;
         }
 
-        /* terminate child in case parent goes away */
-        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        pid = spawn_vfork(fds, argv, envp, &exec_errno);
+        if (pid < 0)
+                return log_error_errno(pid, "failed to fork '%s': %m", cmd);
 
-        /* restore sigmask before exec */
-        (void) reset_signal_mask();
+        if (exec_errno != 0) {
+                (void) wait_for_terminate(pid, NULL);
+                return log_error_errno(exec_errno, "failed to execute '%s' '%s': %m", argv[0], cmd);
+        }
 
-        execve(argv[0], argv, envp);
+        *ret_pid = pid;
 
-        /* exec failed */
-        return log_error_errno(errno, "failed to execute '%s' '%s': %m", argv[0], cmd);
+        return 0;
 }
 
 static void spawn_read(struct udev_event *event,
@@ -612,27 +667,25 @@ static int on_spawn_timeout_warning(sd_event_source *s, uint64_t usec, void *use
         return 1;
 }
 
-static int on_spawn_sigchld(sd_event_source *s, const siginfo_t *si, void *userdata) {
-        Spawn *spawn = userdata;
-
+static int spawn_terminated(sd_event_source *s, Spawn *spawn, int code, int status) {
         assert(spawn);
 
-        switch (si->si_code) {
+        switch (code) {
         case CLD_EXITED:
-                if (si->si_status == 0) {
+                if (status == 0) {
                         log_debug("Process '%s' succeeded.", spawn->cmd);
                         sd_event_exit(sd_event_source_get_event(s), 0);
 
                         return 1;
                 } else if (spawn->accept_failure)
-                        log_debug("Process '%s' failed with exit code %i.", spawn->cmd, si->si_status);
+                        log_debug("Process '%s' failed with exit code %i.", spawn->cmd, status);
                 else
-                        log_warning("Process '%s' failed with exit code %i.", spawn->cmd, si->si_status);
+                        log_warning("Process '%s' failed with exit code %i.", spawn->cmd, status);
 
                 break;
         case CLD_KILLED:
         case CLD_DUMPED:
-                log_warning("Process '%s' terminated by signal %s.", spawn->cmd, signal_to_string(si->si_status));
+                log_warning("Process '%s' terminated by signal %s.", spawn->cmd, signal_to_string(status));
 
                 break;
         default:
@@ -644,14 +697,43 @@ static int on_spawn_sigchld(sd_event_source *s, const siginfo_t *si, void *userd
         return 1;
 }
 
+static int on_spawn_sigchld(sd_event_source *s, const siginfo_t *si, void *userdata) {
+        return spawn_terminated(s, userdata, si->si_code, si->si_status);
+}
+
+static void helper_stop(Helper *helper);
+
+static int on_spawn_reply(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        Spawn *spawn = userdata;
+        int r, code, status;
+
+        assert(spawn);
+        assert(spawn->helper);
+
+        r = udev_helper_receive_reply(fd, &code, &status);
+        if (r == -EAGAIN)
+                return 1;
+        if (r < 0) {
+                log_error_errno(r, "Failed to receive result of '%s' from helper ["PID_FMT"]: %m", spawn->cmd, spawn->pid);
+                helper_stop(spawn->helper);
+                sd_event_exit(sd_event_source_get_event(s), -EIO);
+
+                return 1;
+        }
+
+        return spawn_terminated(s, spawn, code, status);
+}
+
+/* Waits for the process to terminate, or for the reply of the helper if one runs the command */
 static int spawn_wait(struct udev_event *event,
                       usec_t timeout_usec,
                       usec_t timeout_warn_usec,
-                      const char *cmd, pid_t pid,
+                      const char *cmd, pid_t pid, Helper *helper,
                       bool accept_failure) {
         Spawn spawn = {
                 .cmd = cmd,
                 .pid = pid,
+                .helper = helper,
                 .accept_failure = accept_failure,
         };
         _cleanup_(sd_event_unrefp) sd_event *e = NULL;
@@ -686,7 +768,10 @@ static int spawn_wait(struct udev_event *event,
                 }
         }
 
-        r = sd_event_add_child(e, NULL, pid, WEXITED, on_spawn_sigchld, &spawn);
+        if (helper)
+                r = sd_event_add_io(e, NULL, helper->fd, EPOLLIN, on_spawn_reply, &spawn);
+        else
+                r = sd_event_add_child(e, NULL, pid, WEXITED, on_spawn_sigchld, &spawn);
         if (r < 0)
                 return r;
 
@@ -736,6 +821,113 @@ out:
         return 0;
 }
 
+static void helper_stop(Helper *helper) {
+        assert(helper);
+
+        helper->fd = safe_close(helper->fd);
+
+        if (helper->pid > 0) {
+                sigkill_wait(helper->pid);
+                helper->pid = 0;
+        }
+}
+
+static Helper *helper_free(Helper *helper) {
+        if (!helper)
+                return NULL;
+
+        helper_stop(helper);
+        free(helper->path);
+
+        return mfree(helper);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(Helper*, helper_free);
+
+static int helper_start(Helper *helper) {
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        char *argv[] = { helper->path, (char*) UDEV_HELPER_ARG, NULL };
+        int r, code, status;
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, pair) < 0)
+                return -errno;
+
+        r = spawn_exec(helper->path, argv, environ, pair[1], -1, -1, &helper->pid);
+        if (r < 0)
+                return r;
+
+        helper->fd = TAKE_FD(pair[0]);
+
+        /* A program which does not know the protocol most likely just exits */
+        r = fd_wait_for_event(helper->fd, POLLIN, HELPER_START_TIMEOUT_USEC);
+        if (r == 0)
+                r = -ETIMEDOUT;
+        if (r > 0)
+                r = udev_helper_receive_reply(helper->fd, &code, &status);
+        if (r < 0) {
+                helper_stop(helper);
+                return r;
+        }
+
+        return 0;
+}
+
+/* Returns the running helper for the program, starting it if necessary, or NULL if the program is to be executed */
+static Helper *helper_get(const char *path) {
+        _cleanup_(helper_freep) Helper *helper = NULL;
+        const char *name;
+        Helper *found;
+        int r;
+
+        /* The programs shipped with udev which are able to run as persistent helpers */
+        name = path_startswith(path, UDEVLIBEXECDIR);
+        if (!name || !STR_IN_SET(name, "ata_id", "cdrom_id", "mtd_probe", "scsi_id", "v4l_id"))
+                return NULL;
+
+        found = hashmap_get(helpers, path);
+        if (found) {
+                if (found->fd >= 0)
+                        return found;
+                if (found->failed)
+                        return NULL;
+
+                goto start;
+        }
+
+        if (hashmap_ensure_allocated(&helpers, &string_hash_ops) < 0)
+                return NULL;
+
+        helper = new0(Helper, 1);
+        if (!helper)
+                return NULL;
+
+        helper->fd = -1;
+        helper->path = strdup(path);
+        if (!helper->path)
+                return NULL;
+
+        if (hashmap_put(helpers, helper->path, helper) < 0)
+                return NULL;
+
+        found = TAKE_PTR(helper);
+
+start:
+        r = helper_start(found);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to start '%s' as persistent helper, executing it for every command: %m", path);
+                found->failed = true;
+                return NULL;
+        }
+
+        log_debug("Started persistent helper '%s' ["PID_FMT"]", path, found->pid);
+
+        return found;
+}
+
+void udev_event_helpers_free(void) {
+        helpers = hashmap_free_with_destructor(helpers, helper_free);
+}
+
 int udev_event_spawn(struct udev_event *event,
                      usec_t timeout_usec,
                      usec_t timeout_warn_usec,
@@ -744,50 +936,72 @@ int udev_event_spawn(struct udev_event *event,
                      char *result, size_t ressize) {
         int outpipe[2] = {-1, -1};
         int errpipe[2] = {-1, -1};
-        pid_t pid;
+        char arg[UTIL_PATH_SIZE];
+        char *argv[128];
+        char program[UTIL_PATH_SIZE];
+        char **envp;
+        Helper *helper;
+        pid_t pid = 0;
         int err = 0;
 
         /* pipes from child to parent */
         if (result != NULL || log_get_max_level() >= LOG_INFO) {
-                if (pipe2(outpipe, O_NONBLOCK) != 0) {
+                if (pipe2(outpipe, O_NONBLOCK|O_CLOEXEC) != 0) {
                         err = log_error_errno(errno, "pipe failed: %m");
                         goto out;
                 }
         }
         if (log_get_max_level() >= LOG_INFO) {
-                if (pipe2(errpipe, O_NONBLOCK) != 0) {
+                if (pipe2(errpipe, O_NONBLOCK|O_CLOEXEC) != 0) {
                         err = log_error_errno(errno, "pipe failed: %m");
                         goto out;
                 }
         }
 
-        err = safe_fork("(spawn)", FORK_RESET_SIGNALS|FORK_LOG, &pid);
-        if (err < 0)
-                goto out;
-        if (err == 0) {
-                char arg[UTIL_PATH_SIZE];
-                char *argv[128];
-                char program[UTIL_PATH_SIZE];
-
-                /* child closes parent's ends of pipes */
-                outpipe[READ_END] = safe_close(outpipe[READ_END]);
-                errpipe[READ_END] = safe_close(errpipe[READ_END]);
-
-                strscpy(arg, sizeof(arg), cmd);
-                udev_build_argv(event->udev, arg, NULL, argv);
-
-                /* allow programs in /usr/lib/udev/ to be called without the path */
-                if (argv[0][0] != '/') {
-                        strscpyl(program, sizeof(program), UDEVLIBEXECDIR "/", argv[0], NULL);
-                        argv[0] = program;
-                }
+        strscpy(arg, sizeof(arg), cmd);
+        udev_build_argv(event->udev, arg, NULL, argv);
+
+        /* allow programs in /usr/lib/udev/ to be called without the path */
+        if (argv[0][0] != '/') {
+                strscpyl(program, sizeof(program), UDEVLIBEXECDIR "/", argv[0], NULL);
+                argv[0] = program;
+        }
+
+        envp = udev_device_get_properties_envp(event->dev);
+
+        log_debug("starting '%s'", cmd);
 
-                log_debug("starting '%s'", cmd);
+        helper = helper_get(argv[0]);
+        if (helper) {
+                _cleanup_close_ int fd_null = -1;
 
-                spawn_exec(event, cmd, argv, udev_device_get_properties_envp(event->dev),
-                           outpipe[WRITE_END], errpipe[WRITE_END]);
+                if (outpipe[WRITE_END] < 0 || errpipe[WRITE_END] < 0) {
+                        fd_null = open("/dev/null", O_RDWR|O_CLOEXEC);
+                        if (fd_null < 0) {
+                                err = log_error_errno(errno, "open /dev/null failed: %m");
+                                goto out;
+                        }
+                }
 
-                _exit(2);
+                err = udev_helper_send_request(helper->fd, argv, envp,
+                                               outpipe[WRITE_END] >= 0 ? outpipe[WRITE_END] : fd_null,
+                                               errpipe[WRITE_END] >= 0 ? errpipe[WRITE_END] : fd_null);
+                if (IN_SET(err, -E2BIG, -ENOMEM)) {
+                        /* Nothing was sent, the helper can still be used for other commands */
+                        log_debug_errno(err, "Failed to pass '%s' to helper ["PID_FMT"], executing it: %m", cmd, helper->pid);
+                        helper = NULL;
+                } else if (err < 0) {
+                        log_debug_errno(err, "Failed to pass '%s' to helper ["PID_FMT"], executing it and restarting the helper later: %m", cmd, helper->pid);
+                        helper_stop(helper);
+                        helper = NULL;
+                } else
+                        pid = helper->pid;
+        }
+
+        if (!helper) {
+                err = spawn_exec(cmd, argv, envp, -1, outpipe[WRITE_END], errpipe[WRITE_END], &pid);
+                if (err < 0)
+                        goto out;
         }
 
         /* parent closed child's ends of pipes */
@@ -800,7 +1014,7 @@ int udev_event_spawn(struct udev_event *event,
                    outpipe[READ_END], errpipe[READ_END],
                    result, ressize);
 
-        err = spawn_wait(event, timeout_usec, timeout_warn_usec, cmd, pid, accept_failure);
+        err = spawn_wait(event, timeout_usec, timeout_warn_usec, cmd, pid, helper, accept_failure);
 
 out:
         if (outpipe[READ_END] >= 0)
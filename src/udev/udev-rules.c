@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -21,8 +22,11 @@
 #include "dirent-util.h"
 #include "escape.h"
 #include "fd-util.h"
+#include "fileio.h"
 #include "fs-util.h"
 #include "glob-util.h"
+#include "hashmap.h"
+#include "mkdir.h"
 #include "path-util.h"
 #include "proc-cmdline.h"
 #include "stat-util.h"
@@ -31,11 +35,13 @@
 #include "string-util.h"
 #include "strv.h"
 #include "sysctl-util.h"
+#include "time-util.h"
 #include "udev.h"
 #include "user-util.h"
 #include "util.h"
 
 #define PREALLOC_TOKEN          2048
+#define RULES_CACHE_FILE        "/run/udev/rules.bin"
 
 struct uid_gid {
         unsigned int name_off;
@@ -52,10 +58,29 @@ static const char* const rules_dirs[] = {
         NULL
 };
 
+/* device properties rules are indexed by, in the order of preference, see rules_build_index() */
+enum rules_index_type {
+        RULES_INDEX_SUBSYSTEM,
+        RULES_INDEX_KERNEL,
+        RULES_INDEX_ACTION,
+        _RULES_INDEX_MAX,
+};
+
+struct rule_list {
+        char *value;
+        unsigned int *rules;            /* token index of every rule, ascending */
+        size_t n_rules;
+        size_t n_allocated;
+};
+
 struct udev_rules {
         struct udev *udev;
+        char **dirs;
         usec_t dirs_ts_usec;
         int resolve_names;
+        char *cache_file;
+        char **cache_extra_files;
+        char *cache_version;
 
         /* every key in the rules file becomes a token */
         struct token *tokens;
@@ -65,6 +90,16 @@ struct udev_rules {
         /* all key strings are copied and de-duplicated in a single continuous string buffer */
         struct strbuf *strbuf;
 
+        /* when loaded from the cache, tokens and strings point into the mapped file instead */
+        void *map;
+        size_t map_size;
+        char *strings;
+
+        /* rules which can only match a single subsystem, kernel name or action, indexed by that value */
+        Hashmap *index[_RULES_INDEX_MAX];
+        struct rule_list unindexed;
+        bool indexed;
+
         /* during rule parsing, uid/gid lookup results are cached */
         struct uid_gid *uids;
         unsigned int uids_cur;
@@ -75,7 +110,7 @@ struct udev_rules {
 };
 
 static char *rules_str(struct udev_rules *rules, unsigned int off) {
-        return rules->strbuf->buf + off;
+        return (rules->strbuf ? rules->strbuf->buf : rules->strings) + off;
 }
 
 static unsigned int rules_add_string(struct udev_rules *rules, const char *s) {
@@ -319,7 +354,7 @@ static void dump_token(struct udev_rules *rules, struct token *token) {
         enum operation_type op = token->key.op;
         enum string_glob_type glob = token->key.glob;
         const char *value = rules_str(rules, token->key.value_off);
-        const char *attr = &rules->strbuf->buf[token->key.attr_off];
+        const char *attr = rules_str(rules, token->key.attr_off);
 
         switch (type) {
         case TK_RULE:
@@ -329,9 +364,9 @@ static void dump_token(struct udev_rules *rules, struct token *token) {
                         unsigned int idx = (tk_ptr - tks_ptr) / sizeof(struct token);
 
                         log_debug("* RULE %s:%u, token: %u, count: %u, label: '%s'",
-                                  &rules->strbuf->buf[token->rule.filename_off], token->rule.filename_line,
+                                  rules_str(rules, token->rule.filename_off), token->rule.filename_line,
                                   idx, token->rule.token_count,
-                                  &rules->strbuf->buf[token->rule.label_off]);
+                                  rules_str(rules, token->rule.label_off));
                         break;
                 }
         case TK_M_ACTION:
@@ -428,11 +463,15 @@ static void dump_token(struct udev_rules *rules, struct token *token) {
 static void dump_rules(struct udev_rules *rules) {
         unsigned int i;
 
-        log_debug("dumping %u (%zu bytes) tokens, %zu (%zu bytes) strings",
-                  rules->token_cur,
-                  rules->token_cur * sizeof(struct token),
-                  rules->strbuf->nodes_count,
-                  rules->strbuf->len);
+        /* the string buffer is gone when the rules were loaded from the cache */
+        if (rules->strbuf)
+                log_debug("dumping %u (%zu bytes) tokens, %zu (%zu bytes) strings",
+                          rules->token_cur,
+                          rules->token_cur * sizeof(struct token),
+                          rules->strbuf->nodes_count,
+                          rules->strbuf->len);
+        else
+                log_debug("dumping %u (%zu bytes) tokens", rules->token_cur, rules->token_cur * sizeof(struct token));
         for (i = 0; i < rules->token_cur; i++)
                 dump_token(rules, &rules->tokens[i]);
 }
@@ -1516,50 +1555,244 @@ static int parse_file(struct udev_rules *rules, const char *filename) {
         return 0;
 }
 
-struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
-        struct udev_rules *rules;
-        struct udev_list file_list;
-        struct token end_token;
-        char **files, **f;
+/* The compiled rules are written to the cache file, RULES_CACHE_FILE by default, after parsing, and mapped instead of parsing all rules files
+ * again, as long as none of the files changed. Tokens are stored as they are in memory, hence the cache is only used by
+ * the same udev version it was written by. */
+struct rules_cache_header {
+        uint8_t signature[8];
+        char version[16];
+        uint32_t header_size;
+        uint32_t token_size;
+        uint32_t token_types;
+        int32_t resolve_names;
+        uint64_t tokens_count;
+        uint64_t stamps_count;
+        uint64_t strings_len;
+        /* followed by the tokens, the stamps and the strings, each aligned to 8 bytes */
+} _packed_;
+
+/* One for every rules file, and for every extra file, by default the user and group databases, since names are resolved
+ * while parsing */
+struct rules_cache_stamp {
+        uint64_t path_off;
+        uint64_t ino;
+        uint64_t size;
+        uint64_t mtime_nsec;
+} _packed_;
+
+static const uint8_t rules_cache_signature[8] = { 'U', 'D', 'E', 'V', 'R', 'U', 'L', 'E' };
+
+static const char* const rules_cache_extra_files[] = {
+        "/etc/passwd",
+        "/etc/group",
+        NULL
+};
+
+static void rules_cache_stamp(const char *path, unsigned int path_off, struct rules_cache_stamp *ret) {
+        struct stat st;
+
+        *ret = (struct rules_cache_stamp) {
+                .path_off = path_off,
+        };
+
+        if (stat(path, &st) < 0)
+                return;
+
+        ret->ino = st.st_ino;
+        ret->size = st.st_size;
+        ret->mtime_nsec = timespec_load_nsec(&st.st_mtim);
+}
+
+static int rules_cache_load(struct udev_rules *rules, char **files) {
+        const struct rules_cache_stamp *stamps;
+        const struct rules_cache_header *h;
+        size_t n_files, n_extra, tokens_off, stamps_off, strings_off, i;
+        _cleanup_close_ int fd = -1;
+        const char *strings;
+        struct stat st;
+        void *map;
         int r;
 
-        rules = new0(struct udev_rules, 1);
-        if (rules == NULL)
-                return NULL;
-        rules->udev = udev;
-        rules->resolve_names = resolve_names;
-        udev_list_init(udev, &file_list, true);
+        if (!rules->cache_file)
+                return -ENOENT;
+
+        fd = open(rules->cache_file, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+        if ((uint64_t) st.st_size < sizeof(struct rules_cache_header) || (uint64_t) st.st_size > SIZE_MAX)
+                return -EBADMSG;
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+                return -errno;
+
+        h = map;
+        n_files = strv_length(files);
+        n_extra = strv_length(rules->cache_extra_files);
+
+        if (memcmp(h->signature, rules_cache_signature, sizeof(h->signature)) != 0 ||
+            h->header_size != sizeof(struct rules_cache_header) ||
+            h->token_size != sizeof(struct token) ||
+            h->token_types != TK_END ||
+            h->tokens_count == 0 || h->tokens_count > UINT_MAX ||
+            h->tokens_count > (uint64_t) st.st_size / sizeof(struct token) ||
+            h->stamps_count > (uint64_t) st.st_size / sizeof(struct rules_cache_stamp) ||
+            h->strings_len == 0 || h->strings_len > (uint64_t) st.st_size) {
+                r = -EBADMSG;
+                goto fail;
+        }
+
+        if (!strneq(h->version, rules->cache_version, sizeof(h->version)) ||
+            h->resolve_names != rules->resolve_names ||
+            h->stamps_count != n_files + n_extra) {
+                r = -ESTALE;
+                goto fail;
+        }
+
+        tokens_off = ALIGN8(sizeof(struct rules_cache_header));
+        stamps_off = ALIGN8(tokens_off + h->tokens_count * sizeof(struct token));
+        strings_off = stamps_off + h->stamps_count * sizeof(struct rules_cache_stamp);
+        if (strings_off + h->strings_len != (uint64_t) st.st_size) {
+                r = -EBADMSG;
+                goto fail;
+        }
+
+        stamps = (const struct rules_cache_stamp*) ((const uint8_t*) map + stamps_off);
+        strings = (const char*) map + strings_off;
+        if (strings[h->strings_len - 1] != '\0' ||
+            ((const struct token*) ((const uint8_t*) map + tokens_off))[h->tokens_count - 1].type != TK_END) {
+                r = -EBADMSG;
+                goto fail;
+        }
+
+        /* The files have to be the same ones, in the same order, and none of them may have been modified */
+        for (i = 0; i < h->stamps_count; i++) {
+                const char *path = i < n_files ? files[i] : rules->cache_extra_files[i - n_files];
+                struct rules_cache_stamp stamp;
+
+                if (stamps[i].path_off >= h->strings_len || !streq(strings + stamps[i].path_off, path)) {
+                        r = -ESTALE;
+                        goto fail;
+                }
+
+                rules_cache_stamp(path, stamps[i].path_off, &stamp);
+                if (memcmp(&stamp, stamps + i, sizeof(stamp)) != 0) {
+                        r = -ESTALE;
+                        goto fail;
+                }
+        }
+
+        rules->map = map;
+        rules->map_size = st.st_size;
+        rules->tokens = (struct token*) ((uint8_t*) map + tokens_off);
+        rules->token_cur = rules->token_max = h->tokens_count;
+        rules->strings = (char*) map + strings_off;
+
+        return 0;
+
+fail:
+        munmap(map, st.st_size);
+        return r;
+}
+
+static int rules_cache_write(struct udev_rules *rules, const struct rules_cache_stamp *stamps, size_t n_stamps) {
+        nsec_t n = now(CLOCK_REALTIME) * NSEC_PER_USEC;
+        struct rules_cache_header h = {
+                .header_size = sizeof(struct rules_cache_header),
+                .token_size = sizeof(struct token),
+                .token_types = TK_END,
+                .resolve_names = rules->resolve_names,
+                .tokens_count = rules->token_cur,
+                .stamps_count = n_stamps,
+                .strings_len = rules->strbuf->len,
+        };
+        static const uint8_t pad[8] = {};
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *temp = NULL;
+        size_t i, l;
+        int r;
+
+        if (!rules->cache_file)
+                return 0;
+
+        /* Timestamps have a coarse granularity on some file systems, a file modified again right after we read it
+         * might keep its timestamp. Don't cache anything then, the next time the rules are loaded will. */
+        for (i = 0; i < n_stamps; i++)
+                if (stamps[i].mtime_nsec + 2 * NSEC_PER_SEC > n)
+                        return -EBUSY;
+
+        memcpy(h.signature, rules_cache_signature, sizeof(h.signature));
+        strncpy(h.version, rules->cache_version, sizeof(h.version));
+
+        (void) mkdir_parents(rules->cache_file, 0755);
+
+        r = fopen_temporary(rules->cache_file, &f, &temp);
+        if (r < 0)
+                return r;
+
+        (void) fchmod(fileno(f), 0644);
+
+        l = sizeof(h) + rules->token_cur * sizeof(struct token);
+        fwrite(&h, sizeof(h), 1, f);
+        fwrite(rules->tokens, sizeof(struct token), rules->token_cur, f);
+        fwrite(pad, 1, ALIGN8(l) - l, f);
+        fwrite(stamps, sizeof(struct rules_cache_stamp), n_stamps, f);
+        fwrite(rules->strbuf->buf, 1, rules->strbuf->len, f);
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(temp, rules->cache_file) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        (void) unlink(temp);
+        return r;
+}
+
+static int rules_parse_files(struct udev_rules *rules, char **files) {
+        _cleanup_free_ struct rules_cache_stamp *stamps = NULL;
+        size_t n_stamps = 0;
+        struct token end_token;
+        char **f;
+        int r;
 
         /* init token array and string buffer */
         rules->tokens = malloc_multiply(PREALLOC_TOKEN, sizeof(struct token));
         if (rules->tokens == NULL)
-                return udev_rules_unref(rules);
+                return -ENOMEM;
         rules->token_max = PREALLOC_TOKEN;
 
         rules->strbuf = strbuf_new();
         if (!rules->strbuf)
-                return udev_rules_unref(rules);
+                return -ENOMEM;
 
-        udev_rules_check_timestamp(rules);
-
-        r = conf_files_list_strv(&files, ".rules", NULL, 0, rules_dirs);
-        if (r < 0) {
-                log_error_errno(r, "failed to enumerate rules files: %m");
-                return udev_rules_unref(rules);
-        }
+        stamps = new(struct rules_cache_stamp, strv_length(files) + strv_length(rules->cache_extra_files));
+        if (!stamps)
+                return -ENOMEM;
 
         /*
          * The offset value in the rules strct is limited; add all
          * rules file names to the beginning of the string buffer.
+         * Take the stamps for the cache before reading anything,
+         * so that a file modified while parsing invalidates it.
          */
         STRV_FOREACH(f, files)
-                rules_add_string(rules, *f);
+                rules_cache_stamp(*f, rules_add_string(rules, *f), stamps + n_stamps++);
+        STRV_FOREACH(f, rules->cache_extra_files)
+                rules_cache_stamp(*f, rules_add_string(rules, *f), stamps + n_stamps++);
 
         STRV_FOREACH(f, files)
                 parse_file(rules, *f);
 
-        strv_free(files);
-
         memzero(&end_token, sizeof(struct token));
         end_token.type = TK_END;
         add_token(rules, &end_token);
@@ -1580,25 +1813,253 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
         rules->gids_cur = 0;
         rules->gids_max = 0;
 
+        r = rules_cache_write(rules, stamps, n_stamps);
+        if (r < 0)
+                log_debug_errno(r, "Failed to write %s, ignoring: %m", rules->cache_file);
+
+        return 0;
+}
+
+static struct rule_list *rule_list_free(struct rule_list *l) {
+        if (!l)
+                return NULL;
+
+        free(l->value);
+        free(l->rules);
+        return mfree(l);
+}
+
+static int rule_list_add(struct rule_list *l, unsigned int idx) {
+        /* a rule matching "a|a" is only added once */
+        if (l->n_rules > 0 && l->rules[l->n_rules - 1] == idx)
+                return 0;
+
+        if (!GREEDY_REALLOC(l->rules, l->n_allocated, l->n_rules + 1))
+                return -ENOMEM;
+
+        l->rules[l->n_rules++] = idx;
+        return 0;
+}
+
+static int rules_index_add(struct udev_rules *rules, enum rules_index_type type,
+                           const char *value, size_t len, unsigned int idx) {
+        _cleanup_free_ char *v = NULL;
+        struct rule_list *l;
+        int r;
+
+        v = strndup(value, len);
+        if (!v)
+                return -ENOMEM;
+
+        l = hashmap_get(rules->index[type], v);
+        if (!l) {
+                r = hashmap_ensure_allocated(&rules->index[type], &string_hash_ops);
+                if (r < 0)
+                        return r;
+
+                l = new0(struct rule_list, 1);
+                if (!l)
+                        return -ENOMEM;
+
+                l->value = v;
+                v = NULL;
+
+                r = hashmap_put(rules->index[type], l->value, l);
+                if (r < 0) {
+                        rule_list_free(l);
+                        return r;
+                }
+        }
+
+        return rule_list_add(l, idx);
+}
+
+/* Most rules start with SUBSYSTEM==, KERNEL== or ACTION== matches against fixed values. A rule like that can never
+ * match a device with a different value, and those keys are checked before anything with side effects, like
+ * PROGRAM or IMPORT, hence it is safe to not look at such a rule at all. Index every rule by the most specific of
+ * these keys, so that udev_rules_apply_to_event() only walks the rules which might match, plus all rules without
+ * such a key. */
+static int rules_build_index(struct udev_rules *rules) {
+        unsigned int i;
+        int r;
+
+        for (i = 0; i < rules->token_cur; i++) {
+                enum rules_index_type type = _RULES_INDEX_MAX;
+                struct token *rule = &rules->tokens[i];
+                struct token *key = NULL;
+                unsigned int j;
+                const char *v;
+
+                if (rule->type == TK_END)
+                        /* the end is always a candidate, hence looking for the next rule never fails */
+                        return rule_list_add(&rules->unindexed, i);
+
+                if (rule->type != TK_RULE)
+                        continue;
+
+                /* tokens of a rule are sorted by type, hence the keys we are interested in come first */
+                for (j = i + 1; j < i + rule->rule.token_count && rules->tokens[j].type <= TK_M_SUBSYSTEM; j++) {
+                        struct token *t = &rules->tokens[j];
+                        enum rules_index_type k;
+
+                        if (t->key.op != OP_MATCH || !IN_SET(t->key.glob, GL_PLAIN, GL_SPLIT))
+                                continue;
+
+                        if (t->type == TK_M_SUBSYSTEM)
+                                k = RULES_INDEX_SUBSYSTEM;
+                        else if (t->type == TK_M_KERNEL)
+                                k = RULES_INDEX_KERNEL;
+                        else if (t->type == TK_M_ACTION)
+                                k = RULES_INDEX_ACTION;
+                        else
+                                continue;
+
+                        if (k < type) {
+                                type = k;
+                                key = t;
+                        }
+                }
+
+                if (!key) {
+                        r = rule_list_add(&rules->unindexed, i);
+                        if (r < 0)
+                                return r;
+                        continue;
+                }
+
+                /* "A|B" matches either value */
+                for (v = rules_str(rules, key->key.value_off);; ) {
+                        size_t l;
+
+                        l = strcspn(v, "|");
+                        r = rules_index_add(rules, type, v, l, i);
+                        if (r < 0)
+                                return r;
+
+                        if (v[l] == '\0')
+                                break;
+                        v += l + 1;
+                }
+        }
+
+        return -EBADMSG;
+}
+
+static void rules_free_index(struct udev_rules *rules) {
+        struct rule_list *l;
+        unsigned int t;
+
+        for (t = 0; t < _RULES_INDEX_MAX; t++) {
+                while ((l = hashmap_steal_first(rules->index[t])))
+                        rule_list_free(l);
+                rules->index[t] = hashmap_free(rules->index[t]);
+        }
+
+        rules->unindexed.rules = mfree(rules->unindexed.rules);
+        rules->unindexed.n_rules = rules->unindexed.n_allocated = 0;
+        rules->indexed = false;
+}
+
+struct udev_rules *udev_rules_new_full(struct udev *udev, int resolve_names, const struct udev_rules_options *options) {
+        _cleanup_strv_free_ char **files = NULL;
+        struct udev_rules *rules;
+        struct udev_list file_list;
+        int r;
+
+        rules = new0(struct udev_rules, 1);
+        if (rules == NULL)
+                return NULL;
+        rules->udev = udev;
+        rules->resolve_names = resolve_names;
+        udev_list_init(udev, &file_list, true);
+
+        if (options) {
+                rules->dirs = strv_copy(options->dirs);
+                if (options->cache_file) {
+                        rules->cache_file = strdup(options->cache_file);
+                        if (!rules->cache_file)
+                                return udev_rules_unref(rules);
+                }
+                rules->cache_extra_files = strv_copy(options->cache_extra_files ?: (char**) rules_cache_extra_files);
+                rules->cache_version = strdup(options->cache_version ?: PACKAGE_VERSION);
+        } else {
+                rules->dirs = strv_copy((char**) rules_dirs);
+                rules->cache_file = strdup(RULES_CACHE_FILE);
+                if (!rules->cache_file)
+                        return udev_rules_unref(rules);
+                rules->cache_extra_files = strv_copy((char**) rules_cache_extra_files);
+                rules->cache_version = strdup(PACKAGE_VERSION);
+        }
+        if (!rules->dirs || !rules->cache_extra_files || !rules->cache_version)
+                return udev_rules_unref(rules);
+
+        udev_rules_check_timestamp(rules);
+
+        r = conf_files_list_strv(&files, ".rules", NULL, 0, (const char* const*) rules->dirs);
+        if (r < 0) {
+                log_error_errno(r, "failed to enumerate rules files: %m");
+                return udev_rules_unref(rules);
+        }
+
+        r = rules_cache_load(rules, files);
+        if (r >= 0)
+                log_debug("Loaded %u rules tokens from %s", rules->token_cur, rules->cache_file);
+        else {
+                if (r != -ENOENT)
+                        log_debug_errno(r, "Not using %s, parsing rules files: %m", rules->cache_file);
+
+                r = rules_parse_files(rules, files);
+                if (r < 0)
+                        return udev_rules_unref(rules);
+        }
+
+        if (options && options->no_index)
+                log_debug("Not indexing rules, checking all rules for every event");
+        else {
+                r = rules_build_index(rules);
+                if (r < 0) {
+                        log_warning_errno(r, "Failed to index rules, checking all rules for every event: %m");
+                        rules_free_index(rules);
+                } else
+                        rules->indexed = true;
+        }
+
         dump_rules(rules);
         return rules;
 }
 
+struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
+        return udev_rules_new_full(udev, resolve_names, NULL);
+}
+
 struct udev_rules *udev_rules_unref(struct udev_rules *rules) {
         if (rules == NULL)
                 return NULL;
-        free(rules->tokens);
-        strbuf_cleanup(rules->strbuf);
+        if (rules->map)
+                munmap(rules->map, rules->map_size);
+        else
+                free(rules->tokens);
+        if (rules->strbuf)
+                strbuf_cleanup(rules->strbuf);
         free(rules->uids);
         free(rules->gids);
+        rules_free_index(rules);
+        strv_free(rules->dirs);
+        free(rules->cache_file);
+        strv_free(rules->cache_extra_files);
+        free(rules->cache_version);
         return mfree(rules);
 }
 
+bool udev_rules_is_cached(struct udev_rules *rules) {
+        return rules && rules->map;
+}
+
 bool udev_rules_check_timestamp(struct udev_rules *rules) {
         if (!rules)
                 return false;
 
-        return paths_check_timestamp(rules_dirs, &rules->dirs_ts_usec, true);
+        return paths_check_timestamp((const char* const*) rules->dirs, &rules->dirs_ts_usec, true);
 }
 
 static int match_key(struct udev_rules *rules, struct token *token, const char *val) {
@@ -1728,11 +2189,182 @@ enum escape_type {
         ESCAPE_REPLACE,
 };
 
+/* The rules which might match one device: all unindexed ones, and the ones indexed by its subsystem, kernel name
+ * and action. Each list is sorted, and rules are only ever visited in ascending order, GOTO only jumps forward. */
+struct rules_cursor {
+        const struct rule_list *lists[1 + _RULES_INDEX_MAX];
+        size_t pos[1 + _RULES_INDEX_MAX];
+};
+
+static void rules_cursor_init(struct rules_cursor *c, struct udev_rules *rules, struct udev_device *dev) {
+        const char *values[_RULES_INDEX_MAX] = {
+                [RULES_INDEX_SUBSYSTEM] = udev_device_get_subsystem(dev),
+                [RULES_INDEX_KERNEL] = udev_device_get_sysname(dev),
+                [RULES_INDEX_ACTION] = udev_device_get_action(dev),
+        };
+        unsigned int t;
+
+        *c = (struct rules_cursor) {
+                .lists[0] = &rules->unindexed,
+        };
+
+        /* match_key() compares a missing value as empty string */
+        for (t = 0; t < _RULES_INDEX_MAX; t++)
+                c->lists[1 + t] = hashmap_get(rules->index[t], strempty(values[t]));
+}
+
+/* Returns the token index of the first rule at or after idx which might match */
+static unsigned int rules_cursor_next(struct rules_cursor *c, unsigned int idx) {
+        unsigned int next = UINT_MAX, i;
+
+        for (i = 0; i < ELEMENTSOF(c->lists); i++) {
+                const struct rule_list *l = c->lists[i];
+
+                if (!l)
+                        continue;
+
+                while (c->pos[i] < l->n_rules && l->rules[c->pos[i]] < idx)
+                        c->pos[i]++;
+
+                if (c->pos[i] < l->n_rules)
+                        next = MIN(next, l->rules[c->pos[i]]);
+        }
+
+        return next;
+}
+
+static bool format_reads_attr(const char *s) {
+        /* An escaped "$$attr{" is counted too, which errs on the safe side */
+        return strstr(s, "$attr{") || strstr(s, "$sysfs{") || strstr(s, "%s{");
+}
+
+/* Whether substituting the value or the attribute name of a key reads sysfs attributes, of the device itself, or of
+ * any device with "[subsystem/kernel]attribute" */
+static bool token_format_reads_attr(struct udev_rules *rules, struct token *t) {
+        if (t->type == TK_A_GOTO)
+                return false;
+
+        if (t->key.subst == SB_SUBSYS || t->key.attrsubst == SB_SUBSYS)
+                return true;
+        if (t->key.subst == SB_FORMAT && format_reads_attr(rules_str(rules, t->key.value_off)))
+                return true;
+        if (t->key.attrsubst == SB_FORMAT && format_reads_attr(rules_str(rules, t->key.attr_off)))
+                return true;
+
+        return false;
+}
+
+/* Returns false if processing the device can only assign properties, tags, symlinks and permissions, without reading
+ * anything but the device's own properties, its udev database and the kernel command line. Only then it is safe to
+ * do it in the main daemon itself, which has no timeout and nothing to kill if it gets stuck. This walks the
+ * candidate rules like udev_rules_apply_to_event() does, but only evaluates the keys which are fixed for a device;
+ * for any other key both outcomes are considered, i.e. the GOTO of such a rule is not followed, and its assignments
+ * are taken into account. */
+bool udev_rules_event_needs_worker(struct udev_rules *rules, struct udev_device *dev) {
+        struct rules_cursor cursor;
+        unsigned int idx = 0;
+        bool can_set_name;
+
+        if (rules->tokens == NULL)
+                return false;
+        if (!rules->indexed)
+                return true;
+
+        can_set_name = ((!streq(udev_device_get_action(dev), "remove")) &&
+                        (major(udev_device_get_devnum(dev)) > 0 ||
+                         udev_device_get_ifindex(dev) > 0));
+
+        rules_cursor_init(&cursor, rules, dev);
+
+        for (;;) {
+                struct token *rule, *cur;
+                unsigned int rule_goto = 0;
+                bool always = true;
+
+                idx = rules_cursor_next(&cursor, idx);
+                rule = &rules->tokens[idx];
+                if (rule->type == TK_END)
+                        return false;
+
+                if (!can_set_name && rule->rule.can_set_name)
+                        goto next;
+
+                for (cur = rule + 1; cur < rule + rule->rule.token_count; cur++) {
+                        switch (cur->type) {
+                        case TK_M_ACTION:
+                                if (match_key(rules, cur, udev_device_get_action(dev)) != 0)
+                                        goto next;
+                                break;
+                        case TK_M_DEVPATH:
+                                if (match_key(rules, cur, udev_device_get_devpath(dev)) != 0)
+                                        goto next;
+                                break;
+                        case TK_M_KERNEL:
+                                if (match_key(rules, cur, udev_device_get_sysname(dev)) != 0)
+                                        goto next;
+                                break;
+                        case TK_M_SUBSYSTEM:
+                                if (match_key(rules, cur, udev_device_get_subsystem(dev)) != 0)
+                                        goto next;
+                                break;
+
+                        case TK_M_PROGRAM:
+                        case TK_M_IMPORT_PROG:
+                        case TK_M_IMPORT_BUILTIN:
+                        case TK_A_RUN_PROGRAM:
+                        case TK_A_RUN_BUILTIN:
+                        case TK_M_WAITFOR:
+                        case TK_M_ATTR:
+                        case TK_M_SYSCTL:
+                        case TK_M_KERNELS:
+                        case TK_M_SUBSYSTEMS:
+                        case TK_M_DRIVERS:
+                        case TK_M_ATTRS:
+                        case TK_M_TAGS:
+                        case TK_M_IMPORT_PARENT:
+                        case TK_M_IMPORT_FILE:
+                        case TK_M_TEST:
+                        case TK_A_NAME:
+                        case TK_A_ATTR:
+                        case TK_A_SYSCTL:
+                        case TK_A_OWNER:
+                        case TK_A_GROUP:
+                                /* external programs and builtins, waiting, reading sysfs attributes, /proc/sys or
+                                 * the uevent files of parents, which ends up in driver code, reading or checking
+                                 * arbitrary files, renaming network interfaces, writing to sysfs or /proc/sys, and
+                                 * resolving user and group names at runtime via NSS */
+                                return true;
+
+                        case TK_A_GOTO:
+                                rule_goto = cur->key.rule_goto;
+                                break;
+
+                        default:
+                                if (cur->type < TK_M_MAX)
+                                        always = false;
+                                break;
+                        }
+
+                        if (token_format_reads_attr(rules, cur))
+                                return true;
+                }
+
+                if (always && rule_goto > 0) {
+                        idx = rule_goto;
+                        continue;
+                }
+
+        next:
+                idx += rule->rule.token_count;
+        }
+}
+
 void udev_rules_apply_to_event(struct udev_rules *rules,
                                struct udev_event *event,
                                usec_t timeout_usec,
                                usec_t timeout_warn_usec,
                                struct udev_list *properties_list) {
+        struct rules_cursor cursor;
         struct token *cur;
         struct token *rule;
         enum escape_type esc = ESCAPE_UNSET;
@@ -1742,6 +2374,9 @@ void udev_rules_apply_to_event(struct udev_rules *rules,
         if (rules->tokens == NULL)
                 return;
 
+        if (rules->indexed)
+                rules_cursor_init(&cursor, rules, event->dev);
+
         can_set_name = ((!streq(udev_device_get_action(event->dev), "remove")) &&
                         (major(udev_device_get_devnum(event->dev)) > 0 ||
                          udev_device_get_ifindex(event->dev) > 0));
@@ -1753,6 +2388,17 @@ void udev_rules_apply_to_event(struct udev_rules *rules,
                 dump_token(rules, cur);
                 switch (cur->type) {
                 case TK_RULE:
+                        /* skip all rules which cannot match this device */
+                        if (rules->indexed) {
+                                unsigned int next;
+
+                                next = rules_cursor_next(&cursor, cur - rules->tokens);
+                                if (next != (unsigned int) (cur - rules->tokens)) {
+                                        cur = &rules->tokens[next];
+                                        continue;
+                                }
+                        }
+
                         /* current rule */
                         rule = cur;
                         /* possibly skip rules which want to set NAME, SYMLINK, OWNER, GROUP, MODE */
@@ -57,12 +57,23 @@ struct udev_watch {
 
 /* udev-rules.c */
 struct udev_rules;
+/* Only tests use anything but the defaults */
+struct udev_rules_options {
+        char **dirs;                    /* directories to read rules files from */
+        const char *cache_file;         /* where to cache the compiled rules, NULL to not cache them */
+        char **cache_extra_files;       /* files besides the rules files which invalidate the cache, NULL for the default */
+        const char *cache_version;      /* version the cache is valid for, NULL for the package version */
+        bool no_index;                  /* check every rule for every event */
+};
 struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names);
+struct udev_rules *udev_rules_new_full(struct udev *udev, int resolve_names, const struct udev_rules_options *options);
 struct udev_rules *udev_rules_unref(struct udev_rules *rules);
 bool udev_rules_check_timestamp(struct udev_rules *rules);
+bool udev_rules_is_cached(struct udev_rules *rules);
 void udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event,
                                usec_t timeout_usec, usec_t timeout_warn_usec,
                                struct udev_list *properties_list);
+bool udev_rules_event_needs_worker(struct udev_rules *rules, struct udev_device *dev);
 int udev_rules_apply_static_dev_perms(struct udev_rules *rules);
 
 /* udev-event.c */
@@ -84,6 +95,7 @@ void udev_event_execute_rules(struct udev_event *event,
                               struct udev_rules *rules);
 void udev_event_execute_run(struct udev_event *event, usec_t timeout_usec, usec_t timeout_warn_usec);
 int udev_build_argv(struct udev *udev, char *cmd, int *argc, char *argv[]);
+void udev_event_helpers_free(void);
 
 /* udev-watch.c */
 int udev_watch_init(struct udev *udev);
@@ -13,6 +13,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "device-index.h"
 #include "dirent-util.h"
 #include "fd-util.h"
 #include "string-util.h"
@@ -167,6 +168,9 @@ static int export_devices(struct udev *udev) {
         if (udev_enumerate == NULL)
                 return -ENOMEM;
 
+        /* Nothing else runs in this process while scanning, hence it's safe to use a few threads */
+        (void) udev_enumerate_set_n_threads(udev_enumerate, 0);
+
         udev_enumerate_scan_devices(udev_enumerate);
         udev_list_entry_foreach(list_entry, udev_enumerate_get_list_entry(udev_enumerate)) {
                 _cleanup_(udev_device_unrefp) struct udev_device *device;
@@ -211,6 +215,7 @@ static void cleanup_db(struct udev *udev) {
         _cleanup_closedir_ DIR *dir1 = NULL, *dir2 = NULL, *dir3 = NULL, *dir4 = NULL, *dir5 = NULL;
 
         (void) unlink("/run/udev/queue.bin");
+        (void) unlink(DEVICE_INDEX_PATH);
 
         dir1 = opendir("/run/udev/data");
         if (dir1 != NULL)
@@ -141,6 +141,7 @@ static int adm_test(struct udev *udev, int argc, char *argv[]) {
                 printf("run: '%s'\n", program);
         }
 out:
+        udev_event_helpers_free();
         udev_builtin_exit(udev);
         return rc;
 }
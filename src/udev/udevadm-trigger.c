@@ -6,12 +6,20 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "sd-id128.h"
+
+#include "alloc-util.h"
 #include "fd-util.h"
+#include "hashmap.h"
+#include "id128-util.h"
+#include "parse-util.h"
 #include "set.h"
 #include "string-util.h"
 #include "udev-util.h"
@@ -19,17 +27,286 @@
 #include "udevadm-util.h"
 #include "util.h"
 
+/* With --settle, never have more than this many triggered events outstanding, so that the replies fit into the receive
+ * buffer of the monitor socket even on machines with tens of thousands of devices. Events are written in chunks of
+ * TRIGGER_CHUNK_MAX, and before each chunk we wait until there is room for it. */
+#define TRIGGER_MAX_INFLIGHT 4096U
+#define TRIGGER_CHUNK_MAX 256U
+
+/* Devices which have to be triggered after everything else, see device_compare() in sd-device */
+#define TRIGGER_LEVEL_DELAYED UINT_MAX
+
 static int verbose;
 static int dry_run;
+static unsigned concurrency = 1;
+
+/* Kernels before 4.13 do not accept a UUID after the action. Only changed between batches, never while writing. */
+static bool synthetic_uuid = true;
+
+typedef struct TriggerItem {
+        const char *syspath;
+        unsigned level;
+
+        /* with --settle, what the processed event is recognized by: the UUID it was triggered with, or the syspath if
+         * the kernel does not support synthetic uevents with arguments */
+        char *key;
+        bool uuid_rejected;
+        int r;
+} TriggerItem;
+
+typedef struct TriggerBatch {
+        TriggerItem **items;
+        size_t n_items;
+        size_t next;
+        const char *action;
+        bool settle;
+        pthread_mutex_t mutex;
+} TriggerBatch;
+
+static void trigger_item_write(TriggerItem *item, const char *action, bool settle) {
+        char filename[UTIL_PATH_SIZE];
+        _cleanup_close_ int fd = -1;
+
+        strscpyl(filename, sizeof(filename), item->syspath, "/uevent", NULL);
+        fd = open(filename, O_WRONLY|O_CLOEXEC);
+        if (fd < 0)
+                return;
+
+        if (settle && synthetic_uuid) {
+                char uuid[37];
+                const char *buf;
+                sd_id128_t id;
+
+                item->r = sd_id128_randomize(&id);
+                if (item->r < 0)
+                        return;
+
+                id128_to_uuid_string(id, uuid);
+                buf = strjoina(action, " ", uuid);
+
+                if (write(fd, buf, strlen(buf)) >= 0) {
+                        item->key = strdup(uuid);
+                        if (!item->key)
+                                item->r = -ENOMEM;
+                        return;
+                }
+
+                if (errno != EINVAL) {
+                        log_debug_errno(errno, "error writing '%s' to '%s': %m", buf, filename);
+                        return;
+                }
+
+                item->uuid_rejected = true;
+        }
+
+        if (write(fd, action, strlen(action)) < 0) {
+                log_debug_errno(errno, "error writing '%s' to '%s': %m", action, filename);
+                return;
+        }
+
+        if (settle) {
+                item->key = strdup(item->syspath);
+                if (!item->key)
+                        item->r = -ENOMEM;
+        }
+}
+
+static void *trigger_batch_run(void *userdata) {
+        TriggerBatch *b = userdata;
+
+        for (;;) {
+                TriggerItem *item = NULL;
+
+                assert_se(pthread_mutex_lock(&b->mutex) == 0);
+                if (b->next < b->n_items)
+                        item = b->items[b->next++];
+                assert_se(pthread_mutex_unlock(&b->mutex) == 0);
+
+                if (!item)
+                        break;
+
+                trigger_item_write(item, b->action, b->settle);
+        }
+
+        return NULL;
+}
+
+/* Writes the uevent files of all items, with up to 'n_threads' writes in flight. The calling thread takes part, hence
+ * this works even if no thread can be started. */
+static void trigger_batch_write(TriggerItem **items, size_t n_items, const char *action, bool settle, unsigned n_threads) {
+        _cleanup_free_ pthread_t *threads = NULL;
+        TriggerBatch b = {
+                .items = items,
+                .n_items = n_items,
+                .action = action,
+                .settle = settle,
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+        };
+        unsigned n_started = 0, i;
+        sigset_t ss, saved_ss;
+
+        n_threads = MIN(n_threads, n_items);
+        if (n_threads > 1)
+                threads = new(pthread_t, n_threads - 1);
+
+        if (threads) {
+                assert_se(sigfillset(&ss) >= 0);
+                assert_se(pthread_sigmask(SIG_BLOCK, &ss, &saved_ss) == 0);
+
+                for (; n_started < n_threads - 1; n_started++)
+                        if (pthread_create(threads + n_started, NULL, trigger_batch_run, &b) != 0)
+                                break;
+
+                assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+        }
+
+        (void) trigger_batch_run(&b);
+
+        for (i = 0; i < n_started; i++)
+                assert_se(pthread_join(threads[i], NULL) == 0);
+}
+
+/* Processes udev events until at most 'max' of the triggered events are outstanding */
+static void settle_wait(struct udev_monitor *monitor, int fd_ep, Set *settle_set, unsigned max) {
+        int fd_udev;
+
+        fd_udev = udev_monitor_get_fd(monitor);
+
+        while (set_size(settle_set) > max) {
+                int fdcount;
+                struct epoll_event ev[4];
+                int i;
+
+                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), -1);
+                if (fdcount < 0) {
+                        if (errno != EINTR)
+                                log_error_errno(errno, "error receiving uevent message: %m");
+                        continue;
+                }
+
+                for (i = 0; i < fdcount; i++) {
+                        if (ev[i].data.fd == fd_udev && ev[i].events & EPOLLIN) {
+                                _cleanup_(udev_device_unrefp) struct udev_device *device;
+                                const char *syspath, *uuid;
+                                char *key;
+
+                                device = udev_monitor_receive_device(monitor);
+                                if (!device)
+                                        continue;
+
+                                syspath = udev_device_get_syspath(device);
+                                uuid = udev_device_get_property_value(device, "SYNTH_UUID");
+
+                                key = uuid ? set_remove(settle_set, uuid) : NULL;
+                                if (!key)
+                                        key = set_remove(settle_set, syspath);
+                                if (!key) {
+                                        log_debug("Got epoll event on syspath %s not present in syspath set", syspath);
+                                        continue;
+                                }
+
+                                if (verbose)
+                                        printf("settle %s\n", syspath);
+                                free(key);
+                        }
+                }
+        }
+}
+
+static int trigger_items(TriggerItem **items, size_t n_items, const char *action, unsigned n_threads,
+                         struct udev_monitor *monitor, int fd_ep, Set *settle_set) {
+        size_t i;
+
+        for (i = 0; i < n_items; i += TRIGGER_CHUNK_MAX) {
+                size_t j, n = MIN(n_items - i, TRIGGER_CHUNK_MAX);
+                bool rejected = false;
+
+                if (settle_set)
+                        settle_wait(monitor, fd_ep, settle_set, TRIGGER_MAX_INFLIGHT - n);
+
+                trigger_batch_write(items + i, n, action, !!settle_set, n_threads);
+
+                for (j = i; j < i + n; j++) {
+                        TriggerItem *item = items[j];
+
+                        if (item->r < 0)
+                                return log_error_errno(item->r, "Failed to trigger '%s': %m", item->syspath);
+
+                        rejected = rejected || item->uuid_rejected;
 
-static int exec_list(struct udev_enumerate *udev_enumerate, const char *action, Set *settle_set) {
+                        if (item->key) {
+                                if (set_consume(settle_set, TAKE_PTR(item->key)) < 0)
+                                        return log_oom();
+                        }
+                }
+
+                if (rejected && synthetic_uuid) {
+                        log_debug("Kernel does not support synthetic uevents with UUID, waiting for any event of the triggered devices.");
+                        synthetic_uuid = false;
+                }
+        }
+
+        return 0;
+}
+
+static bool trigger_is_delayed(const char *syspath) {
+        const char *sound;
+
+        /* Sound card control devices have to come after the rest of their card, and md and dm devices after all other
+         * devices, see device_compare(). */
+        sound = strstr(syspath, "/sound/card");
+        if (sound) {
+                sound = strchr(sound + STRLEN("/sound/card"), '/');
+                if (sound && startswith(sound, "/controlC"))
+                        return true;
+        }
+
+        return strstr(syspath, "/block/md") || strstr(syspath, "/block/dm-");
+}
+
+static int trigger_item_set_level(TriggerItem *item, Hashmap *levels, unsigned *max_level) {
+        char *path, *slash;
+        unsigned level = 0;
+        int r;
+
+        if (trigger_is_delayed(item->syspath)) {
+                item->level = TRIGGER_LEVEL_DELAYED;
+                return 0;
+        }
+
+        /* One level below the closest parent device that we trigger too */
+        path = strdupa(item->syspath);
+        while ((slash = strrchr(path, '/')) && slash > path) {
+                void *v;
+
+                *slash = 0;
+
+                v = hashmap_get(levels, path);
+                if (v) {
+                        level = PTR_TO_UINT(v);
+                        break;
+                }
+        }
+
+        item->level = level;
+        *max_level = MAX(*max_level, level);
+
+        r = hashmap_put(levels, item->syspath, UINT_TO_PTR(level + 1));
+        return r == -EEXIST ? 0 : r;
+}
+
+static int exec_list(struct udev_enumerate *udev_enumerate, const char *action,
+                     struct udev_monitor *monitor, int fd_ep, Set *settle_set) {
+        _cleanup_hashmap_free_ Hashmap *levels = NULL;
+        _cleanup_free_ TriggerItem *items = NULL;
+        _cleanup_free_ TriggerItem **order = NULL;
+        size_t n_items = 0, n_allocated = 0, n_order = 0, start, i;
         struct udev_list_entry *entry;
+        unsigned max_level = 0, level;
         int r;
 
         udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(udev_enumerate)) {
-                char filename[UTIL_PATH_SIZE];
                 const char *syspath;
-                _cleanup_close_ int fd = -1;
 
                 syspath = udev_list_entry_get_name(entry);
                 if (verbose)
@@ -37,22 +314,66 @@ static int exec_list(struct udev_enumerate *udev_enumerate, const char *action,
                 if (dry_run)
                         continue;
 
-                strscpyl(filename, sizeof(filename), syspath, "/uevent", NULL);
-                fd = open(filename, O_WRONLY|O_CLOEXEC);
-                if (fd < 0)
-                        continue;
+                if (!GREEDY_REALLOC0(items, n_allocated, n_items + 1))
+                        return log_oom();
 
-                if (settle_set) {
-                        r = set_put_strdup(settle_set, syspath);
-                        if (r < 0)
-                                return log_oom();
-                }
+                items[n_items++].syspath = syspath;
+        }
+
+        if (n_items == 0)
+                return 0;
+
+        order = new(TriggerItem*, n_items);
+        if (!order)
+                return log_oom();
 
-                if (write(fd, action, strlen(action)) < 0)
-                        log_debug_errno(errno, "error writing '%s' to '%s': %m", action, filename);
+        if (concurrency <= 1) {
+                /* Everything one after the other, in the order of the enumeration */
+                for (i = 0; i < n_items; i++)
+                        order[i] = items + i;
+
+                r = trigger_items(order, n_items, action, 1, monitor, fd_ep, settle_set);
+                goto finish;
         }
 
-        return 0;
+        /* Devices are triggered in parallel only when that cannot change the order between a parent and its
+         * children: first all devices without a triggered parent, then their children, and so on. The devices which
+         * have to be last are triggered one after another at the end, as before. */
+        levels = hashmap_new(&string_hash_ops);
+        if (!levels)
+                return log_oom();
+
+        for (i = 0; i < n_items; i++) {
+                r = trigger_item_set_level(items + i, levels, &max_level);
+                if (r < 0)
+                        return log_oom();
+        }
+
+        for (level = 0; level <= max_level; level++) {
+                start = n_order;
+
+                for (i = 0; i < n_items; i++)
+                        if (items[i].level == level)
+                                order[n_order++] = items + i;
+
+                r = trigger_items(order + start, n_order - start, action, concurrency, monitor, fd_ep, settle_set);
+                if (r < 0)
+                        goto finish;
+        }
+
+        start = n_order;
+
+        for (i = 0; i < n_items; i++)
+                if (items[i].level == TRIGGER_LEVEL_DELAYED)
+                        order[n_order++] = items + i;
+
+        r = trigger_items(order + start, n_order - start, action, 1, monitor, fd_ep, settle_set);
+
+finish:
+        for (i = 0; i < n_items; i++)
+                free(items[i].key);
+
+        return r;
 }
 
 static const char *keyval(const char *str, const char **val, char *buf, size_t size) {
@@ -88,13 +409,15 @@ static void help(void) {
                "  -y --sysname-match=NAME           Trigger devices with this /sys path\n"
                "     --name-match=NAME              Trigger devices with this /dev name\n"
                "  -b --parent-match=NAME            Trigger devices with that parent device\n"
-               "  -w --settle                       Wait for the triggered events to complete\n"
+               "  -w --settle --wait                Wait for the triggered events to complete\n"
+               "     --concurrency=N                Trigger up to N devices at the same time\n"
                , program_invocation_short_name);
 }
 
 static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
         enum {
                 ARG_NAME = 0x100,
+                ARG_CONCURRENCY,
         };
 
         static const struct option options[] = {
@@ -112,6 +435,8 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
                 { "name-match",        required_argument, NULL, ARG_NAME },
                 { "parent-match",      required_argument, NULL, 'b'      },
                 { "settle",            no_argument,       NULL, 'w'      },
+                { "wait",              no_argument,       NULL, 'w'      },
+                { "concurrency",       required_argument, NULL, ARG_CONCURRENCY },
                 { "version",           no_argument,       NULL, 'V'      },
                 { "help",              no_argument,       NULL, 'h'      },
                 {}
@@ -236,6 +561,14 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
                         settle = true;
                         break;
 
+                case ARG_CONCURRENCY:
+                        r = safe_atou(optarg, &concurrency);
+                        if (r < 0 || concurrency == 0) {
+                                log_error("invalid number of concurrent triggers '%s'", optarg);
+                                return 2;
+                        }
+                        break;
+
                 case ARG_NAME: {
                         _cleanup_(udev_device_unrefp) struct udev_device *dev;
 
@@ -296,6 +629,8 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
                 }
                 fd_udev = udev_monitor_get_fd(udev_monitor);
 
+                (void) udev_monitor_set_receive_buffer_size(udev_monitor, 128*1024*1024);
+
                 if (udev_monitor_enable_receiving(udev_monitor) < 0) {
                         log_error("error: unable to subscribe to udev events");
                         return 4;
@@ -314,6 +649,9 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
                 }
         }
 
+        /* Nothing else runs in this process while scanning, hence it's safe to use a few threads */
+        (void) udev_enumerate_set_n_threads(udev_enumerate, 0);
+
         switch (device_type) {
         case TYPE_SUBSYSTEMS:
                 udev_enumerate_scan_subsystems(udev_enumerate);
@@ -324,39 +662,12 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
         default:
                 assert_not_reached("device_type");
         }
-        r = exec_list(udev_enumerate, action, settle_set);
+        r = exec_list(udev_enumerate, action, udev_monitor, fd_ep, settle_set);
         if (r < 0)
                 return 1;
 
-        while (!set_isempty(settle_set)) {
-                int fdcount;
-                struct epoll_event ev[4];
-                int i;
-
-                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), -1);
-                if (fdcount < 0) {
-                        if (errno != EINTR)
-                                log_error_errno(errno, "error receiving uevent message: %m");
-                        continue;
-                }
-
-                for (i = 0; i < fdcount; i++) {
-                        if (ev[i].data.fd == fd_udev && ev[i].events & EPOLLIN) {
-                                _cleanup_(udev_device_unrefp) struct udev_device *device;
-                                const char *syspath = NULL;
-
-                                device = udev_monitor_receive_device(udev_monitor);
-                                if (!device)
-                                        continue;
-
-                                syspath = udev_device_get_syspath(device);
-                                if (verbose)
-                                        printf("settle %s\n", syspath);
-                                if (!set_remove(settle_set, syspath))
-                                        log_debug("Got epoll event on syspath %s not present in syspath set", syspath);
-                        }
-                }
-        }
+        if (settle_set)
+                settle_wait(udev_monitor, fd_ep, settle_set, 0);
 
         return 0;
 }
@@ -35,6 +35,8 @@
 #include "cgroup-util.h"
 #include "cpu-set-util.h"
 #include "dev-setup.h"
+#include "device-index.h"
+#include "device-private.h"
 #include "fd-util.h"
 #include "fileio.h"
 #include "format-util.h"
@@ -50,7 +52,10 @@
 #include "signal-util.h"
 #include "socket-util.h"
 #include "string-util.h"
+#include "strv.h"
 #include "terminal-util.h"
+#include "udev-device-generations.h"
+#include "udev-event-index.h"
 #include "udev-util.h"
 #include "udev.h"
 #include "user-util.h"
@@ -59,15 +64,24 @@ static bool arg_debug = false;
 static int arg_daemonize = false;
 static int arg_resolve_names = 1;
 static unsigned arg_children_max;
+static bool arg_coalesce_changes = false;
 static int arg_exec_delay;
 static usec_t arg_event_timeout_usec = 180 * USEC_PER_SEC;
 static usec_t arg_event_timeout_warn_usec = 180 * USEC_PER_SEC / 3;
 
+/* maximum number of events processed in the main daemon at once */
+#define EVENTS_INLINE_MAX 32
+
+/* compact the device index when it grew beyond twice its compacted size plus this */
+#define DEVICE_INDEX_SLACK (1024U * 1024U)
+
 typedef struct Manager {
         struct udev *udev;
         sd_event *event;
         Hashmap *workers;
         LIST_HEAD(struct event, events);
+        EventIndex *event_index;
+        DeviceGenerations *device_generations;
         const char *cgroup;
         pid_t pid; /* the process that originally allocated the manager object */
 
@@ -83,9 +97,18 @@ typedef struct Manager {
         sd_event_source *ctrl_event;
         sd_event_source *uevent_event;
         sd_event_source *inotify_event;
+        sd_event_source *queue_continue_event;
 
         usec_t last_usec;
 
+        uint64_t n_uevents;             /* uevents received */
+        uint64_t n_uevent_batches;      /* wakeups they were received in */
+        uint64_t n_uevents_coalesced;   /* redundant "change" uevents dropped */
+        uint64_t n_uevents_coalesced_notified;
+
+        uint64_t device_index_size;     /* size of the device index after it was last rewritten */
+        bool device_index_dirty;
+
         bool stop_exec_queue:1;
         bool exit:1;
 } Manager;
@@ -104,19 +127,16 @@ struct event {
         struct udev_device *dev_kernel;
         struct worker *worker;
         enum event_state state;
-        unsigned long long int delaying_seqnum;
         unsigned long long int seqnum;
         const char *devpath;
-        size_t devpath_len;
-        const char *devpath_old;
-        dev_t devnum;
-        int ifindex;
-        bool is_block;
+        EventIndexEntry index_entry;
         sd_event_source *timeout_warning;
         sd_event_source *timeout;
 };
 
 static void event_queue_cleanup(Manager *manager, enum event_state type);
+static void event_queue_start(Manager *manager);
+static void manager_notify_ready(Manager *manager);
 
 enum worker_state {
         WORKER_UNDEF,
@@ -146,6 +166,15 @@ static void event_free(struct event *event) {
         assert(event->manager);
 
         LIST_REMOVE(event, event->manager->events, event);
+        event_index_remove(event->manager->event_index, &event->index_entry);
+
+        /* whatever the event changed about the device, cached copies are outdated now; workers drop the events
+         * they inherited, which changes nothing */
+        if (event->manager->pid == getpid_cached()) {
+                device_generations_bump(event->manager->device_generations, event->devpath);
+                event->manager->device_index_dirty = true;
+        }
+
         udev_device_unref(event->dev);
         udev_device_unref(event->dev_kernel);
 
@@ -161,6 +190,12 @@ static void event_free(struct event *event) {
                         r = unlink("/run/udev/queue");
                         if (r < 0)
                                 log_warning_errno(errno, "could not unlink /run/udev/queue: %m");
+
+                        if (event->manager->n_uevents_coalesced != event->manager->n_uevents_coalesced_notified)
+                                manager_notify_ready(event->manager);
+
+                        /* don't keep parent devices around while idle */
+                        device_parent_cache_flush();
                 }
         }
 
@@ -284,11 +319,14 @@ static void manager_free(Manager *manager) {
         sd_event_source_unref(manager->ctrl_event);
         sd_event_source_unref(manager->uevent_event);
         sd_event_source_unref(manager->inotify_event);
+        sd_event_source_unref(manager->queue_continue_event);
 
         udev_unref(manager->udev);
         sd_event_unref(manager->event);
         manager_workers_free(manager);
         event_queue_cleanup(manager, EVENT_UNDEF);
+        event_index_free(manager->event_index);
+        device_generations_free(manager->device_generations);
 
         udev_monitor_unref(manager->monitor);
         udev_ctrl_unref(manager->ctrl);
@@ -366,6 +404,7 @@ static void worker_spawn(Manager *manager, struct event *event) {
                 manager->ctrl_event = sd_event_source_unref(manager->ctrl_event);
                 manager->uevent_event = sd_event_source_unref(manager->uevent_event);
                 manager->inotify_event = sd_event_source_unref(manager->inotify_event);
+                manager->queue_continue_event = sd_event_source_unref(manager->queue_continue_event);
 
                 manager->event = sd_event_unref(manager->event);
 
@@ -405,6 +444,9 @@ static void worker_spawn(Manager *manager, struct event *event) {
 
                         assert(dev);
 
+                        /* forget about parent devices which had events since we looked at them */
+                        (void) device_parent_cache_validate();
+
                         log_debug("seq %llu running", udev_device_get_seqnum(dev));
                         udev_event = udev_event_new(dev);
                         if (udev_event == NULL) {
@@ -516,6 +558,7 @@ skip:
                 }
 out:
                 udev_device_unref(dev);
+                udev_event_helpers_free();
                 manager_free(manager);
                 log_close();
                 _exit(r < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
@@ -599,17 +642,30 @@ static int event_queue_insert(Manager *manager, struct udev_device *dev) {
         udev_device_copy_properties(event->dev_kernel, dev);
         event->seqnum = udev_device_get_seqnum(dev);
         event->devpath = udev_device_get_devpath(dev);
-        event->devpath_len = strlen(event->devpath);
-        event->devpath_old = udev_device_get_devpath_old(dev);
-        event->devnum = udev_device_get_devnum(dev);
-        event->is_block = streq("block", udev_device_get_subsystem(dev));
-        event->ifindex = udev_device_get_ifindex(dev);
+        event->index_entry = (EventIndexEntry) {
+                .seqnum = event->seqnum,
+                .devpath = event->devpath,
+                .devpath_old = udev_device_get_devpath_old(dev),
+                .devnum = udev_device_get_devnum(dev),
+                .is_block = streq("block", udev_device_get_subsystem(dev)),
+                .ifindex = udev_device_get_ifindex(dev),
+        };
 
         log_debug("seq %llu queued, '%s' '%s'", udev_device_get_seqnum(dev),
              udev_device_get_action(dev), udev_device_get_subsystem(dev));
 
         event->state = EVENT_QUEUED;
 
+        r = event_index_add(manager->event_index, &event->index_entry);
+        if (r < 0) {
+                udev_device_unref(event->dev_kernel);
+                free(event);
+                return r;
+        }
+
+        /* the kernel changed the device before sending the uevent */
+        device_generations_bump(manager->device_generations, event->devpath);
+
         if (LIST_IS_EMPTY(manager->events)) {
                 r = touch("/run/udev/queue");
                 if (r < 0)
@@ -638,72 +694,8 @@ static void manager_kill_workers(Manager *manager) {
 
 /* lookup event for identical, parent, child device */
 static bool is_devpath_busy(Manager *manager, struct event *event) {
-        struct event *loop_event;
-        size_t common;
-
         /* check if queue contains events we depend on */
-        LIST_FOREACH(event, loop_event, manager->events) {
-                /* we already found a later event, earlier cannot block us, no need to check again */
-                if (loop_event->seqnum < event->delaying_seqnum)
-                        continue;
-
-                /* event we checked earlier still exists, no need to check again */
-                if (loop_event->seqnum == event->delaying_seqnum)
-                        return true;
-
-                /* found ourself, no later event can block us */
-                if (loop_event->seqnum >= event->seqnum)
-                        break;
-
-                /* check major/minor */
-                if (major(event->devnum) != 0 && event->devnum == loop_event->devnum && event->is_block == loop_event->is_block)
-                        return true;
-
-                /* check network device ifindex */
-                if (event->ifindex != 0 && event->ifindex == loop_event->ifindex)
-                        return true;
-
-                /* check our old name */
-                if (event->devpath_old != NULL && streq(loop_event->devpath, event->devpath_old)) {
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
-
-                /* compare devpath */
-                common = MIN(loop_event->devpath_len, event->devpath_len);
-
-                /* one devpath is contained in the other? */
-                if (memcmp(loop_event->devpath, event->devpath, common) != 0)
-                        continue;
-
-                /* identical device event found */
-                if (loop_event->devpath_len == event->devpath_len) {
-                        /* devices names might have changed/swapped in the meantime */
-                        if (major(event->devnum) != 0 && (event->devnum != loop_event->devnum || event->is_block != loop_event->is_block))
-                                continue;
-                        if (event->ifindex != 0 && event->ifindex != loop_event->ifindex)
-                                continue;
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
-
-                /* parent device event found */
-                if (event->devpath[common] == '/') {
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
-
-                /* child device event found */
-                if (loop_event->devpath[common] == '/') {
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
-
-                /* no matching device */
-                continue;
-        }
-
-        return false;
+        return !!event_index_find_blocker(manager->event_index, &event->index_entry);
 }
 
 static int on_exit_timeout(sd_event_source *s, uint64_t usec, void *userdata) {
@@ -752,6 +744,25 @@ static void manager_exit(Manager *manager) {
                 return;
 }
 
+static void manager_notify_ready(Manager *manager) {
+        assert(manager);
+
+        if (manager->n_uevents_coalesced > 0) {
+                log_debug("%"PRIu64" uevents received in %"PRIu64" batches, %"PRIu64" change events coalesced",
+                          manager->n_uevents, manager->n_uevent_batches, manager->n_uevents_coalesced);
+
+                (void) sd_notifyf(false,
+                                  "READY=1\n"
+                                  "STATUS=Processing with %u children at max, %"PRIu64" of %"PRIu64" uevents coalesced",
+                                  arg_children_max, manager->n_uevents_coalesced, manager->n_uevents);
+        } else
+                (void) sd_notifyf(false,
+                                  "READY=1\n"
+                                  "STATUS=Processing with %u children at max", arg_children_max);
+
+        manager->n_uevents_coalesced_notified = manager->n_uevents_coalesced;
+}
+
 /* reload requested, HUP signal received, rules changed, builtin changed */
 static void manager_reload(Manager *manager) {
 
@@ -765,13 +776,91 @@ static void manager_reload(Manager *manager) {
         manager->rules = udev_rules_unref(manager->rules);
         udev_builtin_exit(manager->udev);
 
-        sd_notifyf(false,
-                   "READY=1\n"
-                   "STATUS=Processing with %u children at max", arg_children_max);
+        manager_notify_ready(manager);
+}
+
+static bool event_can_run_inline(Manager *manager, struct event *event) {
+        /* opening the device node to lock it might block */
+        if (!streq_ptr(udev_device_get_action(event->dev), "remove") &&
+            shall_lock_device(event->dev))
+                return false;
+
+        return !udev_rules_event_needs_worker(manager->rules, event->dev);
+}
+
+/* Process an event in the main daemon. This is only done for events whose rules can do no more than assign
+ * properties, tags, symlinks and permissions, without reading sysfs attributes or any other file which might block,
+ * see udev_rules_event_needs_worker(). There is no timeout here, hence nothing else qualifies. It saves handing the
+ * device to a worker and back, and spawning workers only to process such events. */
+static int event_run_inline(Manager *manager, struct event *event) {
+        struct udev_event *udev_event;
+
+        assert(manager);
+        assert(event);
+
+        log_debug("seq %llu running in main daemon", event->seqnum);
+
+        (void) device_parent_cache_validate();
+
+        udev_event = udev_event_new(event->dev);
+        if (!udev_event)
+                return -ENOMEM;
+
+        event->state = EVENT_RUNNING;
+
+        /* apply rules, create node, symlinks */
+        udev_event_execute_rules(udev_event,
+                                 arg_event_timeout_usec, arg_event_timeout_warn_usec,
+                                 &manager->properties,
+                                 manager->rules);
+
+        udev_event_execute_run(udev_event,
+                               arg_event_timeout_usec, arg_event_timeout_warn_usec);
+
+        /* apply/restore inotify watch */
+        if (udev_event->inotify_watch) {
+                udev_watch_begin(manager->udev, event->dev);
+                udev_device_update_db(event->dev);
+        }
+
+        /* send processed event back to libudev listeners */
+        udev_monitor_send_device(manager->monitor, NULL, event->dev);
+
+        log_debug("seq %llu processed", event->seqnum);
+
+        udev_event_unref(udev_event);
+        event_free(event);
+
+        return 0;
+}
+
+static int on_event_queue_continue(sd_event_source *s, void *userdata) {
+        Manager *manager = userdata;
+
+        assert(manager);
+
+        event_queue_start(manager);
+
+        return 1;
+}
+
+static int event_queue_continue(Manager *manager) {
+        int r;
+
+        assert(manager);
+
+        if (!manager->queue_continue_event) {
+                r = sd_event_add_defer(manager->event, &manager->queue_continue_event, on_event_queue_continue, manager);
+                if (r < 0)
+                        return r;
+        }
+
+        return sd_event_source_set_enabled(manager->queue_continue_event, SD_EVENT_ONESHOT);
 }
 
 static void event_queue_start(Manager *manager) {
-        struct event *event;
+        struct event *event, *tmp;
+        unsigned n_inline = 0;
         usec_t usec;
 
         assert(manager);
@@ -799,7 +888,7 @@ static void event_queue_start(Manager *manager) {
                         return;
         }
 
-        LIST_FOREACH(event,event,manager->events) {
+        LIST_FOREACH_SAFE(event, event, tmp, manager->events) {
                 if (event->state != EVENT_QUEUED)
                         continue;
 
@@ -807,6 +896,18 @@ static void event_queue_start(Manager *manager) {
                 if (is_devpath_busy(manager, event))
                         continue;
 
+                if (event_can_run_inline(manager, event)) {
+                        /* don't block the main loop for too long, continue with the remaining events later,
+                         * after having looked at new uevents and worker messages */
+                        if (n_inline >= EVENTS_INLINE_MAX) {
+                                if (event_queue_continue(manager) >= 0)
+                                        continue;
+                        } else if (event_run_inline(manager, event) >= 0) {
+                                n_inline++;
+                                continue;
+                        }
+                }
+
                 event_run(manager, event);
         }
 }
@@ -894,24 +995,112 @@ static int on_worker(sd_event_source *s, int fd, uint32_t revents, void *userdat
         return 1;
 }
 
+static bool device_properties_equal(struct udev_device *a, struct udev_device *b) {
+        struct udev_list_entry *i, *j;
+
+        /* Both lists are sorted by name. The sequence number and the time the device was first seen at differ for
+         * every uevent and hence are not compared. */
+        i = udev_device_get_properties_list_entry(a);
+        j = udev_device_get_properties_list_entry(b);
+
+        for (;;) {
+                while (i && STR_IN_SET(udev_list_entry_get_name(i), "SEQNUM", "USEC_INITIALIZED"))
+                        i = udev_list_entry_get_next(i);
+                while (j && STR_IN_SET(udev_list_entry_get_name(j), "SEQNUM", "USEC_INITIALIZED"))
+                        j = udev_list_entry_get_next(j);
+
+                if (!i || !j)
+                        return !i && !j;
+
+                if (!streq(udev_list_entry_get_name(i), udev_list_entry_get_name(j)) ||
+                    !streq_ptr(udev_list_entry_get_value(i), udev_list_entry_get_value(j)))
+                        return false;
+
+                i = udev_list_entry_get_next(i);
+                j = udev_list_entry_get_next(j);
+        }
+}
+
+/* A "change" uevent is redundant if the latest event queued for the same devpath is a "change" event with the same
+ * properties which has not started yet: when that one is processed, it will look at the device in a state at least
+ * as recent as the one the new uevent announces.
+ *
+ * Triggered uevents with a synthetic UUID are never dropped, as "udevadm trigger --settle" waits for exactly their
+ * broadcast. Without UUID (on older kernels) it waits for any event of the syspath, which the queued event provides,
+ * as it is broadcast only after it was processed. */
+static bool event_queue_coalesce(Manager *manager, struct udev_device *dev) {
+        EventIndexEntry *e;
+        struct event *event;
+
+        assert(manager);
+        assert(dev);
+
+        if (!streq_ptr(udev_device_get_action(dev), "change"))
+                return false;
+
+        if (udev_device_get_property_value(dev, "SYNTH_UUID"))
+                return false;
+
+        e = event_index_get_devpath(manager->event_index, udev_device_get_devpath(dev));
+        if (!e)
+                return false;
+
+        LIST_FIND_TAIL(same_devpath, e, e);
+        event = container_of(e, struct event, index_entry);
+
+        if (event->state != EVENT_QUEUED ||
+            !streq_ptr(udev_device_get_action(event->dev), "change") ||
+            !device_properties_equal(event->dev, dev))
+                return false;
+
+        log_debug("seq %llu coalesced into queued seq %llu, '%s'",
+                  udev_device_get_seqnum(dev), event->seqnum, event->devpath);
+
+        manager->n_uevents_coalesced++;
+        return true;
+}
+
 static int on_uevent(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
         Manager *manager = userdata;
-        struct udev_device *dev;
-        int r;
+        struct udev_device *devs[UDEV_MONITOR_BATCH_MAX];
+        bool queued = false;
+        int i, n, r;
 
         assert(manager);
 
-        dev = udev_monitor_receive_device(manager->monitor);
-        if (dev) {
+        /* Take everything the kernel has queued up to the batch size with one system call. Anything left over
+         * keeps the socket readable, and is picked up on the next iteration of the event loop. */
+        n = udev_monitor_receive_devices(manager->monitor, devs, ELEMENTSOF(devs));
+        if (n < 0) {
+                if (!IN_SET(n, -EAGAIN, -EINTR))
+                        log_debug_errno(n, "unable to receive uevents: %m");
+                return 1;
+        }
+
+        manager->n_uevent_batches++;
+        manager->n_uevents += n;
+
+        for (i = 0; i < n; i++) {
+                struct udev_device *dev = devs[i];
+
                 udev_device_ensure_usec_initialized(dev, NULL);
+
+                if (arg_coalesce_changes && event_queue_coalesce(manager, dev)) {
+                        udev_device_unref(dev);
+                        continue;
+                }
+
                 r = event_queue_insert(manager, dev);
                 if (r < 0)
                         udev_device_unref(dev);
                 else
-                        /* we have fresh events, try to schedule them */
-                        event_queue_start(manager);
+                        queued = true;
         }
 
+        /* we have fresh events, try to schedule them */
+        if (queued)
+                event_queue_start(manager);
+
         return 1;
 }
 
@@ -986,9 +1175,7 @@ static int on_ctrl_msg(sd_event_source *s, int fd, uint32_t revents, void *userd
                 log_debug("udevd message (SET_MAX_CHILDREN) received, children_max=%i", i);
                 arg_children_max = i;
 
-                (void) sd_notifyf(false,
-                                  "READY=1\n"
-                                  "STATUS=Processing with %u children at max", arg_children_max);
+                manager_notify_ready(manager);
         }
 
         if (udev_ctrl_get_ping(ctrl_msg) > 0)
@@ -1225,6 +1412,30 @@ static int on_sigchld(sd_event_source *s, const struct signalfd_siginfo *si, voi
         return 1;
 }
 
+static void manager_update_device_index(Manager *manager, bool force) {
+        struct stat st;
+        int r;
+
+        assert(manager);
+
+        if (force || stat(DEVICE_INDEX_PATH, &st) < 0)
+                /* dropped after a failed write, or by 'udevadm info --cleanup-db' */
+                r = device_index_rebuild(DEVICE_INDEX_PATH, "/run/udev/data");
+        else if ((uint64_t) st.st_size > 2 * manager->device_index_size + DEVICE_INDEX_SLACK) {
+                r = device_index_compact(DEVICE_INDEX_PATH);
+                if (r < 0)
+                        r = device_index_rebuild(DEVICE_INDEX_PATH, "/run/udev/data");
+        } else
+                return;
+        if (r < 0) {
+                log_warning_errno(r, "Failed to write device index, ignoring: %m");
+                return;
+        }
+
+        if (stat(DEVICE_INDEX_PATH, &st) >= 0)
+                manager->device_index_size = st.st_size;
+}
+
 static int on_post(sd_event_source *s, void *userdata) {
         Manager *manager = userdata;
         int r;
@@ -1233,6 +1444,11 @@ static int on_post(sd_event_source *s, void *userdata) {
 
         if (LIST_IS_EMPTY(manager->events)) {
                 /* no pending events */
+                if (manager->device_index_dirty) {
+                        manager->device_index_dirty = false;
+                        manager_update_device_index(manager, false);
+                }
+
                 if (!hashmap_isempty(manager->workers)) {
                         /* there are idle workers */
                         log_debug("cleanup idle workers");
@@ -1389,6 +1605,15 @@ static int parse_proc_cmdline_item(const char *key, const char *value, void *dat
 
                 r = safe_atoi(value, &arg_exec_delay);
 
+        } else if (proc_cmdline_key_streq(key, "udev.coalesce_changes")) {
+
+                if (proc_cmdline_value_missing(key, value))
+                        return 0;
+
+                r = parse_boolean(value);
+                if (r >= 0)
+                        arg_coalesce_changes = r;
+
         } else if (startswith(key, "udev."))
                 log_warning("Unknown udev kernel command line option \"%s\"", key);
 
@@ -1410,10 +1635,15 @@ static void help(void) {
                "  -t --event-timeout=SECONDS  Seconds to wait before terminating an event\n"
                "  -N --resolve-names=early|late|never\n"
                "                              When to resolve users and groups\n"
+               "     --coalesce-changes=BOOL  Drop change events duplicating a queued one\n"
                , program_invocation_short_name);
 }
 
 static int parse_argv(int argc, char *argv[]) {
+        enum {
+                ARG_COALESCE_CHANGES = 0x100,
+        };
+
         static const struct option options[] = {
                 { "daemon",             no_argument,            NULL, 'd' },
                 { "debug",              no_argument,            NULL, 'D' },
@@ -1421,6 +1651,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "exec-delay",         required_argument,      NULL, 'e' },
                 { "event-timeout",      required_argument,      NULL, 't' },
                 { "resolve-names",      required_argument,      NULL, 'N' },
+                { "coalesce-changes",   required_argument,      NULL, ARG_COALESCE_CHANGES },
                 { "help",               no_argument,            NULL, 'h' },
                 { "version",            no_argument,            NULL, 'V' },
                 {}
@@ -1473,6 +1704,13 @@ static int parse_argv(int argc, char *argv[]) {
                                 return 0;
                         }
                         break;
+                case ARG_COALESCE_CHANGES:
+                        r = parse_boolean(optarg);
+                        if (r < 0)
+                                log_warning("Invalid --coalesce-changes ignored: %s", optarg);
+                        else
+                                arg_coalesce_changes = r;
+                        break;
                 case 'h':
                         help();
                         return 0;
@@ -1517,6 +1755,19 @@ static int manager_new(Manager **ret, int fd_ctrl, int fd_uevent, const char *cg
                 return log_error_errno(ENOMEM, "error reading rules");
 
         LIST_HEAD_INIT(manager->events);
+        manager->event_index = event_index_new();
+        if (!manager->event_index)
+                return log_oom();
+
+        /* set up before any worker is forked, so that all of them share it */
+        r = device_generations_new(&manager->device_generations);
+        if (r < 0)
+                return log_error_errno(r, "could not allocate device generation table: %m");
+
+        r = device_generations_enable_parent_cache(manager->device_generations);
+        if (r < 0)
+                return log_error_errno(r, "could not enable parent device cache: %m");
+
         udev_list_init(manager->udev, &manager->properties, true);
 
         manager->cgroup = cgroup;
@@ -1544,6 +1795,9 @@ static int manager_new(Manager **ret, int fd_ctrl, int fd_uevent, const char *cg
         if (manager->fd_inotify < 0)
                 return log_error_errno(ENOMEM, "error initializing inotify");
 
+        /* the database files might have been written without updating the index, e.g. in the initrd */
+        manager_update_device_index(manager, true);
+
         udev_watch_restore(manager->udev);
 
         /* block and listen to all signals on signalfd */
@@ -1620,9 +1874,7 @@ static int run(int fd_ctrl, int fd_uevent, const char *cgroup) {
         if (r < 0)
                 log_error_errno(r, "failed to apply permissions on static device nodes: %m");
 
-        (void) sd_notifyf(false,
-                          "READY=1\n"
-                          "STATUS=Processing with %u children at max", arg_children_max);
+        manager_notify_ready(manager);
 
         r = sd_event_loop(manager->event);
         if (r < 0) {
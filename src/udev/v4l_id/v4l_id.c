@@ -27,9 +27,10 @@
 #include <linux/videodev2.h>
 
 #include "fd-util.h"
+#include "udev-helper.h"
 #include "util.h"
 
-int main(int argc, char *argv[]) {
+static int run(int argc, char *argv[]) {
         static const struct option options[] = {
                 { "help", no_argument, NULL, 'h' },
                 {}
@@ -86,3 +87,5 @@ int main(int argc, char *argv[]) {
 
         return 0;
 }
+
+DEFINE_UDEV_HELPER_MAIN(run);